@@ -0,0 +1,146 @@
+// Timing and reporting helpers shared by the benchmark programs in bench/
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_BENCH_H
+#define ETDC_BENCH_H
+
+// C++ headers
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <string>
+#include <thread>
+#include <sstream>
+#include <vector>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <condition_variable>
+
+// Every benchmark prints one line per measurement:
+//      <what>: <value> <unit> [<key>=<value> ...]
+// such that runs can be compared with diff(1) or collected with awk(1).
+namespace bench {
+    using clock_type = std::chrono::steady_clock;
+
+    class stopwatch {
+        public:
+            stopwatch(): __m_start( clock_type::now() ) {}
+
+            void   restart( void )       { __m_start = clock_type::now(); }
+            double seconds( void ) const { return std::chrono::duration<double>(clock_type::now() - __m_start).count(); }
+
+        private:
+            clock_type::time_point  __m_start;
+    };
+
+    // Make the compiler believe the value is used such that the
+    // computation producing it is not optimized away
+    template <typename T>
+    inline void keep(T const& t) {
+        asm volatile("" : : "g"(&t) : "memory");
+    }
+
+    // Print a result line. Extra is appended verbatim, e.g. "threads=4"
+    inline void report(std::string const& what, double value, std::string const& unit, std::string const& extra = std::string()) {
+        std::cout << what << ": " << std::fixed << std::setprecision(value<10 ? 3 : 1) << value << " " << unit;
+        if( !extra.empty() )
+            std::cout << " " << extra;
+        std::cout << std::endl;
+    }
+
+    // Call f() n times, rounds times over, and report the fastest round in
+    // nanoseconds per call. The first round doubles as warm-up; taking the
+    // best one filters out most of the noise of a busy machine.
+    template <typename F>
+    double time_it(std::string const& what, size_t n, F&& f, unsigned int rounds = 3) {
+        double  best = -1;
+
+        for(unsigned int r = 0; r<rounds; r++) {
+            stopwatch   sw;
+            for(size_t i = 0; i<n; i++)
+                f();
+            const double ns = sw.seconds()*1e9/static_cast<double>(n);
+            if( best<0 || ns<best )
+                best = ns;
+        }
+        report(what, best, "ns/op");
+        return best;
+    }
+
+    // Per thread result of run_threads()
+    struct thread_result {
+        uint64_t    ops;        // operations done
+        double      maxWait;    // longest single operation [s], if the thread timed them
+    };
+
+    // Run f in nThread threads. All threads are released at the same time
+    // and told to stop after secs seconds. f is called as
+    //      f(unsigned int threadIndex, std::atomic<bool> const& stop, thread_result& r)
+    // and must loop until stop is set, counting its operations in r.
+    // Reports the total rate and how fair it was distributed.
+    template <typename F>
+    std::vector<thread_result> run_threads(std::string const& what, unsigned int nThread, double secs, F f) {
+        std::mutex                  mtx;
+        std::condition_variable     cond;
+        bool                        go = false;
+        std::atomic<bool>           stop( false );
+        std::vector<thread_result>  results(nThread, thread_result{0, 0.0});
+        std::vector<std::thread>    threads;
+
+        for(unsigned int t = 0; t<nThread; t++)
+            threads.emplace_back( [&, t]( void ) {
+                    {
+                        std::unique_lock<std::mutex> lk( mtx );
+                        cond.wait(lk, [&]( void ) { return go; });
+                    }
+                    f(t, stop, results[t]);
+                } );
+
+        stopwatch   sw;
+        {
+            std::lock_guard<std::mutex> lk( mtx );
+            go = true;
+        }
+        cond.notify_all();
+        std::this_thread::sleep_for( std::chrono::duration<double>(secs) );
+        stop = true;
+        for(auto& t: threads)
+            t.join();
+        const double    dt = sw.seconds();
+
+        uint64_t    total = 0, least = std::numeric_limits<uint64_t>::max();
+        double      maxWait = 0;
+        for(auto const& r: results) {
+            total  += r.ops;
+            least   = std::min(least, r.ops);
+            maxWait = std::max(maxWait, r.maxWait);
+        }
+        std::ostringstream  extra;
+        extra << "threads=" << nThread << " min/thread=" << least;
+        if( maxWait>0 )
+            extra << " max-wait=" << std::fixed << std::setprecision(3) << maxWait*1e3 << "ms";
+        report(what, static_cast<double>(total)/dt, "ops/s", extra.str());
+        return results;
+    }
+} // namespace bench
+
+#endif
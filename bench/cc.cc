@@ -0,0 +1,346 @@
+// Compare the UDT congestion controls over an emulated lossy, long path
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include "bench.h"
+#include <etdc_fd.h>
+#include <etdc_assert.h>
+#include <etdc_congestion.h>
+#include <argparse.h>
+#include <udt.h>
+
+#include <list>
+#include <deque>
+#include <random>
+#include <vector>
+#include <sstream>
+
+// Plain-old-C
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+namespace AP = argparse;
+
+// The path between the UDT client and server. Every datagram
+//   - is dropped with probability loss
+//   - queues for a bottleneck of rate bits/s (0 = unlimited), dropped if
+//     more than maxQueue seconds' worth is waiting already (drop tail)
+//   - arrives delay seconds after leaving the bottleneck
+// The same holds for both directions, each having its own queue.
+// The client connects to port(); the relay forwards that to the server
+// port and sends the server's replies to where the client's datagrams came
+// from.
+class lossy_relay {
+    public:
+        struct settings_type {
+            double       loss;
+            double       delay;
+            uint64_t     rate;
+            double       maxQueue;
+            unsigned int seed;
+        };
+
+        lossy_relay(unsigned short serverPort, settings_type const& s):
+            __m_settings( s ), __m_stop( false ), __m_random( s.seed ), __m_drop( s.loss ),
+            __m_haveClient( false ), __m_nFwd( 0 ), __m_nLost( 0 ), __m_nQueue( 0 )
+        {
+            ::memset(&__m_client, 0, sizeof(__m_client));
+            __m_link[0].fd = mk_udp(0);
+            __m_link[1].fd = mk_udp(serverPort);
+            __m_thread     = std::thread( &lossy_relay::run, this );
+        }
+
+        unsigned short port( void ) const {
+            struct sockaddr_in  sa;
+            socklen_t           sl( sizeof(sa) );
+            ETDCSYSCALL(::getsockname(__m_link[0].fd, reinterpret_cast<struct sockaddr*>(&sa), &sl)==0,
+                        "relay: getsockname fails - " << etdc::strerror(errno));
+            return ntohs(sa.sin_port);
+        }
+
+        // datagrams forwarded, randomly dropped, dropped at the bottleneck
+        std::string stats( void ) const {
+            std::ostringstream  oss;
+            oss << "fwd=" << __m_nFwd << " lost=" << __m_nLost << " qdrop=" << __m_nQueue;
+            return oss.str();
+        }
+
+        ~lossy_relay() {
+            __m_stop = true;
+            __m_thread.join();
+            for(auto& l: __m_link)
+                ::close(l.fd);
+        }
+
+    private:
+        using buffer_type = std::vector<char>;
+        struct packet_type {
+            bench::clock_type::time_point  due;
+            buffer_type                    data;
+        };
+        // What enters at link[i] leaves through link[1-i]
+        struct link_type {
+            int                             fd;
+            bench::clock_type::time_point   free;     // when the bottleneck is available again
+            std::deque<packet_type>         inflight; // ordered by due
+        };
+
+        settings_type               __m_settings;
+        std::atomic<bool>           __m_stop;
+        std::mt19937                __m_random;
+        std::bernoulli_distribution __m_drop;
+        link_type                   __m_link[2];
+        struct sockaddr_in          __m_client;
+        bool                        __m_haveClient;
+        std::vector<buffer_type>    __m_free;
+        uint64_t                    __m_nFwd, __m_nLost, __m_nQueue;
+        std::thread                 __m_thread;
+
+        // Bound to an ephemeral port on localhost and, if port!=0,
+        // connected to localhost:port
+        static int mk_udp(unsigned short port) {
+            int                 fd;
+            const int           bufSz( 8*1024*1024 );
+            struct sockaddr_in  sa;
+
+            ::memset(&sa, 0, sizeof(sa));
+            sa.sin_family      = AF_INET;
+            sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            ETDCSYSCALL((fd=::socket(AF_INET, SOCK_DGRAM, 0))!=-1, "relay: socket fails - " << etdc::strerror(errno));
+            (void)::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufSz, sizeof(bufSz));
+            (void)::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufSz, sizeof(bufSz));
+            ETDCSYSCALL(::bind(fd, reinterpret_cast<struct sockaddr const*>(&sa), sizeof(sa))==0,
+                        "relay: bind fails - " << etdc::strerror(errno));
+            if( port ) {
+                sa.sin_port = htons(port);
+                ETDCSYSCALL(::connect(fd, reinterpret_cast<struct sockaddr const*>(&sa), sizeof(sa))==0,
+                            "relay: connect fails - " << etdc::strerror(errno));
+            }
+            ETDCSYSCALL(::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL)|O_NONBLOCK)==0,
+                        "relay: fcntl fails - " << etdc::strerror(errno));
+            return fd;
+        }
+
+        // Read everything that's waiting on link i and queue it
+        void receive(unsigned int i) {
+            link_type&  l( __m_link[i] );
+
+            while( true ) {
+                buffer_type         buf;
+                struct sockaddr_in  from;
+                socklen_t           fl( sizeof(from) );
+
+                if( !__m_free.empty() ) {
+                    buf = std::move(__m_free.back());
+                    __m_free.pop_back();
+                }
+                buf.resize( 65536 );
+                const ssize_t  n = ::recvfrom(l.fd, &buf[0], buf.size(), 0, reinterpret_cast<struct sockaddr*>(&from), &fl);
+                if( n<0 ) {
+                    __m_free.push_back( std::move(buf) );
+                    ETDCSYSCALL(errno==EAGAIN || errno==EWOULDBLOCK || errno==ECONNREFUSED,
+                                "relay: recvfrom fails - " << etdc::strerror(errno));
+                    return;
+                }
+                if( i==0 ) {
+                    __m_client     = from;
+                    __m_haveClient = true;
+                }
+                buf.resize( static_cast<size_t>(n) );
+
+                const auto now = bench::clock_type::now();
+                if( __m_drop(__m_random) ) {
+                    __m_nLost++;
+                    __m_free.push_back( std::move(buf) );
+                    continue;
+                }
+                auto depart = now;
+                if( __m_settings.rate ) {
+                    if( l.free>now &&
+                        std::chrono::duration<double>(l.free - now).count()>__m_settings.maxQueue ) {
+                        __m_nQueue++;
+                        __m_free.push_back( std::move(buf) );
+                        continue;
+                    }
+                    depart = std::max(l.free, now) +
+                             std::chrono::duration_cast<bench::clock_type::duration>(std::chrono::duration<double>(n*8.0/__m_settings.rate));
+                    l.free = depart;
+                }
+                l.inflight.push_back( packet_type{depart + std::chrono::duration_cast<bench::clock_type::duration>(std::chrono::duration<double>(__m_settings.delay)),
+                                                  std::move(buf)} );
+            }
+        }
+
+        // Send what's due from link i onto the other one
+        void deliver(unsigned int i, bench::clock_type::time_point now) {
+            link_type&  l( __m_link[i] );
+
+            while( !l.inflight.empty() && l.inflight.front().due<=now ) {
+                buffer_type&  buf( l.inflight.front().data );
+
+                // Errors are the same as loss on a real network
+                if( i==0 )
+                    (void)::send(__m_link[1].fd, &buf[0], buf.size(), 0);
+                else if( __m_haveClient )
+                    (void)::sendto(__m_link[0].fd, &buf[0], buf.size(), 0, reinterpret_cast<struct sockaddr const*>(&__m_client), sizeof(__m_client));
+                __m_nFwd++;
+                __m_free.push_back( std::move(buf) );
+                l.inflight.pop_front();
+            }
+        }
+
+        void run( void ) {
+            while( !__m_stop ) {
+                fd_set          rfds;
+                struct timeval  tv{ 0, 10000 };
+                const auto      now = bench::clock_type::now();
+
+                // Sleep until the next datagram is due or there's something to read
+                for(auto const& l: __m_link) {
+                    if( l.inflight.empty() )
+                        continue;
+                    const auto us = std::chrono::duration_cast<std::chrono::microseconds>(l.inflight.front().due - now).count();
+                    if( us<tv.tv_usec )
+                        tv.tv_usec = (us<0 ? 0 : us);
+                }
+                FD_ZERO(&rfds);
+                FD_SET(__m_link[0].fd, &rfds);
+                FD_SET(__m_link[1].fd, &rfds);
+                const int  r = ::select(std::max(__m_link[0].fd, __m_link[1].fd)+1, &rfds, nullptr, nullptr, &tv);
+                ETDCSYSCALL(r>=0 || errno==EINTR, "relay: select fails - " << etdc::strerror(errno));
+
+                for(unsigned int i = 0; r>0 && i<2; i++)
+                    if( FD_ISSET(__m_link[i].fd, &rfds) )
+                        this->receive(i);
+                for(unsigned int i = 0; i<2; i++)
+                    this->deliver(i, bench::clock_type::now());
+            }
+        }
+};
+
+// Transfer as much as possible in secs seconds from a client to a server
+// through the relay and report the goodput at the receiving end
+static void run_cc(etdc::ccspec_type const& cc, lossy_relay::settings_type const& path, double secs) {
+    auto  server = mk_server(etdc::protocol_type("udt"), etdc::host_type("127.0.0.1"), etdc::any_port,
+                             etdc::blocking_type{true});
+    const unsigned short     serverPort = etdc::untag(std::get<2>(server->getsockname(server->__m_fd)));
+    lossy_relay              relay(serverPort, path);
+    std::atomic<uint64_t>    received( 0 );
+
+    std::thread  receiver( [&]( void ) {
+            try {
+                auto                 conn = server->accept(server->__m_fd);
+                std::vector<char>    buf( 1024*1024 );
+                ssize_t              n;
+                while( (n=conn->read(conn->__m_fd, &buf[0], buf.size()))>0 )
+                    received += static_cast<uint64_t>(n);
+            }
+            catch( ... ) {
+                // the client going away ends up here
+            }
+        } );
+
+    auto  client = mk_client(etdc::protocol_type("udt"), etdc::host_type("127.0.0.1"), etdc::port_type{relay.port()});
+    etdc::set_congestion(client, cc);
+
+    std::vector<char>   buf( 256*1024 );
+    bench::stopwatch    sw;
+    while( sw.seconds()<secs )
+        ETDCASSERT(client->write(client->__m_fd, &buf[0], buf.size())>0, "run_cc: write fails");
+    const double        dt  = sw.seconds();
+    const uint64_t      got = received;
+
+    UDT::TRACEINFO      perf;
+    UDT::perfmon(client->__m_fd, &perf, false);
+
+    // Closing the client ends the receiver
+    client.reset();
+    receiver.join();
+    server.reset();
+
+    std::ostringstream  what, extra;
+    what  << "cc/" << cc.algorithm;
+    extra << "rtt=" << std::fixed << std::setprecision(1) << perf.msRTT << "ms retrans=" << perf.pktRetransTotal << " " << relay.stats();
+    bench::report(what.str(), static_cast<double>(got)*8/dt/1e6, "Mbit/s", extra.str());
+}
+
+int main(int argc, char const*const*const argv) {
+    double              secs = 5;
+    double              lossPct = 0.5;
+    double              delayMs = 10;
+    double              queueMs = 50;
+    uint64_t            rate = 200*1000*1000;
+    uint64_t            fixedRate = 0;
+    unsigned int        seed = 42;
+    AP::ArgumentParser  cmd( AP::docstring("Transfer data over UDT through an in-process relay that emulates "
+                                           "a lossy, long path with a bottleneck, once for each congestion "
+                                           "control, and report the goodput") );
+
+    cmd.add( AP::long_name("help"), AP::print_help(),
+             AP::docstring("Print full help and exit succesfully") );
+    cmd.add( AP::collect<std::string>(), AP::long_name("cc"),
+             AP::is_member_of({"udt", "fixed", "delay", "bbr"}),
+             AP::docstring("Congestion control to test, may be given more than once (default: all)") );
+    cmd.add( AP::store_into(secs), AP::short_name('t'), AP::at_most(1), AP::minimum_value(0.1),
+             AP::docstring("Seconds to transfer per congestion control") );
+    cmd.add( AP::store_into(lossPct), AP::long_name("loss"), AP::at_most(1),
+             AP::minimum_value(0.0), AP::maximum_value(100.0),
+             AP::docstring("Percentage of datagrams dropped at random, each direction") );
+    cmd.add( AP::store_into(delayMs), AP::long_name("delay"), AP::at_most(1), AP::minimum_value(0.0),
+             AP::docstring("One way delay in ms") );
+    cmd.add( AP::store_into(rate), AP::long_name("bottleneck"), AP::at_most(1),
+             AP::convert([](std::string const& s) { return etdc::str2rate(s); }),
+             AP::docstring("Bottleneck rate in bits/s, k/M/G/T suffix allowed (0 = none)") );
+    cmd.add( AP::store_into(queueMs), AP::long_name("queue"), AP::at_most(1), AP::minimum_value(0.0),
+             AP::docstring("Bottleneck buffer in ms") );
+    cmd.add( AP::store_into(fixedRate), AP::long_name("rate"), AP::at_most(1),
+             AP::convert([](std::string const& s) { return etdc::str2rate(s); }),
+             AP::docstring("Rate for fixed rate congestion control (default: 90% of the bottleneck rate)") );
+    cmd.add( AP::store_into(seed), AP::long_name("seed"), AP::at_most(1),
+             AP::docstring("Seed for the random loss") );
+    cmd.parse(argc, argv);
+
+    std::list<etdc::cc_type>  ccs{ etdc::cc_type::UDT, etdc::cc_type::Fixed, etdc::cc_type::Delay, etdc::cc_type::BBR };
+    if( cmd("cc") ) {
+        ccs.clear();
+        for(auto const& name: cmd.get<std::list<std::string>>("cc")) {
+            std::istringstream  iss( name );
+            ccs.emplace_back();
+            iss >> ccs.back();
+        }
+    }
+    // Exactly at the bottleneck rate the retransmissions don't fit: the
+    // queue overflows and keeps overflowing, which is not what's of interest
+    if( fixedRate==0 )
+        fixedRate = rate/10*9;
+    ETDCASSERT(fixedRate>0 || std::find(ccs.begin(), ccs.end(), etdc::cc_type::Fixed)==ccs.end(),
+               "fixed rate congestion control needs --rate or --bottleneck");
+
+    const lossy_relay::settings_type  path{ lossPct/100, delayMs/1e3, rate, queueMs/1e3, seed };
+
+    std::cout << "# loss=" << lossPct << "% delay=" << delayMs << "ms bottleneck=" << rate << "bps queue=" << queueMs << "ms" << std::endl;
+    for(auto cc: ccs)
+        run_cc(etdc::ccspec_type(cc, cc==etdc::cc_type::Fixed ? fixedRate : 0), path, secs);
+    return 0;
+}
@@ -0,0 +1,60 @@
+#!/bin/bash
+# Time repeated runs of "etc --list <URL>", i.e. mostly the start up cost of etc
+# Copyright (C) 2007-2016 Harro Verkouter
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# any later version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT ANY
+# WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+# PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+# usage: etc_list.sh [-n <runs>] <path to etc> [<URL>]
+#
+# The default URL points at a port where nothing listens: the connection is
+# refused immediately so what's left is the time to get to main() and set
+# up. Give the URL of a running etd to include a real listing.
+# Output is in the format of the other benchmarks in bench/.
+runs=10
+if [ "$1" = "-n" ]; then
+    runs=$2
+    shift 2
+fi
+if [ $# -lt 1 ] || [ ! -x "$1" ]; then
+    echo "usage: $0 [-n <runs>] <path to etc> [<URL>]" >&2
+    exit 1
+fi
+etc=$1
+url=${2:-tcp://127.0.0.1#1/}
+
+# Time stamps from EPOCHREALTIME (bash >= 5); forking date(1) would end up
+# in the measurement
+if [ -z "${EPOCHREALTIME}" ]; then
+    echo "$0: needs bash version 5 or later" >&2
+    exit 1
+fi
+
+times=""
+for i in $(seq 1 ${runs}); do
+    t0=${EPOCHREALTIME/,/.}
+    # etc fails loudly if it cannot connect; also keep bash quiet about that
+    { "${etc}" --list "${url}" >/dev/null; } 2>/dev/null
+    t1=${EPOCHREALTIME/,/.}
+    times="${times} ${t0} ${t1}"
+done
+
+echo ${times} | awk -v runs=${runs} '{
+    min = -1; max = 0; sum = 0;
+    for(i = 1; i<NF; i += 2) {
+        dt = ($(i+1) - $i)*1e3;
+        sum += dt;
+        if( min<0 || dt<min ) min = dt;
+        if( dt>max ) max = dt;
+    }
+    printf "etc --list: %.3f ms/run runs=%d min=%.3fms max=%.3fms total=%.3fs\n", sum/runs, runs, min, max, sum/1e3;
+}'
@@ -0,0 +1,190 @@
+// Socket lookups by ID from several threads: UDT's CHash against a map
+// behind a mutex, and the UDT API calls that go through the socket table
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include "bench.h"
+#include <etdc_assert.h>
+#include <argparse.h>
+#include <udt.h>
+#include <queue.h>
+
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+namespace AP = argparse;
+
+// Cheap per thread random numbers; the lookups should hit the table, not
+// the random number generator
+struct lcg {
+    explicit lcg(uint32_t seed): __m_x( seed*2654435761u + 1 ) {}
+
+    size_t operator()(size_t n) {
+        __m_x = __m_x*1103515245u + 12345u;
+        return (__m_x >> 8) % n;
+    }
+    uint32_t __m_x;
+};
+
+// The receive queue and CUDTUnited::lookup() don't look at the instance,
+// any non-NULL value will do
+static CUDT* fake_udt(size_t i) {
+    return reinterpret_cast<CUDT*>(static_cast<uintptr_t>(i+1)*64);
+}
+
+// Before CHash was lock free, finding a socket meant taking the global
+// control lock and searching a std::map
+struct locked_map {
+    CUDT* lookup(int32_t id) {
+        std::lock_guard<std::mutex>  lk( __m_lock );
+        auto                         p = __m_map.find(id);
+        return p==__m_map.end() ? nullptr : p->second;
+    }
+    void insert(int32_t id, CUDT* u) {
+        std::lock_guard<std::mutex>  lk( __m_lock );
+        __m_map[id] = u;
+    }
+    void remove(int32_t id) {
+        std::lock_guard<std::mutex>  lk( __m_lock );
+        __m_map.erase(id);
+    }
+
+    std::mutex                  __m_lock;
+    std::map<int32_t, CUDT*>    __m_map;
+};
+
+// Look up random sockets from nThread threads while, optionally, one more
+// thread keeps removing and re-inserting sockets (the table allows one
+// writer at a time, the UDT library serializes those)
+template <typename Table>
+static void threaded_lookups(std::string const& what, Table& table, std::vector<UDTSOCKET> const& ids,
+                             unsigned int nThread, double secs, bool churn) {
+    std::atomic<bool>   done( false );
+    std::thread         writer;
+
+    if( churn )
+        writer = std::thread( [&]( void ) {
+                lcg  rnd( 0xc0ffee );
+                while( !done ) {
+                    const size_t  i = rnd(ids.size());
+                    table.remove(ids[i]);
+                    table.insert(ids[i], fake_udt(i));
+                }
+            } );
+
+    bench::run_threads(what + (churn ? "/churn" : ""), nThread, secs,
+                       [&](unsigned int t, std::atomic<bool> const& stop, bench::thread_result& r) {
+                           lcg  rnd( t );
+                           while( !stop ) {
+                               for(unsigned int i = 0; i<64; i++)
+                                   bench::keep(table.lookup(ids[rnd(ids.size())]));
+                               r.ops += 64;
+                           }
+                       });
+    done = true;
+    if( writer.joinable() )
+        writer.join();
+}
+
+int main(int argc, char const*const*const argv) {
+    size_t              nSocket = 5000;
+    unsigned int        nThread = 4;
+    double              secs = 1;
+    AP::ArgumentParser  cmd( AP::docstring("Time looking up UDT sockets by ID, as every received packet and UDT "
+                                           "API call does, from one and from several threads") );
+
+    cmd.add( AP::long_name("help"), AP::print_help(),
+             AP::docstring("Print full help and exit succesfully") );
+    cmd.add( AP::store_into(nSocket), AP::short_name('n'), AP::at_most(1), AP::minimum_value(size_t(1)),
+             AP::docstring("Number of open UDT sockets") );
+    cmd.add( AP::store_into(nThread), AP::long_name("threads"), AP::at_most(1), AP::minimum_value(1u),
+             AP::docstring("Number of threads doing lookups") );
+    cmd.add( AP::store_into(secs), AP::short_name('t'), AP::at_most(1), AP::minimum_value(0.1),
+             AP::docstring("Seconds per multi threaded measurement") );
+    cmd.parse(argc, argv);
+
+    // Real sockets, such that the IDs are the ones UDT hands out
+    // and UDT's own socket table is as big
+    std::vector<UDTSOCKET>  ids;
+
+    UDT::startup();
+    for(size_t i = 0; i<nSocket; i++) {
+        ids.push_back( UDT::socket(AF_INET, SOCK_STREAM, 0) );
+        ETDCASSERT(ids.back()!=UDT::INVALID_SOCK, "failed to create UDT socket #" << i << " - " << UDT::getlasterror().getErrorMessage());
+    }
+
+    CHash       chash;
+    locked_map  lmap;
+
+    chash.init(1024);
+    for(size_t i = 0; i<nSocket; i++) {
+        chash.insert(ids[i], fake_udt(i));
+        lmap.insert(ids[i], fake_udt(i));
+    }
+    std::cout << "# sockets=" << nSocket << " threads=" << nThread << std::endl;
+
+    // One thread, no contention: what's left is the cost of the lookup itself
+    lcg  rnd( 1 );
+    bench::time_it("lookup/map+mutex", 1000000, [&]( void ) { bench::keep(lmap.lookup(ids[rnd(nSocket)])); });
+    bench::time_it("lookup/chash",     1000000, [&]( void ) { bench::keep(chash.lookup(ids[rnd(nSocket)])); });
+
+    for(auto churn: {false, true}) {
+        threaded_lookups("lookup/map+mutex", lmap,  ids, nThread, secs, churn);
+        threaded_lookups("lookup/chash",     chash, ids, nThread, secs, churn);
+    }
+
+    // The UDT API finds the socket through CUDTUnited::lookup(); sockets
+    // coming and going change the table it reads
+    int  opt, len;
+    bench::time_it("udt/getsockopt", 1000000, [&]( void ) {
+            len = sizeof(opt);
+            bench::keep(UDT::getsockopt(ids[rnd(nSocket)], 0, UDT_MSS, &opt, &len));
+        });
+    for(auto churn: {false, true}) {
+        std::atomic<bool>   done( false );
+        std::thread         opener;
+
+        if( churn )
+            opener = std::thread( [&]( void ) {
+                    while( !done )
+                        UDT::close( UDT::socket(AF_INET, SOCK_STREAM, 0) );
+                } );
+        bench::run_threads(std::string("udt/getsockopt") + (churn ? "/churn" : ""), nThread, secs,
+                           [&](unsigned int t, std::atomic<bool> const& stop, bench::thread_result& r) {
+                               lcg  trnd( t );
+                               int  topt, tlen;
+                               while( !stop ) {
+                                   tlen = sizeof(topt);
+                                   ETDCASSERT(UDT::getsockopt(ids[trnd(nSocket)], 0, UDT_MSS, &topt, &tlen)==0,
+                                              "getsockopt fails - " << UDT::getlasterror().getErrorMessage());
+                                   r.ops++;
+                               }
+                           });
+        done = true;
+        if( opener.joinable() )
+            opener.join();
+    }
+
+    for(auto s: ids)
+        UDT::close(s);
+    UDT::cleanup();
+    return 0;
+}
@@ -0,0 +1,261 @@
+// Contention on etd's transfer bookkeeping: the sharded transfer_map and
+// blocking range_lock against the global lock with try-and-sleep it replaced
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include "bench.h"
+#include <etdc_assert.h>
+#include <etdc_etd_state.h>
+#include <argparse.h>
+
+#include <map>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace AP = argparse;
+using namespace etdc;
+
+////////////////////////////////////////////////////////////////////////////
+//
+// The locking as it was in etdc_etd_state.h and etdc_etdserver.cc: one
+// std::map under the global etd_state lock, a non-blocking range_lock per
+// transfer, and callers that release the global lock and sleep if the
+// transfer is busy
+//
+////////////////////////////////////////////////////////////////////////////
+namespace old {
+    class range_lock {
+        public:
+            range_lock(): __m_exclusive( false ) {}
+
+            bool try_lock( void ) {
+                std::lock_guard<std::mutex> lk( __m_mutex );
+                if( __m_exclusive || !__m_ranges.empty() )
+                    return false;
+                return (__m_exclusive = true);
+            }
+            void unlock( void ) {
+                std::lock_guard<std::mutex> lk( __m_mutex );
+                __m_exclusive = false;
+            }
+            bool try_lock_range(off_t b, off_t e) {
+                std::lock_guard<std::mutex> lk( __m_mutex );
+                if( __m_exclusive )
+                    return false;
+                for(auto const& r: __m_ranges)
+                    if( b<r.second && r.first<e )
+                        return false;
+                __m_ranges.emplace_back(b, e);
+                return true;
+            }
+            void unlock_range(off_t b, off_t e) {
+                std::lock_guard<std::mutex> lk( __m_mutex );
+                auto  ptr = std::find(__m_ranges.begin(), __m_ranges.end(), std::make_pair(b, e));
+                if( ptr!=__m_ranges.end() )
+                    __m_ranges.erase( ptr );
+            }
+
+        private:
+            bool                                __m_exclusive;
+            std::list<std::pair<off_t, off_t>>  __m_ranges;
+            std::mutex                          __m_mutex;
+    };
+
+    struct transferprops_type {
+        std::string     path;
+        range_lock      lock;
+
+        explicit transferprops_type(std::string const& p): path( p ) {}
+    };
+
+    struct state_type {
+        std::mutex                                                  lock;
+        std::map<uuid_type, std::unique_ptr<transferprops_type>>   transfers;
+    };
+}
+
+// Keep the CPU busy for a while, as if doing I/O while holding a lock
+static void hold(double secs) {
+    const bench::stopwatch  sw;
+    while( sw.seconds()<secs )
+        ;
+}
+
+// Times one operation into r
+template <typename F>
+static void timed(bench::thread_result& r, F&& f) {
+    const bench::stopwatch  sw;
+    f();
+    r.maxWait = std::max(r.maxWait, sw.seconds());
+    r.ops++;
+}
+
+static std::string path_of(unsigned int i) {
+    return "/mnt/disk" + std::to_string(i%8) + "/eg098a/eg098a_ef_no" + std::to_string(i) + ".vdif";
+}
+
+int main(int argc, char const*const*const argv) {
+    unsigned int        nThread = 32, share = 4, nIdle = 1000;
+    double              holdUs = 5, secs = 1;
+    AP::ArgumentParser  cmd( AP::docstring("Time finding and locking transfers, opening and closing them, "
+                                           "and locking byte ranges of one transfer from many threads at once; "
+                                           "with the locking etd has now and the global lock plus "
+                                           "try-lock-and-sleep it had before") );
+
+    cmd.add( AP::long_name("help"), AP::print_help(),
+             AP::docstring("Print full help and exit succesfully") );
+    cmd.add( AP::store_into(nThread), AP::long_name("threads"), AP::at_most(1), AP::minimum_value(1u),
+             AP::docstring("Number of threads") );
+    cmd.add( AP::store_into(share), AP::long_name("share"), AP::at_most(1), AP::minimum_value(1u),
+             AP::docstring("Number of threads using the same transfer (parallel data streams)") );
+    cmd.add( AP::store_into(holdUs), AP::long_name("hold"), AP::at_most(1), AP::minimum_value(0.0),
+             AP::docstring("Microseconds of work done while holding a transfer or byte range") );
+    cmd.add( AP::store_into(nIdle), AP::long_name("idle"), AP::at_most(1),
+             AP::docstring("Number of other, idle, transfers in the map") );
+    cmd.add( AP::store_into(secs), AP::short_name('t'), AP::at_most(1), AP::minimum_value(0.1),
+             AP::docstring("Seconds per measurement") );
+    cmd.parse(argc, argv);
+
+    const double            holdS = holdUs/1e6;
+    std::vector<uuid_type>  busy, idle;
+
+    for(unsigned int i = 0; i<nThread; i+=share)
+        busy.push_back( uuid_type::mk() );
+    for(unsigned int i = 0; i<nIdle; i++)
+        idle.push_back( uuid_type::mk() );
+
+    old::state_type  oldState;
+    transfer_map     transfers;
+    unsigned int     n = 0;
+    for(auto const& uuid: busy) {
+        oldState.transfers.emplace(uuid, std::unique_ptr<old::transferprops_type>(new old::transferprops_type(path_of(n))));
+        transfers.insert(uuid, std::make_shared<transferprops_type>(nullptr, path_of(n), openmode_type::Read));
+        n++;
+    }
+    for(auto const& uuid: idle) {
+        oldState.transfers.emplace(uuid, std::unique_ptr<old::transferprops_type>(new old::transferprops_type(path_of(n))));
+        transfers.insert(uuid, std::make_shared<transferprops_type>(nullptr, path_of(n), openmode_type::Read));
+        n++;
+    }
+    std::cout << "# threads=" << nThread << " share=" << share << " hold=" << holdUs << "us idle=" << nIdle << std::endl;
+
+    // 1. Find a transfer and lock it exclusively, as sendFile/getFile do.
+    //    share threads compete for each transfer
+    bench::run_threads("lock/global+retry", nThread, secs, [&](unsigned int t, std::atomic<bool> const& stop, bench::thread_result& r) {
+            uuid_type const&  uuid( busy[t/share] );
+            while( !stop )
+                timed(r, [&]( void ) {
+                        while( true ) {
+                            std::unique_lock<std::mutex>  lk( oldState.lock );
+                            auto                          ptr = oldState.transfers.find(uuid);
+                            ETDCASSERT(ptr!=oldState.transfers.end(), "transfer went missing");
+                            std::unique_lock<old::range_lock>  sh( ptr->second->lock, std::try_to_lock );
+                            if( !sh.owns_lock() ) {
+                                lk.unlock();
+                                std::this_thread::sleep_for( std::chrono::microseconds(19) );
+                                continue;
+                            }
+                            lk.unlock();
+                            hold(holdS);
+                            break;
+                        }
+                    });
+        });
+    bench::run_threads("lock/sharded+fifo", nThread, secs, [&](unsigned int t, std::atomic<bool> const& stop, bench::thread_result& r) {
+            uuid_type const&  uuid( busy[t/share] );
+            while( !stop )
+                timed(r, [&]( void ) {
+                        transferptr_type              xfer( transfers.find(uuid) );
+                        ETDCASSERT(xfer, "transfer went missing");
+                        std::unique_lock<range_lock>  sh( xfer->lock );
+                        hold(holdS);
+                    });
+        });
+
+    // 2. Open and close transfers, as requestFileRead/removeUUID do: check
+    //    the path is not in use, add the transfer, remove it again
+    bench::run_threads("open/global+scan", nThread, secs, [&](unsigned int t, std::atomic<bool> const& stop, bench::thread_result& r) {
+            const std::string  path( path_of(n+t) );
+            while( !stop )
+                timed(r, [&]( void ) {
+                        const uuid_type  uuid( uuid_type::mk() );
+                        {
+                            std::lock_guard<std::mutex>  lk( oldState.lock );
+                            ETDCASSERT(std::find_if(oldState.transfers.begin(), oldState.transfers.end(),
+                                                    [&](decltype(oldState.transfers)::value_type const& vt) { return vt.second->path==path; })
+                                       ==oldState.transfers.end(), "path in use");
+                            oldState.transfers.emplace(uuid, std::unique_ptr<old::transferprops_type>(new old::transferprops_type(path)));
+                        }
+                        std::lock_guard<std::mutex>  lk( oldState.lock );
+                        oldState.transfers.erase(uuid);
+                    });
+        });
+    bench::run_threads("open/claim_path", nThread, secs, [&](unsigned int t, std::atomic<bool> const& stop, bench::thread_result& r) {
+            const std::string  path( path_of(n+t) );
+            while( !stop )
+                timed(r, [&]( void ) {
+                        const uuid_type  uuid( uuid_type::mk() );
+                        ETDCASSERT(transfers.claim_path(path, true), "path in use");
+                        transfers.insert(uuid, std::make_shared<transferprops_type>(nullptr, path, openmode_type::Read));
+                        ETDCASSERT(transfers.erase(uuid), "transfer went missing");
+                        transfers.release_path(path);
+                    });
+        });
+
+    // 3. All threads on one transfer, each with its own byte range, as
+    //    parallel data streams are; with an exclusive lock now and then
+    //    (every share-th thread) to get in the way
+    const off_t  chunk = 256*1024*1024;
+    bench::run_threads("ranges/retry", nThread, secs, [&](unsigned int t, std::atomic<bool> const& stop, bench::thread_result& r) {
+            old::range_lock&  lock( oldState.transfers.find(busy[0])->second->lock );
+            const off_t       b = static_cast<off_t>(t)*chunk;
+            while( !stop )
+                timed(r, [&]( void ) {
+                        if( t%share==0 ) {
+                            while( !lock.try_lock() )
+                                std::this_thread::sleep_for( std::chrono::microseconds(9) );
+                            hold(holdS);
+                            lock.unlock();
+                            return;
+                        }
+                        while( !lock.try_lock_range(b, b+chunk) )
+                            std::this_thread::sleep_for( std::chrono::microseconds(9) );
+                        hold(holdS);
+                        lock.unlock_range(b, b+chunk);
+                    });
+        });
+    bench::run_threads("ranges/fifo", nThread, secs, [&](unsigned int t, std::atomic<bool> const& stop, bench::thread_result& r) {
+            transferptr_type  xfer( transfers.find(busy[0]) );
+            const off_t       b = static_cast<off_t>(t)*chunk;
+            while( !stop )
+                timed(r, [&]( void ) {
+                        if( t%share==0 ) {
+                            std::unique_lock<range_lock>  sh( xfer->lock );
+                            hold(holdS);
+                            return;
+                        }
+                        range_guard  rg( xfer->lock, b, b+chunk );
+                        hold(holdS);
+                    });
+        });
+    return 0;
+}
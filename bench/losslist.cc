@@ -0,0 +1,233 @@
+// Replay loss patterns through UDT's linked and bitmap loss lists, after
+// checking that both agree on random operations
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include "bench.h"
+#include <etdc_assert.h>
+#include <argparse.h>
+#include <common.h>
+#include <list.h>
+
+#include <random>
+#include <vector>
+#include <functional>
+
+namespace AP = argparse;
+
+////////////////////////////////////////////////////////////////////////////
+//
+// Differential fuzzing: the same random operations on CRcvLossList and
+// CLossBitmap, and on CSndLossList and CSndLossBitmap, must give the same
+// answers. One round in three starts just before the largest sequence
+// number, such that the sequence numbers wrap.
+//
+////////////////////////////////////////////////////////////////////////////
+static uint64_t fuzz(unsigned int rounds, unsigned int seed) {
+    const int       W = 4096;
+    const int       NOP = 300;
+    std::mt19937    rnd( seed );
+    uint64_t        nop = 0;
+    auto            upto = [&](int n) { return static_cast<int>(rnd() % static_cast<unsigned int>(n)); };
+
+    for(unsigned int round = 0; round<rounds; round++) {
+        const int32_t   base = (round%3==0) ? CSeqNo::m_iMaxSeqNo - upto(2*W) : upto(1<<30);
+        CRcvLossList    rl( W );
+        CLossBitmap     rb( W );
+        CSndLossList    sl( W );
+        CSndLossBitmap  sb( W );
+        int32_t         rcvCur = base, sndAck = base;
+
+#define FUZZCHECK(cond, what) \
+        ETDCASSERT(cond, "fuzz: " << what << " differs in round " << round << " op " << op << " (base=" << base << ")")
+
+        for(int op = 0; op<NOP; op++, nop++) {
+            switch( upto(6) ) {
+                case 0: {
+                    // the receiver sees a gap after the last packet received;
+                    // its loss list covers the flight window only
+                    const int32_t  a = CSeqNo::incseq(rcvCur), b = CSeqNo::incseq(rcvCur, 1 + upto(20));
+                    if( CSeqNo::seqoff(rl.getLossLength() ? rl.getFirstLostSeq() : a, b)>=W-10 )
+                        break;
+                    rl.insert(a, b);
+                    rb.insert(a, b);
+                    rcvCur = CSeqNo::incseq(b, 1 + upto(5));
+                    break;
+                }
+                case 1:
+                    // a retransmission arrives, or a packet that wasn't lost
+                    if( rl.getLossLength() ) {
+                        const int32_t  x = CSeqNo::incseq(rl.getFirstLostSeq(), upto(40));
+                        FUZZCHECK(rl.remove(x)==rb.remove(x), "rcv remove(" << x << ")");
+                    }
+                    break;
+                case 2:
+                    // a message dropped by the sender
+                    if( rl.getLossLength() ) {
+                        const int32_t  x = rl.getFirstLostSeq(), y = CSeqNo::incseq(x, upto(10));
+                        rl.remove(x, y);
+                        rb.remove(x, y);
+                    }
+                    break;
+                case 3: {
+                    // a NAK arrives at the sender
+                    const int32_t  a = CSeqNo::incseq(sndAck, upto(2000)), b = CSeqNo::incseq(a, upto(30));
+                    FUZZCHECK(sl.insert(a, b)==sb.insert(a, b), "snd insert(" << a << ", " << b << ")");
+                    break;
+                }
+                case 4:
+                    // the sender picks the next packet to retransmit
+                    FUZZCHECK(sl.getLostSeq()==sb.getLostSeq(), "snd getLostSeq()");
+                    break;
+                default:
+                    // an ACK arrives at the sender
+                    sndAck = CSeqNo::incseq(sndAck, upto(50));
+                    sl.remove(sndAck);
+                    sb.remove(sndAck);
+                    break;
+            }
+
+            FUZZCHECK(rl.getLossLength()==rb.getLossLength(), "rcv length");
+            FUZZCHECK(rl.getFirstLostSeq()==rb.getFirstLostSeq(), "rcv first loss");
+            FUZZCHECK(sl.getLossLength()==sb.getLossLength(), "snd length");
+
+            int32_t  la[400], lb[400];
+            int      na, nb;
+            rl.getLossArray(la, na, 400);
+            rb.getLossArray(lb, nb, 400);
+            FUZZCHECK(na==nb && std::equal(la, la+na, lb), "rcv loss array");
+
+            const int32_t  q1 = CSeqNo::incseq(base, upto(3000)), q2 = CSeqNo::incseq(q1, upto(50));
+            FUZZCHECK(rl.find(q1, q2)==rb.find(q1, q2), "rcv find(" << q1 << ", " << q2 << ")");
+        }
+#undef FUZZCHECK
+    }
+    return nop;
+}
+
+////////////////////////////////////////////////////////////////////////////
+//
+// Replay: packets go out back to back, the pattern says which ones get
+// lost. The receiver enters the gaps in its list and the sender learns
+// of them right away. Losses are retransmitted half a window later, the
+// receiver builds a NAK and the sender processes an ACK every nakEvery
+// packets. The sequence numbers start just before the wrap.
+//
+////////////////////////////////////////////////////////////////////////////
+struct pattern_type {
+    const char*                                         name;
+    std::function<bool(uint64_t, std::mt19937&)>        lost;
+};
+
+static const pattern_type patterns[] = {
+    { "random-1%",      [](uint64_t, std::mt19937& r) { return r()%100==0; } },
+    { "burst-50/5000",  [](uint64_t i, std::mt19937&) { return i%5000<50; } },
+    { "alternate-40%",  [](uint64_t i, std::mt19937&) { return i%2==0 && i%100000<40000; } }
+};
+
+struct replay_result {
+    double      secs;
+    uint64_t    check;  // what was seen in the NAKs, the same for both lists
+};
+
+template <typename RcvList, typename SndList>
+static replay_result replay(pattern_type const& pattern, uint64_t n, int window, int nakEvery) {
+    RcvList             rcv( window );
+    SndList             snd( window*2 );
+    std::mt19937        rnd( 7 );
+    int32_t             next = CSeqNo::m_iMaxSeqNo - window;  // next seq. no. to send
+    int32_t             rcvNext = next;                       // what the receiver expects
+    int32_t             nak[368];
+    int                 nakLen;
+    int                 sinceNak = 0;
+    replay_result       rv{0.0, 0};
+    bench::stopwatch    sw;
+
+    for(uint64_t i = 0; i<n; i++) {
+        const int32_t  seq = next;
+
+        next = CSeqNo::incseq(next);
+        if( pattern.lost(i, rnd) )
+            continue;
+
+        if( CSeqNo::seqcmp(seq, rcvNext)>0 ) {
+            rcv.insert(rcvNext, CSeqNo::decseq(seq));
+            snd.insert(rcvNext, CSeqNo::decseq(seq));
+        }
+        rcvNext = CSeqNo::incseq(seq);
+
+        // Retransmit what was lost more than half a window ago; it arrives
+        if( rcv.getLossLength() && CSeqNo::seqoff(rcv.getFirstLostSeq(), seq)>window/2 ) {
+            int32_t  x;
+            while( (x=snd.getLostSeq())>=0 && CSeqNo::seqoff(x, seq)>window/2 )
+                rcv.remove(x);
+            if( x>=0 )
+                snd.insert(x, x);
+        }
+
+        if( ++sinceNak<nakEvery )
+            continue;
+        sinceNak = 0;
+        if( rcv.getLossLength() ) {
+            rcv.getLossArray(nak, nakLen, 368);
+            rv.check += static_cast<uint64_t>(rcv.getLossLength()) + static_cast<uint64_t>(nakLen);
+            for(int k = 0; k<nakLen; k++)
+                rv.check += static_cast<uint32_t>(nak[k]);
+        }
+        // the ACK: everything before the first loss arrived
+        snd.remove( rcv.getLossLength() ? CSeqNo::decseq(rcv.getFirstLostSeq()) : seq );
+    }
+    rv.secs = sw.seconds();
+    return rv;
+}
+
+int main(int argc, char const*const*const argv) {
+    uint64_t            n = 5000000;
+    int                 window = 131072;
+    unsigned int        rounds = 2000, seed = 1;
+    AP::ArgumentParser  cmd( AP::docstring("Check that UDT's bitmap loss lists behave like the linked ones, "
+                                           "then time both replaying a number of loss patterns") );
+
+    cmd.add( AP::long_name("help"), AP::print_help(),
+             AP::docstring("Print full help and exit succesfully") );
+    cmd.add( AP::store_into(n), AP::short_name('n'), AP::at_most(1),
+             AP::docstring("Number of packets per replay") );
+    cmd.add( AP::store_into(window), AP::long_name("window"), AP::at_most(1), AP::minimum_value(1024),
+             AP::docstring("Flight window in packets, the size of the loss lists") );
+    cmd.add( AP::store_into(rounds), AP::long_name("rounds"), AP::at_most(1),
+             AP::docstring("Rounds of differential fuzzing (0 = skip)") );
+    cmd.add( AP::store_into(seed), AP::long_name("seed"), AP::at_most(1),
+             AP::docstring("Seed for the fuzzer") );
+    cmd.parse(argc, argv);
+
+    // The fuzzer throws if they disagree
+    const uint64_t  nop = fuzz(rounds, seed);
+    bench::report("fuzz", static_cast<double>(nop), "ops", "rounds=" + std::to_string(rounds) + " agree");
+
+    // A NAK every 10ms at 10Gbit/s with 1500 byte packets
+    const int  nakEvery = 8300;
+    for(auto const& p: patterns) {
+        const replay_result  linked = replay<CRcvLossList, CSndLossList>(p, n, window, nakEvery);
+        const replay_result  bitmap = replay<CLossBitmap, CSndLossBitmap>(p, n, window, nakEvery);
+
+        ETDCASSERT(linked.check==bitmap.check, "replay " << p.name << ": the lists reported different losses");
+        bench::report(std::string("replay/") + p.name + "/linked", linked.secs*1e9/static_cast<double>(n), "ns/packet");
+        bench::report(std::string("replay/") + p.name + "/bitmap", bitmap.secs*1e9/static_cast<double>(n), "ns/packet");
+    }
+    return 0;
+}
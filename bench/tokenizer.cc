@@ -0,0 +1,261 @@
+// Compare the protocol tokenizer against the std::regex parsing it replaced
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include "bench.h"
+#include <etdc_assert.h>
+#include <etdc_tokenizer.h>
+#include <etdc_dataheader.h>
+#include <etdc_stringutil.h>
+#include <argparse.h>
+
+#include <map>
+#include <regex>
+#include <limits>
+#include <string>
+#include <vector>
+#include <iterator>
+
+namespace AP = argparse;
+using etdc::strview;
+namespace tok = etdc::tok;
+
+// Three kinds of messages, each as it arrives in a receive buffer
+static const std::string sendFileMsg( "#17 send-file 7f3ac1d2-6c4b-4a8e-9b0d-3e5f7a9c1b2d 0c9e8d7f-1a2b-4c3d-8e9f-a0b1c2d3e4f5 "
+                                      "1073741824 udt://10.88.0.12:8008,udt6://[fe80::1%enp4s0]:8008 4\n" );
+static std::string listReply( void ) {
+    std::string r;
+    for(unsigned int i = 0; i<10; i++)
+        r += "OK /mnt/data/eg098a/eg098a_ef_no000" + std::to_string(i) + ".vdif\n";
+    return r + "OK\n";
+}
+static const std::string dataHeader( "{ uuid:7f3ac1d2-6c4b-4a8e-9b0d-3e5f7a9c1b2d, sz:1073741824, push:1, offset:536870912 }"
+                                     "<binary data follows>" );
+
+////////////////////////////////////////////////////////////////////////////
+//
+// The std::regex parsing as it was in etdc_etdserver.cc
+//
+////////////////////////////////////////////////////////////////////////////
+namespace old {
+    static const std::regex::flag_type rxFlags = (std::regex::ECMAScript | std::regex::icase);
+    static const std::regex  rxLine("([^\\r\\n]+)[\\r\\n]+");
+    static const std::regex  rxReply("^(OK|ERR)(\\s+(\\S.*)?)?$", rxFlags);
+    static const std::regex  rxTagged("^#([0-9]+)\\s+(\\S.*)$");
+    static const std::regex  rxList("^list\\s+(\\S.*)$", rxFlags);
+    static const std::regex  rxReqFileWrite("^write-file-(\\S+)\\s+(\\S.*)$", rxFlags);
+    static const std::regex  rxReqFileRead("^read-file\\s+([0-9]+)\\s+(\\S.*)$", rxFlags);
+    static const std::regex  rxSendFile("^send-file\\s+(\\S+)\\s+(\\S+)\\s+([0-9]+)\\s+(\\S+)(\\s+([0-9]+))?$", rxFlags);
+    static const std::regex  rxDataSep("[^,]+");
+    static const std::regex  rxCommand("^(\\{([^\\}]*)\\})");
+    static const std::regex  rxKeyValue("\\b([a-zA-Z][a-zA-Z0-9_-]+)\\s*:\\s*(\"(.*(?!\\\\))\"|[^, \\t\\v]+)", rxFlags);
+    static const std::regex  rxSlash("\\\\");
+
+    using kvmap_type = std::map<std::string, std::string, etdc::case_insensitive_lt>;
+
+    static std::vector<std::string> lines(std::string const& buf) {
+        std::vector<std::string>  rv;
+        for(std::sregex_iterator l(buf.begin(), buf.end(), rxLine); l!=std::sregex_iterator(); l++)
+            rv.push_back( (*l)[1].str() );
+        return rv;
+    }
+
+    // The server side: split into lines, strip the tag and find out which
+    // command it is. Returns the number of data channel addresses.
+    static size_t command(std::string const& buf) {
+        std::smatch  fields;
+        size_t       n = 0;
+
+        for(auto const& line: lines(buf)) {
+            std::string  cmd( line );
+            if( std::regex_match(line, fields, rxTagged) )
+                cmd = fields[2].str();
+            if( std::regex_match(cmd, fields, rxList) || std::regex_match(cmd, fields, rxReqFileWrite) ||
+                std::regex_match(cmd, fields, rxReqFileRead) )
+                continue;
+            ETDCASSERT(std::regex_match(cmd, fields, rxSendFile), "old: not a send-file command");
+            const std::string  addrs( fields[4].str() );
+            n += static_cast<size_t>(std::distance(std::sregex_iterator(addrs.begin(), addrs.end(), rxDataSep), std::sregex_iterator()));
+        }
+        return n;
+    }
+
+    // The client side: a listing is a number of "OK <path>" lines
+    static size_t reply(std::string const& buf) {
+        std::smatch  fields;
+        size_t       n = 0;
+
+        for(auto const& line: lines(buf)) {
+            ETDCASSERT(std::regex_match(line, fields, rxReply), "old: invalid reply");
+            if( fields[3].length() )
+                n++;
+        }
+        return n;
+    }
+
+    // The data server: find "{ ... }" and collect the key:value pairs
+    static off_t header(std::string const& buf) {
+        std::cmatch  command;
+        kvmap_type   kv;
+
+        ETDCASSERT(std::regex_search(buf.data(), buf.data()+buf.size(), command, rxCommand), "old: no header");
+        for(std::cregex_iterator p(buf.data()+command.position()+1, buf.data()+command.position()+command.length()-1, rxKeyValue);
+            p!=std::cregex_iterator(); p++) {
+            const auto this_kv = *p;
+            kv.insert( kvmap_type::value_type(this_kv[1].str(),
+                                              std::regex_replace((this_kv[3].length() ? this_kv[3].str() : this_kv[2].str()), rxSlash, "")) );
+        }
+        ETDCASSERT(kv.find("uuid")!=kv.end() && kv.find("push")!=kv.end(), "old: missing keys");
+        return std::stoll(kv["sz"]) + std::stoll(kv["offset"]);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+//
+// The binary data header that replaces "{ ... }" on connections that
+// negotiated it
+//
+////////////////////////////////////////////////////////////////////////////
+namespace bin {
+    static off_t header(unsigned char const* buf) {
+        const etdc::dataheader_type  hdr = etdc::decode_dataheader(buf);
+        ETDCASSERT(hdr.push, "bin: missing keys");
+        return hdr.sz + hdr.offset;
+    }
+
+    // Offset and size each fit in an off_t but their sum does not; the
+    // decoder must not hand that to the range locking. The fields are
+    // patched in (see the layout in etdc_dataheader.h) because the
+    // encoder refuses to produce such a header.
+    static bool rejects_overflow(unsigned char const* valid) {
+        const uint64_t  big = static_cast<uint64_t>(std::numeric_limits<off_t>::max()) / 2 + 1;
+        unsigned char   buf[ etdc::dataheader_type::size ];
+
+        std::copy(valid, valid+sizeof(buf), buf);
+        for(unsigned int i = 0; i<8; i++)
+            buf[40+i] = buf[48+i] = static_cast<unsigned char>(big >> (56-8*i));
+        const uint32_t  crc = etdc::crc32c(buf, 60);
+        for(unsigned int i = 0; i<4; i++)
+            buf[60+i] = static_cast<unsigned char>(crc >> (24-8*i));
+        try {
+            (void)etdc::decode_dataheader(buf);
+        }
+        catch( std::exception const& ) {
+            return true;
+        }
+        return false;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////
+//
+// The same with the tokenizer, as in etdc_etdserver.cc now
+//
+////////////////////////////////////////////////////////////////////////////
+namespace cur {
+    static size_t command(std::string const& buf) {
+        std::vector<strview>  ls;
+        size_t                n = 0;
+
+        ls.reserve( 4 );
+        tok::split_lines(buf.data(), buf.data()+buf.size(), std::back_inserter(ls));
+        for(auto const& line: ls) {
+            strview       id, cmd( line ), arg1, arg2, arg3, arg4, arg5;
+            tok::scanner  s( cmd );
+
+            // Strip the request id, if any
+            if( !(s.character('#') && s.digits(id) && s.spaces() && s.rest(cmd)) )
+                cmd = line;
+            if( (s=tok::scanner(cmd)).literal("list") && s.spaces() && s.rest(arg1) )
+                continue;
+            if( (s=tok::scanner(cmd)).literal("write-file-") && s.word(arg1) && s.spaces() && s.rest(arg2) )
+                continue;
+            if( (s=tok::scanner(cmd)).literal("read-file") && s.spaces() && s.digits(arg1) && s.spaces() && s.rest(arg2) )
+                continue;
+            ETDCASSERT((s=tok::scanner(cmd)).literal("send-file") && s.spaces() && s.word(arg1) && s.spaces() && s.word(arg2) &&
+                       s.spaces() && s.digits(arg3) && s.spaces() && s.word(arg4) &&
+                       (s.at_end() || (s.spaces() && s.digits(arg5) && s.at_end())), "cur: not a send-file command");
+            tok::scanner  addrs( arg4 );
+            strview       addr;
+            do {
+                if( addrs.span(addr, [](char c) { return c!=','; }) )
+                    n++;
+            } while( addrs.character(',') );
+        }
+        return n;
+    }
+
+    static size_t reply(std::string const& buf) {
+        std::vector<strview>  ls;
+        size_t                n = 0;
+
+        ls.reserve( 16 );
+        tok::split_lines(buf.data(), buf.data()+buf.size(), std::back_inserter(ls));
+        for(auto const& line: ls) {
+            tok::scanner  s( line );
+            strview       info;
+            ETDCASSERT((s.literal("OK") || s.literal("ERR")) && (s.at_end() || (s.spaces() && (s.at_end() || s.rest(info)))),
+                       "cur: invalid reply");
+            if( !info.empty() )
+                n++;
+        }
+        return n;
+    }
+
+    static off_t header(std::string const& buf) {
+        etdc::kvheader_type  kv;
+
+        ETDCASSERT(kv.parse(buf.data(), buf.data()+buf.size())>0, "cur: no header");
+        ETDCASSERT(kv.has("uuid") && kv.has("push"), "cur: missing keys");
+        return tok::to_int<off_t>(kv.find("sz")) + tok::to_int<off_t>(kv.find("offset"));
+    }
+}
+
+int main(int argc, char const*const*const argv) {
+    size_t              n = 10000;
+    AP::ArgumentParser  cmd( AP::docstring("Time parsing of control channel commands, replies and "
+                                           "data channel headers with std::regex (as before) and "
+                                           "with the tokenizer in etdc_tokenizer.h, and decoding of the binary data header") );
+
+    cmd.add( AP::long_name("help"), AP::print_help(),
+             AP::docstring("Print full help and exit succesfully") );
+    cmd.add( AP::store_into(n), AP::short_name('n'), AP::at_most(1),
+             AP::docstring("Number of messages to parse per measurement") );
+    cmd.parse(argc, argv);
+
+    const std::string  reply( listReply() );
+    unsigned char      binHeader[ etdc::dataheader_type::size ];
+
+    etdc::encode_dataheader(etdc::dataheader_type(etdc::uuid_type("7f3ac1d26c4b4a8e9b0d3e5f7a9c1b2d"), 1073741824, true, true, 536870912), binHeader);
+
+    // Both must come up with the same answers before timing means anything
+    ETDCASSERT(old::command(sendFileMsg)==2 && cur::command(sendFileMsg)==2, "send-file command parsed differently");
+    ETDCASSERT(old::reply(reply)==10 && cur::reply(reply)==10, "list reply parsed differently");
+    ETDCASSERT(old::header(dataHeader)==cur::header(dataHeader), "data header parsed differently");
+    ETDCASSERT(bin::header(binHeader)==cur::header(dataHeader), "binary data header decoded differently");
+    ETDCASSERT(bin::rejects_overflow(binHeader), "binary data header with offset + size beyond off_t accepted");
+
+    bench::time_it("command/regex",     n, [&]( void ) { bench::keep(old::command(sendFileMsg)); });
+    bench::time_it("command/tokenizer", n, [&]( void ) { bench::keep(cur::command(sendFileMsg)); });
+    bench::time_it("reply/regex",       n, [&]( void ) { bench::keep(old::reply(reply)); });
+    bench::time_it("reply/tokenizer",   n, [&]( void ) { bench::keep(cur::reply(reply)); });
+    bench::time_it("header/regex",      n, [&]( void ) { bench::keep(old::header(dataHeader)); });
+    bench::time_it("header/tokenizer",  n, [&]( void ) { bench::keep(cur::header(dataHeader)); });
+    bench::time_it("header/binary",     n, [&]( void ) { bench::keep(bin::header(binHeader)); });
+    return 0;
+}
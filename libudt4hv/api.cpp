@@ -116,6 +116,7 @@ CUDTSocket::~CUDTSocket()
 
 CUDTUnited::CUDTUnited():
 m_Sockets(),
+m_SocketIndex(),
 m_ControlLock(),
 m_IDLock(),
 m_SocketID(0),
@@ -132,6 +133,8 @@ m_bGCStatus(false),
 m_GCThread(),
 m_ClosedSockets()
 {
+   m_SocketIndex.init(1024);
+
    // Socket ID MUST start from a random value
    srand((unsigned int)CTimer::getTime());
    m_SocketID = 1 + (int)((1 << 30) * (double(rand()) / RAND_MAX));
@@ -297,6 +300,7 @@ UDTSOCKET CUDTUnited::newSocket(int af, int type)
    try
    {
       m_Sockets[ns->m_SocketID] = ns;
+      m_SocketIndex.insert(ns->m_SocketID, ns->m_pUDT);
    }
    catch (...)
    {
@@ -327,6 +331,9 @@ int CUDTUnited::newConnection(const UDTSOCKET listen, const sockaddr* peer, CHan
       if (ns->m_pUDT->m_bBroken)
       {
          // last connection from the "peer" address has been broken
+         CGuard::enterCS(m_ControlLock);
+         m_SocketIndex.remove(ns->m_SocketID);
+         CGuard::leaveCS(m_ControlLock);
          ns->m_Status = CLOSED;
          ns->m_TimeStamp = CTimer::getTime();
 
@@ -417,6 +424,7 @@ int CUDTUnited::newConnection(const UDTSOCKET listen, const sockaddr* peer, CHan
    try
    {
       m_Sockets[ns->m_SocketID] = ns;
+      m_SocketIndex.insert(ns->m_SocketID, ns->m_pUDT);
       m_PeerRec[(ns->m_PeerID << 30) + ns->m_iISN].insert(ns->m_SocketID);
    }
    catch (...)
@@ -444,6 +452,9 @@ int CUDTUnited::newConnection(const UDTSOCKET listen, const sockaddr* peer, CHan
    ERR_ROLLBACK:
    if (error > 0)
    {
+      CGuard::enterCS(m_ControlLock);
+      m_SocketIndex.remove(ns->m_SocketID);
+      CGuard::leaveCS(m_ControlLock);
       ns->m_pUDT->close();
       ns->m_Status = CLOSED;
       ns->m_TimeStamp = CTimer::getTime();
@@ -465,15 +476,14 @@ int CUDTUnited::newConnection(const UDTSOCKET listen, const sockaddr* peer, CHan
 
 CUDT* CUDTUnited::lookup(const UDTSOCKET u)
 {
-   // protects the m_Sockets structure
-   CGuard cg(m_ControlLock);
-
-   map<UDTSOCKET, CUDTSocket*>::iterator i = m_Sockets.find(u);
+   // every API call comes here, so no lock: sockets leave the index when they are
+   // closed and are deleted only a while later
+   CUDT* udt = m_SocketIndex.lookup(u);
 
-   if ((i == m_Sockets.end()) || (i->second->m_Status == CLOSED))
+   if (NULL == udt)
       throw CUDTException(5, 4, 0);
 
-   return i->second->m_pUDT;
+   return udt;
 }
 
 UDTSTATUS CUDTUnited::getStatus(const UDTSOCKET u)
@@ -609,6 +619,12 @@ int CUDTUnited::listen(const UDTSOCKET u, int backlog)
       throw CUDTException(3, 2, 0);
    }
 
+   // connection requests arrive at the first shard of the port
+   {
+      CGuard mg(m_ControlLock);
+      useShard(s, m_mMultiplexer[s->m_iMuxID].m_iGroup, 0);
+   }
+
    s->m_pUDT->listen();
 
    s->m_Status = LISTENING;
@@ -760,6 +776,13 @@ int CUDTUnited::connect(const UDTSOCKET u, const sockaddr* name, int namelen)
    else if (OPENED != s->m_Status)
       throw CUDTException(5, 2, 0);
 
+   // the peer's rendezvous requests arrive at the first shard of the port
+   if (s->m_pUDT->m_bRendezvous)
+   {
+      CGuard mg(m_ControlLock);
+      useShard(s, m_mMultiplexer[s->m_iMuxID].m_iGroup, 0);
+   }
+
    // connect_complete() may be called before connect() returns.
    // So we need to update the status before connect() is called,
    // otherwise the status may be overwritten with wrong value (CONNECTED vs. CONNECTING).
@@ -844,6 +867,7 @@ int CUDTUnited::close(const UDTSOCKET u)
       return 0;
    s = i->second;
 
+   m_SocketIndex.remove(s->m_SocketID);
    s->m_Status = CLOSED;
 
    // a socket will not be immediated removed when it is closed
@@ -1201,6 +1225,7 @@ void CUDTUnited::checkBrokenSockets()
          }
 
          //close broken connections and start removal timer
+         m_SocketIndex.remove(i->first);
          i->second->m_Status = CLOSED;
          i->second->m_TimeStamp = CTimer::getTime();
          tbc.push_back(i->first);
@@ -1269,6 +1294,7 @@ void CUDTUnited::removeSocket(const UDTSOCKET u)
       // if it is a listener, close all un-accepted sockets in its queue and remove them later
       for (set<UDTSOCKET>::iterator q = i->second->m_pQueuedSockets->begin(); q != i->second->m_pQueuedSockets->end(); ++ q)
       {
+         m_SocketIndex.remove(*q);
          m_Sockets[*q]->m_pUDT->m_bBroken = true;
          m_Sockets[*q]->m_pUDT->close();
          m_Sockets[*q]->m_TimeStamp = CTimer::getTime();
@@ -1302,15 +1328,29 @@ void CUDTUnited::removeSocket(const UDTSOCKET u)
       return;
    }
 
+   // shards sharing a port go together, the kernel steers packets by their order
+   const int group = m->second.m_iGroup;
+   m = m_mMultiplexer.find(group);
+   if (m == m_mMultiplexer.end())
+      return;
+
    m->second.m_iRefCount --;
    if (0 == m->second.m_iRefCount)
    {
-      m->second.m_pChannel->close();
-      delete m->second.m_pSndQueue;
-      delete m->second.m_pRcvQueue;
-      delete m->second.m_pTimer;
-      delete m->second.m_pChannel;
-      m_mMultiplexer.erase(m);
+      for (m = m_mMultiplexer.begin(); m != m_mMultiplexer.end(); )
+      {
+         if (m->second.m_iGroup != group)
+         {
+            ++ m;
+            continue;
+         }
+         m->second.m_pChannel->close();
+         delete m->second.m_pSndQueue;
+         delete m->second.m_pRcvQueue;
+         delete m->second.m_pTimer;
+         delete m->second.m_pChannel;
+         m_mMultiplexer.erase(m ++);
+      }
    }
 }
 
@@ -1386,75 +1426,134 @@ void CUDTUnited::updateMux(CUDTSocket* s, const sockaddr* addr, const UDPSOCKET*
          {
             if (i->second.m_iPort == port)
             {
-               // reuse the existing multiplexer
-               ++ i->second.m_iRefCount;
-               s->m_pUDT->m_pSndQueue = i->second.m_pSndQueue;
-               s->m_pUDT->m_pRcvQueue = i->second.m_pRcvQueue;
-               s->m_iMuxID = i->second.m_iID;
+               // reuse the existing multiplexer, or the shard of it that receives this socket's packets
+               CMultiplexer& first = m_mMultiplexer[i->second.m_iGroup];
+               ++ first.m_iRefCount;
+               useShard(s, first.m_iGroup, s->m_SocketID % first.m_iShards);
                return;
             }
          }
       }
    }
 
-   // a new multiplexer is needed
-   CMultiplexer m;
-   m.m_iMSS = s->m_pUDT->m_iMSS;
-   m.m_iIPversion = s->m_pUDT->m_iIPversion;
-   m.m_iRefCount = 1;
-   m.m_bReusable = s->m_pUDT->m_bReuseAddr;
-   m.m_iID = s->m_SocketID;
-
-   m.m_pChannel = new CChannel(s->m_pUDT->m_iIPversion);
-   m.m_pChannel->setSndBufSize(s->m_pUDT->m_iUDPSndBufSize);
-   m.m_pChannel->setRcvBufSize(s->m_pUDT->m_iUDPRcvBufSize);
+   // a new multiplexer is needed; with UDT_SHARDS > 1 several, each with their own
+   // sending and receiving thread, bound to the same port
+   int shards = ((NULL != udpsock) || (s->m_pUDT->m_iShards < 1)) ? 1 : s->m_pUDT->m_iShards;
+   vector<CChannel*> channels;
 
    try
    {
-      if (NULL != udpsock)
-         m.m_pChannel->open(*udpsock);
-      else
-         m.m_pChannel->open(addr);
+      for (int k = 0; k < shards; ++ k)
+      {
+         channels.push_back(new CChannel(s->m_pUDT->m_iIPversion));
+         channels[k]->setSndBufSize(s->m_pUDT->m_iUDPSndBufSize);
+         channels[k]->setRcvBufSize(s->m_pUDT->m_iUDPRcvBufSize);
+         channels[k]->setReusePort(shards > 1);
+         channels[k]->setPMTUD(s->m_pUDT->m_bPMTUD);
+
+         if (NULL != udpsock)
+            channels[k]->open(*udpsock);
+         else if (k == 0)
+            channels[k]->open(addr);
+         else
+         {
+            // the others go where the first one went, which may be an ephemeral port
+            sockaddr_in6 sa;
+            channels[0]->getSockAddr((sockaddr*)&sa);
+            channels[k]->open((sockaddr*)&sa);
+         }
+      }
+
+      // without steering by socket ID the shards would get each other's packets
+      if ((shards > 1) && !channels[0]->setShardFilter(shards))
+      {
+         for (int k = 1; k < shards; ++ k)
+         {
+            channels[k]->close();
+            delete channels[k];
+         }
+         channels.resize(1);
+         shards = 1;
+      }
    }
    catch (CUDTException const& e)
    {
-      m.m_pChannel->close();
-      delete m.m_pChannel;
+      for (vector<CChannel*>::iterator c = channels.begin(); c != channels.end(); ++ c)
+      {
+         (*c)->close();
+         delete *c;
+      }
       throw e;
    }
 
    sockaddr* sa = (AF_INET == s->m_pUDT->m_iIPversion) ? (sockaddr*) new sockaddr_in : (sockaddr*) new sockaddr_in6;
-   m.m_pChannel->getSockAddr(sa);
-   m.m_iPort = (AF_INET == s->m_pUDT->m_iIPversion) ? ntohs(((sockaddr_in*)sa)->sin_port) : ntohs(((sockaddr_in6*)sa)->sin6_port);
+   channels[0]->getSockAddr(sa);
+   const int port = (AF_INET == s->m_pUDT->m_iIPversion) ? ntohs(((sockaddr_in*)sa)->sin_port) : ntohs(((sockaddr_in6*)sa)->sin6_port);
    if (AF_INET == s->m_pUDT->m_iIPversion) delete (sockaddr_in*)sa; else delete (sockaddr_in6*)sa;
 
-   m.m_pTimer = new CTimer;
+   for (int k = 0; k < shards; ++ k)
+   {
+      CMultiplexer m;
+      m.m_iMSS = s->m_pUDT->m_iMSS;
+      m.m_iIPversion = s->m_pUDT->m_iIPversion;
+      m.m_iRefCount = (k == 0) ? 1 : 0;
+      m.m_bReusable = s->m_pUDT->m_bReuseAddr;
+      m.m_iPort = port;
+      m.m_pChannel = channels[k];
+      m.m_iShard = k;
+      m.m_iShards = shards;
 
-   m.m_pSndQueue = new CSndQueue;
-   m.m_pSndQueue->init(m.m_pChannel, m.m_pTimer);
-   m.m_pRcvQueue = new CRcvQueue;
-   m.m_pRcvQueue->init(32, s->m_pUDT->m_iPayloadSize, m.m_iIPversion, 1024, m.m_pChannel, m.m_pTimer);
+      if (k == 0)
+         m.m_iID = s->m_SocketID;
+      else
+      {
+         // the other shards take unused socket IDs, those are unique
+         CGuard::enterCS(m_IDLock);
+         m.m_iID = -- m_SocketID;
+         CGuard::leaveCS(m_IDLock);
+      }
+      m.m_iGroup = s->m_SocketID;
 
-   m_mMultiplexer[m.m_iID] = m;
+      startMux(m, s->m_pUDT);
 
-   s->m_pUDT->m_pSndQueue = m.m_pSndQueue;
-   s->m_pUDT->m_pRcvQueue = m.m_pRcvQueue;
-   s->m_iMuxID = m.m_iID;
+      #ifdef LINUX
+         // spread the shards over the CPUs
+         if (shards > 1)
+         {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(k % ::sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+            pthread_setaffinity_np(m.m_pSndQueue->m_WorkerThread, sizeof(cpu_set_t), &cpus);
+            pthread_setaffinity_np(m.m_pRcvQueue->m_WorkerThread, sizeof(cpu_set_t), &cpus);
+         }
+      #endif
+
+      m_mMultiplexer[m.m_iID] = m;
+   }
+
+   useShard(s, s->m_SocketID, s->m_SocketID % shards);
 }
 
 void CUDTUnited::updateMux(CUDTSocket* s, const CUDTSocket* ls)
 {
    CGuard cg(m_ControlLock);
 
-   int port = (AF_INET == ls->m_iIPversion) ? ntohs(((sockaddr_in*)ls->m_pSelfAddr)->sin_port) : ntohs(((sockaddr_in6*)ls->m_pSelfAddr)->sin6_port);
+   map<int, CMultiplexer>::iterator i = m_mMultiplexer.find(ls->m_iMuxID);
+   if (i == m_mMultiplexer.end())
+      return;
+
+   // the listener's multiplexer, or the shard of it that receives this socket's packets
+   CMultiplexer& first = m_mMultiplexer[i->second.m_iGroup];
+   ++ first.m_iRefCount;
+   useShard(s, first.m_iGroup, s->m_SocketID % first.m_iShards);
+}
 
-   // find the listener's address
+void CUDTUnited::useShard(CUDTSocket* s, int group, int shard)
+{
    for (map<int, CMultiplexer>::iterator i = m_mMultiplexer.begin(); i != m_mMultiplexer.end(); ++ i)
    {
-      if (i->second.m_iPort == port)
+      if ((i->second.m_iGroup == group) && (i->second.m_iShard == shard))
       {
-         // reuse the existing multiplexer
-         ++ i->second.m_iRefCount;
          s->m_pUDT->m_pSndQueue = i->second.m_pSndQueue;
          s->m_pUDT->m_pRcvQueue = i->second.m_pRcvQueue;
          s->m_iMuxID = i->second.m_iID;
@@ -1463,6 +1562,17 @@ void CUDTUnited::updateMux(CUDTSocket* s, const CUDTSocket* ls)
    }
 }
 
+void CUDTUnited::startMux(CMultiplexer& m, const CUDT* u)
+{
+   m.m_pTimer = new CTimer;
+   m.m_pTimer->setSpinInterval(u->m_iPacingSpin);
+
+   m.m_pSndQueue = new CSndQueue;
+   m.m_pSndQueue->init(m.m_pChannel, m.m_pTimer);
+   m.m_pRcvQueue = new CRcvQueue;
+   m.m_pRcvQueue->init(32, u->m_iPayloadSize, m.m_iIPversion, 1024, m.m_pChannel, m.m_pTimer);
+}
+
 #ifndef WIN32
    void* CUDTUnited::garbageCollect(void* p)
 #else
@@ -1498,6 +1608,7 @@ void CUDTUnited::updateMux(CUDTSocket* s, const CUDTSocket* ls)
    CGuard::enterCS(self->m_ControlLock);
    for (map<UDTSOCKET, CUDTSocket*>::iterator i = self->m_Sockets.begin(); i != self->m_Sockets.end(); ++ i)
    {
+      self->m_SocketIndex.remove(i->first);
       i->second->m_pUDT->m_bBroken = true;
       i->second->m_pUDT->close();
       i->second->m_Status = CLOSED;
@@ -1875,6 +1986,120 @@ int CUDT::recvmsg(UDTSOCKET u, char* buf, int len)
    }
 }
 
+#ifndef WIN32
+int64_t CUDT::sendfile(UDTSOCKET u, int fd, int64_t& offset, int64_t size, int block)
+{
+   try
+   {
+      CUDT* udt = s_UDTUnited.lookup(u);
+      return udt->sendfile(fd, offset, size, block);
+   }
+   catch (CUDTException const& e)
+   {
+      s_UDTUnited.setError(new CUDTException(e));
+      return ERROR;
+   }
+   catch (bad_alloc&)
+   {
+      s_UDTUnited.setError(new CUDTException(3, 2, 0));
+      return ERROR;
+   }
+   catch (...)
+   {
+      s_UDTUnited.setError(new CUDTException(-1, 0, 0));
+      return ERROR;
+   }
+}
+
+int64_t CUDT::recvfile(UDTSOCKET u, int fd, int64_t& offset, int64_t size, int block)
+{
+   try
+   {
+      CUDT* udt = s_UDTUnited.lookup(u);
+      return udt->recvfile(fd, offset, size, block);
+   }
+   catch (CUDTException const& e)
+   {
+      s_UDTUnited.setError(new CUDTException(e));
+      return ERROR;
+   }
+   catch (bad_alloc&)
+   {
+      s_UDTUnited.setError(new CUDTException(3, 2, 0));
+      return ERROR;
+   }
+   catch (...)
+   {
+      s_UDTUnited.setError(new CUDTException(-1, 0, 0));
+      return ERROR;
+   }
+}
+#endif
+
+int CUDT::sendref(UDTSOCKET u, const char* buf, int len, UDT_RELEASE_FN release, void* ctx)
+{
+   try
+   {
+      CUDT* udt = s_UDTUnited.lookup(u);
+      return udt->sendref(buf, len, release, ctx);
+   }
+   catch (CUDTException const& e)
+   {
+      s_UDTUnited.setError(new CUDTException(e));
+      return ERROR;
+   }
+   catch (bad_alloc&)
+   {
+      s_UDTUnited.setError(new CUDTException(3, 2, 0));
+      return ERROR;
+   }
+   catch (...)
+   {
+      s_UDTUnited.setError(new CUDTException(-1, 0, 0));
+      return ERROR;
+   }
+}
+
+#ifndef WIN32
+int CUDT::recvref(UDTSOCKET u, iovec* iov, int iovcnt)
+{
+   try
+   {
+      CUDT* udt = s_UDTUnited.lookup(u);
+      return udt->recvref(iov, iovcnt);
+   }
+   catch (CUDTException const& e)
+   {
+      s_UDTUnited.setError(new CUDTException(e));
+      return ERROR;
+   }
+   catch (...)
+   {
+      s_UDTUnited.setError(new CUDTException(-1, 0, 0));
+      return ERROR;
+   }
+}
+
+int CUDT::recvrelease(UDTSOCKET u, int len)
+{
+   try
+   {
+      CUDT* udt = s_UDTUnited.lookup(u);
+      return udt->recvrelease(len);
+   }
+   catch (CUDTException const& e)
+   {
+      s_UDTUnited.setError(new CUDTException(e));
+      return ERROR;
+   }
+   catch (...)
+   {
+      s_UDTUnited.setError(new CUDTException(-1, 0, 0));
+      return ERROR;
+   }
+}
+#endif
+
 int64_t CUDT::sendfile(UDTSOCKET u, fstream& ifs, int64_t& offset, int64_t size, int block)
 {
    try
@@ -2243,6 +2468,23 @@ int recvmsg(UDTSOCKET u, char* buf, int len)
    return CUDT::recvmsg(u, buf, len);
 }
 
+int sendref(UDTSOCKET u, const char* buf, int len, UDT_RELEASE_FN release, void* ctx)
+{
+   return CUDT::sendref(u, buf, len, release, ctx);
+}
+
+#ifndef WIN32
+int recvref(UDTSOCKET u, struct iovec* iov, int iovcnt)
+{
+   return CUDT::recvref(u, iov, iovcnt);
+}
+
+int recvrelease(UDTSOCKET u, int len)
+{
+   return CUDT::recvrelease(u, len);
+}
+#endif
+
 int64_t sendfile(UDTSOCKET u, fstream& ifs, int64_t& offset, int64_t size, int block)
 {
    return CUDT::sendfile(u, ifs, offset, size, block);
@@ -2253,6 +2495,18 @@ int64_t recvfile(UDTSOCKET u, fstream& ofs, int64_t& offset, int64_t size, int b
    return CUDT::recvfile(u, ofs, offset, size, block);
 }
 
+#ifndef WIN32
+int64_t sendfile(UDTSOCKET u, int fd, int64_t& offset, int64_t size, int block)
+{
+   return CUDT::sendfile(u, fd, offset, size, block);
+}
+
+int64_t recvfile(UDTSOCKET u, int fd, int64_t& offset, int64_t size, int block)
+{
+   return CUDT::recvfile(u, fd, offset, size, block);
+}
+#endif
+
 int64_t sendfile2(UDTSOCKET u, const char* path, int64_t* offset, int64_t size, int block)
 {
    fstream ifs(path, ios::binary | ios::in);
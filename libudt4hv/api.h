@@ -204,6 +204,7 @@ private:
 
 private:
    std::map<UDTSOCKET, CUDTSocket*> m_Sockets;       // stores all the socket structures
+   CHash m_SocketIndex;                              // the open sockets' UDT instances, for lookup() without locking; changed under m_ControlLock
 
    pthread_mutex_t m_ControlLock;                    // used to synchronize UDT API
 
@@ -228,6 +229,8 @@ private:
    CUDTSocket* locate(const sockaddr* peer, const UDTSOCKET id, int32_t isn);
    void updateMux(CUDTSocket* s, const sockaddr* addr = NULL, const UDPSOCKET* = NULL);
    void updateMux(CUDTSocket* s, const CUDTSocket* ls);
+   void useShard(CUDTSocket* s, int group, int shard);
+   void startMux(CMultiplexer& m, const CUDT* u);
 
 private:
    std::map<int, CMultiplexer> m_mMultiplexer;		// UDP multiplexer
@@ -40,6 +40,10 @@ written by
 
 #include <cstring>
 #include <cmath>
+#ifndef WIN32
+   #include <cerrno>
+   #include <unistd.h>
+#endif
 #include "buffer.h"
 
 using namespace std;
@@ -77,7 +81,8 @@ m_iCount(0)
    char* pc = m_pBuffer->m_pcData;
    for (int i = 0; i < m_iSize; ++ i)
    {
-      pb->m_pcData = pc;
+      pb->m_pcData = pb->m_pcStorage = pc;
+      pb->m_pRef = NULL;
       pb = pb->m_pNext;
       pc += m_iMSS;
    }
@@ -93,6 +98,15 @@ m_iCount(0)
 
 CSndBuffer::~CSndBuffer()
 {
+   // user data that was never acknowledged is given back too
+   Reference* done = NULL;
+   for (Block* p = m_pFirstBlock; p != m_pLastBlock; p = p->m_pNext)
+   {
+      if (NULL != p->m_pRef)
+         unref(p->m_pRef, false, done);
+   }
+   release(done);
+
    Block* pb = m_pBlock->m_pNext;
    while (pb != m_pBlock)
    {
@@ -138,6 +152,8 @@ void CSndBuffer::addBuffer(const char* data, int len, int ttl, bool order)
       if (pktlen > m_iMSS)
          pktlen = m_iMSS;
 
+      s->m_pcData = s->m_pcStorage;
+      s->m_pRef = NULL;
       memcpy(s->m_pcData, data + i * m_iMSS, pktlen);
       s->m_iLength = pktlen;
 
@@ -184,6 +200,8 @@ int CSndBuffer::addBufferFromFile(fstream& ifs, int len)
       if (pktlen > m_iMSS)
          pktlen = m_iMSS;
 
+      s->m_pcData = s->m_pcStorage;
+      s->m_pRef = NULL;
       ifs.read(s->m_pcData, pktlen);
       if ((pktlen = ifs.gcount()) <= 0)
          break;
@@ -214,6 +232,203 @@ int CSndBuffer::addBufferFromFile(fstream& ifs, int len)
    return total;
 }
 
+#ifndef WIN32
+int CSndBuffer::addBufferFromFD(int fd, int64_t offset, int len)
+{
+   int size = len / m_iMSS;
+   if ((len % m_iMSS) != 0)
+      size ++;
+
+   // dynamically increase sender buffer
+   while (size + m_iCount >= m_iSize)
+      increase();
+
+   // read into the blocks' own space, as many at a time as the system allows
+   const int maxiov = 256;
+   iovec iov[maxiov];
+   Block* s = m_pLastBlock;
+   int total = 0;
+   while (total < len)
+   {
+      int n = 0;
+      int toread = 0;
+      for (Block* p = s; (n < maxiov) && (total + toread < len); ++ n, p = p->m_pNext)
+      {
+         iov[n].iov_base = p->m_pcStorage;
+         iov[n].iov_len = (len - total - toread > m_iMSS) ? m_iMSS : len - total - toread;
+         toread += iov[n].iov_len;
+      }
+
+      ssize_t res = preadv(fd, iov, n, offset + total);
+      if (res < 0)
+      {
+         if (EINTR == errno)
+            continue;
+         if (0 == total)
+            return -1;
+         break;
+      }
+
+      total += res;
+
+      // end of file, or a short read that ended half way a block
+      if ((res < toread) && ((0 == res) || (0 != total % m_iMSS)))
+         break;
+
+      for (int i = 0; i < res / m_iMSS; ++ i)
+         s = s->m_pNext;
+   }
+
+   if (total <= 0)
+      return total;
+
+   // only now that we know how much there is, turn it into a message
+   size = total / m_iMSS;
+   if ((total % m_iMSS) != 0)
+      size ++;
+
+   uint64_t time = CTimer::getTime();
+
+   s = m_pLastBlock;
+   for (int i = 0; i < size; ++ i)
+   {
+      int pktlen = total - i * m_iMSS;
+      if (pktlen > m_iMSS)
+         pktlen = m_iMSS;
+
+      s->m_pcData = s->m_pcStorage;
+      s->m_pRef = NULL;
+      s->m_iLength = pktlen;
+
+      // file transfer is only available in streaming mode, message is always in order, ttl = infinite
+      s->m_iMsgNo = m_iNextMsgNo | 0x20000000;
+      if (i == 0)
+         s->m_iMsgNo |= 0x80000000;
+      if (i == size - 1)
+         s->m_iMsgNo |= 0x40000000;
+
+      s->m_OriginTime = time;
+      s->m_iTTL = -1;
+      s = s->m_pNext;
+   }
+   m_pLastBlock = s;
+
+   CGuard::enterCS(m_BufLock);
+   m_iCount += size;
+   CGuard::leaveCS(m_BufLock);
+
+   m_iNextMsgNo ++;
+   if (m_iNextMsgNo == CMsgNo::m_iMaxMsgNo)
+      m_iNextMsgNo = 1;
+
+   return total;
+}
+#endif
+
+void CSndBuffer::addReference(const char* data, int len, Reference* ref)
+{
+   int size = len / m_iMSS;
+   if ((len % m_iMSS) != 0)
+      size ++;
+
+   // dynamically increase sender buffer
+   while (size + m_iCount >= m_iSize)
+      increase();
+
+   // before the blocks can be sent, and ACKed
+   CGuard::enterCS(m_BufLock);
+   ++ ref->m_iRefs;
+   CGuard::leaveCS(m_BufLock);
+
+   uint64_t time = CTimer::getTime();
+
+   Block* s = m_pLastBlock;
+   for (int i = 0; i < size; ++ i)
+   {
+      int pktlen = len - i * m_iMSS;
+      if (pktlen > m_iMSS)
+         pktlen = m_iMSS;
+
+      // only references in streaming mode: in order, ttl = infinite
+      s->m_pcData = const_cast<char*>(data) + i * m_iMSS;
+      s->m_iLength = pktlen;
+      s->m_pRef = NULL;
+
+      s->m_iMsgNo = m_iNextMsgNo | 0x20000000;
+      if (i == 0)
+         s->m_iMsgNo |= 0x80000000;
+      if (i == size - 1)
+      {
+         s->m_iMsgNo |= 0x40000000;
+
+         // the last block of the message holds on to the user data for all of them
+         s->m_pRef = ref;
+      }
+
+      s->m_OriginTime = time;
+      s->m_iTTL = -1;
+
+      s = s->m_pNext;
+   }
+   m_pLastBlock = s;
+
+   CGuard::enterCS(m_BufLock);
+   m_iCount += size;
+   CGuard::leaveCS(m_BufLock);
+
+   m_iNextMsgNo ++;
+   if (m_iNextMsgNo == CMsgNo::m_iMaxMsgNo)
+      m_iNextMsgNo = 1;
+}
+
+CSndBuffer::Reference* CSndBuffer::newReference(UDT_RELEASE_FN release, void* ctx, const char* data)
+{
+   Reference* ref = new Reference;
+   ref->m_Release = release;
+   ref->m_pContext = ctx;
+   ref->m_pcData = data;
+   ref->m_iLength = 0;
+   ref->m_iRefs = 1;
+   ref->m_bAcked = true;
+   ref->m_pNext = NULL;
+   return ref;
+}
+
+void CSndBuffer::releaseReference(Reference* ref, int len)
+{
+   Reference* done = NULL;
+
+   CGuard::enterCS(m_BufLock);
+   ref->m_iLength = len;
+   unref(ref, true, done);
+   CGuard::leaveCS(m_BufLock);
+
+   release(done);
+}
+
+void CSndBuffer::unref(Reference* ref, bool acked, Reference*& done)
+{
+   if (!acked)
+      ref->m_bAcked = false;
+
+   if (0 == -- ref->m_iRefs)
+   {
+      ref->m_pNext = done;
+      done = ref;
+   }
+}
+
+void CSndBuffer::release(Reference* done)
+{
+   while (NULL != done)
+   {
+      Reference* ref = done;
+      done = done->m_pNext;
+      ref->m_Release(ref->m_pContext, ref->m_pcData, ref->m_iLength, ref->m_bAcked);
+      delete ref;
+   }
+}
+
 int CSndBuffer::readData(char** data, int32_t& msgno)
 {
    // No data to read
@@ -267,13 +482,27 @@ int CSndBuffer::readData(char** data, const int offset, int32_t& msgno, int& msg
 
 void CSndBuffer::ackData(int offset)
 {
-   CGuard bufferguard(m_BufLock);
+   Reference* done = NULL;
+
+   CGuard::enterCS(m_BufLock);
 
    for (int i = 0; i < offset; ++ i)
+   {
+      if (NULL != m_pFirstBlock->m_pRef)
+      {
+         unref(m_pFirstBlock->m_pRef, true, done);
+         m_pFirstBlock->m_pRef = NULL;
+      }
       m_pFirstBlock = m_pFirstBlock->m_pNext;
+   }
 
    m_iCount -= offset;
 
+   CGuard::leaveCS(m_BufLock);
+
+   // not under the lock, the owner of the data may take its time
+   release(done);
+
    CTimer::triggerEvent();
 }
 
@@ -333,7 +562,8 @@ void CSndBuffer::increase()
    char* pc = nbuf->m_pcData;
    for (int i = 0; i < unitsize; ++ i)
    {
-      pb->m_pcData = pc;
+      pb->m_pcData = pb->m_pcStorage = pc;
+      pb->m_pRef = NULL;
       pb = pb->m_pNext;
       pc += m_iMSS;
    }
@@ -350,11 +580,18 @@ m_pUnitQueue(queue),
 m_iStartPos(0),
 m_iLastAckPos(0),
 m_iMaxPos(0),
-m_iNotch(0)
+m_iNotch(0),
+m_BufLock()
 {
    m_pUnit = new CUnit* [m_iSize];
    for (int i = 0; i < m_iSize; ++ i)
       m_pUnit[i] = NULL;
+
+   #ifndef WIN32
+      pthread_mutex_init(&m_BufLock, NULL);
+   #else
+      m_BufLock = CreateMutex(NULL, false, NULL);
+   #endif
 }
 
 CRcvBuffer::~CRcvBuffer()
@@ -369,6 +606,12 @@ CRcvBuffer::~CRcvBuffer()
    }
 
    delete [] m_pUnit;
+
+   #ifndef WIN32
+      pthread_mutex_destroy(&m_BufLock);
+   #else
+      CloseHandle(m_BufLock);
+   #endif
 }
 
 int CRcvBuffer::addData(CUnit* unit, int offset)
@@ -390,6 +633,8 @@ int CRcvBuffer::addData(CUnit* unit, int offset)
 
 int CRcvBuffer::readBuffer(char* data, int len)
 {
+   CGuard bufguard(m_BufLock);
+
    int p = m_iStartPos;
    int lastack = m_iLastAckPos;
    int rs = len;
@@ -400,8 +645,11 @@ int CRcvBuffer::readBuffer(char* data, int len)
       if (unitsize > rs)
          unitsize = rs;
 
-      memcpy(data, m_pUnit[p]->m_Packet.m_pcData + m_iNotch, unitsize);
-      data += unitsize;
+      if (NULL != data)
+      {
+         memcpy(data, m_pUnit[p]->m_Packet.m_pcData + m_iNotch, unitsize);
+         data += unitsize;
+      }
 
       if ((rs > unitsize) || (rs == m_pUnit[p]->m_Packet.getLength() - m_iNotch))
       {
@@ -425,8 +673,83 @@ int CRcvBuffer::readBuffer(char* data, int len)
    return len - rs;
 }
 
+#ifndef WIN32
+int CRcvBuffer::peekBuffer(iovec* iov, int iovcnt) const
+{
+   CGuard bufguard(m_BufLock);
+
+   int p = m_iStartPos;
+   int lastack = m_iLastAckPos;
+   int notch = m_iNotch;
+   int n = 0;
+
+   while ((p != lastack) && (n < iovcnt))
+   {
+      iov[n].iov_base = m_pUnit[p]->m_Packet.m_pcData + notch;
+      iov[n].iov_len = m_pUnit[p]->m_Packet.getLength() - notch;
+      ++ n;
+
+      if (++ p == m_iSize)
+         p = 0;
+      notch = 0;
+   }
+
+   return n;
+}
+#endif
+
+#ifndef WIN32
+int CRcvBuffer::readBufferToFD(int fd, int64_t offset, int len)
+{
+   const int maxiov = 256;
+   iovec iov[maxiov];
+   int total = 0;
+
+   while (total < len)
+   {
+      int n = peekBuffer(iov, maxiov);
+      if (0 == n)
+         break;
+
+      // not more than asked for
+      int towrite = 0;
+      int i = 0;
+      for (; (i < n) && (towrite < len - total); ++ i)
+      {
+         if ((int)iov[i].iov_len > len - total - towrite)
+            iov[i].iov_len = len - total - towrite;
+         towrite += iov[i].iov_len;
+      }
+
+      ssize_t res = pwritev(fd, iov, i, offset + total);
+      if (res < 0)
+      {
+         if (EINTR == errno)
+            continue;
+         return (0 == total) ? -1 : total;
+      }
+
+      // what made it to the file can go
+      skipData(res);
+      total += res;
+
+      if (res < towrite)
+         break;
+   }
+
+   return total;
+}
+#endif
+
+int CRcvBuffer::skipData(int len)
+{
+   return readBuffer(NULL, len);
+}
+
 int CRcvBuffer::readBufferToFile(fstream& ofs, int len)
 {
+   CGuard bufguard(m_BufLock);
+
    int p = m_iStartPos;
    int lastack = m_iLastAckPos;
    int rs = len;
@@ -497,6 +820,8 @@ void CRcvBuffer::dropMsg(int32_t msgno)
 
 int CRcvBuffer::readMsg(char* data, int len)
 {
+   CGuard bufguard(m_BufLock);
+
    int p, q;
    bool passack;
    if (!scanMsg(p, q, passack))
@@ -538,11 +863,60 @@ int CRcvBuffer::readMsg(char* data, int len)
 
 int CRcvBuffer::getRcvMsgNum()
 {
+   CGuard bufguard(m_BufLock);
+
    int p, q;
    bool passack;
    return scanMsg(p, q, passack) ? 1 : 0;
 }
 
+int CRcvBuffer::resize(int size)
+{
+   if (size <= m_iSize)
+      return -1;
+
+   CUnit** unit = NULL;
+   try
+   {
+      unit = new CUnit* [size];
+   }
+   catch (...)
+   {
+      return -1;
+   }
+   for (int i = 0; i < size; ++ i)
+      unit[i] = NULL;
+
+   // never keep the receiving thread waiting for an application that is writing to disk
+   #ifndef WIN32
+      if (0 != pthread_mutex_trylock(&m_BufLock))
+   #else
+      if (WAIT_OBJECT_0 != WaitForSingleObject(m_BufLock, 0))
+   #endif
+   {
+      delete [] unit;
+      return -1;
+   }
+
+   // Units keep their position, only the part that had wrapped around moves up behind the old end.
+   // That way the unlocked getRcvDataSize() never sees an empty buffer as non-empty or vice versa.
+   for (int i = 0; i < m_iSize; ++ i)
+   {
+      if (NULL != m_pUnit[i])
+         unit[(i < m_iStartPos) ? (i + m_iSize) % size : i] = m_pUnit[i];
+   }
+   if (m_iLastAckPos < m_iStartPos)
+      m_iLastAckPos = (m_iLastAckPos + m_iSize) % size;
+
+   delete [] m_pUnit;
+   m_pUnit = unit;
+   m_iSize = size;
+
+   CGuard::leaveCS(m_BufLock);
+
+   return 0;
+}
+
 bool CRcvBuffer::scanMsg(int& p, int& q, bool& passack)
 {
    // empty buffer
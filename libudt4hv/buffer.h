@@ -53,6 +53,18 @@ public:
    CSndBuffer(int size = 32, int mss = 1500);
    ~CSndBuffer();
 
+      // user data handed over by reference, see addReference()
+   struct Reference
+   {
+      UDT_RELEASE_FN m_Release;         // to be called when the user data is not needed anymore
+      void* m_pContext;                 // argument to m_Release
+      const char* m_pcData;             // the user data
+      int m_iLength;                    // length of the user data
+      int m_iRefs;                      // number of blocks (and callers) still referring to it
+      bool m_bAcked;                    // false if any of the blocks was discarded before it was ACKed
+      Reference* m_pNext;               // next reference to be released
+   };
+
       // Functionality:
       //    Insert a user buffer into the sending list.
       // Parameters:
@@ -75,6 +87,52 @@ public:
 
    int addBufferFromFile(std::fstream& ifs, int len);
 
+#ifndef WIN32
+      // Functionality:
+      //    Read a block of data from a file descriptor, at a given offset, straight into the sending list.
+      // Parameters:
+      //    0) [in] fd: file descriptor to pread(2) from.
+      //    1) [in] offset: where in the file to start reading.
+      //    2) [in] len: size of the block.
+      // Returned value:
+      //    actual size of data added from the file, 0 on end-of-file, -1 on error.
+
+   int addBufferFromFD(int fd, int64_t offset, int len);
+#endif
+
+      // Functionality:
+      //    Insert a user buffer into the sending list without copying it.
+      // Parameters:
+      //    0) [in] data: pointer to the user data block, which must stay valid until "ref" is released.
+      //    1) [in] len: size of the block.
+      //    2) [in] ref: the reference the block belongs to, see newReference().
+      // Returned value:
+      //    None.
+
+   void addReference(const char* data, int len, Reference* ref);
+
+      // Functionality:
+      //    Create the bookkeeping for a user buffer handed over by reference. The caller holds
+      //    one reference to it, which it must drop with releaseReference().
+      // Parameters:
+      //    0) [in] release: called once none of the data is referenced by the buffer anymore.
+      //    1) [in] ctx: passed on to "release".
+      //    2) [in] data: the user buffer.
+      // Returned value:
+      //    the new reference.
+
+   static Reference* newReference(UDT_RELEASE_FN release, void* ctx, const char* data);
+
+      // Functionality:
+      //    Drop the caller's reference; the release function is called if it was the last one.
+      // Parameters:
+      //    0) [in] ref: the reference.
+      //    1) [in] len: total size of the data actually inserted with addReference().
+      // Returned value:
+      //    None.
+
+   void releaseReference(Reference* ref, int len);
+
       // Functionality:
       //    Find data position to pack a DATA packet from the furthest reading point.
       // Parameters:
@@ -118,13 +176,21 @@ public:
 private:
    void increase();
 
+      // drop one reference, under m_BufLock; the ones that need releasing are put on "done"
+   static void unref(Reference* ref, bool acked, Reference*& done);
+
+      // call the release function of all references on "done" and delete them
+   static void release(Reference* done);
+
 private:
    pthread_mutex_t m_BufLock;           // used to synchronize buffer operation
 
    struct Block
    {
       char* m_pcData;                   // pointer to the data block
+      char* m_pcStorage;                // this block's own space in the physical buffer
       int m_iLength;                    // length of the block
+      Reference* m_pRef;                // if m_pcData points into user memory: the reference it belongs to
 
       int32_t m_iMsgNo;                 // message number
       uint64_t m_OriginTime;            // original request time
@@ -195,6 +261,40 @@ public:
 
    int readBufferToFile(std::fstream& ofs, int len);
 
+#ifndef WIN32
+      // Functionality:
+      //    Write data straight from the protocol buffer to a file descriptor, at a given offset.
+      // Parameters:
+      //    0) [in] fd: file descriptor to pwritev(2) to.
+      //    1) [in] offset: where in the file to start writing.
+      //    2) [in] len: expected length of data to write into the file.
+      // Returned value:
+      //    size of data written, -1 on error.
+
+   int readBufferToFD(int fd, int64_t offset, int len);
+#endif
+
+#ifndef WIN32
+      // Functionality:
+      //    Point the caller at the data that can be read, without copying or removing it.
+      // Parameters:
+      //    0) [out] iov: spans of readable data, in order.
+      //    1) [in] iovcnt: maximum number of spans.
+      // Returned value:
+      //    number of spans filled in.
+
+   int peekBuffer(iovec* iov, int iovcnt) const;
+#endif
+
+      // Functionality:
+      //    Remove data from the buffer without reading it, e.g. after peekBuffer().
+      // Parameters:
+      //    0) [in] len: size of data to remove.
+      // Returned value:
+      //    size of data removed.
+
+   int skipData(int len);
+
       // Functionality:
       //    Update the ACK point of the buffer.
       // Parameters:
@@ -250,6 +350,16 @@ public:
 
    int getRcvMsgNum();
 
+      // Functionality:
+      //    Grow the buffer; the data in it stays where it is. Only to be called from the
+      //    thread that adds and acknowledges data.
+      // Parameters:
+      //    0) [in] size: new size of the buffer, in packets.
+      // Returned value:
+      //    0 if the buffer was resized, -1 if not (smaller size, no memory or a read in progress).
+
+   int resize(int size);
+
 private:
    bool scanMsg(int& start, int& end, bool& passack);
 
@@ -265,6 +375,8 @@ private:
 
    int m_iNotch;			// the starting read point of the first unit
 
+   mutable pthread_mutex_t m_BufLock;	// keeps resize() out of the reading functions
+
 private:
    CRcvBuffer();
    CRcvBuffer(const CRcvBuffer&);
@@ -54,6 +54,8 @@ m_iMSS(),
 m_iSndCurrSeqNo(),
 m_iRcvRate(),
 m_iRTT(),
+m_iRTTSample(),
+m_iRcvRateSample(),
 m_pcParam(NULL),
 m_iPSize(0),
 m_UDT(),
@@ -143,6 +145,12 @@ void CCC::setRTT(int rtt)
    m_iRTT = rtt;
 }
 
+void CCC::setSamples(int rtt, int rcvrate)
+{
+   m_iRTTSample = rtt;
+   m_iRcvRateSample = rcvrate;
+}
+
 void CCC::setUserParam(const char* param, int size)
 {
    delete [] m_pcParam;
@@ -312,3 +320,372 @@ void CUDTCC::onTimeout()
       */
    }
 }
+
+////////////////////////////////////////////////////////////////////////////////
+
+void CFixedRateCC::init()
+{
+   setACKTimer(m_iSYNInterval);
+
+   // CUDT::CCUpdate() stretches this to the UDT_MAXBW rate
+   m_dPktSndPeriod = 1;
+   m_dCWndSize = m_dMaxCWndSize;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+const int CDelayCC::m_iTargetDelay = 5000;
+
+CDelayCC::CDelayCC():
+m_iRCInterval(0),
+m_LastRCTime(0),
+m_bSlowStart(true),
+m_iMinRTT(0),
+m_iLastAck(0),
+m_iLastDecSeq(0)
+{
+}
+
+void CDelayCC::init()
+{
+   m_iRCInterval = m_iSYNInterval;
+   m_LastRCTime = CTimer::getTime();
+   setACKTimer(m_iRCInterval);
+
+   // the initial RTT is a guess, not a measurement
+   m_iMinRTT = 0;
+   m_iLastAck = m_iSndCurrSeqNo;
+   m_iLastDecSeq = CSeqNo::decseq(m_iLastAck);
+
+   // A CC that replaces another one on a running connection is handed the
+   // sending period it got to; carry on from there. Otherwise probe like CUDTCC.
+   m_bSlowStart = (m_dPktSndPeriod <= 1.0);
+   if (m_bSlowStart)
+   {
+      m_dCWndSize = 16;
+      m_dPktSndPeriod = 1;
+   }
+   else
+      setRate(1000000.0 / m_dPktSndPeriod);
+}
+
+void CDelayCC::setRate(double rate)
+{
+   if (rate < 1.0)
+      rate = 1.0;
+   m_dPktSndPeriod = 1000000.0 / rate;
+
+   // twice what this rate needs, so the window never gets in the way of pacing
+   m_dCWndSize = 2.0 * rate * (m_iRTT + m_iRCInterval) / 1000000.0 + 16;
+}
+
+void CDelayCC::leaveSlowStart()
+{
+   // UDT's receiving rate is smoothed from a made up initial value and may
+   // not have caught up yet; the window is what actually got through.
+   m_bSlowStart = false;
+   setRate(m_dCWndSize * 1000000.0 / (m_iRTT + m_iRCInterval));
+}
+
+void CDelayCC::onACK(int32_t ack)
+{
+   uint64_t currtime = CTimer::getTime();
+   if (currtime - m_LastRCTime < (uint64_t)m_iRCInterval)
+      return;
+
+   const double elapsed = double(currtime - m_LastRCTime);
+   const int delivered = CSeqNo::seqoff(m_iLastAck, ack);
+   m_LastRCTime = currtime;
+   m_iLastAck = ack;
+
+   if ((0 == m_iMinRTT) || (m_iRTT < m_iMinRTT))
+      m_iMinRTT = m_iRTT;
+   const int queue = m_iRTT - m_iMinRTT;
+
+   if (m_bSlowStart)
+   {
+      if (delivered > 0)
+         m_dCWndSize += delivered;
+
+      if ((m_dCWndSize <= m_dMaxCWndSize) && (queue < m_iTargetDelay / 2))
+         return;
+
+      leaveSlowStart();
+      return;
+   }
+
+   // Move the rate in proportion to how far the queueing delay is off target,
+   // by at most a quarter per RTT.
+   double off = double(m_iTargetDelay - queue) / m_iTargetDelay;
+   if (off < -1.0)
+      off = -1.0;
+   const int rtt = (m_iRTT > m_iRCInterval) ? m_iRTT : m_iRCInterval;
+   const double rate = 1000000.0 / m_dPktSndPeriod;
+   double next = rate * (1.0 + 0.25 * off * m_iRCInterval / rtt);
+
+   // Not seeing a queue does not mean there is capacity left, e.g. when the
+   // receiver drops packets. Don't run away from what actually got through.
+   const double cap = 2.0 * delivered * 1000000.0 / elapsed;
+   if ((next > rate) && (next > cap))
+      next = (rate > cap) ? rate : cap;
+
+   setRate(next);
+}
+
+void CDelayCC::onLoss(const int32_t* losslist, int)
+{
+   if (m_bSlowStart)
+      leaveSlowStart();
+
+   // Loss without a queue is not congestion but e.g. bit errors
+   if (m_iRTT - m_iMinRTT < m_iTargetDelay)
+      return;
+
+   // once per congestion event
+   if (CSeqNo::seqcmp(losslist[0] & 0x7FFFFFFF, m_iLastDecSeq) > 0)
+   {
+      setRate(1000000.0 / m_dPktSndPeriod * 0.875);
+      m_iLastDecSeq = m_iSndCurrSeqNo;
+   }
+}
+
+void CDelayCC::onTimeout()
+{
+   if (m_bSlowStart)
+      leaveSlowStart();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+const int CBBRCC::m_iRTpropWindow = 10000000;
+const int CBBRCC::m_iProbeRTTTime = 200000;
+
+// 2/ln(2): the smallest gain that doubles the delivery rate each round trip
+static const double bbr_high_gain = 2.885;
+static const double bbr_cycle_gain[] = {1.25, 0.75, 1, 1, 1, 1, 1, 1};
+static const int bbr_cycle_len = sizeof(bbr_cycle_gain) / sizeof(bbr_cycle_gain[0]);
+
+CBBRCC::CBBRCC():
+m_State(STARTUP),
+m_RoundStart(0),
+m_iRound(0),
+m_dRateSum(0),
+m_iRateCount(0),
+m_iSent(0),
+m_iRoundSent(0),
+m_bFilledPipe(false),
+m_iFullBw(0),
+m_iFullBwCount(0),
+m_bRTTSamples(false),
+m_iRTprop(0),
+m_RTpropStamp(0),
+m_ProbeRTTDone(0),
+m_dPriorCWnd(0),
+m_iCycleIndex(0),
+m_iLastAck(0)
+{
+   memset(m_aiBwSample, 0, sizeof(m_aiBwSample));
+}
+
+void CBBRCC::init()
+{
+   setACKTimer(m_iSYNInterval);
+
+   m_State = STARTUP;
+   m_RoundStart = CTimer::getTime();
+   m_iRound = 0;
+   memset(m_aiBwSample, 0, sizeof(m_aiBwSample));
+   m_dRateSum = 0;
+   m_iRateCount = 0;
+   m_iRoundSent = m_iSent;
+   m_bFilledPipe = false;
+   m_iFullBw = 0;
+   m_iFullBwCount = 0;
+   m_bRTTSamples = false;
+   m_iRTprop = 0;
+   m_RTpropStamp = 0;
+   m_ProbeRTTDone = 0;
+   m_dPriorCWnd = 0;
+   m_iCycleIndex = 0;
+   m_iLastAck = m_iSndCurrSeqNo;
+
+   // Until the first bandwidth sample startup does not pace. Keep the window
+   // of the CC this one replaces, if any.
+   if (m_dCWndSize < 16)
+      m_dCWndSize = 16;
+   m_dPktSndPeriod = 1;
+}
+
+double CBBRCC::btlBw() const
+{
+   int bw = 0;
+   for (int i = 0; i < m_iBwWindow; ++ i)
+      if (m_aiBwSample[i] > bw)
+         bw = m_aiBwSample[i];
+   return bw;
+}
+
+void CBBRCC::newRound(uint64_t currtime)
+{
+   // The receiver counts every packet that arrives, retransmissions included,
+   // where the ACK number stalls behind a loss and then jumps. What it reports
+   // during the round is averaged into the round's sample. It times a few
+   // packets only and bursts make it overestimate, but the receiver can't
+   // get more than was sent. In PROBE_RTT the window holds the rate down,
+   // those rounds say nothing about the bandwidth and don't count.
+   const uint32_t sent = m_iSent;
+   if ((PROBE_RTT != m_State) && (m_iRateCount > 0) && (currtime > m_RoundStart))
+   {
+      const double sndrate = (sent - m_iRoundSent) * 1000000.0 / (currtime - m_RoundStart);
+      const double rcvrate = m_dRateSum / m_iRateCount;
+      m_aiBwSample[m_iRound % m_iBwWindow] = (int)((rcvrate < sndrate) ? rcvrate : sndrate);
+   }
+   m_iRoundSent = sent;
+   m_dRateSum = 0;
+   m_iRateCount = 0;
+   m_RoundStart = currtime;
+
+   switch (m_State)
+   {
+   case STARTUP:
+      // the pipe is full once the bandwidth stops growing by a quarter per round, for three rounds
+      if (btlBw() >= 1.25 * m_iFullBw)
+      {
+         m_iFullBw = (int)btlBw();
+         m_iFullBwCount = 0;
+      }
+      else if ((++ m_iFullBwCount >= 3) || (m_dCWndSize > m_dMaxCWndSize))
+      {
+         m_bFilledPipe = true;
+         m_State = DRAIN;
+      }
+      break;
+
+   case PROBE_BW:
+      m_iCycleIndex = (m_iCycleIndex + 1) % bbr_cycle_len;
+      break;
+
+   case PROBE_RTT:
+      return;
+
+   default:
+      break;
+   }
+
+   // the oldest sample drops out of the window
+   ++ m_iRound;
+   m_aiBwSample[m_iRound % m_iBwWindow] = 0;
+}
+
+void CBBRCC::updateRTprop(uint64_t currtime)
+{
+   // Prefer the receiver's latest measurement; the minimum of a smoothed RTT
+   // trails the real one. Without those, e.g. from an unmodified UDT peer,
+   // the smoothed RTT has to do.
+   int rtt = m_iRTTSample;
+   if (rtt > 0)
+      m_bRTTSamples = true;
+   else if (!m_bRTTSamples)
+      rtt = m_iRTT;
+
+   const bool expired = (currtime - m_RTpropStamp > (uint64_t)m_iRTpropWindow);
+   if ((rtt > 0) && ((0 == m_iRTprop) || (rtt <= m_iRTprop) || expired))
+   {
+      m_iRTprop = rtt;
+      m_RTpropStamp = currtime;
+   }
+
+   // No lower RTT for a while: maybe the queue never empties. Go look.
+   if (expired && (PROBE_RTT != m_State) && m_bFilledPipe)
+   {
+      m_State = PROBE_RTT;
+      m_ProbeRTTDone = 0;
+      m_dPriorCWnd = m_dCWndSize;
+   }
+}
+
+void CBBRCC::onACK(int32_t ack)
+{
+   uint64_t currtime = CTimer::getTime();
+
+   updateRTprop(currtime);
+
+   if (m_iRcvRateSample > 0)
+   {
+      m_dRateSum += m_iRcvRateSample;
+      ++ m_iRateCount;
+   }
+
+   const int acked = CSeqNo::seqoff(m_iLastAck, ack);
+   if (acked > 0)
+      m_iLastAck = ack;
+
+   if (currtime - m_RoundStart >= (uint64_t)((m_iRTT > m_iSYNInterval) ? m_iRTT : m_iSYNInterval))
+      newRound(currtime);
+
+   // Without a bandwidth to pace at, grow the window by what was acknowledged,
+   // doubling it each round trip, like CUDTCC does
+   const double bw = btlBw();
+   if (bw <= 0)
+   {
+      if (acked > 0)
+         m_dCWndSize += acked;
+      return;
+   }
+
+   // packets sent but not acknowledged; lost ones too, until they're retransmitted
+   int inflight = CSeqNo::seqoff(m_iLastAck, m_iSndCurrSeqNo) + 1;
+   if (inflight < 0)
+      inflight = 0;
+   const double bdp = bw * m_iRTprop / 1000000.0;
+
+   double pacing_gain = bbr_cycle_gain[m_iCycleIndex];
+   double cwnd_gain = 2.0;
+   switch (m_State)
+   {
+   case STARTUP:
+      pacing_gain = cwnd_gain = bbr_high_gain;
+      break;
+
+   case DRAIN:
+      // pace below the bandwidth until the queue startup built is gone
+      if (inflight <= bdp)
+      {
+         m_State = PROBE_BW;
+         m_iCycleIndex = m_iRound % bbr_cycle_len;
+         pacing_gain = bbr_cycle_gain[m_iCycleIndex];
+         break;
+      }
+      pacing_gain = 1.0 / bbr_high_gain;
+      cwnd_gain = bbr_high_gain;
+      break;
+
+   case PROBE_RTT:
+      // hold the minimum window for a while and at least a round, once it's reached
+      m_dPktSndPeriod = 1000000.0 / bw;
+      m_dCWndSize = m_iMinPipeCWnd;
+      if ((0 == m_ProbeRTTDone) && (inflight <= m_iMinPipeCWnd))
+         m_ProbeRTTDone = currtime + m_iProbeRTTTime;
+      else if ((0 != m_ProbeRTTDone) && (currtime > m_ProbeRTTDone) && (m_RoundStart + m_iProbeRTTTime > m_ProbeRTTDone))
+      {
+         m_RTpropStamp = currtime;
+         m_dCWndSize = m_dPriorCWnd;
+         m_State = PROBE_BW;
+         m_iCycleIndex = m_iRound % bbr_cycle_len;
+      }
+      return;
+
+   default:
+      break;
+   }
+
+   m_dPktSndPeriod = 1000000.0 / (pacing_gain * bw);
+
+   // The window is only released by ACKs, which come every SYN interval
+   m_dCWndSize = cwnd_gain * bw * (m_iRTprop + m_iSYNInterval) / 1000000.0 + 16;
+}
+
+void CBBRCC::onPktSent(const CPacket*)
+{
+   m_iSent = m_iSent + 1;
+}
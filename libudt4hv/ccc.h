@@ -201,6 +201,7 @@ private:
    void setSndCurrSeqNo(int32_t seqno);
    void setRcvRate(int rcvrate);
    void setRTT(int rtt);
+   void setSamples(int rtt, int rcvrate);
 
 protected:
    const int32_t& m_iSYNInterval;	// UDT constant parameter, SYN
@@ -215,6 +216,8 @@ protected:
    int32_t m_iSndCurrSeqNo;		// current maximum seq no sent out
    int m_iRcvRate;			// packet arrive rate at receiver side, packets per second
    int m_iRTT;				// current estimated RTT, microsecond
+   int m_iRTTSample;			// RTT measured by the receiver, not smoothed; 0 if the last ACK had none
+   int m_iRcvRateSample;		// packet arrive rate the last ACK reported, not smoothed; 0 if it had none
 
    char* m_pcParam;			// user defined parameter
    int m_iPSize;			// size of m_pcParam
@@ -275,4 +278,92 @@ private:
    int m_iDecCount;			// number of decreases in a congestion epoch
 };
 
+// Sends at a constant rate and ignores packet loss, for dedicated paths.
+// The rate is the one set with UDT_MAXBW; without it the sender runs at
+// full speed, limited by the flow window only.
+class CFixedRateCC: public CCC
+{
+public:
+   virtual void init();
+};
+
+// Delay based: keeps the queueing delay, the RTT above the smallest one
+// seen, close to a target. Loss only reduces the rate if it comes with a
+// queue building up, random loss is ignored.
+class CDelayCC: public CCC
+{
+public:
+   CDelayCC();
+
+public:
+   virtual void init();
+   virtual void onACK(int32_t);
+   virtual void onLoss(const int32_t*, int);
+   virtual void onTimeout();
+
+private:
+   void setRate(double rate);
+   void leaveSlowStart();
+
+private:
+   static const int m_iTargetDelay;	// queueing delay to aim for, microseconds
+
+   int m_iRCInterval;			// rate control interval
+   uint64_t m_LastRCTime;		// last rate update time
+   bool m_bSlowStart;			// if in slow start phase
+   int m_iMinRTT;			// smallest RTT observed, microseconds
+   int32_t m_iLastAck;			// last ACKed seq no
+   int32_t m_iLastDecSeq;		// max pkt seq no sent out when last decrease happened
+};
+
+// Model based, after BBR: paces at a gain times the bottleneck bandwidth,
+// the windowed maximum of the delivery rate the receiver reports, and keeps
+// about two bandwidth-delay products in flight. Loss is not a congestion
+// signal. Startup paces at a high gain until the bandwidth stops growing,
+// drain then empties the queue that built up. Every 10s without a new
+// minimum RTT the window drops to a few packets for 200ms, such that the
+// queue drains and the minimum is re-taken.
+class CBBRCC: public CCC
+{
+public:
+   CBBRCC();
+
+public:
+   virtual void init();
+   virtual void onACK(int32_t);
+   virtual void onPktSent(const CPacket*);
+
+private:
+   enum State {STARTUP, DRAIN, PROBE_BW, PROBE_RTT};
+
+   static const int m_iBwWindow = 10;	// rounds the bandwidth maximum is taken over
+   static const int m_iRTpropWindow;	// lifetime of the minimum RTT, microseconds
+   static const int m_iProbeRTTTime;	// time spent at the minimum window in PROBE_RTT, microseconds
+   static const int m_iMinPipeCWnd = 4;	// the window in PROBE_RTT, packets
+
+   void newRound(uint64_t currtime);
+   void updateRTprop(uint64_t currtime);
+   double btlBw() const;
+
+private:
+   State m_State;
+   uint64_t m_RoundStart;		// time the current round trip started
+   int m_iRound;			// round trips since init()
+   int m_aiBwSample[m_iBwWindow];	// delivery rate per round, packets per second
+   double m_dRateSum;			// sum of the receiver's rates reported in the current round
+   int m_iRateCount;			// number of those
+   volatile uint32_t m_iSent;		// packets sent, retransmissions included; only the sending thread writes it
+   uint32_t m_iRoundSent;		// m_iSent at the start of the round
+   bool m_bFilledPipe;			// if STARTUP found the bandwidth
+   int m_iFullBw;			// bandwidth at the last significant increase in STARTUP
+   int m_iFullBwCount;			// rounds without significant increase
+   bool m_bRTTSamples;			// if the peer sends RTT samples; if not, the smoothed RTT is used
+   int m_iRTprop;			// minimum RTT, microseconds
+   uint64_t m_RTpropStamp;		// time m_iRTprop was taken
+   uint64_t m_ProbeRTTDone;		// time PROBE_RTT may end, 0 until the window has drained
+   double m_dPriorCWnd;			// window before PROBE_RTT
+   int m_iCycleIndex;			// phase in the PROBE_BW gain cycle
+   int32_t m_iLastAck;			// last ACKed seq no
+};
+
 #endif
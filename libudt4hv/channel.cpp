@@ -46,6 +46,14 @@ written by
    #include <cstring>
    #include <cstdio>
    #include <cerrno>
+   #ifdef LINUX
+      #include <netinet/udp.h>
+      #include <sys/epoll.h>
+      #include <sys/eventfd.h>
+      #include <linux/filter.h>
+   #else
+      #include <poll.h>
+   #endif
 #else
    #include <winsock2.h>
    #include <ws2tcpip.h>
@@ -72,21 +80,69 @@ m_iIPversion(AF_INET),
 m_iSockAddrSize(sizeof(sockaddr_in)),
 m_iSocket(),
 m_iSndBufSize(65536),
-m_iRcvBufSize(65536)
+m_iRcvBufSize(65536),
+m_bReusePort(false),
+m_bPMTUD(false),
+#ifdef LINUX
+m_iEPollFD(-1),
+#endif
+m_bGSO(false),
+m_bGRO(false),
+m_pGROBuffer(NULL),
+m_pGROAddr(NULL),
+m_piGROLen(NULL),
+m_piGROSegSize(NULL),
+m_iGROCount(0),
+m_iGROCurr(0),
+m_iGROPos(0)
 {
+   m_iWakeupFD[0] = m_iWakeupFD[1] = -1;
 }
 
 CChannel::CChannel(int version):
 m_iIPversion(version),
 m_iSocket(),
 m_iSndBufSize(65536),
-m_iRcvBufSize(65536)
+m_iRcvBufSize(65536),
+m_bReusePort(false),
+m_bPMTUD(false),
+#ifdef LINUX
+m_iEPollFD(-1),
+#endif
+m_bGSO(false),
+m_bGRO(false),
+m_pGROBuffer(NULL),
+m_pGROAddr(NULL),
+m_piGROLen(NULL),
+m_piGROSegSize(NULL),
+m_iGROCount(0),
+m_iGROCurr(0),
+m_iGROPos(0)
 {
+   m_iWakeupFD[0] = m_iWakeupFD[1] = -1;
    m_iSockAddrSize = (AF_INET == m_iIPversion) ? sizeof(sockaddr_in) : sizeof(sockaddr_in6);
 }
 
 CChannel::~CChannel()
 {
+   #ifndef WIN32
+      #ifdef LINUX
+         if (m_iEPollFD >= 0)
+            ::close(m_iEPollFD);
+         if (m_iWakeupFD[0] >= 0)
+            ::close(m_iWakeupFD[0]);
+      #else
+         if (m_iWakeupFD[0] >= 0)
+            ::close(m_iWakeupFD[0]);
+         if (m_iWakeupFD[1] >= 0)
+            ::close(m_iWakeupFD[1]);
+      #endif
+   #endif
+
+   delete [] m_pGROBuffer;
+   delete [] m_pGROAddr;
+   delete [] m_piGROLen;
+   delete [] m_piGROSegSize;
 }
 
 void CChannel::open(const sockaddr* addr)
@@ -110,6 +166,12 @@ void CChannel::open(const sockaddr* addr)
       //if( ::setsockopt(m_iSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(int))!=0 )
       //  throw CUDTException(1, 3, NET_ERROR);
 
+      #ifdef SO_REUSEPORT
+         const int reuseport = 1;
+         if (m_bReusePort && (0 != ::setsockopt(m_iSocket, SOL_SOCKET, SO_REUSEPORT, (char*)&reuseport, sizeof(int))))
+            throw CUDTException(1, 3, NET_ERROR);
+      #endif
+
       if (0 != ::bind(m_iSocket, addr, namelen))
          throw CUDTException(1, 3, NET_ERROR);
    }
@@ -159,30 +221,77 @@ void CChannel::setUDPSockOpt()
          throw CUDTException(1, 3, NET_ERROR);
    #endif
 
-   timeval tv;
-   tv.tv_sec = 0;
-   #if defined (BSD) || defined (OSX)
-      // Known BSD bug as the day I wrote this code.
-      // A small time out value will cause the socket to block forever.
-      tv.tv_usec = 10000;
-   #else
-      tv.tv_usec = 100;
-   #endif
-
-   #ifdef UNIX
-      // Set non-blocking I/O
-      // UNIX does not support SO_RCVTIMEO
-      int opts = ::fcntl(m_iSocket, F_GETFL);
-      if (-1 == ::fcntl(m_iSocket, F_SETFL, opts | O_NONBLOCK))
-         throw CUDTException(1, 3, NET_ERROR);
-   #elif WIN32
+   #ifdef WIN32
       DWORD ot = 1; //milliseconds
       if (0 != ::setsockopt(m_iSocket, SOL_SOCKET, SO_RCVTIMEO, (char *)&ot, sizeof(DWORD)))
          throw CUDTException(1, 3, NET_ERROR);
    #else
-      // Set receiving time-out value
-      if (0 != ::setsockopt(m_iSocket, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof(timeval)))
-         throw CUDTException(1, 3, NET_ERROR);
+      // The socket stays blocking for sending; receiving never blocks (MSG_DONTWAIT),
+      // the receiving thread sleeps in waitForPackets() instead of polling the socket.
+      #ifdef LINUX
+         if (m_iEPollFD < 0)
+         {
+            m_iWakeupFD[0] = m_iWakeupFD[1] = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            m_iEPollFD = ::epoll_create1(EPOLL_CLOEXEC);
+            if ((m_iWakeupFD[0] < 0) || (m_iEPollFD < 0))
+               throw CUDTException(1, 3, NET_ERROR);
+
+            epoll_event ev;
+            memset(&ev, 0, sizeof(epoll_event));
+            ev.events = EPOLLIN;
+            ev.data.fd = m_iWakeupFD[0];
+            if (0 != ::epoll_ctl(m_iEPollFD, EPOLL_CTL_ADD, m_iWakeupFD[0], &ev))
+               throw CUDTException(1, 3, NET_ERROR);
+         }
+
+         epoll_event ev;
+         memset(&ev, 0, sizeof(epoll_event));
+         ev.events = EPOLLIN;
+         ev.data.fd = m_iSocket;
+         if (0 != ::epoll_ctl(m_iEPollFD, EPOLL_CTL_ADD, m_iSocket, &ev))
+            throw CUDTException(1, 3, NET_ERROR);
+      #else
+         if (m_iWakeupFD[0] < 0)
+         {
+            if (0 != ::pipe(m_iWakeupFD))
+               throw CUDTException(1, 3, NET_ERROR);
+            for (int i = 0; i < 2; ++ i)
+               ::fcntl(m_iWakeupFD[i], F_SETFL, ::fcntl(m_iWakeupFD[i], F_GETFL) | O_NONBLOCK);
+         }
+      #endif
+   #endif
+
+   #ifdef IP_MTU_DISCOVER
+      // the kernel refuses what it knows won't fit (EMSGSIZE), the network drops the rest
+      if (m_bPMTUD)
+      {
+         int df = (AF_INET == m_iIPversion) ? IP_PMTUDISC_DO : IPV6_PMTUDISC_DO;
+         if ((AF_INET == m_iIPversion) ? (0 != ::setsockopt(m_iSocket, IPPROTO_IP, IP_MTU_DISCOVER, (char *)&df, sizeof(int)))
+                                       : (0 != ::setsockopt(m_iSocket, IPPROTO_IPV6, IPV6_MTU_DISCOVER, (char *)&df, sizeof(int))))
+            throw CUDTException(1, 3, NET_ERROR);
+      }
+   #endif
+
+   #ifdef LINUX
+      // UDP segmentation/receive offload need kernel support (4.18 resp. 5.0);
+      // without it everything goes out and comes in one datagram per packet
+      #ifdef UDP_SEGMENT
+         int gso = 0;
+         socklen_t gsolen = sizeof(int);
+         m_bGSO = (0 == ::getsockopt(m_iSocket, SOL_UDP, UDP_SEGMENT, (char *)&gso, &gsolen));
+      #endif
+
+      #ifdef UDP_GRO
+         int gro = 1;
+         m_bGRO = (0 == ::setsockopt(m_iSocket, SOL_UDP, UDP_GRO, (char *)&gro, sizeof(int)));
+         if (m_bGRO && (NULL == m_pGROBuffer))
+         {
+            m_pGROBuffer = new char[m_iGROBatch * m_iGROBufSize];
+            m_pGROAddr = new sockaddr_in6[m_iGROBatch];
+            m_piGROLen = new int[m_iGROBatch];
+            m_piGROSegSize = new int[m_iGROBatch];
+         }
+      #endif
    #endif
 }
 
@@ -219,6 +328,65 @@ void CChannel::setRcvBufSize(int size)
    m_iRcvBufSize = size;
 }
 
+void CChannel::setReusePort(bool reuse)
+{
+   m_bReusePort = reuse;
+}
+
+void CChannel::setPMTUD(bool pmtud)
+{
+   m_bPMTUD = pmtud;
+}
+
+int CChannel::getPathMTU(const sockaddr* addr, int version)
+{
+   #ifdef IP_MTU
+      // a connected socket sees the route, nothing is sent
+      int s = ::socket(version, SOCK_DGRAM, 0);
+      if (s < 0)
+         return -1;
+
+      int mtu = -1;
+      socklen_t size = sizeof(int);
+      int df = (AF_INET == version) ? IP_PMTUDISC_DO : IPV6_PMTUDISC_DO;
+      if ((AF_INET == version) ? ((0 != ::setsockopt(s, IPPROTO_IP, IP_MTU_DISCOVER, (char *)&df, sizeof(int))) ||
+                                  (0 != ::connect(s, addr, sizeof(sockaddr_in))) ||
+                                  (0 != ::getsockopt(s, IPPROTO_IP, IP_MTU, (char *)&mtu, &size)))
+                               : ((0 != ::setsockopt(s, IPPROTO_IPV6, IPV6_MTU_DISCOVER, (char *)&df, sizeof(int))) ||
+                                  (0 != ::connect(s, addr, sizeof(sockaddr_in6))) ||
+                                  (0 != ::getsockopt(s, IPPROTO_IPV6, IPV6_MTU, (char *)&mtu, &size))))
+         mtu = -1;
+
+      ::close(s);
+      return mtu;
+   #else
+      return -1;
+   #endif
+}
+
+bool CChannel::setShardFilter(int shards)
+{
+   #if defined(LINUX) && defined(SO_ATTACH_REUSEPORT_CBPF)
+      // The destination socket ID is the 4th word of the UDT header; the UDP header
+      // has been pulled off already. Connection requests (ID 0) go to the first socket.
+      sock_filter code[] = {
+         {BPF_LD  | BPF_W   | BPF_ABS, 0, 0, 12},
+         {BPF_JMP | BPF_JEQ | BPF_K,   2, 0, 0},
+         {BPF_ALU | BPF_MOD | BPF_K,   0, 0, (uint32_t)shards},
+         {BPF_RET | BPF_A,             0, 0, 0},
+         {BPF_RET | BPF_K,             0, 0, 0}
+      };
+      sock_fprog prog;
+      prog.len = sizeof(code) / sizeof(code[0]);
+      prog.filter = code;
+
+      return 0 == ::setsockopt(m_iSocket, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+   #else
+      (void)shards;
+      return false;
+   #endif
+}
+
 void CChannel::getSockAddr(sockaddr* addr) const
 {
    socklen_t namelen = m_iSockAddrSize;
@@ -285,8 +453,15 @@ int CChannel::sendto(const sockaddr* addr, CPacket& packet) const
    return res;
 }
 
-int CChannel::recvfrom(sockaddr* addr, CPacket& packet) const
+int CChannel::recvfrom(sockaddr* addr, CPacket& packet)
 {
+   // a coalesced datagram does not fit in a single packet; let recvBatch() split it
+   if (m_bGRO)
+   {
+      CPacket* p = &packet;
+      return (recvBatch(&addr, &p, 1) > 0) ? packet.getLength() : -1;
+   }
+
    #ifndef WIN32
       msghdr mh;   
       mh.msg_name = addr;
@@ -297,17 +472,7 @@ int CChannel::recvfrom(sockaddr* addr, CPacket& packet) const
       mh.msg_controllen = 0;
       mh.msg_flags = 0;
 
-      #ifdef UNIX
-         fd_set set;
-         timeval tv;
-         FD_ZERO(&set);
-         FD_SET(m_iSocket, &set);
-         tv.tv_sec = 0;
-         tv.tv_usec = 10000;
-         ::select(m_iSocket+1, &set, NULL, &set, &tv);
-      #endif
-
-      int res = ::recvmsg(m_iSocket, &mh, 0);
+      int res = ::recvmsg(m_iSocket, &mh, MSG_DONTWAIT);
    #else
       DWORD size = CPacket::m_iPktHdrSize + packet.getLength();
       DWORD flag = 0;
@@ -343,3 +508,329 @@ int CChannel::recvfrom(sockaddr* addr, CPacket& packet) const
 
    return packet.getLength();
 }
+
+const int CChannel::m_iMaxBatchSize = 64;
+const int CChannel::m_iGROBatch = 8;
+const int CChannel::m_iGROBufSize = 65536;
+// stay clear of the 64kB IP datagram limit for both IPv4 and IPv6
+const int CChannel::m_iMaxGSOSize = 65000;
+
+void CChannel::packetToNet(CPacket& packet)
+{
+   if (packet.getFlag())
+      for (int i = 0, n = packet.getLength() / 4; i < n; ++ i)
+         *((uint32_t *)packet.m_pcData + i) = htonl(*((uint32_t *)packet.m_pcData + i));
+
+   for (int j = 0; j < 4; ++ j)
+      packet.m_nHeader[j] = htonl(packet.m_nHeader[j]);
+}
+
+void CChannel::packetToHost(CPacket& packet)
+{
+   for (int i = 0; i < 4; ++ i)
+      packet.m_nHeader[i] = ntohl(packet.m_nHeader[i]);
+
+   if (packet.getFlag())
+      for (int j = 0, n = packet.getLength() / 4; j < n; ++ j)
+         *((uint32_t *)packet.m_pcData + j) = ntohl(*((uint32_t *)packet.m_pcData + j));
+}
+
+int CChannel::sendBatch(sockaddr* const* addr, CPacket* const* packet, int n)
+{
+   #ifdef LINUX
+      mmsghdr mh[m_iMaxBatchSize];
+      iovec iov[2 * m_iMaxBatchSize];
+      int npkt[m_iMaxBatchSize];
+      char ctrl[m_iMaxBatchSize][CMSG_SPACE(sizeof(uint16_t))];
+
+      if (n > m_iMaxBatchSize)
+         n = m_iMaxBatchSize;
+
+      for (int i = 0; i < n; ++ i)
+         packetToNet(*packet[i]);
+
+      // a (partial) failure leaves the remaining packets unsent, as if they were lost
+      int res = 0;
+      while (res < n)
+      {
+         // Group the packets into datagrams. With segmentation offload, consecutive
+         // packets to the same destination go into one buffer that the kernel (or NIC)
+         // cuts into datagrams of the size of the first one; only the last one may be shorter.
+         int nmsg = 0;
+         int niov = 0;
+         for (int i = res; i < n; ++ nmsg)
+         {
+            const int seg = CPacket::m_iPktHdrSize + packet[i]->getLength();
+            int total = 0;
+            int size = seg;
+
+            mh[nmsg].msg_hdr.msg_name = addr[i];
+            mh[nmsg].msg_hdr.msg_namelen = m_iSockAddrSize;
+            mh[nmsg].msg_hdr.msg_iov = iov + niov;
+            mh[nmsg].msg_hdr.msg_control = NULL;
+            mh[nmsg].msg_hdr.msg_controllen = 0;
+            mh[nmsg].msg_hdr.msg_flags = 0;
+            mh[nmsg].msg_len = 0;
+            npkt[nmsg] = 0;
+
+            do
+            {
+               iov[niov ++] = packet[i]->m_PacketVector[0];
+               iov[niov ++] = packet[i]->m_PacketVector[1];
+               total += size;
+               ++ npkt[nmsg];
+
+               if ((++ i == n) || !m_bGSO || (size < seg))
+                  break;
+               size = CPacket::m_iPktHdrSize + packet[i]->getLength();
+            } while ((size <= seg) && (total + size <= m_iMaxGSOSize) &&
+                     ((addr[i] == addr[i - 1]) || (0 == memcmp(addr[i], addr[i - 1], m_iSockAddrSize))));
+
+            mh[nmsg].msg_hdr.msg_iovlen = 2 * npkt[nmsg];
+
+            #ifdef UDP_SEGMENT
+               if (npkt[nmsg] > 1)
+               {
+                  mh[nmsg].msg_hdr.msg_control = ctrl[nmsg];
+                  mh[nmsg].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+                  cmsghdr* cm = CMSG_FIRSTHDR(&mh[nmsg].msg_hdr);
+                  cm->cmsg_level = SOL_UDP;
+                  cm->cmsg_type = UDP_SEGMENT;
+                  cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                  *(uint16_t*)CMSG_DATA(cm) = (uint16_t)seg;
+               }
+            #endif
+         }
+
+         int sent = ::sendmmsg(m_iSocket, mh, nmsg, 0);
+         if (sent <= 0)
+         {
+            // the route/device may not support it after all: fall back for good
+            if ((npkt[0] > 1) && ((EIO == errno) || (EINVAL == errno) || (EOPNOTSUPP == errno)))
+            {
+               m_bGSO = false;
+               continue;
+            }
+            break;
+         }
+
+         for (int i = 0; i < sent; ++ i)
+            res += npkt[i];
+      }
+
+      for (int i = 0; i < n; ++ i)
+         packetToHost(*packet[i]);
+
+      return (res > 0) ? res : -1;
+   #else
+      int res = 0;
+      for (int i = 0; i < n; ++ i)
+         if (sendto(addr[i], *packet[i]) >= 0)
+            ++ res;
+      return (res > 0) ? res : -1;
+   #endif
+}
+
+bool CChannel::nextGROSegment(sockaddr* addr, CPacket& packet)
+{
+   while (m_iGROCurr < m_iGROCount)
+   {
+      const int msg = m_iGROCurr;
+      const char* buf = m_pGROBuffer + msg * m_iGROBufSize + m_iGROPos;
+      int size = m_piGROLen[m_iGROCurr] - m_iGROPos;
+
+      if (size > m_piGROSegSize[m_iGROCurr])
+         size = m_piGROSegSize[m_iGROCurr];
+
+      m_iGROPos += size;
+      if (m_iGROPos >= m_piGROLen[m_iGROCurr])
+      {
+         ++ m_iGROCurr;
+         m_iGROPos = 0;
+      }
+
+      // too short to carry a UDT header
+      if (size < CPacket::m_iPktHdrSize)
+         continue;
+
+      // like recvmsg(), silently truncate what does not fit
+      int len = size - CPacket::m_iPktHdrSize;
+      if (len > (int)packet.m_PacketVector[1].iov_len)
+         len = (int)packet.m_PacketVector[1].iov_len;
+
+      memcpy(packet.m_nHeader, buf, CPacket::m_iPktHdrSize);
+      memcpy(packet.m_pcData, buf + CPacket::m_iPktHdrSize, len);
+      memcpy(addr, m_pGROAddr + msg, m_iSockAddrSize);
+
+      packet.setLength(len);
+      packetToHost(packet);
+      return true;
+   }
+   return false;
+}
+
+int CChannel::recvBatch(sockaddr* const* addr, CPacket* const* packet, int n)
+{
+   #ifdef LINUX
+      if (n > m_iMaxBatchSize)
+         n = m_iMaxBatchSize;
+
+      #ifdef UDP_GRO
+         if (m_bGRO)
+         {
+            // only go to the kernel once everything from the previous call is handed out
+            if (m_iGROCurr >= m_iGROCount)
+            {
+               mmsghdr mh[m_iGROBatch];
+               iovec iov[m_iGROBatch];
+               char ctrl[m_iGROBatch][CMSG_SPACE(sizeof(int))];
+
+               for (int i = 0; i < m_iGROBatch; ++ i)
+               {
+                  iov[i].iov_base = m_pGROBuffer + i * m_iGROBufSize;
+                  iov[i].iov_len = m_iGROBufSize;
+
+                  mh[i].msg_hdr.msg_name = m_pGROAddr + i;
+                  mh[i].msg_hdr.msg_namelen = m_iSockAddrSize;
+                  mh[i].msg_hdr.msg_iov = iov + i;
+                  mh[i].msg_hdr.msg_iovlen = 1;
+                  mh[i].msg_hdr.msg_control = ctrl[i];
+                  mh[i].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(int));
+                  mh[i].msg_hdr.msg_flags = 0;
+                  mh[i].msg_len = 0;
+               }
+
+               int res = ::recvmmsg(m_iSocket, mh, m_iGROBatch, MSG_DONTWAIT, NULL);
+
+               if (res <= 0)
+               {
+                  packet[0]->setLength(-1);
+                  return -1;
+               }
+
+               for (int i = 0; i < res; ++ i)
+               {
+                  m_piGROLen[i] = (int)mh[i].msg_len;
+                  m_piGROSegSize[i] = (int)mh[i].msg_len;
+
+                  for (cmsghdr* cm = CMSG_FIRSTHDR(&mh[i].msg_hdr); NULL != cm; cm = CMSG_NXTHDR(&mh[i].msg_hdr, cm))
+                     if ((SOL_UDP == cm->cmsg_level) && (UDP_GRO == cm->cmsg_type))
+                        m_piGROSegSize[i] = *(int*)CMSG_DATA(cm);
+
+                  if (m_piGROSegSize[i] <= 0)
+                     m_piGROSegSize[i] = m_piGROLen[i];
+               }
+
+               m_iGROCount = res;
+               m_iGROCurr = 0;
+               m_iGROPos = 0;
+            }
+
+            int res = 0;
+            while ((res < n) && nextGROSegment(addr[res], *packet[res]))
+               ++ res;
+
+            if (0 == res)
+            {
+               packet[0]->setLength(-1);
+               return -1;
+            }
+            return res;
+         }
+      #endif
+
+      mmsghdr mh[m_iMaxBatchSize];
+
+      for (int i = 0; i < n; ++ i)
+      {
+         mh[i].msg_hdr.msg_name = addr[i];
+         mh[i].msg_hdr.msg_namelen = m_iSockAddrSize;
+         mh[i].msg_hdr.msg_iov = packet[i]->m_PacketVector;
+         mh[i].msg_hdr.msg_iovlen = 2;
+         mh[i].msg_hdr.msg_control = NULL;
+         mh[i].msg_hdr.msg_controllen = 0;
+         mh[i].msg_hdr.msg_flags = 0;
+         mh[i].msg_len = 0;
+      }
+
+      int res = ::recvmmsg(m_iSocket, mh, n, MSG_DONTWAIT, NULL);
+
+      if (res <= 0)
+      {
+         packet[0]->setLength(-1);
+         return -1;
+      }
+
+      for (int i = 0; i < res; ++ i)
+      {
+         packet[i]->setLength((int)mh[i].msg_len - CPacket::m_iPktHdrSize);
+         packetToHost(*packet[i]);
+      }
+
+      return res;
+   #else
+      // one at a time
+      if ((n < 1) || (recvfrom(addr[0], *packet[0]) < 0))
+         return -1;
+      return 1;
+   #endif
+}
+
+bool CChannel::waitForPackets(int64_t timeout)
+{
+   // split up datagrams from the previous receive come first
+   if (m_iGROCurr < m_iGROCount)
+      return true;
+
+   #ifndef WIN32
+      // round up so we don't wake up just before the deadline
+      int ms = (timeout < 0) ? -1 : (int)((timeout + 999) / 1000);
+      bool readable = false;
+      uint64_t dummy;
+
+      #ifdef LINUX
+         epoll_event ev[2];
+         int nev = ::epoll_wait(m_iEPollFD, ev, 2, ms);
+
+         for (int i = 0; i < nev; ++ i)
+         {
+            if (ev[i].data.fd == m_iSocket)
+               readable = true;
+            else
+               while (::read(m_iWakeupFD[0], &dummy, sizeof(dummy)) > 0) {}
+         }
+      #else
+         pollfd pfd[2];
+         pfd[0].fd = m_iSocket;
+         pfd[0].events = POLLIN;
+         pfd[0].revents = 0;
+         pfd[1].fd = m_iWakeupFD[0];
+         pfd[1].events = POLLIN;
+         pfd[1].revents = 0;
+
+         if (::poll(pfd, 2, ms) > 0)
+         {
+            readable = (0 != pfd[0].revents);
+            if (0 != pfd[1].revents)
+               while (::read(m_iWakeupFD[0], &dummy, sizeof(dummy)) > 0) {}
+         }
+      #endif
+
+      return readable;
+   #else
+      // the socket's receive time-out does the waiting
+      return true;
+   #endif
+}
+
+void CChannel::interrupt()
+{
+   #ifndef WIN32
+      if (m_iWakeupFD[1] >= 0)
+      {
+         uint64_t one = 1;
+         if (::write(m_iWakeupFD[1], &one, sizeof(one)) < 0) {}
+      }
+   #endif
+}
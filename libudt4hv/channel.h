@@ -116,6 +116,46 @@ public:
 
    void setRcvBufSize(int size);
 
+      // Functionality:
+      //    Let the channel share its port with other channels (SO_REUSEPORT); must precede open().
+      // Parameters:
+      //    0) [in] reuse: true to share the port.
+      // Returned value:
+      //    None.
+
+   void setReusePort(bool reuse);
+
+      // Functionality:
+      //    Send everything with the don't fragment bit set (path MTU discovery); must precede open().
+      // Parameters:
+      //    0) [in] pmtud: true to set it.
+      // Returned value:
+      //    None.
+
+   void setPMTUD(bool pmtud);
+
+      // Functionality:
+      //    Ask the system for the MTU of the route to a host: the MTU of the interface
+      //    or what path MTU discovery has learned since.
+      // Parameters:
+      //    0) [in] addr: the host.
+      //    1) [in] version: IP version.
+      // Returned value:
+      //    The MTU in bytes, -1 if the system cannot tell.
+
+   static int getPathMTU(const sockaddr* addr, int version);
+
+      // Functionality:
+      //    Have the kernel hand each packet that arrives on the shared port to channel
+      //    (destination socket ID % shards), in the order the channels were bound.
+      //    Connection requests go to the first channel.
+      // Parameters:
+      //    0) [in] shards: number of channels bound to the port.
+      // Returned value:
+      //    false if the system cannot do this.
+
+   bool setShardFilter(int shards);
+
       // Functionality:
       //    Query the socket address that the channel is using.
       // Parameters:
@@ -146,17 +186,73 @@ public:
 
       // Functionality:
       //    Receive a packet from the channel and record the source address.
+      //    Does not block; use waitForPackets() to wait for one.
       // Parameters:
       //    0) [in] addr: pointer to the source address.
       //    1) [in] packet: reference to a CPacket entity.
       // Returned value:
       //    Actual size of data received.
 
-   int recvfrom(sockaddr* addr, CPacket& packet) const;
+   int recvfrom(sockaddr* addr, CPacket& packet);
+
+      // Functionality:
+      //    Send a number of packets in one go (sendmmsg(2) where available).
+      //    If the kernel supports UDP segmentation offload, runs of equally sized
+      //    data packets to the same destination are handed over as one buffer.
+      // Parameters:
+      //    0) [in] addr: destination address of each packet.
+      //    1) [in] packet: the packets.
+      //    2) [in] n: number of packets, at most m_iMaxBatchSize.
+      // Returned value:
+      //    Number of packets sent, -1 on error.
+
+   int sendBatch(sockaddr* const* addr, CPacket* const* packet, int n);
+
+      // Functionality:
+      //    Receive as many packets as are available, up to n, without blocking
+      //    (recvmmsg(2) where available).
+      //    If the kernel supports UDP receive offload, coalesced datagrams are split back
+      //    into packets; what doesn't fit is returned by the next call.
+      // Parameters:
+      //    0) [in] addr: where to store the source address of each packet.
+      //    1) [in] packet: the packets to receive into.
+      //    2) [in] n: number of packets, at most m_iMaxBatchSize.
+      // Returned value:
+      //    Number of packets received, -1 if nothing was received.
+
+   int recvBatch(sockaddr* const* addr, CPacket* const* packet, int n);
+
+      // Functionality:
+      //    Wait until packets can be received, the time-out expires or interrupt() is called.
+      // Parameters:
+      //    0) [in] timeout: maximum waiting time in microseconds, negative to wait indefinitely.
+      // Returned value:
+      //    true if packets can be received, otherwise false.
+
+   bool waitForPackets(int64_t timeout);
+
+      // Functionality:
+      //    Make a (concurrent) waitForPackets() return now.
+      // Parameters:
+      //    None.
+      // Returned value:
+      //    None.
+
+   void interrupt();
+
+public:
+   static const int m_iMaxBatchSize;    // maximum number of packets sent/received per system call
 
 private:
    void setUDPSockOpt();
 
+   // convert header (and control information) between host and network order
+   static void packetToNet(CPacket& packet);
+   static void packetToHost(CPacket& packet);
+
+   // split the next segment of the coalesced receives into the packet
+   bool nextGROSegment(sockaddr* addr, CPacket& packet);
+
 private:
    int m_iIPversion;                    // IP version
    int m_iSockAddrSize;                 // socket address structure size (pre-defined to avoid run-time test)
@@ -165,6 +261,28 @@ private:
 
    int m_iSndBufSize;                   // UDP sending buffer size
    int m_iRcvBufSize;                   // UDP receiving buffer size
+   bool m_bReusePort;                   // bind with SO_REUSEPORT
+   bool m_bPMTUD;                       // don't fragment
+
+   int m_iWakeupFD[2];                  // interrupt()s waitForPackets(): eventfd (twice) or pipe
+   #ifdef LINUX
+   int m_iEPollFD;                      // epoll on the socket and the wake-up fd
+   #endif
+
+   bool m_bGSO;                         // UDP segmentation offload (UDP_SEGMENT) is in use
+   bool m_bGRO;                         // UDP receive offload (UDP_GRO) is in use
+
+   char* m_pGROBuffer;                  // m_iGROBatch buffers for (coalesced) receives
+   sockaddr_in6* m_pGROAddr;            // source address of each of them
+   int* m_piGROLen;                     // number of bytes received in each of them
+   int* m_piGROSegSize;                 // size of the individual datagrams in each of them
+   int m_iGROCount;                     // number of buffers holding data
+   int m_iGROCurr;                      // buffer currently being split
+   int m_iGROPos;                       // position in that buffer
+
+   static const int m_iGROBatch;        // number of coalesced receives per system call
+   static const int m_iGROBufSize;      // maximum size of a coalesced receive
+   static const int m_iMaxGSOSize;      // maximum size of a buffer to be segmented by the kernel
 };
 
 
@@ -40,6 +40,7 @@ written by
 
 
 #ifndef WIN32
+   #include <cstdio>
    #include <cstring>
    #include <cerrno>
    #include <unistd.h>
@@ -59,7 +60,7 @@ written by
 #include "common.h"
 
 bool CTimer::m_bUseMicroSecond = false;
-uint64_t CTimer::s_ullCPUFrequency = CTimer::readCPUFrequency();
+bool CTimer::m_bUseMonotonic = false;
 #ifndef WIN32
    pthread_mutex_t CTimer::m_EventLock = PTHREAD_MUTEX_INITIALIZER;
    pthread_cond_t CTimer::m_EventCond = PTHREAD_COND_INITIALIZER;
@@ -70,12 +71,22 @@ uint64_t CTimer::s_ullCPUFrequency = CTimer::readCPUFrequency();
 
 CTimer::CTimer():
 m_ullSchedTime(),
+m_llSpinInterval(-1),
 m_TickCond(),
 m_TickLock()
 {
    #ifndef WIN32
       pthread_mutex_init(&m_TickLock, NULL);
-      pthread_cond_init(&m_TickCond, NULL);
+      #ifdef LINUX
+         // immune to changes of the wall clock
+         pthread_condattr_t attr;
+         pthread_condattr_init(&attr);
+         pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+         pthread_cond_init(&m_TickCond, &attr);
+         pthread_condattr_destroy(&attr);
+      #else
+         pthread_cond_init(&m_TickCond, NULL);
+      #endif
    #else
       m_TickLock = CreateMutex(NULL, false, NULL);
       m_TickCond = CreateEvent(NULL, false, false, NULL);
@@ -95,12 +106,25 @@ CTimer::~CTimer()
 
 void CTimer::rdtsc(uint64_t &x)
 {
+   // the clock source is chosen on first use
+   getCPUFrequency();
+
    if (m_bUseMicroSecond)
    {
       x = getTime();
       return;
    }
 
+   #ifndef WIN32
+      if (m_bUseMonotonic)
+      {
+         timespec ts;
+         clock_gettime(CLOCK_MONOTONIC, &ts);
+         x = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+         return;
+      }
+   #endif
+
    #ifdef IA32
       uint32_t lval, hval;
       //asm volatile ("push %eax; push %ebx; push %ecx; push %edx");
@@ -122,7 +146,7 @@ void CTimer::rdtsc(uint64_t &x)
       BOOL ret = QueryPerformanceCounter((LARGE_INTEGER *)&x);
       //SetThreadAffinityMask(hCurThread, dwOldMask);
       if (!ret)
-         x = getTime() * s_ullCPUFrequency;
+         x = getTime() * getCPUFrequency();
    #elif defined(OSX)
       x = mach_absolute_time();
    #else
@@ -136,17 +160,18 @@ uint64_t CTimer::readCPUFrequency()
    uint64_t frequency = 1;  // 1 tick per microsecond.
 
    #if defined(IA32) || defined(IA64) || defined(AMD64)
-      uint64_t t1, t2;
-
-      rdtsc(t1);
-      timespec ts;
-      ts.tv_sec = 0;
-      ts.tv_nsec = 100000000;
-      nanosleep(&ts, NULL);
-      rdtsc(t2);
-
-      // CPU clocks per microsecond
-      frequency = (t2 - t1) / 100000;
+      // Only use the TSC if the kernel tells us its rate: measuring it here would
+      // cost every process a sleep at start-up. Otherwise count nanoseconds.
+      #if !defined(IA64)
+         frequency = readTSCFrequency();
+      #else
+         frequency = 0;
+      #endif
+      if (frequency == 0)
+      {
+         frequency = 1000;
+         m_bUseMonotonic = true;
+      }
    #elif defined(WIN32)
       int64_t ccf;
       if (QueryPerformanceFrequency((LARGE_INTEGER *)&ccf))
@@ -166,9 +191,31 @@ uint64_t CTimer::readCPUFrequency()
    return frequency;
 }
 
+uint64_t CTimer::readTSCFrequency()
+{
+   uint64_t khz = 0;
+
+   #ifdef LINUX
+      // tsc_khz, as exported by the kernel (or the tsc_freq_khz module)
+      FILE* f = fopen("/sys/devices/system/cpu/cpu0/tsc_freq_khz", "r");
+      if (NULL != f)
+      {
+         unsigned long long val;
+         if (1 == fscanf(f, "%llu", &val))
+            khz = val;
+         fclose(f);
+      }
+   #endif
+
+   // CPU clocks per microsecond
+   return khz / 1000;
+}
+
 uint64_t CTimer::getCPUFrequency()
 {
-   return s_ullCPUFrequency;
+   // determined on first use rather than during static initialisation
+   static const uint64_t frequency = readCPUFrequency();
+   return frequency;
 }
 
 void CTimer::sleep(uint64_t interval)
@@ -190,31 +237,42 @@ void CTimer::sleepto(uint64_t nexttime)
 
    while (t < m_ullSchedTime)
    {
+      #ifndef WIN32
+         if (m_llSpinInterval >= 0)
+         {
+            // sleep through all but the last bit, which is too short to trust the scheduler with
+            const uint64_t freq = getCPUFrequency();
+            uint64_t spin = m_llSpinInterval * freq;
+            if (t + spin < m_ullSchedTime)
+            {
+               timespec timeout;
+               getDeadline(timeout, (m_ullSchedTime - spin - t) / freq);
+
+               // interrupt() may have moved the scheduled time in the mean time
+               pthread_mutex_lock(&m_TickLock);
+               if (t + spin < m_ullSchedTime)
+                  pthread_cond_timedwait(&m_TickCond, &m_TickLock, &timeout);
+               pthread_mutex_unlock(&m_TickLock);
+            }
+            else
+               relax();
+
+            rdtsc(t);
+            continue;
+         }
+      #endif
+
       #ifndef NO_BUSY_WAITING
-         #ifdef IA32
-            __asm__ volatile ("pause; rep; nop; nop; nop; nop; nop;");
-         #elif IA64
-            __asm__ volatile ("nop 0; nop 0; nop 0; nop 0; nop 0;");
-         #elif AMD64
-            __asm__ volatile ("nop; nop; nop; nop; nop;");
-         #endif
+         relax();
       #else
          #ifndef WIN32
-            timeval now;
+            // wait for the scheduled time itself rather than in 10ms steps that
+            // need someone to tick() every ~100us; interrupt() still wakes us
             timespec timeout;
-            gettimeofday(&now, 0);
-            if (now.tv_usec < 990000)
-            {
-               timeout.tv_sec = now.tv_sec;
-               timeout.tv_nsec = (now.tv_usec + 10000) * 1000;
-            }
-            else
-            {
-               timeout.tv_sec = now.tv_sec + 1;
-               timeout.tv_nsec = (now.tv_usec + 10000 - 1000000) * 1000;
-            }
+            getDeadline(timeout, (m_ullSchedTime - t) / getCPUFrequency());
             pthread_mutex_lock(&m_TickLock);
-            pthread_cond_timedwait(&m_TickCond, &m_TickLock, &timeout);
+            if (t < m_ullSchedTime)
+               pthread_cond_timedwait(&m_TickCond, &m_TickLock, &timeout);
             pthread_mutex_unlock(&m_TickLock);
          #else
             WaitForSingleObject(m_TickCond, 1);
@@ -225,6 +283,44 @@ void CTimer::sleepto(uint64_t nexttime)
    }
 }
 
+void CTimer::relax()
+{
+   #ifdef IA32
+      __asm__ volatile ("pause; rep; nop; nop; nop; nop; nop;");
+   #elif IA64
+      __asm__ volatile ("nop 0; nop 0; nop 0; nop 0; nop 0;");
+   #elif AMD64
+      __asm__ volatile ("nop; nop; nop; nop; nop;");
+   #endif
+}
+
+void CTimer::setSpinInterval(int64_t interval)
+{
+   m_llSpinInterval = interval;
+}
+
+#ifndef WIN32
+void CTimer::getDeadline(timespec& deadline, uint64_t interval)
+{
+   #ifdef LINUX
+      clock_gettime(CLOCK_MONOTONIC, &deadline);
+   #else
+      timeval now;
+      gettimeofday(&now, 0);
+      deadline.tv_sec = now.tv_sec;
+      deadline.tv_nsec = now.tv_usec * 1000;
+   #endif
+
+   deadline.tv_sec += interval / 1000000;
+   deadline.tv_nsec += (interval % 1000000) * 1000;
+   if (deadline.tv_nsec >= 1000000000)
+   {
+      ++ deadline.tv_sec;
+      deadline.tv_nsec -= 1000000000;
+   }
+}
+#endif
+
 void CTimer::interrupt()
 {
    // schedule the sleepto time to the current CCs, so that it will stop
@@ -235,7 +331,10 @@ void CTimer::interrupt()
 void CTimer::tick()
 {
    #ifndef WIN32
+      // under the lock so a sleepto() that's about to wait can't miss it
+      pthread_mutex_lock(&m_TickLock);
       pthread_cond_signal(&m_TickCond);
+      pthread_mutex_unlock(&m_TickLock);
    #else
       SetEvent(m_TickCond);
    #endif
@@ -246,7 +345,7 @@ uint64_t CTimer::getTime()
    //For Cygwin and other systems without microsecond level resolution, uncomment the following three lines
    //uint64_t x;
    //rdtsc(x);
-   //return x / s_ullCPUFrequency;
+   //return x / getCPUFrequency();
    //Specific fix may be necessary if rdtsc is not available either.
 
    #ifndef WIN32
@@ -90,6 +90,17 @@ public:
 
    void sleepto(uint64_t nexttime);
 
+      // Functionality:
+      //    Let sleepto() sleep until shortly before the scheduled time and only
+      //    busy-wait for the remainder.
+      // Parameters:
+      //    0) [in] interval: microseconds to busy-wait; negative for the compiled-in behaviour
+      //       (busy-waiting all the time or, with NO_BUSY_WAITING, sleeping until the scheduled time).
+      // Returned value:
+      //    None.
+
+   void setSpinInterval(int64_t interval);
+
       // Functionality:
       //    Stop the sleep() or sleepto() methods.
       // Parameters:
@@ -100,7 +111,7 @@ public:
    void interrupt();
 
       // Functionality:
-      //    trigger the clock for a tick, for better granuality in no_busy_waiting timer.
+      //    wake up a sleepto() in progress, such that it re-reads the scheduled time.
       // Parameters:
       //    None.
       // Returned value:
@@ -167,8 +178,17 @@ public:
 private:
    uint64_t getTimeInMicroSec();
 
+      // burn a few cycles while busy-waiting
+   static void relax();
+
+   #ifndef WIN32
+      // absolute time "interval" microseconds from now, on the clock m_TickCond uses
+   static void getDeadline(timespec& deadline, uint64_t interval);
+   #endif
+
 private:
    uint64_t m_ullSchedTime;             // next schedulled time
+   int64_t m_llSpinInterval;            // busy-wait only this long before the scheduled time, in microseconds
 
    pthread_cond_t m_TickCond;
    pthread_mutex_t m_TickLock;
@@ -177,9 +197,10 @@ private:
    static pthread_mutex_t m_EventLock;
 
 private:
-   static uint64_t s_ullCPUFrequency;	// CPU frequency : clock cycles per microsecond
-   static uint64_t readCPUFrequency();
+   static uint64_t readCPUFrequency();  // CPU frequency : clock cycles per microsecond
+   static uint64_t readTSCFrequency();  // TSC rate as reported by the OS, 0 if unknown
    static bool m_bUseMicroSecond;       // No higher resolution timer available, use gettimeofday().
+   static bool m_bUseMonotonic;         // TSC rate unknown, count nanoseconds of CLOCK_MONOTONIC instead.
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -40,6 +40,7 @@ written by
 
 #ifndef WIN32
    #include <unistd.h>
+   #include <fcntl.h>
    #include <netdb.h>
    #include <arpa/inet.h>
    #include <cerrno>
@@ -116,9 +117,14 @@ CUDT::CUDT()
    m_iRcvTimeOut = -1;
    m_bReuseAddr = true;
    m_llMaxBW = -1;
+   m_iPacingSpin = 100;
+   m_iShards = 1;
+   m_llBufLimit = 0;
+   m_bPMTUD = false;
 
    m_pCCFactory = new CCCFactory<CUDTCC>;
    m_pCC = NULL;
+   m_pNewCC = NULL;
    m_pCache = NULL;
 
    // Initial status
@@ -169,9 +175,14 @@ CUDT::CUDT(const CUDT& ancestor)
    m_iRcvTimeOut = ancestor.m_iRcvTimeOut;
    m_bReuseAddr = true;	// this must be true, because all accepted sockets shared the same port with the listener
    m_llMaxBW = ancestor.m_llMaxBW;
+   m_iPacingSpin = ancestor.m_iPacingSpin;
+   m_iShards = ancestor.m_iShards;
+   m_llBufLimit = ancestor.m_llBufLimit;
+   m_bPMTUD = ancestor.m_bPMTUD;
 
    m_pCCFactory = ancestor.m_pCCFactory->clone();
    m_pCC = NULL;
+   m_pNewCC = NULL;
    m_pCache = ancestor.m_pCache;
 
    // Initial status
@@ -201,6 +212,7 @@ CUDT::~CUDT()
    delete m_pRcvTimeWindow;
    delete m_pCCFactory;
    delete m_pCC;
+   delete m_pNewCC;
    delete m_pPeerAddr;
    delete m_pSNode;
    delete m_pRNode;
@@ -243,12 +255,16 @@ void CUDT::setOpt(UDTOpt optName, const void* optval, int)
       break;
 
    case UDT_CC:
-      if (m_bConnecting || m_bConnected)
+      if (m_bConnecting)
          throw CUDTException(5, 1, 0);
       if (NULL != m_pCCFactory)
          delete m_pCCFactory;
       m_pCCFactory = ((CCCVirtualFactory *)optval)->clone();
 
+      // an established connection switches to the new algorithm right away
+      if (m_bConnected)
+         setupCC();
+
       break;
 
    case UDT_FC:
@@ -344,6 +360,46 @@ void CUDT::setOpt(UDTOpt optName, const void* optval, int)
 
    case UDT_MAXBW:
       m_llMaxBW = *(int64_t*)optval;
+
+      // an established connection is paced at the new rate right away, not from the next ACK on
+      if (m_bConnected)
+      {
+         CGuard ccguard(m_CCLock);
+         CCUpdate();
+      }
+
+      break;
+
+   case UDT_PACING:
+      // it's a property of the multiplexer, which is chosen when the socket is opened
+      if (m_bOpened)
+         throw CUDTException(5, 1, 0);
+      if (*(int*)optval < 0)
+         throw CUDTException(5, 3, 0);
+      m_iPacingSpin = *(int*)optval;
+      break;
+
+   case UDT_SHARDS:
+      if (m_bOpened)
+         throw CUDTException(5, 1, 0);
+      if (*(int*)optval < 1)
+         throw CUDTException(5, 3, 0);
+      m_iShards = *(int*)optval;
+      break;
+
+   case UDT_BUFLIMIT:
+      if (m_bConnecting || m_bConnected)
+         throw CUDTException(5, 2, 0);
+      if (*(int64_t*)optval < 0)
+         throw CUDTException(5, 3, 0);
+      m_llBufLimit = *(int64_t*)optval;
+      break;
+
+   case UDT_PMTUD:
+      // the don't fragment bit is set on the multiplexer's socket
+      if (m_bOpened)
+         throw CUDTException(5, 1, 0);
+      m_bPMTUD = *(bool*)optval;
       break;
     
    default:
@@ -438,6 +494,26 @@ void CUDT::getOpt(UDTOpt optName, void* optval, int& optlen)
       optlen = sizeof(int64_t);
       break;
 
+   case UDT_PACING:
+      *(int*)optval = m_iPacingSpin;
+      optlen = sizeof(int);
+      break;
+
+   case UDT_SHARDS:
+      *(int*)optval = m_iShards;
+      optlen = sizeof(int);
+      break;
+
+   case UDT_BUFLIMIT:
+      *(int64_t*)optval = m_llBufLimit;
+      optlen = sizeof(int64_t);
+      break;
+
+   case UDT_PMTUD:
+      *(bool*)optval = m_bPMTUD;
+      optlen = sizeof(bool);
+      break;
+
    case UDT_STATE:
       *(int32_t*)optval = s_UDTUnited.getStatus(m_SocketID);
       optlen = sizeof(int32_t);
@@ -493,6 +569,9 @@ void CUDT::open()
    m_iBandwidth = 1;
    m_iDeliveryRate = 16;
    m_iAckSeqNo = 0;
+   m_iMaxBufSize = m_iRcvBufSize;
+   m_iMaxSndBufSize = m_iSndBufSize;
+   m_iSndBDP = m_iRcvBDP = 0;
    m_ullLastAckTime = 0;
 
    // trace information
@@ -518,6 +597,7 @@ void CUDT::open()
 
    m_iRTT = 10 * m_iSYNInterval;
    m_iRTTVar = m_iRTT >> 1;
+   m_iRTTSample = 0;
    m_ullCPUFrequency = CTimer::getCPUFrequency();
 
    // set up the timers
@@ -590,14 +670,30 @@ void CUDT::connect(const sockaddr* serv_addr)
    uint64_t ttl = 3000000;
    if (m_bRendezvous)
       ttl *= 10;
+
+   // start with what the route to the peer allows, lower it if the probes get lost on the way
+   m_iConnProbes = -2;
+   if (m_bPMTUD)
+   {
+      int mtu = CChannel::getPathMTU(serv_addr, m_iIPversion);
+      if ((mtu >= int(28 + CHandShake::m_iContentSize)) && (mtu < m_iMSS))
+         setupMSS(mtu);
+      m_iConnProbes = 0;
+      ttl += 3000000;
+   }
+
    ttl += CTimer::getTime();
+
+   // the first request is sent below, keep the receiving thread from sending one while m_ConnReq is being set up
+   m_llLastReqTime = CTimer::getTime();
    m_pRcvQueue->registerConnector(m_SocketID, this, m_iIPversion, serv_addr, ttl);
 
    // This is my current configurations
    m_ConnReq.m_iVersion = m_iVersion;
    m_ConnReq.m_iType = m_iSockType;
    m_ConnReq.m_iMSS = m_iMSS;
-   m_ConnReq.m_iFlightFlagSize = (m_iRcvBufSize < m_iFlightFlagSize)? m_iRcvBufSize : m_iFlightFlagSize;
+   setupBufLimit();
+   m_ConnReq.m_iFlightFlagSize = (m_iMaxBufSize < m_iFlightFlagSize)? m_iMaxBufSize : m_iFlightFlagSize;
    m_ConnReq.m_iReqType = (!m_bRendezvous) ? 1 : 0;
    m_ConnReq.m_iID = m_SocketID;
    CIPAddress::ntop(serv_addr, m_ConnReq.m_piPeerIP, m_iIPversion);
@@ -614,26 +710,13 @@ void CUDT::connect(const sockaddr* serv_addr)
    m_ullSndLastAck2Time = CTimer::getTime();
 
    // Inform the server my configurations.
-   CPacket request;
-   char* reqdata = new char [m_iPayloadSize];
-   request.pack(0, NULL, reqdata, m_iPayloadSize);
-   // ID = 0, connection request
-   request.m_iID = 0;
-
-   int hs_size = m_iPayloadSize;
-   m_ConnReq.serialize(reqdata, hs_size);
-   request.setLength(hs_size);
-   m_pSndQueue->sendto(serv_addr, request);
-   m_llLastReqTime = CTimer::getTime();
+   sendConnReq();
 
    m_bConnecting = true;
 
    // asynchronous connect, return immediately
    if (!m_bSynRecving)
-   {
-      delete [] reqdata;
       return;
-   }
 
    // Wait for the negotiated configurations from the peer side.
    CPacket response;
@@ -646,14 +729,7 @@ void CUDT::connect(const sockaddr* serv_addr)
    {
       // avoid sending too many requests, at most 1 request per 250ms
       if (CTimer::getTime() - m_llLastReqTime > 250000)
-      {
-         m_ConnReq.serialize(reqdata, hs_size);
-         request.setLength(hs_size);
-         if (m_bRendezvous)
-            request.m_iID = m_ConnRes.m_iID;
-         m_pSndQueue->sendto(serv_addr, request);
-         m_llLastReqTime = CTimer::getTime();
-      }
+         sendConnReq();
 
       response.setLength(m_iPayloadSize);
       if (m_pRcvQueue->recvfrom(m_SocketID, response) > 0)
@@ -673,7 +749,6 @@ void CUDT::connect(const sockaddr* serv_addr)
       }
    }
 
-   delete [] reqdata;
    delete [] resdata;
 
    if (e.getErrorCode() == 0)
@@ -711,6 +786,10 @@ int CUDT::connect(const CPacket& response) throw ()
 
    m_ConnRes.deserialize(response.m_pcData, response.getLength());
 
+   // the peer got a request of the current size and its answer made it back: stop probing
+   if (m_iConnProbes >= 0)
+      m_iConnProbes = -1;
+
    if (m_bRendezvous)
    {
       // regular connect should NOT communicate with rendezvous connect
@@ -743,10 +822,17 @@ POST_CONNECT:
    m_pRcvQueue->removeConnector(m_SocketID);
 
    // Re-configure according to the negotiated values.
-   m_iMSS = m_ConnRes.m_iMSS;
+   if (m_ConnRes.m_iMSS < m_iMSS)
+   {
+      // the peer lowered the MSS; the receiver can't use more than the flight window the peer was told about
+      setupMSS(m_ConnRes.m_iMSS);
+      setupBufLimit();
+      if (m_iRcvBufSize > m_ConnReq.m_iFlightFlagSize)
+         m_iRcvBufSize = m_ConnReq.m_iFlightFlagSize;
+      if (m_iMaxBufSize > m_ConnReq.m_iFlightFlagSize)
+         m_iMaxBufSize = m_ConnReq.m_iFlightFlagSize;
+   }
    m_iFlowWindowSize = m_ConnRes.m_iFlightFlagSize;
-   m_iPktSize = m_iMSS - 28;
-   m_iPayloadSize = m_iPktSize - CPacket::m_iPktHdrSize;
    m_iPeerISN = m_ConnRes.m_iISN;
    m_iRcvLastAck = m_ConnRes.m_iISN;
    m_iRcvLastAckAck = m_ConnRes.m_iISN;
@@ -760,8 +846,8 @@ POST_CONNECT:
       m_pSndBuffer = new CSndBuffer(32, m_iPayloadSize);
       m_pRcvBuffer = new CRcvBuffer(&(m_pRcvQueue->m_UnitQueue), m_iRcvBufSize);
       // after introducing lite ACK, the sndlosslist may not be cleared in time, so it requires twice space.
-      m_pSndLossList = new CSndLossList(m_iFlowWindowSize * 2);
-      m_pRcvLossList = new CRcvLossList(m_iFlightFlagSize);
+      m_pSndLossList = new CSndLoss(m_iFlowWindowSize * 2);
+      m_pRcvLossList = new CRcvLoss(m_iFlightFlagSize);
       m_pACKWindow = new CACKWindow(1024);
       m_pRcvTimeWindow = new CPktTimeWindow(16, 64);
       m_pSndTimeWindow = new CPktTimeWindow();
@@ -771,6 +857,8 @@ POST_CONNECT:
       throw CUDTException(3, 2, 0);
    }
 
+   initBufTuning();
+
    CInfoBlock ib;
    ib.m_iIPversion = m_iIPversion;
    CInfoBlock::convert(m_pPeerAddr, m_iIPversion, ib.m_piIP);
@@ -780,18 +868,7 @@ POST_CONNECT:
       m_iBandwidth = ib.m_iBandwidth;
    }
 
-   m_pCC = m_pCCFactory->create();
-   m_pCC->m_UDT = m_SocketID;
-   m_pCC->setMSS(m_iMSS);
-   m_pCC->setMaxCWndSize(m_iFlowWindowSize);
-   m_pCC->setSndCurrSeqNo(m_iSndCurrSeqNo);
-   m_pCC->setRcvRate(m_iDeliveryRate);
-   m_pCC->setRTT(m_iRTT);
-   m_pCC->setBandwidth(m_iBandwidth);
-   m_pCC->init();
-
-   m_ullInterval = (uint64_t)(m_pCC->m_dPktSndPeriod * m_ullCPUFrequency);
-   m_dCongestionWindow = m_pCC->m_dCWndSize;
+   setupCC();
 
    // And, I am connected too.
    m_bConnecting = false;
@@ -814,15 +891,23 @@ void CUDT::connect(const sockaddr* peer, CHandShake* hs)
 {
    CGuard cg(m_ConnectionLock);
 
-   // Uses the smaller MSS between the peers        
-   if (hs->m_iMSS > m_iMSS)
-      hs->m_iMSS = m_iMSS;
-   else
-      m_iMSS = hs->m_iMSS;
+   // Uses the smaller MSS between the peers and, with path MTU discovery, the route back to the peer
+   int mss = (hs->m_iMSS < m_iMSS) ? hs->m_iMSS : m_iMSS;
+   if (m_bPMTUD)
+   {
+      int mtu = CChannel::getPathMTU(peer, m_iIPversion);
+      if ((mtu >= int(28 + CHandShake::m_iContentSize)) && (mtu < mss))
+         mss = mtu;
+   }
+   if (mss != m_iMSS)
+      setupMSS(mss);
+   hs->m_iMSS = m_iMSS;
 
    // exchange info for maximum flow window size
+   // the receiver buffer may grow up to m_iMaxBufSize, the peer must be able to track that many packets
+   setupBufLimit();
    m_iFlowWindowSize = hs->m_iFlightFlagSize;
-   hs->m_iFlightFlagSize = (m_iRcvBufSize < m_iFlightFlagSize)? m_iRcvBufSize : m_iFlightFlagSize;
+   hs->m_iFlightFlagSize = (m_iMaxBufSize < m_iFlightFlagSize)? m_iMaxBufSize : m_iFlightFlagSize;
 
    m_iPeerISN = hs->m_iISN;
 
@@ -858,8 +943,8 @@ void CUDT::connect(const sockaddr* peer, CHandShake* hs)
    {
       m_pSndBuffer = new CSndBuffer(32, m_iPayloadSize);
       m_pRcvBuffer = new CRcvBuffer(&(m_pRcvQueue->m_UnitQueue), m_iRcvBufSize);
-      m_pSndLossList = new CSndLossList(m_iFlowWindowSize * 2);
-      m_pRcvLossList = new CRcvLossList(m_iFlightFlagSize);
+      m_pSndLossList = new CSndLoss(m_iFlowWindowSize * 2);
+      m_pRcvLossList = new CRcvLoss(m_iFlightFlagSize);
       m_pACKWindow = new CACKWindow(1024);
       m_pRcvTimeWindow = new CPktTimeWindow(16, 64);
       m_pSndTimeWindow = new CPktTimeWindow();
@@ -869,6 +954,8 @@ void CUDT::connect(const sockaddr* peer, CHandShake* hs)
       throw CUDTException(3, 2, 0);
    }
 
+   initBufTuning();
+
    CInfoBlock ib;
    ib.m_iIPversion = m_iIPversion;
    CInfoBlock::convert(peer, m_iIPversion, ib.m_piIP);
@@ -878,18 +965,7 @@ void CUDT::connect(const sockaddr* peer, CHandShake* hs)
       m_iBandwidth = ib.m_iBandwidth;
    }
 
-   m_pCC = m_pCCFactory->create();
-   m_pCC->m_UDT = m_SocketID;
-   m_pCC->setMSS(m_iMSS);
-   m_pCC->setMaxCWndSize(m_iFlowWindowSize);
-   m_pCC->setSndCurrSeqNo(m_iSndCurrSeqNo);
-   m_pCC->setRcvRate(m_iDeliveryRate);
-   m_pCC->setRTT(m_iRTT);
-   m_pCC->setBandwidth(m_iBandwidth);
-   m_pCC->init();
-
-   m_ullInterval = (uint64_t)(m_pCC->m_dPktSndPeriod * m_ullCPUFrequency);
-   m_dCongestionWindow = m_pCC->m_dCWndSize;
+   setupCC();
 
    m_pPeerAddr = (AF_INET == m_iIPversion) ? (sockaddr*)new sockaddr_in : (sockaddr*)new sockaddr_in6;
    memcpy(m_pPeerAddr, peer, (AF_INET == m_iIPversion) ? sizeof(sockaddr_in) : sizeof(sockaddr_in6));
@@ -989,7 +1065,9 @@ void CUDT::close()
       if (!m_bShutdown)
          sendCtrl(5);
 
+      CGuard::enterCS(m_CCLock);
       m_pCC->close();
+      CGuard::leaveCS(m_CCLock);
 
       // Store current connection information.
       CInfoBlock ib;
@@ -1026,6 +1104,55 @@ int CUDT::send(const char* data, int len)
 
    CGuard sendguard(m_SendLock);
 
+   return sendBuffer(data, len, NULL);
+}
+
+int CUDT::sendref(const char* data, int len, UDT_RELEASE_FN release, void* ctx)
+{
+   if (UDT_DGRAM == m_iSockType)
+      throw CUDTException(5, 10, 0);
+
+   // throw an exception if not connected
+   if (m_bBroken || m_bClosing)
+      throw CUDTException(2, 1, 0);
+   else if (!m_bConnected)
+      throw CUDTException(2, 2, 0);
+
+   if (len < 0)
+      len = 0;
+
+   CGuard sendguard(m_SendLock);
+
+   // our own reference keeps "release" from being called until we're done adding
+   CSndBuffer::Reference* ref = CSndBuffer::newReference(release, ctx, data);
+   int total = 0;
+
+   try
+   {
+      while (total < len)
+      {
+         int size = sendBuffer(data + total, len - total, ref);
+         total += size;
+
+         // non-blocking sockets take what fits
+         if ((0 == size) || !m_bSynSending)
+            break;
+      }
+   }
+   catch (...)
+   {
+      m_pSndBuffer->releaseReference(ref, total);
+      if (0 == total)
+         throw;
+      return total;
+   }
+
+   m_pSndBuffer->releaseReference(ref, total);
+   return total;
+}
+
+int CUDT::sendBuffer(const char* data, int len, CSndBuffer::Reference* ref)
+{
    if (m_pSndBuffer->getCurrBufSize() == 0)
    {
       // delay the EXP timer to avoid mis-fired timeout
@@ -1105,7 +1232,10 @@ int CUDT::send(const char* data, int len)
       m_llSndDurationCounter = CTimer::getTime();
 
    // insert the user buffer into the sening list
-   m_pSndBuffer->addBuffer(data, size);
+   if (NULL == ref)
+      m_pSndBuffer->addBuffer(data, size);
+   else
+      m_pSndBuffer->addReference(data, size, ref);
 
    // insert this socket to snd list if it is not on the list yet
    m_pSndQueue->m_pSndUList->update(this, false);
@@ -1135,6 +1265,70 @@ int CUDT::recv(char* data, int len)
 
    CGuard recvguard(m_RecvLock);
 
+   waitForData();
+
+   int res = m_pRcvBuffer->readBuffer(data, len);
+
+   if (m_pRcvBuffer->getRcvDataSize() <= 0)
+   {
+      // read is not available any more
+      s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_IN, false);
+   }
+
+   if ((res <= 0) && (m_iRcvTimeOut >= 0))
+      throw CUDTException(6, 3, 0);
+
+   return res;
+}
+
+#ifndef WIN32
+int CUDT::recvref(iovec* iov, int iovcnt)
+{
+   if (UDT_DGRAM == m_iSockType)
+      throw CUDTException(5, 10, 0);
+
+   // throw an exception if not connected
+   if (!m_bConnected)
+      throw CUDTException(2, 2, 0);
+   else if ((m_bBroken || m_bClosing) && (0 == m_pRcvBuffer->getRcvDataSize()))
+      throw CUDTException(2, 1, 0);
+
+   if (iovcnt <= 0)
+      return 0;
+
+   CGuard recvguard(m_RecvLock);
+
+   waitForData();
+
+   int res = m_pRcvBuffer->peekBuffer(iov, iovcnt);
+
+   if ((res <= 0) && (m_iRcvTimeOut >= 0))
+      throw CUDTException(6, 3, 0);
+
+   return res;
+}
+
+int CUDT::recvrelease(int len)
+{
+   if (len <= 0)
+      return 0;
+
+   CGuard recvguard(m_RecvLock);
+
+   int res = m_pRcvBuffer->skipData(len);
+
+   if (m_pRcvBuffer->getRcvDataSize() <= 0)
+   {
+      // read is not available any more
+      s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_IN, false);
+   }
+
+   return res;
+}
+#endif
+
+void CUDT::waitForData()
+{
    if (0 == m_pRcvBuffer->getRcvDataSize())
    {
       if (!m_bSynRecving)
@@ -1191,19 +1385,6 @@ int CUDT::recv(char* data, int len)
       throw CUDTException(2, 2, 0);
    else if ((m_bBroken || m_bClosing) && (0 == m_pRcvBuffer->getRcvDataSize()))
       throw CUDTException(2, 1, 0);
-
-   int res = m_pRcvBuffer->readBuffer(data, len);
-
-   if (m_pRcvBuffer->getRcvDataSize() <= 0)
-   {
-      // read is not available any more
-      s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_IN, false);
-   }
-
-   if ((res <= 0) && (m_iRcvTimeOut >= 0))
-      throw CUDTException(6, 3, 0);
-
-   return res;
 }
 
 int CUDT::sendmsg(const char* data, int len, int msttl, bool inorder)
@@ -1576,6 +1757,154 @@ int64_t CUDT::recvfile(fstream& ofs, int64_t& offset, int64_t size, int block)
    return size - torecv;
 }
 
+#ifndef WIN32
+int64_t CUDT::sendfile(int fd, int64_t& offset, int64_t size, int block)
+{
+   if (UDT_DGRAM == m_iSockType)
+      throw CUDTException(5, 10, 0);
+
+   if (m_bBroken || m_bClosing)
+      throw CUDTException(2, 1, 0);
+   else if (!m_bConnected)
+      throw CUDTException(2, 2, 0);
+
+   if (size <= 0)
+      return 0;
+
+   CGuard sendguard(m_SendLock);
+
+   if (m_pSndBuffer->getCurrBufSize() == 0)
+   {
+      // delay the EXP timer to avoid mis-fired timeout
+      uint64_t currtime;
+      CTimer::rdtsc(currtime);
+      m_ullLastRspTime = currtime;
+   }
+
+   #ifdef POSIX_FADV_SEQUENTIAL
+      // ask for a bigger readahead window
+      posix_fadvise(fd, offset, size, POSIX_FADV_SEQUENTIAL);
+   #endif
+
+   int64_t tosend = size;
+   int unitsize;
+
+   // sending block by block
+   while (tosend > 0)
+   {
+      unitsize = int((tosend >= block) ? block : tosend);
+
+      #ifdef POSIX_FADV_WILLNEED
+         // have the next block read from disk while this one is being sent
+         if (tosend > unitsize)
+            posix_fadvise(fd, offset + unitsize, (tosend - unitsize >= block) ? block : tosend - unitsize, POSIX_FADV_WILLNEED);
+      #endif
+
+      pthread_mutex_lock(&m_SendBlockLock);
+      while (!m_bBroken && m_bConnected && !m_bClosing && (m_iSndBufSize <= m_pSndBuffer->getCurrBufSize()) && m_bPeerHealth)
+         pthread_cond_wait(&m_SendBlockCond, &m_SendBlockLock);
+      pthread_mutex_unlock(&m_SendBlockLock);
+
+      if (m_bBroken || m_bClosing)
+         throw CUDTException(2, 1, 0);
+      else if (!m_bConnected)
+         throw CUDTException(2, 2, 0);
+      else if (!m_bPeerHealth)
+      {
+         // reset peer health status, once this error returns, the app should handle the situation at the peer side
+         m_bPeerHealth = true;
+         throw CUDTException(7);
+      }
+
+      // record total time used for sending
+      if (0 == m_pSndBuffer->getCurrBufSize())
+         m_llSndDurationCounter = CTimer::getTime();
+
+      int sentsize = m_pSndBuffer->addBufferFromFD(fd, offset, unitsize);
+
+      if (sentsize < 0)
+         throw CUDTException(4, 4, errno);
+
+      // end of file
+      if (0 == sentsize)
+         break;
+
+      tosend -= sentsize;
+      offset += sentsize;
+
+      // insert this socket to snd list if it is not on the list yet
+      m_pSndQueue->m_pSndUList->update(this, false);
+   }
+
+   if (m_iSndBufSize <= m_pSndBuffer->getCurrBufSize())
+   {
+      // write is not available any more
+      s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_OUT, false);
+   }
+
+   return size - tosend;
+}
+
+int64_t CUDT::recvfile(int fd, int64_t& offset, int64_t size, int block)
+{
+   if (UDT_DGRAM == m_iSockType)
+      throw CUDTException(5, 10, 0);
+
+   if (!m_bConnected)
+      throw CUDTException(2, 2, 0);
+   else if ((m_bBroken || m_bClosing) && (0 == m_pRcvBuffer->getRcvDataSize()))
+      throw CUDTException(2, 1, 0);
+
+   if (size <= 0)
+      return 0;
+
+   CGuard recvguard(m_RecvLock);
+
+   int64_t torecv = size;
+   int unitsize;
+   int recvsize;
+
+   // receiving... "recvfile" is always blocking
+   while (torecv > 0)
+   {
+      pthread_mutex_lock(&m_RecvDataLock);
+      while (!m_bBroken && m_bConnected && !m_bClosing && (0 == m_pRcvBuffer->getRcvDataSize()))
+         pthread_cond_wait(&m_RecvDataCond, &m_RecvDataLock);
+      pthread_mutex_unlock(&m_RecvDataLock);
+
+      if (!m_bConnected)
+         throw CUDTException(2, 2, 0);
+      else if ((m_bBroken || m_bClosing) && (0 == m_pRcvBuffer->getRcvDataSize()))
+         throw CUDTException(2, 1, 0);
+
+      unitsize = int((torecv >= block) ? block : torecv);
+      recvsize = m_pRcvBuffer->readBufferToFD(fd, offset, unitsize);
+
+      if (recvsize < 0)
+      {
+         int err = errno;
+
+         // send the sender a signal so it will not be blocked forever
+         int32_t err_code = CUDTException::EFILE;
+         sendCtrl(8, &err_code);
+
+         throw CUDTException(4, 4, err);
+      }
+
+      torecv -= recvsize;
+      offset += recvsize;
+   }
+
+   if (m_pRcvBuffer->getRcvDataSize() <= 0)
+   {
+      // read is not available any more
+      s_UDTUnited.m_EPoll.update_events(m_SocketID, m_sPollID, UDT_EPOLL_IN, false);
+   }
+
+   return size - torecv;
+}
+#endif
+
 void CUDT::sample(CPerfMon* perf, bool clear)
 {
    if (!m_bConnected)
@@ -1620,6 +1949,26 @@ void CUDT::sample(CPerfMon* perf, bool clear)
    perf->msRTT = m_iRTT/1000.0;
    perf->mbpsBandwidth = m_iBandwidth * m_iPayloadSize * 8.0 / 1000000.0;
 
+   perf->sndBatchTotal = m_pSndQueue->m_llBatch;
+   perf->pktSndBatchTotal = m_pSndQueue->m_llBatchPkt;
+   perf->usSndBatchAvg = (0 == perf->sndBatchTotal) ? 0 : m_pSndQueue->m_llBatchTime / double(m_ullCPUFrequency) / perf->sndBatchTotal;
+   perf->rcvBatchTotal = m_pRcvQueue->m_llBatch;
+   perf->pktRcvBatchTotal = m_pRcvQueue->m_llBatchPkt;
+   perf->usRcvBatchAvg = (0 == perf->rcvBatchTotal) ? 0 : m_pRcvQueue->m_llBatchTime / double(m_ullCPUFrequency) / perf->rcvBatchTotal;
+   perf->pktPacedTotal = m_pSndQueue->m_llPaced;
+   perf->usPacingErrAvg = (0 == perf->pktPacedTotal) ? 0 : m_pSndQueue->m_llPacingErrTime / double(m_ullCPUFrequency) / perf->pktPacedTotal;
+   perf->usPacingErrMax = m_pSndQueue->m_llPacingErrMax / double(m_ullCPUFrequency);
+   for (int i = 0; i < 8; ++ i)
+      perf->pktPacingErrHist[i] = m_pSndQueue->m_llPacingErrHist[i];
+
+   perf->pktSndBuf = m_iSndBufSize;
+   perf->pktRcvBuf = m_iRcvBufSize;
+   perf->pktMaxBuf = m_iMaxBufSize;
+   perf->pktMaxSndBuf = m_iMaxSndBufSize;
+   perf->pktSndBDP = m_iSndBDP;
+   perf->pktRcvBDP = m_iRcvBDP;
+   perf->pktUnitQueue = m_pRcvQueue->m_UnitQueue.m_iSize;
+
    #ifndef WIN32
       if (0 == pthread_mutex_trylock(&m_ConnectionLock))
    #else
@@ -1649,6 +1998,48 @@ void CUDT::sample(CPerfMon* perf, bool clear)
    }
 }
 
+void CUDT::setupCC()
+{
+   CCC* cc = m_pCCFactory->create();
+   cc->m_UDT = m_SocketID;
+
+   // The receiving thread calls into the CC without taking a lock, so on an
+   // established connection it takes over the new one itself, see checkTimers().
+   if (m_bConnected)
+   {
+      CGuard ccguard(m_CCLock);
+      delete m_pNewCC;
+      m_pNewCC = cc;
+      return;
+   }
+
+   installCC(cc);
+}
+
+void CUDT::installCC(CCC* cc)
+{
+   cc->setMSS(m_iMSS);
+   cc->setMaxCWndSize(m_iFlowWindowSize);
+   cc->setSndCurrSeqNo(m_iSndCurrSeqNo);
+   cc->setRcvRate(m_iDeliveryRate);
+   cc->setRTT(m_iRTT);
+   cc->setBandwidth(m_iBandwidth);
+
+   // A replacement continues from where its predecessor left off, init() may override that.
+   if (NULL != m_pCC)
+   {
+      cc->m_dPktSndPeriod = m_pCC->m_dPktSndPeriod;
+      cc->m_dCWndSize = m_pCC->m_dCWndSize;
+   }
+   cc->init();
+
+   CGuard ccguard(m_CCLock);
+   delete m_pCC;
+   m_pCC = cc;
+
+   CCUpdate();
+}
+
 void CUDT::CCUpdate()
 {
    m_ullInterval = (uint64_t)(m_pCC->m_dPktSndPeriod * m_ullCPUFrequency);
@@ -1661,6 +2052,160 @@ void CUDT::CCUpdate()
        m_ullInterval = minSP;
 }
 
+void CUDT::setupBufLimit()
+{
+   // without auto-tuning the buffers keep their configured sizes
+   m_iMaxBufSize = m_iRcvBufSize;
+   m_iMaxSndBufSize = m_iSndBufSize;
+   if (m_llBufLimit <= 0)
+      return;
+
+   int64_t limit = m_llBufLimit / (m_iMSS - 28);
+   if (limit > (1 << 30))
+      limit = 1 << 30;
+   if (limit > m_iMaxSndBufSize)
+      m_iMaxSndBufSize = (int)limit;
+
+   // a received packet takes a unit of the multiplexer's queue, which is sized for the MSS the
+   // multiplexer started with; with a smaller one negotiated each unit is only partly used
+   int unit = (m_pRcvQueue->m_iPayloadSize > m_iPayloadSize) ? m_pRcvQueue->m_iPayloadSize : m_iPayloadSize;
+   limit = m_llBufLimit / (unit + CPacket::m_iPktHdrSize);
+   if (limit > (1 << 30))
+      limit = 1 << 30;
+   if (limit > m_iMaxBufSize)
+      m_iMaxBufSize = (int)limit;
+
+   // recv buffer MUST not be greater than FC size
+   if (m_iFlightFlagSize < m_iMaxBufSize)
+      m_iFlightFlagSize = m_iMaxBufSize;
+}
+
+void CUDT::setupMSS(int mss)
+{
+   // the sizes are in packets
+   double scale = double(m_iMSS - 28) / (mss - 28);
+   double size = m_iSndBufSize * scale;
+   m_iSndBufSize = (size > (1 << 30)) ? (1 << 30) : (int)size;
+   size = m_iRcvBufSize * scale;
+   m_iRcvBufSize = (size > (1 << 30)) ? (1 << 30) : (int)size;
+   size = m_iFlightFlagSize * scale;
+   m_iFlightFlagSize = (size > (1 << 30)) ? (1 << 30) : (int)size;
+
+   m_iMSS = mss;
+   m_iPktSize = m_iMSS - 28;
+   m_iPayloadSize = m_iPktSize - CPacket::m_iPktHdrSize;
+}
+
+void CUDT::sendConnReq()
+{
+   // MSS values worth a try: jumbo frames, FDDI/Token Ring, Ethernet, tunnels, the IPv6 minimum
+   static const int steps[] = {9000, 4352, 1500, 1400, 1280};
+
+   if (m_iConnProbes >= 2)
+   {
+      int mss = 0;
+      for (unsigned int i = 0; (0 == mss) && (i < sizeof(steps) / sizeof(int)); ++ i)
+      {
+         if (steps[i] < m_iMSS)
+            mss = steps[i];
+      }
+
+      if (mss > 0)
+      {
+         setupMSS(mss);
+         setupBufLimit();
+         m_ConnReq.m_iMSS = m_iMSS;
+         m_ConnReq.m_iFlightFlagSize = (m_iMaxBufSize < m_iFlightFlagSize)? m_iMaxBufSize : m_iFlightFlagSize;
+         m_iConnProbes = 0;
+      }
+      else
+      {
+         // nothing gets through, perhaps the peer does not accept padded requests
+         m_iConnProbes = -2;
+      }
+   }
+
+   CPacket request;
+   char* reqdata = new char [m_iPayloadSize];
+   request.pack(0, NULL, reqdata, m_iPayloadSize);
+   // ID = 0, connection request
+   request.m_iID = !m_bRendezvous ? 0 : m_ConnRes.m_iID;
+
+   int hs_size = m_iPayloadSize;
+   m_ConnReq.serialize(reqdata, hs_size);
+   if (m_iConnProbes != -2)
+   {
+      memset(reqdata + hs_size, 0, m_iPayloadSize - hs_size);
+      hs_size = m_iPayloadSize;
+   }
+   request.setLength(hs_size);
+   m_pSndQueue->sendto(m_pPeerAddr, request);
+   m_llLastReqTime = CTimer::getTime();
+
+   if (m_iConnProbes >= 0)
+      ++ m_iConnProbes;
+
+   delete [] reqdata;
+}
+
+void CUDT::initBufTuning()
+{
+   CTimer::rdtsc(m_ullLastSndTuneTime);
+   m_ullLastRcvTuneTime = m_ullLastSndTuneTime;
+   m_iSndTuneAck = m_iSndLastDataAck;
+   m_llRcvTuneRecv = m_llRecvTotal;
+   m_iSndBDP = m_iRcvBDP = 0;
+}
+
+void CUDT::tuneSndBuffer(uint64_t currtime)
+{
+   if ((m_llBufLimit <= 0) || (m_iSndBufSize >= m_iMaxSndBufSize))
+      return;
+
+   // once per RTT, that is how long the ACKs take to show the effect of the previous step
+   uint64_t period = currtime - m_ullLastSndTuneTime;
+   if (period < (uint64_t)(m_iRTT + m_iSYNInterval) * m_ullCPUFrequency)
+      return;
+
+   // what got acknowledged in that time, scaled to one RTT
+   int acked = CSeqNo::seqoff(m_iSndTuneAck, m_iSndLastDataAck);
+   m_iSndBDP = (int)(acked * (uint64_t)(m_iRTT + m_iSYNInterval) * m_ullCPUFrequency / period);
+   m_ullLastSndTuneTime = currtime;
+   m_iSndTuneAck = m_iSndLastDataAck;
+
+   // a window in flight and one for the application to fill in the meantime; while the buffer
+   // is what limits the rate, this doubles it every RTT
+   int64_t target = 2 * (int64_t)m_iSndBDP;
+   if (target > m_iMaxSndBufSize)
+      target = m_iMaxSndBufSize;
+   if (target > m_iSndBufSize)
+      m_iSndBufSize = (int)target;
+}
+
+void CUDT::tuneRcvBuffer(uint64_t currtime)
+{
+   if ((m_llBufLimit <= 0) || (m_iRcvBufSize >= m_iMaxBufSize))
+      return;
+
+   uint64_t period = currtime - m_ullLastRcvTuneTime;
+   if (period < (uint64_t)(m_iRTT + m_iSYNInterval) * m_ullCPUFrequency)
+      return;
+
+   // what arrived in that time, scaled to one RTT; the flow window follows the buffer,
+   // the sender learns the new size from the ACK that is being prepared
+   m_iRcvBDP = (int)((m_llRecvTotal - m_llRcvTuneRecv) * (uint64_t)(m_iRTT + m_iSYNInterval) * m_ullCPUFrequency / period);
+   m_ullLastRcvTuneTime = currtime;
+   m_llRcvTuneRecv = m_llRecvTotal;
+
+   int64_t target = 2 * (int64_t)m_iRcvBDP;
+   if (target > m_iMaxBufSize)
+      target = m_iMaxBufSize;
+
+   // the units themselves come from the shared unit queue, which grows as they are used
+   if ((target > m_iRcvBufSize) && (0 == m_pRcvBuffer->resize((int)target)))
+      m_iRcvBufSize = (int)target;
+}
+
 void CUDT::initSynch()
 {
    #ifndef WIN32
@@ -1671,6 +2216,7 @@ void CUDT::initSynch()
       pthread_mutex_init(&m_SendLock, NULL);
       pthread_mutex_init(&m_RecvLock, NULL);
       pthread_mutex_init(&m_AckLock, NULL);
+      pthread_mutex_init(&m_CCLock, NULL);
       pthread_mutex_init(&m_ConnectionLock, NULL);
    #else
       m_SendBlockLock = CreateMutex(NULL, false, NULL);
@@ -1680,6 +2226,7 @@ void CUDT::initSynch()
       m_SendLock = CreateMutex(NULL, false, NULL);
       m_RecvLock = CreateMutex(NULL, false, NULL);
       m_AckLock = CreateMutex(NULL, false, NULL);
+      m_CCLock = CreateMutex(NULL, false, NULL);
       m_ConnectionLock = CreateMutex(NULL, false, NULL);
    #endif
 }
@@ -1694,6 +2241,7 @@ void CUDT::destroySynch()
       pthread_mutex_destroy(&m_SendLock);
       pthread_mutex_destroy(&m_RecvLock);
       pthread_mutex_destroy(&m_AckLock);
+      pthread_mutex_destroy(&m_CCLock);
       pthread_mutex_destroy(&m_ConnectionLock);
    #else
       CloseHandle(m_SendBlockLock);
@@ -1703,6 +2251,7 @@ void CUDT::destroySynch()
       CloseHandle(m_SendLock);
       CloseHandle(m_RecvLock);
       CloseHandle(m_AckLock);
+      CloseHandle(m_CCLock);
       CloseHandle(m_ConnectionLock);
    #endif
 }
@@ -1802,12 +2351,13 @@ void CUDT::sendCtrl(int pkttype, void* lparam, void* rparam, int size)
       // Send out the ACK only if has not been received by the sender before
       if (CSeqNo::seqcmp(m_iRcvLastAck, m_iRcvLastAckAck) > 0)
       {
-         int32_t data[6];
+         int32_t data[7];
 
          m_iAckSeqNo = CAckNo::incack(m_iAckSeqNo);
          data[0] = m_iRcvLastAck;
          data[1] = m_iRTT;
          data[2] = m_iRTTVar;
+         tuneRcvBuffer(currtime);
          data[3] = m_pRcvBuffer->getAvailBufSize();
          // a minimum flow window of 2 is used, even if buffer is full, to break potential deadlock
          if (data[3] < 2)
@@ -1817,7 +2367,9 @@ void CUDT::sendCtrl(int pkttype, void* lparam, void* rparam, int size)
          {
             data[4] = m_pRcvTimeWindow->getPktRcvSpeed();
             data[5] = m_pRcvTimeWindow->getBandwidth();
-            ctrlpkt.pack(pkttype, &m_iAckSeqNo, data, 24);
+            // an extra field for senders that want an RTT sample rather than the average; others don't read it
+            data[6] = m_iRTTSample;
+            ctrlpkt.pack(pkttype, &m_iAckSeqNo, data, 28);
 
             CTimer::rdtsc(m_ullLastAckTime);
          }
@@ -2035,6 +2587,8 @@ void CUDT::processCtrl(CPacket& ctrlpkt)
 
       CGuard::leaveCS(m_AckLock);
 
+      tuneSndBuffer(currtime);
+
       #ifndef WIN32
          pthread_mutex_lock(&m_SendBlockLock);
          if (m_bSynSending)
@@ -2073,6 +2627,10 @@ void CUDT::processCtrl(CPacket& ctrlpkt)
          m_pCC->setBandwidth(m_iBandwidth);
       }
 
+      // the unsmoothed values in this ACK, if it has them
+      m_pCC->setSamples((ctrlpkt.getLength() > 24) ? *((int32_t *)ctrlpkt.m_pcData + 6) : 0,
+                        (ctrlpkt.getLength() > 16) ? *((int32_t *)ctrlpkt.m_pcData + 4) : 0);
+
       m_pCC->onACK(ack);
       CCUpdate();
 
@@ -2091,6 +2649,7 @@ void CUDT::processCtrl(CPacket& ctrlpkt)
       rtt = m_pACKWindow->acknowledge(ctrlpkt.getAckSeqNo(), ack);
       if (rtt <= 0)
          break;
+      m_iRTTSample = rtt;
 
       //if increasing delay detected...
       //   sendCtrl(4);
@@ -2318,7 +2877,6 @@ int CUDT::packData(CPacket& packet, uint64_t& ts)
          if (0 != (payload = m_pSndBuffer->readData(&(packet.m_pcData), packet.m_iMsgNo)))
          {
             m_iSndCurrSeqNo = CSeqNo::incseq(m_iSndCurrSeqNo);
-            m_pCC->setSndCurrSeqNo(m_iSndCurrSeqNo);
 
             packet.m_iSeqNo = m_iSndCurrSeqNo;
 
@@ -2347,7 +2905,10 @@ int CUDT::packData(CPacket& packet, uint64_t& ts)
    packet.m_iID = m_PeerID;
    packet.setLength(payload);
 
+   CGuard::enterCS(m_CCLock);
+   m_pCC->setSndCurrSeqNo(m_iSndCurrSeqNo);
    m_pCC->onPktSent(&packet);
+   CGuard::leaveCS(m_CCLock);
    //m_pSndTimeWindow->onPktSent(packet.m_iTimeStamp);
 
    ++ m_llTraceSent;
@@ -2452,7 +3013,8 @@ int CUDT::listen(sockaddr* addr, CPacket& packet)
    if (m_bClosing)
       return 1002;
 
-   if (packet.getLength() != CHandShake::m_iContentSize)
+   // requests may be padded to probe the path MTU
+   if (packet.getLength() < CHandShake::m_iContentSize)
       return 1004;
 
    CHandShake hs;
@@ -2532,6 +3094,18 @@ int CUDT::listen(sockaddr* addr, CPacket& packet)
 
 void CUDT::checkTimers()
 {
+   // a CC set on the established connection, see setupCC()
+   if (NULL != m_pNewCC)
+   {
+      CGuard::enterCS(m_CCLock);
+      CCC* cc = m_pNewCC;
+      m_pNewCC = NULL;
+      CGuard::leaveCS(m_CCLock);
+
+      if (NULL != cc)
+         installCC(cc);
+   }
+
    // update CC parameters
    CCUpdate();
    //uint64_t minint = (uint64_t)(m_ullCPUFrequency * m_pSndTimeWindow->getMinPktSndInt() * 0.9);
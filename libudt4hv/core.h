@@ -93,8 +93,17 @@ public: //API
    static int recv(UDTSOCKET u, char* buf, int len, int flags);
    static int sendmsg(UDTSOCKET u, const char* buf, int len, int ttl = -1, bool inorder = false);
    static int recvmsg(UDTSOCKET u, char* buf, int len);
+   static int sendref(UDTSOCKET u, const char* buf, int len, UDT_RELEASE_FN release, void* ctx);
+#ifndef WIN32
+   static int recvref(UDTSOCKET u, iovec* iov, int iovcnt);
+   static int recvrelease(UDTSOCKET u, int len);
+#endif
    static int64_t sendfile(UDTSOCKET u, std::fstream& ifs, int64_t& offset, int64_t size, int block = 364000);
    static int64_t recvfile(UDTSOCKET u, std::fstream& ofs, int64_t& offset, int64_t size, int block = 7280000);
+#ifndef WIN32
+   static int64_t sendfile(UDTSOCKET u, int fd, int64_t& offset, int64_t size, int block = 364000);
+   static int64_t recvfile(UDTSOCKET u, int fd, int64_t& offset, int64_t size, int block = 7280000);
+#endif
    static int select(int nfds, ud_set* readfds, ud_set* writefds, ud_set* exceptfds, const timeval* timeout);
    static int selectEx(const std::vector<UDTSOCKET>& fds, std::vector<UDTSOCKET>* readfds, std::vector<UDTSOCKET>* writefds, std::vector<UDTSOCKET>* exceptfds, int64_t msTimeOut);
    static int epoll_create();
@@ -187,6 +196,59 @@ private:
 
    int recv(char* data, int len);
 
+      // Functionality:
+      //    Like send(), but the data is not copied: UDT sends it straight from "data".
+      // Parameters:
+      //    0) [in] data: The address of the application data to be sent, valid until "release" is called.
+      //    1) [in] len: The size of the data block.
+      //    2) [in] release: called exactly once, when UDT does not refer to any of the data anymore.
+      //    3) [in] ctx: passed on to "release".
+      // Returned value:
+      //    Actual size of data queued; blocking sockets queue all of it unless the connection fails.
+
+   int sendref(const char* data, int len, UDT_RELEASE_FN release, void* ctx);
+
+#ifndef WIN32
+      // Functionality:
+      //    Point the caller at received data, in place. The data stays put until recvrelease().
+      // Parameters:
+      //    0) [out] iov: spans of received data, in order.
+      //    1) [in] iovcnt: maximum number of spans.
+      // Returned value:
+      //    Number of spans filled in.
+
+   int recvref(iovec* iov, int iovcnt);
+
+      // Functionality:
+      //    Consume data previously obtained through recvref().
+      // Parameters:
+      //    0) [in] len: The size of data consumed.
+      // Returned value:
+      //    Actual size of data consumed.
+
+   int recvrelease(int len);
+#endif
+
+      // Functionality:
+      //    Queue (part of) a data block, waiting for space in the sending buffer if need be.
+      // Parameters:
+      //    0) [in] data: The address of the application data to be sent.
+      //    1) [in] len: The size of the data block.
+      //    2) [in] ref: if not NULL, the data is referred to instead of copied.
+      // Returned value:
+      //    Actual size of data queued.
+
+   int sendBuffer(const char* data, int len, CSndBuffer::Reference* ref);
+
+      // Functionality:
+      //    Wait until there is data to read, according to the socket's blocking mode and time-out.
+      // Parameters:
+      //    None.
+      // Returned value:
+      //    None.
+
+   void waitForData();
+
       // Functionality:
       //    send a message of a memory block "data" with size of "len".
       // Parameters:
@@ -233,6 +295,32 @@ private:
 
    int64_t recvfile(std::fstream& ofs, int64_t& offset, int64_t size, int block = 7320000);
 
+#ifndef WIN32
+      // Functionality:
+      //    Like sendfile() above, but pread(2) straight from the file descriptor "fd" into the sending buffer.
+      // Parameters:
+      //    0) [in] fd: The file descriptor, its file position is not used nor changed.
+      //    1) [in, out] offset: From where to read and send data; output is the new offset when the call returns.
+      //    2) [in] size: How many data to be sent.
+      //    3) [in] block: size of block per read from disk
+      // Returned value:
+      //    Actual size of data sent.
+
+   int64_t sendfile(int fd, int64_t& offset, int64_t size, int block = 366000);
+
+      // Functionality:
+      //    Like recvfile() above, but pwritev(2) straight from the received packets into "fd".
+      // Parameters:
+      //    0) [in] fd: The file descriptor, its file position is not used nor changed.
+      //    1) [in, out] offset: From where to write data; output is the new offset when the call returns.
+      //    2) [in] size: How many data to be received.
+      //    3) [in] block: size of block per write to disk
+      // Returned value:
+      //    Actual size of data received.
+
+   int64_t recvfile(int fd, int64_t& offset, int64_t size, int block = 7320000);
+#endif
+
       // Functionality:
       //    Configure UDT options.
       // Parameters:
@@ -298,10 +386,15 @@ private: // Options
    int m_iRcvTimeOut;                           // receiving timeout in milliseconds
    bool m_bReuseAddr;				// reuse an exiting port or not, for UDP multiplexer
    int64_t m_llMaxBW;				// maximum data transfer rate (threshold)
+   int m_iPacingSpin;				// busy-wait window of the multiplexer's sending timer, microseconds (-1: compiled-in timer)
+   int m_iShards;				// number of sending/receiving queue pairs of the multiplexer
+   int64_t m_llBufLimit;			// upper bound for auto-tuning the buffers, in bytes (0: no auto-tuning)
+   bool m_bPMTUD;				// path MTU discovery: don't fragment, probe with full sized connection requests
 
 private: // congestion control
    CCCVirtualFactory* m_pCCFactory;             // Factory class to create a specific CC instance
    CCC* m_pCC;                                  // congestion control class
+   CCC* volatile m_pNewCC;                      // replacement for m_pCC, installed by the receiving thread
    CCache<CInfoBlock>* m_pCache;		// network information cache
 
 private: // Status
@@ -319,6 +412,7 @@ private: // Status
    int m_iBandwidth;                            // Estimated bandwidth, number of packets per second
    int m_iRTT;                                  // RTT, in microseconds
    int m_iRTTVar;                               // RTT variance
+   int m_iRTTSample;                            // Last RTT measured from an ACK2, not smoothed; 0 if none yet
    int m_iDeliveryRate;				// Packet arrival rate at the receiver side
 
    uint64_t m_ullLingerExpiration;		// Linger expiration time (for GC to close a socket with data in sending buffer)
@@ -326,10 +420,11 @@ private: // Status
    CHandShake m_ConnReq;			// connection request
    CHandShake m_ConnRes;			// connection response
    int64_t m_llLastReqTime;			// last time when a connection request is sent
+   int m_iConnProbes;				// unanswered requests of the current size (-1: size confirmed, -2: not probing)
 
 private: // Sending related data
    CSndBuffer* m_pSndBuffer;                    // Sender buffer
-   CSndLossList* m_pSndLossList;                // Sender loss list
+   CSndLoss* m_pSndLossList;                    // Sender loss list
    CPktTimeWindow* m_pSndTimeWindow;            // Packet sending time window
 
    volatile uint64_t m_ullInterval;             // Inter-packet time, in CPU clock cycles
@@ -347,11 +442,13 @@ private: // Sending related data
 
    int32_t m_iISN;                              // Initial Sequence Number
 
+   void setupCC();
+   void installCC(CCC* cc);
    void CCUpdate();
 
 private: // Receiving related data
    CRcvBuffer* m_pRcvBuffer;                    // Receiver buffer
-   CRcvLossList* m_pRcvLossList;                // Receiver loss list
+   CRcvLoss* m_pRcvLossList;                    // Receiver loss list
    CACKWindow* m_pACKWindow;                    // ACK history window
    CPktTimeWindow* m_pRcvTimeWindow;            // Packet arrival time window
 
@@ -365,6 +462,41 @@ private: // Receiving related data
 
    int32_t m_iPeerISN;                          // Initial Sequence Number of the peer side
 
+private: // Buffer auto-tuning
+   int m_iMaxBufSize;				// upper bound for m_iRcvBufSize, in packets
+   int m_iMaxSndBufSize;			// upper bound for m_iSndBufSize, in packets
+   uint64_t m_ullLastSndTuneTime;		// last time the sender buffer size was reconsidered, in CPU clock cycles
+   int32_t m_iSndTuneAck;			// m_iSndLastDataAck at that time
+   int m_iSndBDP;				// bandwidth-delay product seen by the sender, in packets
+   uint64_t m_ullLastRcvTuneTime;		// last time the receiver buffer size was reconsidered, in CPU clock cycles
+   int64_t m_llRcvTuneRecv;			// m_llRecvTotal at that time
+   int m_iRcvBDP;				// bandwidth-delay product seen by the receiver, in packets
+
+   void setupBufLimit();
+
+      // Functionality:
+      //    Change the MSS, keeping the sizes of the buffers and flight window in bytes.
+      // Parameters:
+      //    0) [in] mss: the new MSS.
+      // Returned value:
+      //    None.
+
+   void setupMSS(int mss);
+
+      // Functionality:
+      //    Send (again) the connection request to the peer. With path MTU discovery
+      //    the request is padded to the MSS it proposes, and the MSS is lowered step by
+      //    step while the requests go unanswered.
+      // Parameters:
+      //    None.
+      // Returned value:
+      //    None.
+
+   void sendConnReq();
+   void initBufTuning();
+   void tuneSndBuffer(uint64_t currtime);
+   void tuneRcvBuffer(uint64_t currtime);
+
 private: // synchronization: mutexes and conditions
    pthread_mutex_t m_ConnectionLock;            // used to synchronize connection operation
 
@@ -373,6 +505,8 @@ private: // synchronization: mutexes and conditions
 
    pthread_mutex_t m_AckLock;                   // used to protected sender's loss list when processing ACK
 
+   pthread_mutex_t m_CCLock;                    // used to replace m_pCC while the sending thread or an API call uses it
+
    pthread_cond_t m_RecvDataCond;               // used to block "recv" when there is no data
    pthread_mutex_t m_RecvDataLock;              // lock associated to m_RecvDataCond
 
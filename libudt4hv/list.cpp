@@ -630,15 +630,18 @@ bool CRcvLossList::remove(int32_t seqno)
 
 bool CRcvLossList::remove(int32_t seqno1, int32_t seqno2)
 {
+   // the loops stop before the last one: ++ would overflow past m_iMaxSeqNo
    if (seqno1 <= seqno2)
    {
-      for (int32_t i = seqno1; i <= seqno2; ++ i)
+      for (int32_t i = seqno1; i < seqno2; ++ i)
          remove(i);
+      remove(seqno2);
    }
    else
    {
       for (int32_t j = seqno1; j < CSeqNo::m_iMaxSeqNo; ++ j)
          remove(j);
+      remove(CSeqNo::m_iMaxSeqNo);
       for (int32_t k = 0; k <= seqno2; ++ k)
          remove(k);
    }
@@ -701,3 +704,377 @@ void CRcvLossList::getLossArray(int32_t* array, int& len, int limit)
       i = m_piNext[i];
    }
 }
+
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef WIN32
+   static inline int popcount64(uint64_t x) {return __builtin_popcountll(x);}
+   static inline int ctz64(uint64_t x) {return __builtin_ctzll(x);}
+#else
+   static inline int popcount64(uint64_t x) {int n = 0; for (; 0 != x; x &= x - 1) ++ n; return n;}
+   static inline int ctz64(uint64_t x) {int n = 0; for (; 0 == (x & 1); x >>= 1) ++ n; return n;}
+#endif
+
+// the bits [b, b + k) of a word, 0 < k <= 64 - b
+static inline uint64_t bitmask(int b, int k)
+{
+   return ((64 == k) ? ~0ULL : ((1ULL << k) - 1)) << b;
+}
+
+CLossBitmap::CLossBitmap(int size):
+m_pullBits(NULL),
+m_pullWords(NULL),
+m_iSize(64 * 64),
+m_iMask(),
+m_iWords(),
+m_iSummary(),
+m_iLength(0),
+m_iFirst(-1),
+m_iLast(-1)
+{
+   // a power of 2 keeps the bit positions in order across the seq. no. wrap-around
+   while (m_iSize < size)
+      m_iSize <<= 1;
+
+   m_iMask = m_iSize - 1;
+   m_iWords = m_iSize / 64;
+   m_iSummary = m_iWords / 64;
+
+   m_pullBits = new uint64_t [m_iWords];
+   m_pullWords = new uint64_t [m_iSummary];
+
+   for (int i = 0; i < m_iWords; ++ i)
+      m_pullBits[i] = 0;
+   for (int j = 0; j < m_iSummary; ++ j)
+      m_pullWords[j] = 0;
+}
+
+CLossBitmap::~CLossBitmap()
+{
+   delete [] m_pullBits;
+   delete [] m_pullWords;
+}
+
+int CLossBitmap::insert(int32_t seqno1, int32_t seqno2)
+{
+   if (0 == m_iLength)
+   {
+      if (CSeqNo::seqlen(seqno1, seqno2) > m_iSize)
+         seqno2 = CSeqNo::incseq(seqno1, m_iSize - 1);
+
+      m_iLength = setBits(seqno1 & m_iMask, CSeqNo::seqlen(seqno1, seqno2));
+      m_iFirst = seqno1;
+      m_iLast = seqno2;
+
+      return m_iLength;
+   }
+
+   // everything must fit in the window
+   if (CSeqNo::seqoff(seqno1, m_iLast) >= m_iSize)
+      return 0;
+
+   int32_t lo = (CSeqNo::seqcmp(seqno1, m_iFirst) < 0) ? seqno1 : m_iFirst;
+   if (CSeqNo::seqoff(lo, seqno2) >= m_iSize)
+      seqno2 = CSeqNo::incseq(lo, m_iSize - 1);
+   if (CSeqNo::seqcmp(seqno2, seqno1) < 0)
+      return 0;
+
+   int added = setBits(seqno1 & m_iMask, CSeqNo::seqlen(seqno1, seqno2));
+
+   m_iLength += added;
+   m_iFirst = lo;
+   if (CSeqNo::seqcmp(seqno2, m_iLast) > 0)
+      m_iLast = seqno2;
+
+   return added;
+}
+
+bool CLossBitmap::remove(int32_t seqno)
+{
+   return removeRange(seqno, seqno) > 0;
+}
+
+bool CLossBitmap::remove(int32_t seqno1, int32_t seqno2)
+{
+   return removeRange(seqno1, seqno2) > 0;
+}
+
+bool CLossBitmap::find(int32_t seqno1, int32_t seqno2) const
+{
+   if (0 == m_iLength)
+      return false;
+
+   if (CSeqNo::seqcmp(seqno1, m_iFirst) < 0)
+      seqno1 = m_iFirst;
+   if (CSeqNo::seqcmp(seqno2, m_iLast) > 0)
+      seqno2 = m_iLast;
+   if (CSeqNo::seqcmp(seqno1, seqno2) > 0)
+      return false;
+
+   return nextSet(seqno1 & m_iMask, CSeqNo::seqlen(seqno1, seqno2)) >= 0;
+}
+
+int CLossBitmap::getLossLength() const
+{
+   return m_iLength;
+}
+
+int CLossBitmap::getFirstLostSeq() const
+{
+   if (0 == m_iLength)
+      return -1;
+
+   return m_iFirst;
+}
+
+void CLossBitmap::getLossArray(int32_t* array, int& len, int limit) const
+{
+   len = 0;
+
+   if (0 == m_iLength)
+      return;
+
+   int32_t seqno = m_iFirst;
+   int left = CSeqNo::seqlen(m_iFirst, m_iLast);
+
+   while ((len < limit - 1) && (left > 0))
+   {
+      int off = nextSet(seqno & m_iMask, left);
+      if (off < 0)
+         break;
+
+      seqno = CSeqNo::incseq(seqno, off);
+      left -= off;
+
+      // the run of losses starting here
+      int run = nextClear(seqno & m_iMask, left);
+
+      array[len] = seqno;
+      if (run > 1)
+      {
+         // there are more than 1 loss in the sequence
+         array[len] |= 0x80000000;
+         ++ len;
+         array[len] = CSeqNo::incseq(seqno, run - 1);
+      }
+
+      ++ len;
+
+      seqno = CSeqNo::incseq(seqno, run);
+      left -= run;
+   }
+}
+
+int CLossBitmap::removeRange(int32_t seqno1, int32_t seqno2)
+{
+   if (0 == m_iLength)
+      return 0;
+
+   if (CSeqNo::seqcmp(seqno1, m_iFirst) < 0)
+      seqno1 = m_iFirst;
+   if (CSeqNo::seqcmp(seqno2, m_iLast) > 0)
+      seqno2 = m_iLast;
+   if (CSeqNo::seqcmp(seqno1, seqno2) > 0)
+      return 0;
+
+   int removed = clearBits(seqno1 & m_iMask, CSeqNo::seqlen(seqno1, seqno2));
+
+   m_iLength -= removed;
+
+   if ((m_iLength > 0) && (seqno1 == m_iFirst))
+   {
+      // the first loss is now after seqno2
+      int32_t next = CSeqNo::incseq(seqno2);
+      m_iFirst = CSeqNo::incseq(next, nextSet(next & m_iMask, CSeqNo::seqlen(next, m_iLast)));
+   }
+
+   return removed;
+}
+
+int CLossBitmap::setBits(int pos, int n)
+{
+   int added = 0;
+
+   while (n > 0)
+   {
+      int w = pos >> 6;
+      int b = pos & 63;
+      int k = (64 - b < n) ? 64 - b : n;
+      uint64_t m = bitmask(b, k);
+
+      added += popcount64(m & ~m_pullBits[w]);
+      m_pullBits[w] |= m;
+      m_pullWords[w >> 6] |= 1ULL << (w & 63);
+
+      pos = (pos + k) & m_iMask;
+      n -= k;
+   }
+
+   return added;
+}
+
+int CLossBitmap::clearBits(int pos, int n)
+{
+   int removed = 0;
+
+   while (n > 0)
+   {
+      int w = pos >> 6;
+      int b = pos & 63;
+      int k = (64 - b < n) ? 64 - b : n;
+      uint64_t m = bitmask(b, k);
+
+      if (0 != (m_pullBits[w] & m))
+      {
+         removed += popcount64(m & m_pullBits[w]);
+         m_pullBits[w] &= ~m;
+         if (0 == m_pullBits[w])
+            m_pullWords[w >> 6] &= ~(1ULL << (w & 63));
+      }
+
+      pos = (pos + k) & m_iMask;
+      n -= k;
+   }
+
+   return removed;
+}
+
+int CLossBitmap::nextSet(int pos, int n) const
+{
+   // in the first word
+   uint64_t x = m_pullBits[pos >> 6] & (~0ULL << (pos & 63));
+   int off;
+
+   if (0 != x)
+      off = ((pos & ~63) + ctz64(x)) - pos;
+   else
+   {
+      // the next word with bits set; mind the wrap-around
+      int w = nextWord(((pos >> 6) + 1) % m_iWords);
+      if (w < 0)
+      {
+         // only the bits before "pos" in its own word are left
+         x = m_pullBits[pos >> 6];
+         if (0 == x)
+            return -1;
+         w = pos >> 6;
+      }
+      off = (((w << 6) + ctz64(m_pullBits[w])) - pos) & m_iMask;
+   }
+
+   return (off < n) ? off : -1;
+}
+
+int CLossBitmap::nextClear(int pos, int n) const
+{
+   int off = 0;
+
+   while (off < n)
+   {
+      int b = pos & 63;
+      uint64_t x = ~m_pullBits[pos >> 6] & (~0ULL << b);
+
+      if (0 != x)
+      {
+         off += ctz64(x) - b;
+         break;
+      }
+
+      off += 64 - b;
+      pos = (pos + 64 - b) & m_iMask;
+   }
+
+   return (off < n) ? off : n;
+}
+
+int CLossBitmap::nextWord(int word) const
+{
+   int s = word >> 6;
+   uint64_t x = m_pullWords[s] & (~0ULL << (word & 63));
+
+   for (int i = 0; i <= m_iSummary; ++ i)
+   {
+      if (0 != x)
+      {
+         int w = (s << 6) + ctz64(x);
+         // the last round revisits the first summary word, its bits from "word" on were seen
+         return ((i == m_iSummary) && (w >= word)) ? -1 : w;
+      }
+
+      s = (s + 1) % m_iSummary;
+      x = m_pullWords[s];
+   }
+
+   return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+CSndLossBitmap::CSndLossBitmap(int size):
+m_Bitmap(size),
+m_iLength(0),
+m_ListLock()
+{
+   // sender list needs mutex protection
+   #ifndef WIN32
+      pthread_mutex_init(&m_ListLock, 0);
+   #else
+      m_ListLock = CreateMutex(NULL, false, NULL);
+   #endif
+}
+
+CSndLossBitmap::~CSndLossBitmap()
+{
+   #ifndef WIN32
+      pthread_mutex_destroy(&m_ListLock);
+   #else
+      CloseHandle(m_ListLock);
+   #endif
+}
+
+int CSndLossBitmap::insert(int32_t seqno1, int32_t seqno2)
+{
+   CGuard listguard(m_ListLock);
+
+   int added = m_Bitmap.insert(seqno1, seqno2);
+   m_iLength = m_Bitmap.getLossLength();
+
+   return added;
+}
+
+void CSndLossBitmap::remove(int32_t seqno)
+{
+   CGuard listguard(m_ListLock);
+
+   int32_t first = m_Bitmap.getFirstLostSeq();
+   if ((first < 0) || (CSeqNo::seqcmp(seqno, first) < 0))
+      return;
+
+   m_Bitmap.remove(first, seqno);
+   m_iLength = m_Bitmap.getLossLength();
+}
+
+int CSndLossBitmap::getLossLength()
+{
+   CGuard listguard(m_ListLock);
+
+   return m_iLength;
+}
+
+int32_t CSndLossBitmap::getLostSeq()
+{
+   // packData() asks for every packet, mostly there is nothing
+   if (0 == m_iLength)
+      return -1;
+
+   CGuard listguard(m_ListLock);
+
+   int32_t seqno = m_Bitmap.getFirstLostSeq();
+   if (seqno >= 0)
+   {
+      m_Bitmap.remove(seqno);
+      m_iLength = m_Bitmap.getLossLength();
+   }
+
+   return seqno;
+}
@@ -198,5 +198,186 @@ private:
    CRcvLossList& operator=(const CRcvLossList&);
 };
 
+////////////////////////////////////////////////////////////////////////////////
+
+// Loss list as a bitmap over a window of sequence numbers, one bit per packet,
+// with a second level bitmap of the words that have bits set. Inserting and
+// removing cost a bit per packet, finding the next loss is a few word scans:
+// nothing depends on how many loss ranges there are, unlike the linked lists above.
+// It has the receiver loss list's interface.
+
+class CLossBitmap
+{
+public:
+   CLossBitmap(int size = 1024);
+   ~CLossBitmap();
+
+      // Functionality:
+      //    Insert a series of loss seq. no. between "seqno1" and "seqno2".
+      //    Everything in the list must stay within "size" of each other; what doesn't is left out.
+      // Parameters:
+      //    0) [in] seqno1: sequence number starts.
+      //    1) [in] seqno2: seqeunce number ends.
+      // Returned value:
+      //    number of packets that are not in the list previously.
+
+   int insert(int32_t seqno1, int32_t seqno2);
+
+      // Functionality:
+      //    Remove a loss seq. no. from the list.
+      // Parameters:
+      //    0) [in] seqno: sequence number.
+      // Returned value:
+      //    if the packet is removed (true) or no such lost packet is found (false).
+
+   bool remove(int32_t seqno);
+
+      // Functionality:
+      //    Remove all packets between seqno1 and seqno2.
+      // Parameters:
+      //    0) [in] seqno1: start sequence number.
+      //    1) [in] seqno2: end sequence number.
+      // Returned value:
+      //    if any packet was removed.
+
+   bool remove(int32_t seqno1, int32_t seqno2);
+
+      // Functionality:
+      //    Find if there is any lost packets whose sequence number falling seqno1 and seqno2.
+      // Parameters:
+      //    0) [in] seqno1: start sequence number.
+      //    1) [in] seqno2: end sequence number.
+      // Returned value:
+      //    True if found; otherwise false.
+
+   bool find(int32_t seqno1, int32_t seqno2) const;
+
+      // Functionality:
+      //    Read the loss length.
+      // Parameters:
+      //    None.
+      // Returned value:
+      //    the length of the list.
+
+   int getLossLength() const;
+
+      // Functionality:
+      //    Read the first (smallest) seq. no. in the list.
+      // Parameters:
+      //    None.
+      // Returned value:
+      //    the sequence number or -1 if the list is empty.
+
+   int getFirstLostSeq() const;
+
+      // Functionality:
+      //    Get a encoded loss array for NAK report.
+      // Parameters:
+      //    0) [out] array: the result list of seq. no. to be included in NAK.
+      //    1) [out] physical length of the result array.
+      //    2) [in] limit: maximum length of the array.
+      // Returned value:
+      //    None.
+
+   void getLossArray(int32_t* array, int& len, int limit) const;
+
+private:
+   int removeRange(int32_t seqno1, int32_t seqno2);
+
+   // bit operations on "n" bits from bit "pos" on, wrapping around at the end
+   int setBits(int pos, int n);
+   int clearBits(int pos, int n);
+   int nextSet(int pos, int n) const;     // offset of the first bit set, -1 if none
+   int nextClear(int pos, int n) const;   // offset of the first bit clear, n if none
+   int nextWord(int word) const;          // first word from "word" on with bits set, -1 if none
+
+private:
+   uint64_t* m_pullBits;                // one bit per sequence number (seq. no. & m_iMask)
+   uint64_t* m_pullWords;               // one bit per word of m_pullBits that is not 0
+
+   int m_iSize;                         // number of bits, a power of 2
+   int m_iMask;                         // m_iSize - 1
+   int m_iWords;                        // number of words in m_pullBits
+   int m_iSummary;                      // number of words in m_pullWords
+
+   int m_iLength;                       // loss length
+   int32_t m_iFirst;                    // smallest seq. no. in the list
+   int32_t m_iLast;                     // no seq. no. in the list is larger than this
+
+private:
+   CLossBitmap(const CLossBitmap&);
+   CLossBitmap& operator=(const CLossBitmap&);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// CLossBitmap with the sender loss list's interface and locking
+
+class CSndLossBitmap
+{
+public:
+   CSndLossBitmap(int size = 1024);
+   ~CSndLossBitmap();
+
+      // Functionality:
+      //    Insert a seq. no. into the sender loss list.
+      // Parameters:
+      //    0) [in] seqno1: sequence number starts.
+      //    1) [in] seqno2: sequence number ends.
+      // Returned value:
+      //    number of packets that are not in the list previously.
+
+   int insert(int32_t seqno1, int32_t seqno2);
+
+      // Functionality:
+      //    Remove ALL the seq. no. that are not greater than the parameter.
+      // Parameters:
+      //    0) [in] seqno: sequence number.
+      // Returned value:
+      //    None.
+
+   void remove(int32_t seqno);
+
+      // Functionality:
+      //    Read the loss length.
+      // Parameters:
+      //    None.
+      // Returned value:
+      //    The length of the list.
+
+   int getLossLength();
+
+      // Functionality:
+      //    Read the first (smallest) loss seq. no. in the list and remove it.
+      // Parameters:
+      //    None.
+      // Returned value:
+      //    The seq. no. or -1 if the list is empty.
+
+   int32_t getLostSeq();
+
+private:
+   CLossBitmap m_Bitmap;                // the losses
+   volatile int m_iLength;              // their number, for checking without the lock
+
+   pthread_mutex_t m_ListLock;          // used to synchronize list operation
+
+private:
+   CSndLossBitmap(const CSndLossBitmap&);
+   CSndLossBitmap& operator=(const CSndLossBitmap&);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+
+// The loss lists CUDT uses: the bitmaps, or the linked lists if built with LINKED_LOSS_LISTS
+
+#ifndef LINKED_LOSS_LISTS
+   typedef CSndLossBitmap CSndLoss;
+   typedef CLossBitmap CRcvLoss;
+#else
+   typedef CSndLossList CSndLoss;
+   typedef CRcvLossList CRcvLoss;
+#endif
+
 
 #endif
@@ -197,6 +197,7 @@ void CPacket::pack(int pkttype, void* lparam, void* rparam, int size)
 
       // data ACK seq. no. 
       // optional: RTT (microsends), RTT variance (microseconds) advertised flow window size (packets), and estimated link capacity (packets per second)
+      // full ACKs add the last RTT sample (microseconds); older peers send and read one field less
       m_PacketVector[1].iov_base = (char *)rparam;
       m_PacketVector[1].iov_len = size;
 
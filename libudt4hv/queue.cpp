@@ -46,6 +46,9 @@ written by
    #endif
 #endif
 #include <cstring>
+#ifdef LINUX
+   #include <sys/prctl.h>
+#endif
 
 #include "common.h"
 #include "core.h"
@@ -53,6 +56,19 @@ written by
 
 using namespace std;
 
+#ifndef WIN32
+   template <class T> static inline T atomicLoad(const T& x) {return __atomic_load_n(&x, __ATOMIC_ACQUIRE);}
+   template <class T> static inline void atomicStore(T& x, T v) {__atomic_store_n(&x, v, __ATOMIC_RELEASE);}
+   static inline void atomicAdd(int& x, int v) {__atomic_add_fetch(&x, v, __ATOMIC_SEQ_CST);}
+   static inline void atomicFence() {__atomic_thread_fence(__ATOMIC_SEQ_CST);}
+#else
+   // MSVC gives volatile accesses acquire/release semantics
+   template <class T> static inline T atomicLoad(const T& x) {return *(const volatile T*)&x;}
+   template <class T> static inline void atomicStore(T& x, T v) {*(volatile T*)&x = v;}
+   static inline void atomicAdd(int& x, int v) {InterlockedExchangeAdd((volatile LONG*)&x, v);}
+   static inline void atomicFence() {MemoryBarrier();}
+#endif
+
 CUnitQueue::CUnitQueue():
 m_pQEntry(NULL),
 m_pCurrQueue(NULL),
@@ -149,8 +165,11 @@ int CUnitQueue::increase()
    CUnit* tempu = NULL;
    char* tempb = NULL;
 
-   // all queues have the same size
-   int size = m_pQEntry->m_iSize;
+   // grow by half of what there is, so a large bandwidth-delay product does not take
+   // thousands of increases, each counting all units
+   int size = m_iSize / 2;
+   if (size < m_pQEntry->m_iSize)
+      size = m_pQEntry->m_iSize;
 
    try
    {
@@ -222,6 +241,24 @@ CUnit* CUnitQueue::getNextAvailUnit()
    return NULL;
 }
 
+int CUnitQueue::getNextAvailUnits(CUnit** units, int n)
+{
+   int found = 0;
+
+   while (found < n)
+   {
+      CUnit* unit = getNextAvailUnit();
+      if (NULL == unit)
+         break;
+
+      // make sure the next search won't return the same one
+      unit->m_iFlag = 4;
+      units[found ++] = unit;
+   }
+
+   return found;
+}
+
 
 CSndUList::CSndUList():
 m_pHeap(NULL),
@@ -450,8 +487,17 @@ m_pTimer(NULL),
 m_WindowLock(),
 m_WindowCond(),
 m_bClosing(false),
-m_ExitCond()
+m_ExitCond(),
+m_llBatch(0),
+m_llBatchPkt(0),
+m_llBatchTime(0),
+m_llPaced(0),
+m_llPacingErrTime(0),
+m_llPacingErrMax(0)
 {
+   for (int i = 0; i < 8; ++ i)
+      m_llPacingErrHist[i] = 0;
+
    #ifndef WIN32
       pthread_cond_init(&m_WindowCond, NULL);
       pthread_mutex_init(&m_WindowLock, NULL);
@@ -518,6 +564,21 @@ void CSndQueue::init(CChannel* c, CTimer* t)
 {
    CSndQueue* self = (CSndQueue*)param;
 
+   const int n = CChannel::m_iMaxBatchSize;
+   sockaddr** addr = new sockaddr*[n];
+   CPacket* pkts = new CPacket[n];
+   CPacket** pkt = new CPacket*[n];
+   for (int i = 0; i < n; ++ i)
+      pkt[i] = pkts + i;
+
+   // upper bounds of the pacing error histogram, in microseconds
+   const uint64_t errbound[7] = {1, 2, 5, 10, 20, 50, 100};
+
+   #ifdef LINUX
+      // the timer's sleeps end as close to the requested time as the kernel can do
+      ::prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL);
+   #endif
+
    while (!self->m_bClosing)
    {
       uint64_t ts = self->m_pSndUList->getNextProcTime();
@@ -528,15 +589,44 @@ void CSndQueue::init(CChannel* c, CTimer* t)
          uint64_t currtime;
          CTimer::rdtsc(currtime);
          if (currtime < ts)
+         {
             self->m_pTimer->sleepto(ts);
 
-         // it is time to send the next pkt
-         sockaddr* addr;
-         CPacket pkt;
-         if (self->m_pSndUList->pop(addr, pkt) < 0)
+            // how late are we?
+            CTimer::rdtsc(currtime);
+            if (currtime >= ts)
+            {
+               uint64_t late = currtime - ts;
+               uint64_t us = late / CTimer::getCPUFrequency();
+               int b = 0;
+               while ((b < 7) && (us >= errbound[b]))
+                  ++ b;
+
+               ++ self->m_llPaced;
+               self->m_llPacingErrTime += late;
+               if ((int64_t)late > self->m_llPacingErrMax)
+                  self->m_llPacingErrMax = late;
+               ++ self->m_llPacingErrHist[b];
+            }
+         }
+
+         // it is time to send the next pkt, and all others that are due by now;
+         // pop() won't hand out packets before their time so pacing is kept
+         int due = 0;
+         while ((due < n) && (self->m_pSndUList->pop(addr[due], *pkt[due]) > 0))
+            ++ due;
+
+         if (0 == due)
             continue;
 
-         self->m_pChannel->sendto(addr, pkt);
+         uint64_t t0, t1;
+         CTimer::rdtsc(t0);
+         self->m_pChannel->sendBatch(addr, pkt, due);
+         CTimer::rdtsc(t1);
+
+         ++ self->m_llBatch;
+         self->m_llBatchPkt += due;
+         self->m_llBatchTime += t1 - t0;
       }
       else
       {
@@ -552,6 +642,10 @@ void CSndQueue::init(CChannel* c, CTimer* t)
       }
    }
 
+   delete [] pkt;
+   delete [] pkts;
+   delete [] addr;
+
    #ifndef WIN32
       return NULL;
    #else
@@ -661,90 +755,206 @@ void CRcvUList::update(const CUDT* u)
    m_pLast = n;
 }
 
-//
 CHash::CHash():
-m_pBucket(NULL),
-m_iHashSize(0)
+m_pTable(NULL),
+m_iUsed(0),
+m_iCount(0),
+m_iMinSize(0),
+m_iEpoch(0),
+m_iRetireNo(0),
+m_vRetired()
 {
+   m_aiReaders[0] = m_aiReaders[1] = 0;
+   m_aiQuiet[0] = m_aiQuiet[1] = 0;
 }
 
 CHash::~CHash()
 {
-   for (int i = 0; i < m_iHashSize; ++ i)
-   {
-      CBucket* b = m_pBucket[i];
-      while (NULL != b)
-      {
-         CBucket* n = b->m_pNext;
-         delete b;
-         b = n;
-      }
-   }
+   release(m_pTable);
 
-   delete [] m_pBucket;
+   for (vector<pair<CTable*, int> >::iterator i = m_vRetired.begin(); i != m_vRetired.end(); ++ i)
+      release(i->first);
 }
 
 void CHash::init(int size)
 {
-   m_pBucket = new CBucket* [size];
-
-   for (int i = 0; i < size; ++ i)
-      m_pBucket[i] = NULL;
+   m_iMinSize = 2;
+   while (m_iMinSize < size)
+      m_iMinSize <<= 1;
 
-   m_iHashSize = size;
+   rebuild(m_iMinSize);
 }
 
-CUDT* CHash::lookup(int32_t id)
+CUDT* CHash::lookup(int32_t id) const
 {
-   // simple hash function (% hash table size); suitable for socket descriptors
-   CBucket* b = m_pBucket[id % m_iHashSize];
+   // 0 and -1 mark free slots, socket IDs are positive
+   if (id <= 0)
+      return NULL;
+
+   // announce ourselves before picking up the table, see reclaim()
+   const int e = atomicLoad(m_iEpoch);
+   atomicAdd(m_aiReaders[e], 1);
+   atomicFence();
 
-   while (NULL != b)
+   const CTable* t = atomicLoad(m_pTable);
+   const int mask = (1 << t->m_iBits) - 1;
+   CUDT* u = NULL;
+
+   // there is always a free slot: the table is rebuilt before it gets half full
+   for (int i = home(t, id); ; i = (i + 1) & mask)
    {
-      if (id == b->m_iID)
-         return b->m_pUDT;
-      b = b->m_pNext;
+      const int32_t sid = atomicLoad(t->m_pSlot[i].m_iID);
+
+      if (id == sid)
+      {
+         u = atomicLoad(t->m_pSlot[i].m_pUDT);
+         break;
+      }
+      if (0 == sid)
+         break;
    }
 
-   return NULL;
+   atomicAdd(m_aiReaders[e], -1);
+   return u;
 }
 
 void CHash::insert(int32_t id, CUDT* u)
 {
-   CBucket* b = m_pBucket[id % m_iHashSize];
+   if (!m_vRetired.empty())
+      reclaim();
+
+   CTable* t = m_pTable;
+   int mask = (1 << t->m_iBits) - 1;
+   int i;
+
+   for (i = home(t, id); 0 != t->m_pSlot[i].m_iID; i = (i + 1) & mask)
+   {
+      if (id == t->m_pSlot[i].m_iID)
+      {
+         atomicStore(t->m_pSlot[i].m_pUDT, u);
+         return;
+      }
+   }
 
-   CBucket* n = new CBucket;
-   n->m_iID = id;
-   n->m_pUDT = u;
-   n->m_pNext = b;
+   // Removed slots are not reused, a reader may just have matched the old ID.
+   // They go when the table is rebuilt.
+   if (2 * (m_iUsed + 1) > (1 << t->m_iBits))
+   {
+      int size = m_iMinSize;
+      while (size < 4 * (m_iCount + 1))
+         size <<= 1;
+      rebuild(size);
+
+      t = m_pTable;
+      mask = (1 << t->m_iBits) - 1;
+      for (i = home(t, id); 0 != t->m_pSlot[i].m_iID; i = (i + 1) & mask) {}
+   }
+
+   atomicStore(t->m_pSlot[i].m_pUDT, u);
+   atomicStore(t->m_pSlot[i].m_iID, id);
 
-   m_pBucket[id % m_iHashSize] = n;
+   ++ m_iUsed;
+   ++ m_iCount;
 }
 
 void CHash::remove(int32_t id)
 {
-   CBucket* b = m_pBucket[id % m_iHashSize];
-   CBucket* p = NULL;
+   if (id <= 0)
+      return;
+
+   if (!m_vRetired.empty())
+      reclaim();
 
-   while (NULL != b)
+   CTable* t = m_pTable;
+   const int mask = (1 << t->m_iBits) - 1;
+
+   for (int i = home(t, id); 0 != t->m_pSlot[i].m_iID; i = (i + 1) & mask)
    {
-      if (id == b->m_iID)
+      if (id == t->m_pSlot[i].m_iID)
       {
-         if (NULL == p)
-            m_pBucket[id % m_iHashSize] = b->m_pNext;
-         else
-            p->m_pNext = b->m_pNext;
+         atomicStore(t->m_pSlot[i].m_iID, -1);
+         -- m_iCount;
+         return;
+      }
+   }
+}
 
-         delete b;
+void CHash::rebuild(int size)
+{
+   CTable* t = new CTable;
+   t->m_iBits = 0;
+   while ((1 << t->m_iBits) < size)
+      ++ t->m_iBits;
+   t->m_pSlot = new CSlot[size];
+   memset(t->m_pSlot, 0, size * sizeof(CSlot));
+
+   // the new table is private until it is published
+   m_iUsed = 0;
+   if (NULL != m_pTable)
+   {
+      for (int j = (1 << m_pTable->m_iBits) - 1; j >= 0; -- j)
+      {
+         const CSlot& s = m_pTable->m_pSlot[j];
+         if (s.m_iID <= 0)
+            continue;
 
-         return;
+         int i = home(t, s.m_iID);
+         while (0 != t->m_pSlot[i].m_iID)
+            i = (i + 1) & (size - 1);
+         t->m_pSlot[i] = s;
+         ++ m_iUsed;
       }
+   }
+
+   CTable* old = m_pTable;
+   atomicStore(m_pTable, t);
 
-      p = b;
-      b = b->m_pNext;
+   if (NULL != old)
+   {
+      m_vRetired.push_back(make_pair(old, ++ m_iRetireNo));
+      reclaim();
    }
 }
 
+void CHash::reclaim()
+{
+   // Readers that start from here on see the current table. Readers that
+   // may still be using a retired one counted themselves before this, so
+   // a counter at zero means none of those are left in that parity.
+   atomicFence();
+   for (int p = 0; p < 2; ++ p)
+   {
+      if (0 == atomicLoad(m_aiReaders[p]))
+         m_aiQuiet[p] = m_iRetireNo;
+   }
+
+   const int quiet = (m_aiQuiet[0] < m_aiQuiet[1]) ? m_aiQuiet[0] : m_aiQuiet[1];
+   vector<pair<CTable*, int> >::iterator i = m_vRetired.begin();
+   for (; (i != m_vRetired.end()) && (i->second <= quiet); ++ i)
+      release(i->first);
+   m_vRetired.erase(m_vRetired.begin(), i);
+
+   // send new readers to the other counter such that this one drains
+   if (!m_vRetired.empty())
+      atomicStore(m_iEpoch, m_iEpoch ^ 1);
+}
+
+int CHash::home(const CTable* t, int32_t id)
+{
+   // Fibonacci hashing: IDs are handed out sequentially and, with sharded
+   // multiplexers, a receiving queue gets only every n-th of them
+   return (int)(((uint32_t)id * 2654435761U) >> (32 - t->m_iBits));
+}
+
+void CHash::release(CTable* t)
+{
+   if (NULL == t)
+      return;
+
+   delete [] t->m_pSlot;
+   delete t;
+}
+
 
 //
 CRendezvousQueue::CRendezvousQueue():
@@ -829,6 +1039,13 @@ CUDT* CRendezvousQueue::retrieve(const sockaddr* addr, UDTSOCKET& id)
    return NULL;
 }
 
+bool CRendezvousQueue::empty()
+{
+   CGuard vg(m_RIDVectorLock);
+
+   return m_lRendezvousID.empty();
+}
+
 void CRendezvousQueue::updateConnStatus()
 {
    if (m_lRendezvousID.empty())
@@ -849,17 +1066,10 @@ void CRendezvousQueue::updateConnStatus()
             continue;
          }
 
-         CPacket request;
-         char* reqdata = new char [i->m_pUDT->m_iPayloadSize];
-         request.pack(0, NULL, reqdata, i->m_pUDT->m_iPayloadSize);
-         // ID = 0, connection request
-         request.m_iID = !i->m_pUDT->m_bRendezvous ? 0 : i->m_pUDT->m_ConnRes.m_iID;
-         int hs_size = i->m_pUDT->m_iPayloadSize;
-         i->m_pUDT->m_ConnReq.serialize(reqdata, hs_size);
-         request.setLength(hs_size);
-         i->m_pUDT->m_pSndQueue->sendto(i->m_pPeerAddr, request);
-         i->m_pUDT->m_llLastReqTime = CTimer::getTime();
-         delete [] reqdata;
+         // a synchronous connect() repeats the request itself, and sendConnReq() steps
+         // the MSS probing; only one thread may drive that
+         if (!i->m_pUDT->m_bSynRecving)
+            i->m_pUDT->sendConnReq();
       }
    }
 }
@@ -875,6 +1085,9 @@ m_pTimer(NULL),
 m_iPayloadSize(),
 m_bClosing(false),
 m_ExitCond(),
+m_llBatch(0),
+m_llBatchPkt(0),
+m_llBatchTime(0),
 m_LSLock(),
 m_pListener(NULL),
 m_pRendezvousQueue(NULL),
@@ -901,6 +1114,8 @@ m_PassCond()
 CRcvQueue::~CRcvQueue()
 {
    m_bClosing = true;
+   if (NULL != m_pChannel)
+      m_pChannel->interrupt();
 
    #ifndef WIN32
       if (0 != m_WorkerThread)
@@ -974,16 +1189,17 @@ void CRcvQueue::init(int qsize, int payload, int version, int hsize, CChannel* c
 {
    CRcvQueue* self = (CRcvQueue*)param;
 
-   sockaddr* addr = (AF_INET == self->m_UnitQueue.m_iIPversion) ? (sockaddr*) new sockaddr_in : (sockaddr*) new sockaddr_in6;
-   CUDT* u = NULL;
-   int32_t id;
+   // room for a batch of incoming packets; sockaddr_in6 is big enough for either IP version
+   const int n = CChannel::m_iMaxBatchSize;
+   sockaddr_in6* addrs = new sockaddr_in6[n];
+   sockaddr** addrv = new sockaddr*[n];
+   CUnit** units = new CUnit*[n];
+   CPacket** pkts = new CPacket*[n];
+   for (int i = 0; i < n; ++ i)
+      addrv[i] = (sockaddr*)(addrs + i);
 
    while (!self->m_bClosing)
    {
-      #ifdef NO_BUSY_WAITING
-         self->m_pTimer->tick();
-      #endif
-
       // check waiting list, if new socket, insert it to the list
       while (self->ifNewEntry())
       {
@@ -995,77 +1211,73 @@ void CRcvQueue::init(int qsize, int payload, int version, int hsize, CChannel* c
          }
       }
 
-      // find next available slot for incoming packet
-      CUnit* unit = self->m_UnitQueue.getNextAvailUnit();
-      if (NULL == unit)
+      // sleep until packets arrive, a socket's timers are due or we're interrupted
+      // (new socket, connection request, closing)
+      uint64_t currtime;
+      CTimer::rdtsc(currtime);
+
+      int64_t timeout = -1;
+      CRNode* ul = self->m_pRcvUList->m_pUList;
+      if (NULL != ul)
       {
-         // no space, skip this packet
-         CPacket temp;
-         temp.m_pcData = new char[self->m_iPayloadSize];
-         temp.setLength(self->m_iPayloadSize);
-         self->m_pChannel->recvfrom(addr, temp);
-         delete [] temp.m_pcData;
-         goto TIMER_CHECK;
+         uint64_t due = ul->m_llTimeStamp + CUDT::m_iSYNInterval * CTimer::getCPUFrequency();
+         timeout = (due > currtime) ? (int64_t)((due - currtime) / CTimer::getCPUFrequency()) : 0;
       }
+      if (!self->m_pRendezvousQueue->empty() && ((timeout < 0) || (timeout > CUDT::m_iSYNInterval)))
+         timeout = CUDT::m_iSYNInterval;
 
-      unit->m_Packet.setLength(self->m_iPayloadSize);
-
-      // reading next incoming packet, recvfrom returns -1 is nothing has been received
-      if (self->m_pChannel->recvfrom(addr, unit->m_Packet) < 0)
-         goto TIMER_CHECK;
-
-      id = unit->m_Packet.m_iID;
-
-      // ID 0 is for connection request, which should be passed to the listening socket or rendezvous sockets
-      if (0 == id)
+      // drain the socket: keep reading while batches come back full
+      bool more = self->m_pChannel->waitForPackets(timeout);
+      while (more && !self->m_bClosing)
       {
-         if (NULL != self->m_pListener)
-            self->m_pListener->listen(addr, unit->m_Packet);
-         else if (NULL != (u = self->m_pRendezvousQueue->retrieve(addr, id)))
+         // find next available slots for incoming packets
+         int navail = self->m_UnitQueue.getNextAvailUnits(units, n);
+         if (0 == navail)
          {
-            // asynchronous connect: call connect here
-            // otherwise wait for the UDT socket to retrieve this packet
-            if (!u->m_bSynRecving)
-               u->connect(unit->m_Packet);
-            else
-               self->storePkt(id, unit->m_Packet.clone());
+            // no space, skip this packet
+            CPacket temp;
+            temp.m_pcData = new char[self->m_iPayloadSize];
+            temp.setLength(self->m_iPayloadSize);
+            self->m_pChannel->recvfrom(addrv[0], temp);
+            delete [] temp.m_pcData;
+            break;
          }
-      }
-      else if (id > 0)
-      {
-         if (NULL != (u = self->m_pHash->lookup(id)))
+
+         for (int i = 0; i < navail; ++ i)
          {
-            if (CIPAddress::ipcmp(addr, u->m_pPeerAddr, u->m_iIPversion))
-            {
-               if (u->m_bConnected && !u->m_bBroken && !u->m_bClosing)
-               {
-                  if (0 == unit->m_Packet.getFlag())
-                     u->processData(unit);
-                  else
-                     u->processCtrl(unit->m_Packet);
-
-                  u->checkTimers();
-                  self->m_pRcvUList->update(u);
-               }
-            }
+            units[i]->m_Packet.setLength(self->m_iPayloadSize);
+            pkts[i] = &units[i]->m_Packet;
          }
-         else if (NULL != (u = self->m_pRendezvousQueue->retrieve(addr, id)))
+
+         // reading the incoming packets, returns -1 if nothing has been received
+         uint64_t t0, t1;
+         CTimer::rdtsc(t0);
+         int nrecv = self->m_pChannel->recvBatch(addrv, pkts, navail);
+         CTimer::rdtsc(t1);
+
+         if (nrecv > 0)
          {
-            if (!u->m_bSynRecving)
-               u->connect(unit->m_Packet);
-            else
-               self->storePkt(id, unit->m_Packet.clone());
+            ++ self->m_llBatch;
+            self->m_llBatchPkt += nrecv;
+            self->m_llBatchTime += t1 - t0;
          }
+
+         for (int i = 0; i < nrecv; ++ i)
+            self->processUnit(addrv[i], units[i]);
+
+         // the units that did not end up in a receiver buffer are free again
+         for (int i = 0; i < navail; ++ i)
+            if (4 == units[i]->m_iFlag)
+               units[i]->m_iFlag = 0;
+
+         more = (nrecv == navail);
       }
 
-TIMER_CHECK:
       // take care of the timing event for all UDT sockets
-
-      uint64_t currtime;
       CTimer::rdtsc(currtime);
 
-      CRNode* ul = self->m_pRcvUList->m_pUList;
-      uint64_t ctime = currtime - 100000 * CTimer::getCPUFrequency();
+      ul = self->m_pRcvUList->m_pUList;
+      uint64_t ctime = currtime - CUDT::m_iSYNInterval * CTimer::getCPUFrequency();
       while ((NULL != ul) && (ul->m_llTimeStamp < ctime))
       {
          CUDT* u = ul->m_pUDT;
@@ -1090,10 +1302,10 @@ TIMER_CHECK:
       self->m_pRendezvousQueue->updateConnStatus();
    }
 
-   if (AF_INET == self->m_UnitQueue.m_iIPversion)
-      delete (sockaddr_in*)addr;
-   else
-      delete (sockaddr_in6*)addr;
+   delete [] pkts;
+   delete [] units;
+   delete [] addrv;
+   delete [] addrs;
 
    #ifndef WIN32
       return NULL;
@@ -1103,6 +1315,54 @@ TIMER_CHECK:
    #endif
 }
 
+void CRcvQueue::processUnit(sockaddr* addr, CUnit* unit)
+{
+   CUDT* u = NULL;
+   int32_t id = unit->m_Packet.m_iID;
+
+   // ID 0 is for connection request, which should be passed to the listening socket or rendezvous sockets
+   if (0 == id)
+   {
+      if (NULL != m_pListener)
+         m_pListener->listen(addr, unit->m_Packet);
+      else if (NULL != (u = m_pRendezvousQueue->retrieve(addr, id)))
+      {
+         // asynchronous connect: call connect here
+         // otherwise wait for the UDT socket to retrieve this packet
+         if (!u->m_bSynRecving)
+            u->connect(unit->m_Packet);
+         else
+            storePkt(id, unit->m_Packet.clone());
+      }
+   }
+   else if (id > 0)
+   {
+      if (NULL != (u = m_pHash->lookup(id)))
+      {
+         if (CIPAddress::ipcmp(addr, u->m_pPeerAddr, u->m_iIPversion))
+         {
+            if (u->m_bConnected && !u->m_bBroken && !u->m_bClosing)
+            {
+               if (0 == unit->m_Packet.getFlag())
+                  u->processData(unit);
+               else
+                  u->processCtrl(unit->m_Packet);
+
+               u->checkTimers();
+               m_pRcvUList->update(u);
+            }
+         }
+      }
+      else if (NULL != (u = m_pRendezvousQueue->retrieve(addr, id)))
+      {
+         if (!u->m_bSynRecving)
+            u->connect(unit->m_Packet);
+         else
+            storePkt(id, unit->m_Packet.clone());
+      }
+   }
+}
+
 int CRcvQueue::recvfrom(int32_t id, CPacket& packet)
 {
    CGuard bufferlock(m_PassLock);
@@ -1181,6 +1441,7 @@ void CRcvQueue::removeListener(const CUDT* u)
 void CRcvQueue::registerConnector(const UDTSOCKET& id, CUDT* u, int ipv, const sockaddr* addr, uint64_t ttl)
 {
    m_pRendezvousQueue->insert(id, u, ipv, addr, ttl);
+   m_pChannel->interrupt();
 }
 
 void CRcvQueue::removeConnector(const UDTSOCKET& id)
@@ -1204,8 +1465,11 @@ void CRcvQueue::removeConnector(const UDTSOCKET& id)
 
 void CRcvQueue::setNewEntry(CUDT* u)
 {
-   CGuard listguard(m_IDLock);
-   m_vNewEntry.push_back(u);
+   {
+      CGuard listguard(m_IDLock);
+      m_vNewEntry.push_back(u);
+   }
+   m_pChannel->interrupt();
 }
 
 bool CRcvQueue::ifNewEntry()
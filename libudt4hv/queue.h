@@ -55,13 +55,15 @@ class CUDT;
 struct CUnit
 {
    CPacket m_Packet;		// packet
-   int m_iFlag;			// 0: free, 1: occupied, 2: msg read but not freed (out-of-order), 3: msg dropped
+   int m_iFlag;			// 0: free, 1: occupied, 2: msg read but not freed (out-of-order), 3: msg dropped,
+				// 4: reserved for an incoming packet
 };
 
 class CUnitQueue
 {
 friend class CRcvQueue;
 friend class CRcvBuffer;
+friend class CUDT;
 
 public:
    CUnitQueue();
@@ -81,7 +83,7 @@ public:
    int init(int size, int mss, int version);
 
       // Functionality:
-      //    Increase (double) the unit queue size.
+      //    Increase the unit queue size by half.
       // Parameters:
       //    None.
       // Returned value:
@@ -107,6 +109,17 @@ public:
 
    CUnit* getNextAvailUnit();
 
+      // Functionality:
+      //    find up to n available units for incoming packets and reserve them (flag 4).
+      //    Units that were not used afterwards must be freed by the caller.
+      // Parameters:
+      //    0) [out] units: the available units.
+      //    1) [in] n: maximum number of units.
+      // Returned value:
+      //    Number of units found.
+
+   int getNextAvailUnits(CUnit** units, int n);
+
 private:
    struct CQEntry
    {
@@ -295,16 +308,17 @@ public:
    void init(int size);
 
       // Functionality:
-      //    Look for a UDT instance from the hash table.
+      //    Look for a UDT instance from the hash table. Takes no lock and may run
+      //    concurrently with one insert() or remove().
       // Parameters:
       //    1) [in] id: socket ID
       // Returned value:
       //    Pointer to a UDT instance, or NULL if not found.
 
-   CUDT* lookup(int32_t id);
+   CUDT* lookup(int32_t id) const;
 
       // Functionality:
-      //    Insert an entry to the hash table.
+      //    Insert an entry to the hash table. Callers must not insert or remove concurrently.
       // Parameters:
       //    1) [in] id: socket ID
       //    2) [in] u: pointer to the UDT instance
@@ -314,7 +328,7 @@ public:
    void insert(int32_t id, CUDT* u);
 
       // Functionality:
-      //    Remove an entry from the hash table.
+      //    Remove an entry from the hash table. Callers must not insert or remove concurrently.
       // Parameters:
       //    1) [in] id: socket ID
       // Returned value:
@@ -323,15 +337,41 @@ public:
    void remove(int32_t id);
 
 private:
-   struct CBucket
+   // Open addressing with linear probing. A slot is published by writing its
+   // ID after the instance, so a reader that sees the ID also sees the instance.
+   struct CSlot
    {
-      int32_t m_iID;		// Socket ID
+      int32_t m_iID;		// Socket ID, 0: never used, -1: removed
       CUDT* m_pUDT;		// Socket instance
+   };
+
+   struct CTable
+   {
+      int m_iBits;		// log2 of the number of slots
+      CSlot* m_pSlot;		// the slots
+   };
 
-      CBucket* m_pNext;		// next bucket
-   } **m_pBucket;		// list of buckets (the hash table)
+   CTable* m_pTable;		// current table; replaced, never changed in size
+   int m_iUsed;			// slots that are not empty, removed ones included
+   int m_iCount;		// entries
+   int m_iMinSize;		// the table never shrinks below this
+
+   // Replaced tables are freed once no reader can be using them anymore. A
+   // reader counts itself in m_aiReaders[m_iEpoch] while it probes. A
+   // table replaced at retirement number n can go when, afterwards, each of
+   // the two counters has been seen at zero; flipping the epoch lets the
+   // counter that new readers do not use drain.
+   int m_iEpoch;			// 0 or 1: the counter for new readers
+   mutable int m_aiReaders[2];	// readers in flight, per epoch parity
+   int m_iRetireNo;		// number of tables replaced so far
+   int m_aiQuiet[2];		// all retired up to here were seen unused, per parity
+   std::vector<std::pair<CTable*, int> > m_vRetired;	// replaced tables, with their retirement number
 
-   int m_iHashSize;		// size of hash table
+private:
+   void rebuild(int size);
+   void reclaim();
+   static int home(const CTable* t, int32_t id);
+   static void release(CTable* t);
 
 private:
    CHash(const CHash&);
@@ -348,6 +388,7 @@ public:
    void insert(const UDTSOCKET& id, CUDT* u, int ipv, const sockaddr* addr, uint64_t ttl);
    void remove(const UDTSOCKET& id);
    CUDT* retrieve(const sockaddr* addr, UDTSOCKET& id);
+   bool empty();
 
    void updateConnStatus();
 
@@ -416,6 +457,15 @@ private:
    volatile bool m_bClosing;		// closing the worker
    pthread_cond_t m_ExitCond;
 
+   int64_t m_llBatch;			// number of batched sends
+   int64_t m_llBatchPkt;		// number of packets sent in batches
+   int64_t m_llBatchTime;		// total time spent in batched sends, in CPU ticks
+
+   int64_t m_llPaced;			// number of times the worker waited for the next packet to be due
+   int64_t m_llPacingErrTime;		// total time it woke up too late, in CPU ticks
+   int64_t m_llPacingErrMax;		// worst case, in CPU ticks
+   int64_t m_llPacingErrHist[8];	// woke up late by < 1, 2, 5, 10, 20, 50, 100, >= 100 microseconds
+
 private:
    CSndQueue(const CSndQueue&);
    CSndQueue& operator=(const CSndQueue&);
@@ -463,6 +513,16 @@ private:
    static DWORD WINAPI worker(LPVOID param);
 #endif
 
+      // Functionality:
+      //    Hand a received packet to the socket (or listener) it is meant for.
+      // Parameters:
+      //    0) [in] addr: source address of the packet
+      //    1) [in] unit: the unit the packet was received into
+      // Returned value:
+      //    None.
+
+   void processUnit(sockaddr* addr, CUnit* unit);
+
    pthread_t m_WorkerThread;
 
 private:
@@ -478,6 +538,10 @@ private:
    volatile bool m_bClosing;            // closing the workder
    pthread_cond_t m_ExitCond;
 
+   int64_t m_llBatch;			// number of batched receives that returned packets
+   int64_t m_llBatchPkt;		// number of packets received in batches
+   int64_t m_llBatchTime;		// total time spent in those receives, in CPU ticks
+
 private:
    int setListener(CUDT* u);
    void removeListener(const CUDT* u);
@@ -518,10 +582,13 @@ struct CMultiplexer
    int m_iPort;			// The UDP port number of this multiplexer
    int m_iIPversion;		// IP version
    int m_iMSS;			// Maximum Segment Size
-   int m_iRefCount;		// number of UDT instances that are associated with this multiplexer
+   int m_iRefCount;		// number of UDT instances that are associated with this multiplexer (all shards, kept by the first)
    bool m_bReusable;		// if this one can be shared with others
 
    int m_iID;			// multiplexer ID
+   int m_iGroup;		// ID of the first of the multiplexers sharing the port, its own ID if it doesn't share
+   int m_iShard;		// index among them: it receives the packets for socket IDs with this remainder
+   int m_iShards;		// number of multiplexers sharing the port
 };
 
 #endif
@@ -45,6 +45,7 @@ written by
 #ifndef WIN32
    #include <sys/types.h>
    #include <sys/socket.h>
+   #include <sys/uio.h>
    #include <netinet/in.h>
 #else
    #ifdef __MINGW__
@@ -108,6 +109,11 @@ written by
 typedef SYSSOCKET UDPSOCKET;
 typedef int UDTSOCKET;
 
+// Called when UDT is done with data handed over by UDT::sendref(): the "len" bytes at "buf" were
+// acknowledged by the peer ("acked" is true) or the socket went away before that. Called from a UDT
+// thread, so it must not block, nor call UDT on the same socket.
+typedef void (*UDT_RELEASE_FN)(void* ctx, const char* buf, int len, bool acked);
+
 ////////////////////////////////////////////////////////////////////////////////
 
 typedef std::set<UDTSOCKET> ud_set;
@@ -151,7 +157,11 @@ enum UDTOpt
    UDT_STATE,		// current socket state, see UDTSTATUS, read only
    UDT_EVENT,		// current avalable events associated with the socket
    UDT_SNDDATA,		// size of data in the sending buffer
-   UDT_RCVDATA		// size of data available for recv
+   UDT_RCVDATA,		// size of data available for recv
+   UDT_PACING,		// sender pacing: sleep until this many microseconds before a packet is due, then busy-wait (0 = sleep until due)
+   UDT_SHARDS,		// number of sending/receiving thread pairs serving the bound port (SO_REUSEPORT)
+   UDT_BUFLIMIT,	// grow the buffers and flight window to twice the measured bandwidth-delay product, up to this many bytes (0 = fixed sizes)
+   UDT_PMTUD		// don't fragment; connect with the largest MSS up to UDT_MSS that the path carries
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -194,6 +204,27 @@ struct CPerfMon
    double mbpsBandwidth;                // estimated bandwidth, in Mb/s
    int byteAvailSndBuf;                 // available UDT sender buffer size
    int byteAvailRcvBuf;                 // available UDT receiver buffer size
+
+   // UDP channel measurements, shared by all UDT sockets on the same port (since the start)
+   int64_t sndBatchTotal;               // number of batched UDP sends
+   int64_t pktSndBatchTotal;            // number of packets sent in those
+   double usSndBatchAvg;                // average time per batched send, in microseconds
+   int64_t rcvBatchTotal;               // number of batched UDP receives that returned packets
+   int64_t pktRcvBatchTotal;            // number of packets received in those
+   double usRcvBatchAvg;                // average time per batched receive, in microseconds
+   int64_t pktPacedTotal;               // number of times the sender waited for a packet to become due
+   double usPacingErrAvg;               // average time it woke up too late, in microseconds
+   double usPacingErrMax;               // worst case, in microseconds
+   int64_t pktPacingErrHist[8];         // woke up late by < 1, 2, 5, 10, 20, 50, 100, >= 100 microseconds
+
+   // buffer sizes, as chosen by the auto-tuning (UDT_BUFLIMIT)
+   int pktSndBuf;                       // sender buffer size, in packets
+   int pktRcvBuf;                       // receiver buffer size, in packets
+   int pktMaxBuf;                       // upper bound for the receiver buffer, in packets
+   int pktMaxSndBuf;                    // upper bound for the sender buffer, in packets
+   int pktSndBDP;                       // last bandwidth-delay product seen by the sender, in packets
+   int pktRcvBDP;                       // last bandwidth-delay product seen by the receiver, in packets
+   int pktUnitQueue;                    // size of the receiving queue shared by all UDT sockets on the same port, in packets
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -326,10 +357,19 @@ UDT_API int send(UDTSOCKET u, const char* buf, int len, int flags);
 UDT_API int recv(UDTSOCKET u, char* buf, int len, int flags);
 UDT_API int sendmsg(UDTSOCKET u, const char* buf, int len, int ttl = -1, bool inorder = false);
 UDT_API int recvmsg(UDTSOCKET u, char* buf, int len);
+UDT_API int sendref(UDTSOCKET u, const char* buf, int len, UDT_RELEASE_FN release, void* ctx);
+#ifndef WIN32
+UDT_API int recvref(UDTSOCKET u, struct iovec* iov, int iovcnt);
+UDT_API int recvrelease(UDTSOCKET u, int len);
+#endif
 UDT_API int64_t sendfile(UDTSOCKET u, std::fstream& ifs, int64_t& offset, int64_t size, int block = 364000);
 UDT_API int64_t recvfile(UDTSOCKET u, std::fstream& ofs, int64_t& offset, int64_t size, int block = 7280000);
 UDT_API int64_t sendfile2(UDTSOCKET u, const char* path, int64_t* offset, int64_t size, int block = 364000);
 UDT_API int64_t recvfile2(UDTSOCKET u, const char* path, int64_t* offset, int64_t size, int block = 7280000);
+#ifndef WIN32
+UDT_API int64_t sendfile(UDTSOCKET u, int fd, int64_t& offset, int64_t size, int block = 364000);
+UDT_API int64_t recvfile(UDTSOCKET u, int fd, int64_t& offset, int64_t size, int block = 7280000);
+#endif
 
 // select and selectEX are DEPRECATED; please use epoll. 
 UDT_API int select(int nfds, UDSET* readfds, UDSET* writefds, UDSET* exceptfds, const struct timeval* timeout);
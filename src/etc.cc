@@ -28,6 +28,8 @@
 
 // C++ standard headers
 #include <map>
+#include <list>
+#include <mutex>
 #include <thread>
 #include <string>
 #include <vector>
@@ -126,28 +128,6 @@ extern "C" {
     void dummy_signal_handler(int) { }
 }
 
-struct socketoptions_type {
-
-    socketoptions_type():
-        bufSize{ 32*1024*1024 }, MTU{ 1500 }
-    {}
-
-    size_t        bufSize;
-    unsigned int  MTU;
-#if 0
-    template <typename... Args>
-    auto mk_etdserver(Args&&... args) -> decltype(::mk_etdserver()) {
-        return ::mk_etdserver(std::forward<Args>(args)..., etdc::udt_mss{ MTU }, etdc::udt_rcvbuf{ bufSize },
-                            etdc::udt_sndbuf{ bufSize }, etdc::so_rcvbuf{ bufSize }, etdc::so_sndbuf{ bufSize });
-    }
-    template <typename... Args>
-    auto mk_etdproxy(Args&&... args) -> decltype(::mk_etdserver()) {
-        return ::mk_etdproxy(std::forward<Args>(args)..., etdc::udt_mss{ MTU }, etdc::udt_rcvbuf{ bufSize },
-                           etdc::udt_sndbuf{ bufSize }, etdc::so_rcvbuf{ bufSize }, etdc::so_sndbuf{ bufSize });
-    }
-#endif
-};
-
 
 
 int main(int argc, char const*const*const argv) {
@@ -155,9 +135,12 @@ int main(int argc, char const*const*const argv) {
     etdc::BlockAll         ba;
     // Let's set up the command line parsing
     int                    message_level = 0;
-#if 0
-    socketoptions_type     sockopts{};
-#endif
+    unsigned int           nBuffers = etdc::defaultNBuffers;
+    unsigned int           nStreams = 1;
+    unsigned int           nParallel = 1;
+    unsigned int           nBatch = 1;
+    int                    pacingSpin = etdc::detail::defaultUDTPacing;
+    etdc::ccspec_type      cc{};
     etdc::openmode_type    mode{ etdc::openmode_type::New };
     AP::ArgumentParser     cmd( AP::version( buildinfo() ),
                                 AP::docstring("'ftp' like etransfer client program.\n"
@@ -174,7 +157,7 @@ int main(int argc, char const*const*const argv) {
     // What does our command line look like?
     //
     // <prog> [-h] [--help] [--version]
-    //        [-m <int>] { [--list SRC] | SRC DST }
+    //        [-m <int>] { [--list SRC] | [--status URL] | SRC DST }
     //
     cmd.add( AP::long_name("help"), AP::print_help(),
              AP::docstring("Print full help and exit succesfully") );
@@ -188,6 +171,46 @@ int main(int argc, char const*const*const argv) {
              AP::maximum_value(5), AP::minimum_value(-1), AP::at_most(1),
              AP::docstring("Message level - higher = more output") );
 
+    // buffering of local transfers
+    cmd.add( AP::store_into(nBuffers), AP::long_name("nbuf"),
+             AP::minimum_value(1u), AP::maximum_value(64u), AP::at_most(1),
+             AP::docstring(std::string("Number of transfer buffers for local file I/O; >1 means file and network I/O "
+                                       "are done in parallel. Default ")+etdc::repr(nBuffers)) );
+    cmd.add( AP::store_true(), AP::long_name("uring"), AP::at_most(1),
+             AP::docstring("Use io_uring(7) for local file I/O if the kernel supports it") );
+    cmd.add( AP::store_into(pacingSpin), AP::long_name("pacing"),
+             AP::minimum_value(0), AP::at_most(1),
+             AP::docstring(std::string("UDT pacing: sleep until this many microseconds before a packet is due and busy-wait for the "
+                                       "rest (0 = just sleep). Default ")+etdc::repr(pacingSpin)) );
+
+    // congestion control of UDT data connections
+    cmd.add( AP::store_into(cc.algorithm), AP::long_name("cc"), AP::at_most(1),
+             AP::is_member_of({etdc::cc_type::UDT, etdc::cc_type::Fixed, etdc::cc_type::Delay, etdc::cc_type::BBR}),
+             AP::convert([](std::string const& s) { std::istringstream iss(s); etdc::cc_type c; iss >> c; return c; }),
+             AP::docstring("Congestion control for UDT data connections: udt (AIMD, UDT's own), fixed (constant rate, "
+                           "ignores loss; requires --rate), delay (backs off when a queue builds up) or bbr "
+                           "(paces at the measured bottleneck bandwidth). Default: whatever the sending end uses") );
+    cmd.add( AP::store_into(cc.rate), AP::long_name("rate"), AP::at_most(1),
+             AP::convert([](std::string const& s) { return etdc::str2rate(s); }),
+             AP::docstring("Limit UDT data connections to this many bits per second, e.g. 800M or 8G; "
+                           "per data connection (see --streams). Default: no limit") );
+
+    // parallel data connections per file
+    cmd.add( AP::store_into(nStreams), AP::long_name("streams"),
+             AP::minimum_value(1u), AP::maximum_value(etdc::maxNStreams), AP::at_most(1),
+             AP::docstring(std::string("Transfer each file over this many parallel data connections, "
+                                       "each carrying its own part of the file. Default ")+etdc::repr(nStreams)) );
+
+    // multiple files at the same time
+    cmd.add( AP::store_into(nParallel), AP::long_name("parallel"),
+             AP::minimum_value(1u), AP::maximum_value(64u), AP::at_most(1),
+             AP::docstring(std::string("Transfer this many files at the same time, each over its own "
+                                       "control connection. Failures are reported at the end. Default ")+etdc::repr(nParallel)) );
+    cmd.add( AP::store_into(nBatch), AP::long_name("batch"),
+             AP::minimum_value(1u), AP::maximum_value(etdc::maxNOpen), AP::at_most(1),
+             AP::docstring(std::string("Open/close this many files at once using pipelined requests; "
+                                       "daemons that don't support this get them one at a time. Default ")+etdc::repr(nBatch)) );
+
     // verbosity
     cmd.add( AP::store_false(), AP::short_name('v'), AP::long_name("verbose"),
              AP::at_most(1), AP::docstring("Verbose output for each file transferred") );
@@ -231,23 +254,27 @@ int main(int argc, char const*const*const argv) {
         AP::option(AP::long_name("list"), AP::collect_into(urls), AP::match(rxURL), AP::at_most(1), str2url_type(),
                    AP::constrain([](url_type const& url) { return !url.isLocal; }, "Can only list remote URLs"),
                    AP::docstring("Request to list the contents of URL")),
+        AP::option(AP::long_name("status"), AP::collect_into(urls), AP::match(rxURL), AP::at_most(1), str2url_type(),
+                   AP::constrain([](url_type const& url) { return !url.isLocal; }, "Can only show the status of remote daemons"),
+                   AP::docstring("Show the status of the etransfer daemon at URL (the path is ignored)")),
         AP::option(AP::collect_into(urls), AP::exactly(2), str2url_type(), AP::match(rxURL),
                    AP::constrain([&](url_type const& url) { if( url.isLocal ) nLocal++; return nLocal<2; }, "At most one local PATH can be given"),
                    AP::docstring("SRC and DST URL/PATH"))
         );
-#if 0
-    // Allow user to set network related options
-    cmd.add( AP::store_into(sockopts.MTU), AP::long_name("mss"),
+    // Allow user to set network related options of the data connections
+    cmd.add( AP::store_into(cc.mss), AP::long_name("mss"), AP::at_most(1),
              AP::minimum_value((unsigned int)64), AP::maximum_value((unsigned int)65536), // UDP datagram limits
-             AP::docstring(std::string("Set UDT maximum segment size. Not honoured if data channel is TCP. Default ")+etdc::repr(sockopts.MTU)) );
-    cmd.add( AP::store_into(sockopts.bufSize), AP::long_name("buffer"),
-             AP::docstring(std::string("Set send/receive buffer size. Default ")+etdc::repr(sockopts.bufSize)) );
-#endif
+             AP::docstring(std::string("Set UDT maximum segment size; the path may lower it. Not honoured if data channel is TCP. "
+                                       "Default: the daemon's, up to ")+etdc::repr(etdc::detail::defaultUDTMSS)) );
+    cmd.add( AP::store_into(cc.bufSize), AP::long_name("buffer"), AP::at_most(1),
+             AP::minimum_value((size_t)1),
+             AP::docstring("Set send/receive buffer size of the data connections, in bytes. Default: the daemon's") );
     // Flag wether or not to wait
     //cmd.add(AP::store_true(), AP::short_name('b'), AP::docstring("Do not exit but do a blocking read instead"));
 
     // OK Let's check that mother
     cmd.parse(argc, argv);
+    ETDCASSERT(cc.algorithm!=etdc::cc_type::Fixed || cc.rate>0, "--cc fixed needs a --rate");
 
     // Set message level based on command line value (or default)
     etdc::dbglev_fn( message_level );
@@ -259,13 +286,21 @@ int main(int argc, char const*const*const argv) {
 
     const bool                        verbose = cmd.get<bool>("verbose");
     etdc::etd_state                   localState{};
+    localState.nBuffers = nBuffers;
+    localState.useUring = cmd.get<bool>("uring");
+    localState.pacingSpin = pacingSpin;
     std::vector<etdc::etd_server_ptr> servers;
 
     // We must transform the URL(s) into ETDServerInterface* 
-    std::transform(std::begin(urls), std::end(urls), std::back_inserter(servers),
-                   [&](url_type const& url) {
-                        return url.isLocal ? ::mk_etdserver(std::ref(localState)) : ::mk_etdproxy(url.protocol, url.host, url.port);
-                    });
+    auto const mkServer = [&](url_type const& url) {
+                            return url.isLocal ? ::mk_etdserver(std::ref(localState)) : ::mk_etdproxy(url.protocol, url.host, url.port);
+                          };
+    std::transform(std::begin(urls), std::end(urls), std::back_inserter(servers), mkServer);
+
+    if( cmd("status") ) {
+        std::cout << servers[0]->status();
+        return 0;
+    }
 
     // Get the list of files to transfer (or to list if servers.size()==1)
     static const auto isDir = [](std::string const& str) { return !str.empty() && str[str.size()-1]=='/'; };
@@ -318,49 +353,180 @@ int main(int argc, char const*const*const argv) {
         *ptr = mk_sockname(get_protocol(*ptr), etdc::host_type(std::regex_replace(get_host(*ptr), rxWildCard, dstHost)), get_port(*ptr));
 
     // Before processing all file(s) we already know if we're going to push or pull
-    std::function<bool(etdc::uuid_type const&, etdc::uuid_type&, off_t, etdc::dataaddrlist_type const&)> fn;
+    using fn_type = std::function<bool(etdc::uuid_type const&, etdc::uuid_type&, off_t, etdc::dataaddrlist_type const&)>;
     namespace ph = std::placeholders;
-    fn = (push ?
-          std::bind(&etdc::ETDServerInterface::sendFile, servers[0].get(), ph::_1, ph::_2, ph::_3, ph::_4) :
-          std::bind(&etdc::ETDServerInterface::getFile,  servers[1].get(), ph::_1, ph::_2, ph::_3, ph::_4));
-
-    // Loop over all files to do ...
-    using unique_result = std::unique_ptr<etdc::result_type>;
+    auto const mkFn = [&](std::vector<etdc::etd_server_ptr> const& srv) -> fn_type {
+        return (push ?
+                std::bind(&etdc::ETDServerInterface::sendFile, srv[0].get(), ph::_1, ph::_2, ph::_3, ph::_4, nStreams, cc) :
+                std::bind(&etdc::ETDServerInterface::getFile,  srv[1].get(), ph::_1, ph::_2, ph::_3, ph::_4, nStreams, cc));
+    };
+
+    // Transfer a number of files using the indicated pair of servers.
+    // All files are opened at both ends in one go (which, talking to a
+    // remote daemon, costs one round trip per batch rather than per file)
+    // and released afterwards.
+    // Returns the files that failed and why.
+    using failure_type  = std::pair<std::string, std::exception_ptr>;
+    using failures_type = std::list<failure_type>;
     const int 	lvl( verbose ? -1 : 9 );
+    auto const  doFiles = [&](std::vector<etdc::etd_server_ptr> const& srv, fn_type const& fn, std::vector<std::string> const& files) {
+        failures_type                 failures;
+        std::vector<std::string>      outputFNs;
+        std::vector<etdc::uuid_type>  srcUUIDs, dstUUIDs;
+        etdc::readrequest_type        reads;
+        std::vector<size_t>           readIdx;
+
+        std::transform(std::begin(files), std::end(files), std::back_inserter(outputFNs), mkOutputPath);
+        for(size_t i=0; i<files.size(); i++)
+            ETDCDEBUG(lvl, (push ? "PUSH" : "PULL" ) << " " << mode << " " << files[i] << " -> " << outputFNs[i] << std::endl);
+
+        // Open all destination files and, based on how much they already
+        // have, decide which source files need to be opened
+        auto const dstResults = srv[1]->requestFileWrites(outputFNs, mode);
+        for(size_t i=0; i<files.size(); i++) {
+            auto const& dst = dstResults[i];
+            if( !dst.first ) {
+                failures.emplace_back(files[i], dst.second);
+                continue;
+            }
+            dstUUIDs.push_back( etdc::get_uuid(*dst.first) );
 
-    for(auto const& file: files2do) {
-        // Skip directories
-        if( file[file.size()-1]=='/' )
-            continue;
-        // We must keep these outside the try/catch such that we can clean up?
-        unique_result      srcResult, dstResult;
-        std::exception_ptr eptr;
-        try {
-            auto const outputFN = mkOutputPath(file);
-            ETDCDEBUG(lvl, (push ? "PUSH" : "PULL" ) << " " << mode << " " << file << " -> " << outputFN << std::endl);
-            dstResult = std::move( unique_result(new etdc::result_type(servers[1]->requestFileWrite(outputFN, mode))) );
-            auto nByte = etdc::get_filepos(*dstResult);
-
+            auto nByte = etdc::get_filepos(*dst.first);
             if( mode!=etdc::openmode_type::SkipExisting || nByte==0 ) {
-                srcResult      = std::move(  unique_result(new etdc::result_type(servers[0]->requestFileRead(file, nByte))) );
-                auto nByteToGo = etdc::get_filepos(*srcResult);
+                reads.emplace_back(files[i], nByte);
+                readIdx.push_back(i);
+            }
+        }
+
+        auto const srcResults = (reads.empty() ? etdc::batchresult_type() : srv[0]->requestFileReads(reads));
+        for(size_t j=0; j<reads.size(); j++) {
+            auto const& src = srcResults[j];
+            auto const& dst = dstResults[readIdx[j]];
+            if( !src.first ) {
+                failures.emplace_back(reads[j].first, src.second);
+                continue;
+            }
+            srcUUIDs.push_back( etdc::get_uuid(*src.first) );
+
+            try {
+                auto nByteToGo = etdc::get_filepos(*src.first);
 
                 if( nByteToGo>0 )
-                    (void)fn(etdc::get_uuid(*srcResult), etdc::get_uuid(*dstResult), nByteToGo, dataChannels);
+                    (void)fn(etdc::get_uuid(*src.first), etdc::get_uuid(*dst.first), nByteToGo, dataChannels);
                 else
-                    ETDCDEBUG(lvl, "Destination is complete or is larger than source file" << std::endl);
+                    ETDCDEBUG(lvl, "Destination " << outputFNs[readIdx[j]] << " is complete or is larger than source file" << std::endl);
+            }
+            catch( ... ) {
+                failures.emplace_back(reads[j].first, std::current_exception());
             }
         }
+
+        // Release all of them, even if one side fails
+        std::exception_ptr eptr;
+        try {
+            if( !dstUUIDs.empty() )
+                srv[1]->removeUUIDs( dstUUIDs );
+        }
+        catch( ... ) {
+            eptr = std::current_exception();
+        }
+        try {
+            if( !srcUUIDs.empty() )
+                srv[0]->removeUUIDs( srcUUIDs );
+        }
         catch( ... ) {
             eptr = std::current_exception();
         }
-        if( dstResult )
-            servers[1]->removeUUID( etdc::get_uuid(*dstResult) );
-        if( srcResult )
-            servers[0]->removeUUID( etdc::get_uuid(*srcResult) );
         if( eptr )
             std::rethrow_exception(eptr);
+        return failures;
+    };
+    // Don't ask for more open files than either end can have
+    if( nBatch>1 )
+        nBatch = std::min(nBatch, std::min(servers[0]->maxOpen(), servers[1]->maxOpen()));
+
+    // Take the next batch of files off the list
+    auto const  nextBatch = [&](void) {
+        std::vector<std::string>  batch;
+        while( !files2do.empty() && batch.size()<nBatch ) {
+            batch.push_back( files2do.front() );
+            files2do.pop_front();
+        }
+        return batch;
+    };
+
+    // Loop over all files to do ...
+    if( nParallel<=1 || files2do.size()<=nBatch ) {
+        const fn_type fn = mkFn( servers );
+        while( !files2do.empty() ) {
+            const auto failures = doFiles(servers, fn, nextBatch());
+            if( !failures.empty() )
+                std::rethrow_exception(failures.front().second);
+        }
+        return 0;
+    }
+
+    // ... or have a number of workers do that. An ETDServer(Proxy) can
+    // only do one transfer at a time so each worker gets their own pair.
+    // The first worker reuses the ones we already have.
+    std::mutex                                       queueLock;
+    std::list<std::pair<std::string, std::string>>   errors;
+    std::list<std::thread>                           workers;
+    auto const                                       what = [](std::exception_ptr eptr) -> std::string {
+        try {
+            std::rethrow_exception(eptr);
+        }
+        catch( std::exception const& e ) {
+            return e.what();
+        }
+        catch( ... ) { }
+        return "unknown exception";
+    };
+    auto const                                       worker = [&](std::vector<etdc::etd_server_ptr> srv) {
+        const fn_type  fn = mkFn( srv );
+        while( true ) {
+            std::vector<std::string>  batch;
+            {
+                std::lock_guard<std::mutex>  lk( queueLock );
+                if( files2do.empty() )
+                    break;
+                batch = nextBatch();
+            }
+            try {
+                const auto failures = doFiles(srv, fn, batch);
+
+                std::lock_guard<std::mutex>  lk( queueLock );
+                for(auto const& f: failures)
+                    errors.emplace_back(f.first, what(f.second));
+            }
+            catch( ... ) {
+                // If releasing the files fails we don't know which one(s)
+                std::lock_guard<std::mutex>  lk( queueLock );
+                errors.emplace_back(batch.front() + (batch.size()>1 ? " (+ "+etdc::repr(batch.size()-1)+" more)" : std::string()),
+                                    what(std::current_exception()));
+            }
+        }
+    };
+
+    std::vector<std::vector<etdc::etd_server_ptr>>   serverPairs{ servers };
+
+    nParallel = std::min(nParallel, (unsigned int)((files2do.size() + nBatch - 1)/nBatch));
+    ETDCDEBUG(3, "Transferring " << files2do.size() << " files using " << nParallel << " parallel transfers" << std::endl);
+    // Make all connections before starting anything
+    while( serverPairs.size()<nParallel ) {
+        serverPairs.emplace_back();
+        std::transform(std::begin(urls), std::end(urls), std::back_inserter(serverPairs.back()), mkServer);
     }
+    for(unsigned int i=1; i<nParallel; i++)
+        workers.emplace_back( etdc::thread(worker, serverPairs[i]) );
+    worker( serverPairs[0] );
+    for(auto& w: workers)
+        w.join();
+
+    // Report all failures at once
+    for(auto const& err: errors)
+        ETDCDEBUG(-1, "FAILED " << err.first << " - " << err.second << std::endl);
+    ETDCASSERT(errors.empty(), errors.size() << " file(s) failed to transfer");
     return 0;
 }
 
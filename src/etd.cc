@@ -20,8 +20,9 @@
 #include <version.h>
 #include <etdc_fd.h>
 #include <reentrant.h>
-//#include <etdc_thread.h>
+#include <etdc_thread.h>
 #include <etdc_debug.h>
+#include <etdc_reactor.h>
 #include <etdc_etd_state.h>
 #include <etdc_etdserver.h>
 #include <etdc_stringutil.h>
@@ -29,6 +30,8 @@
 
 #include <map>
 #include <thread>
+#include <memory>
+#include <algorithm>
 #include <string>
 #include <vector>
 #include <future>
@@ -142,11 +145,14 @@ static std::string unbracket(std::string const& h) {
 struct socketoptions_type {
 
     socketoptions_type():
-        bufSize{ 32*1024*1024 }, MTU{ 1500 }
+        bufSize{ 32*1024*1024 }, MTU{ etdc::detail::defaultUDTMSS }, pacingSpin{ etdc::detail::defaultUDTPacing },
+        nShards{ etdc::detail::defaultUDTShards }
     {}
 
     size_t        bufSize;
     unsigned int  MTU;
+    int           pacingSpin;
+    int           nShards;
 };
 
 
@@ -167,13 +173,18 @@ struct string2socket_type_m {
 
         std::regex_match(s, m, rxURL);
 
+        // TCP servers are watched by the reactor so they must not block;
+        // the UDT ones each have a thread doing blocking accept(2)s
+        const bool  isUDT = etdc::stricmp(m[2].str(), std::string("udt"));
         fd = mk_server(etdc::protocol_type(m[1]), etdc::host_type(unbracket(m[3])), // protocol + local addres (if any)
                        (m[7].length() ? port(m[7]) :  __m_default_port), // port
-                       etdc::udt_mss{ __m_sockopts.MTU },
+                       etdc::udt_mss{ __m_sockopts.MTU }, etdc::udt_pacing{ __m_sockopts.pacingSpin },
+                       etdc::udt_shards{ __m_sockopts.nShards },
                        //etdc::udt_rcvbuf{ __m_sockopts.bufSize }, etdc::udt_sndbuf{ __m_sockopts.bufSize },
                        etdc::so_rcvbuf{ __m_sockopts.bufSize }, etdc::so_sndbuf{ __m_sockopts.bufSize },
                        //etdc::udt_rcvbuf{32*1024*1024}, etdc::udt_sndbuf{32*1024*1024}, etdc::so_rcvbuf{4*1024},  // some socket options
-                       etdc::blocking_type{true});
+                       // clients may arrive in bursts
+                       etdc::backlog_type{64}, etdc::blocking_type{isUDT});
 
         auto socknm =  fd->getsockname(fd->__m_fd);
         ETDCDEBUG(2, "etd: server is-at " << socknm << endl);
@@ -192,8 +203,28 @@ struct string2socket_type_m {
 // Forward declarations &cet
 //
 ////////////////////////////////////////////////////////////////////////////////////
-template <int> void command_server_thread(etdc::etdc_fdptr fd, etdc::etd_state&);
-template <int> void data_server_thread(etdc::etdc_fdptr fd, etdc::etd_state&);
+
+// Command connections spend most of their life waiting for the client to
+// send the next command. The TCP ones are all watched by one reactor; when
+// a command comes in, it is executed on the (bounded) command pool. Work
+// that blocks for as long as a file transfer takes, and all data
+// connections, go to the I/O pool which grows as needed: a transfer waits
+// for its data connection(s) so these may never wait for each other.
+// UDT sockets cannot be watched by epoll/poll; their listening sockets get
+// a thread each that accepts clients and hands them to the I/O pool.
+struct server_context {
+    etdc::etd_state&    state;
+    etdc::reactor&      reactor;
+    etdc::thread_pool&  cmdPool;
+    etdc::thread_pool&  ioPool;
+};
+
+using client_fn = void (*)(etdc::etdc_fdptr, server_context&);
+
+template <int> void command_client(etdc::etdc_fdptr pClient, server_context& ctx);
+template <int> void data_client(etdc::etdc_fdptr pClient, server_context& ctx);
+template <int> void udt_accept_thread(etdc::etdc_fdptr pServer, server_context& ctx, client_fn);
+void add_server(etdc::etdc_fdptr pServer, server_context& ctx, client_fn);
 
 // Make sure our zignal handlert has C-linkage
 extern "C" {
@@ -228,6 +259,9 @@ int main(int argc, char const*const*const argv) {
     etdc::BlockAll      ba;
     // Let's set up the command line parsing
     int                 message_level = 0;
+    unsigned int        nBuffers = etdc::defaultNBuffers;
+    size_t              maxBufMem = 0;
+    unsigned int        bufIdleTime = 60;
     socketoptions_type  sockopts{};
     AP::ArgumentParser  cmd( AP::version( buildinfo() ),
                              AP::docstring("'ftp' like etransfer server daemon, to be used with etransfer client for "
@@ -282,9 +316,33 @@ int main(int argc, char const*const*const argv) {
     // Allow user to set network related options
     cmd.add( AP::store_into(sockopts.MTU), AP::long_name("mss"),
              AP::minimum_value((unsigned int)64), AP::maximum_value((unsigned int)65536), // UDP datagram limits
-             AP::docstring(std::string("Set UDT maximum segment size. Not honoured if data channel is TCP. Default ")+etdc::repr(sockopts.MTU)) );
+             AP::docstring(std::string("Set UDT maximum segment size; lowered to what the path to the client carries. Not honoured if data channel is TCP. Default ")+etdc::repr(sockopts.MTU)) );
     cmd.add( AP::store_into(sockopts.bufSize), AP::long_name("buffer"),
              AP::docstring(std::string("Set send/receive buffer size. Default ")+etdc::repr(sockopts.bufSize)) );
+    cmd.add( AP::store_into(sockopts.pacingSpin), AP::long_name("pacing"),
+             AP::minimum_value(0), AP::at_most(1),
+             AP::docstring(std::string("UDT pacing: sleep until this many microseconds before a packet is due and busy-wait for the "
+                                       "rest (0 = just sleep). Default ")+etdc::repr(sockopts.pacingSpin)) );
+    cmd.add( AP::store_into(sockopts.nShards), AP::long_name("shards"),
+             AP::minimum_value(1), AP::maximum_value(256), AP::at_most(1),
+             AP::docstring(std::string("Serve a UDT port with this many send/receive thread pairs, one per CPU, so concurrent "
+                                       "transfers can use more than one core (Linux >= 4.5). Default ")+etdc::repr(sockopts.nShards)) );
+    cmd.add( AP::store_into(nBuffers), AP::long_name("nbuf"),
+             AP::minimum_value(1u), AP::maximum_value(64u), AP::at_most(1),
+             AP::docstring(std::string("Split the transfer buffer into this many buffers; >1 means file and network I/O "
+                                       "are done in parallel, 1 = read-then-write. Default ")+etdc::repr(nBuffers)) );
+    cmd.add( AP::store_into(maxBufMem), AP::long_name("max-buffer-mem"), AP::at_most(1),
+             AP::docstring("Upper limit on the total amount of memory (in bytes) used for transfer buffers; transfers "
+                           "that would exceed this wait until others have finished. Default 0 = no limit") );
+    cmd.add( AP::store_into(bufIdleTime), AP::long_name("buffer-idle-time"), AP::at_most(1),
+             AP::docstring(std::string("Release transfer buffers that have not been used for this many seconds "
+                                       "(0 = keep them). Default ")+etdc::repr(bufIdleTime)) );
+    cmd.add( AP::store_true(), AP::long_name("hugepages"), AP::at_most(1),
+             AP::docstring("Back transfer buffers by huge pages (MAP_HUGETLB), or ask for transparent huge pages "
+                           "if none are available") );
+    cmd.add( AP::store_true(), AP::long_name("uring"), AP::at_most(1),
+             AP::docstring("Use io_uring(7) for file I/O, keeping up to 'nbuf' reads/writes in flight. "
+                           "Silently falls back to normal I/O if the kernel does not support it") );
 
     // command servers; we require at least one of 'm
     cmd.add( AP::collect<std::string>(), AP::long_name("command"),
@@ -342,6 +400,30 @@ int main(int argc, char const*const*const argv) {
 
     // Start threads for the command+data servers
     etdc::etd_state            serverState;
+    serverState.nBuffers = nBuffers;
+    serverState.useUring = cmd.get<bool>("uring");
+    serverState.pacingSpin = sockopts.pacingSpin;
+    serverState.buffers.set_limit( maxBufMem );
+    serverState.buffers.set_hugepages( cmd.get<bool>("hugepages") );
+    serverState.buffers.set_idle_time( std::chrono::seconds(bufIdleTime) );
+
+    // Note: the order of declaration matters - the pools' destructors wait
+    //       for their running jobs, which may use the reactor and the other
+    //       pool
+    etdc::reactor              reactor;
+    etdc::thread_pool          ioPool;
+    etdc::thread_pool          cmdPool( std::max(4u, 2*std::thread::hardware_concurrency()) );
+    server_context             context{ serverState, reactor, cmdPool, ioPool };
+
+    std::thread                reactorThread = etdc::thread([&reactor]() {
+                                                    try {
+                                                        reactor.run();
+                                                    }
+                                                    catch( std::exception const& e ) {
+                                                        ETDCDEBUG(-1, "reactor thread got exception: " << e.what() << std::endl);
+                                                    }
+                                                });
+
     const string2socket_type_m mk_cmd ( port(4004), sockopts );
     const string2socket_type_m mk_data( port(8008), sockopts );
 
@@ -350,11 +432,11 @@ int main(int argc, char const*const*const argv) {
         auto srv = mk_data( datasrv );
         // Append the data server to the list of possible data servers
         serverState.dataaddrs.push_back( srv->getsockname(srv->__m_fd) );
-        serverState.add_thread(&data_server_thread<SIGUSR2>, srv, std::ref(serverState));
+        add_server(srv, context, &data_client<SIGUSR2>);
     }
 
     for(auto&& cmdsrv: cmd.get<std::list<std::string>>("command"))
-        serverState.add_thread(&command_server_thread<SIGUSR1>, mk_cmd(cmdsrv), std::ref(serverState));
+        add_server(mk_cmd(cmdsrv), context, &command_client<SIGUSR1>);
 
     // Now just wait ..
     killSigFuture.wait();
@@ -367,28 +449,33 @@ int main(int argc, char const*const*const argv) {
     // Before starting to process cancellations, set the cancel flag
     std::atomic_store(&serverState.cancelled, true);
 
-    for(auto& cancel: serverState.cancellations)
-        cancel();
+    reactor.stop();
+    reactorThread.join();
+    {
+        // Jobs remove their cancellation when done so we must hold the lock
+        etdc::scoped_lock lk(serverState.lock);
+        for(auto& cancel: serverState.cancellations)
+            cancel();
+    }
 
     // Now wait for all of them to finish?
+    ETDCDEBUG(1, "main: buffer pool " << serverState.buffers.stats() << endl);
     ETDCDEBUG(1, "main: terminating." << endl);
     return 0;
 }
 
 
 
-// New approach to command_server: there's just one (1) thread function:
-//   1. do blocking accept
-//   2. if fd accepted - spawn new thread with self state
-//   3. thread falls through to handle accepted client
-template <int KillSignal>
-void command_server_thread(etdc::etdc_fdptr pServer, etdc::etd_state& shared_state) {
-    // First things first: push ourselves on the list of cancellations
-    // But we'll unblock a signal for that such that we can let the
-    // cancellation function send a signal to us :D
+// Execute f() such that it can be cancelled at shutdown: the cancellation
+// closes the file descriptor and sends a signal to the thread executing
+// f() so it is kicked out of whatever blocking system call it is in.
+// Exceptions are logged, not propagated.
+template <int KillSignal, typename F>
+void run_cancellable(etdc::etdc_fdptr pFD, etdc::etd_state& shared_state, char const* what, F&& f) {
+    // We'll unblock a signal such that the cancellation function can
+    // send a signal to us :D
     pthread_t                       thisThread = ::pthread_self();
     etdc::UnBlock                   s({KillSignal});
-    etdc::etdc_fdptr                pClient{ pServer };
     etdc::cancellist_type::iterator ourCancellation;
 
     etdc::install_handler(dummy_signal_handler, {KillSignal});
@@ -396,133 +483,144 @@ void command_server_thread(etdc::etdc_fdptr pServer, etdc::etd_state& shared_sta
     {
         // used scoped lock to add ourselves to the list of cancellations
         etdc::scoped_lock lk(shared_state.lock);
+        if( std::atomic_load(&shared_state.cancelled) )
+            return;
         ourCancellation = shared_state.cancellations.insert( shared_state.cancellations.end(),
-                 [&](void) {
-                    // Atomically load the file descriptor we need to cancel
-                    etdc::etdc_fdptr  myFD = std::atomic_load(&pClient);
-
-                    ETDCDEBUG(2, "Cancellation fn/signalling thread for command fd=" << myFD->__m_fd << std::endl);
-                    myFD->close(myFD->__m_fd);
+                 [=](void) {
+                    ETDCDEBUG(2, "Cancellation fn/signalling thread for " << what << " fd=" << pFD->__m_fd << std::endl);
+                    pFD->close(pFD->__m_fd);
                     ::pthread_kill(thisThread, KillSignal); }
                );
     }
 
     try {
-        // Now we can get on with our lives
-        if( !std::atomic_load(&shared_state.cancelled) )
-            std::atomic_store(&pClient, pServer->accept(pServer->__m_fd));
-
-        // OK we accepted a client. Now spawn a new acceptor - unless we're calling it a day
-        if( !std::atomic_load(&shared_state.cancelled) )
-            shared_state.add_thread(&command_server_thread<KillSignal>, pServer, std::ref(shared_state));
-
-        if( !pClient )
-            throw std::runtime_error("No incoming command client?!");
-
-        // Now we fall through handling the client
-        auto peernm = pClient->getpeername(pClient->__m_fd);
-        ETDCDEBUG(2, "Incoming COMMAND from " << peernm << " [local " << pClient->getsockname(pClient->__m_fd) << "]" << endl);
-
-        // Command sockets typically do small messages so we set tcp_nodelay
-        // (if the protocol is TCP-like that is!)
-        if( get_protocol(peernm).find("tcp")!=std::string::npos )
-            etdc::setsockopt(pClient->__m_fd, etdc::tcp_nodelay{true});
-
-        dbgMap[get_protocol(peernm)](pClient, "client"); 
-
-        // Fall into ETDServerWrapper
-        etdc::ETDServerWrapper(pClient, std::ref(shared_state));
+        std::forward<F>(f)();
     }
     catch( std::exception const& e ) {
-        ETDCDEBUG(1, "command server thread got exception: " << e.what() << std::endl);
+        ETDCDEBUG(1, what << " got exception: " << e.what() << std::endl);
     }
     catch( ... ) {
-        ETDCDEBUG(1, "command server thread got unknown exception" << std::endl);
+        ETDCDEBUG(1, what << " got unknown exception" << std::endl);
     }
-    if( !std::atomic_load(&shared_state.cancelled) ) {
-        etdc::scoped_lock  lk(shared_state.lock);
-        shared_state.cancellations.erase( ourCancellation );
+    // main() holds the lock whilst executing the cancellations so after
+    // this no-one will signal this thread anymore
+    etdc::scoped_lock  lk(shared_state.lock);
+    shared_state.cancellations.erase( ourCancellation );
+}
+
+// Make the server accept clients and pass them on to onClient()
+void add_server(etdc::etdc_fdptr pServer, server_context& ctx, client_fn onClient) {
+    if( get_protocol(pServer->getsockname(pServer->__m_fd)).find("udt")!=std::string::npos ) {
+        // The thread's signal number does not matter much; it only
+        // interrupts its own accept(2)
+        ctx.state.add_thread(&udt_accept_thread<SIGUSR1>, pServer, std::ref(ctx), onClient);
+        return;
     }
-    ETDCDEBUG(1, "command server thread terminated" << endl);
-    return;
+    // The reactor tells us when there are clients waiting; the server is
+    // non-blocking so we can take all of them
+    ctx.reactor.add(pServer->__m_fd, [=, &ctx](void) {
+        try {
+            etdc::etdc_fdptr  pClient;
+
+            while( !std::atomic_load(&ctx.state.cancelled) && (pClient=pServer->accept(pServer->__m_fd)) ) {
+                // Some O/Ses let the accepted socket inherit O_NONBLOCK
+                pClient->setblocking(pClient->__m_fd, true);
+                onClient(pClient, ctx);
+            }
+        }
+        catch( std::exception const& e ) {
+            ETDCDEBUG(1, "accept failed: " << e.what() << std::endl);
+        }
+        ctx.reactor.rearm(pServer->__m_fd);
+    });
 }
 
-// We repeat for data_server threads
 template <int KillSignal>
-void data_server_thread(etdc::etdc_fdptr pServer, etdc::etd_state& shared_state) {
-    // First things first: push ourselves on the list of cancellations
-    // But we'll unblock a signal for that such that we can let the
-    // cancellation function send a signal to us :D
-    pthread_t                       thisThread = ::pthread_self();
-    etdc::UnBlock                   s({KillSignal});
-    etdc::etdc_fdptr                pClient{ pServer };
-    etdc::cancellist_type::iterator ourCancellation;
-
-    etdc::install_handler(dummy_signal_handler, {KillSignal});
+void udt_accept_thread(etdc::etdc_fdptr pServer, server_context& ctx, client_fn onClient) {
+    run_cancellable<KillSignal>(pServer, ctx.state, "UDT accept thread", [&](void) {
+        while( !std::atomic_load(&ctx.state.cancelled) ) {
+            etdc::etdc_fdptr  pClient = pServer->accept(pServer->__m_fd);
+
+            if( pClient )
+                onClient(pClient, ctx);
+        }
+    });
+    ETDCDEBUG(1, "UDT accept thread terminated" << endl);
+}
 
-    {
-        // used scoped lock to add ourselves to the list of cancellations
-        etdc::scoped_lock lk(shared_state.lock);
-        ourCancellation = shared_state.cancellations.insert( shared_state.cancellations.end(),
-                // cancellation function void(void):
-                [&](void) {
-                    // Atomically load the shared pointer
-                    // http://en.cppreference.com/w/cpp/memory/shared_ptr/atomic
-                    etdc::etdc_fdptr  myFD = std::atomic_load(&pClient);
-
-                    ETDCDEBUG(2, "Cancellation fn/signalling thread for data fd=" << myFD->__m_fd << std::endl);
-                    myFD->close(myFD->__m_fd);
-                    ::pthread_kill(thisThread, KillSignal); }
-            );
+// One step in the life of a command connection, executed on the command
+// pool or, when a transfer is involved, the I/O pool
+template <int KillSignal>
+void command_step(std::shared_ptr<etdc::ETDServerWrapper> session, server_context& ctx, bool isTransfer) {
+    using state_type = etdc::ETDServerWrapper::state_type;
+
+    etdc::etdc_fdptr  pClient = session->connection();
+    state_type        state   = state_type::Closed;
+
+    run_cancellable<KillSignal>(pClient, ctx.state, "command connection", [&](void) {
+        state = (isTransfer ? session->process(true) : session->read(false));
+    });
+
+    switch( state ) {
+        case state_type::Idle:
+            ctx.reactor.rearm(pClient->__m_fd);
+            break;
+        case state_type::Transfer:
+            ctx.ioPool.submit( [=, &ctx](void) { command_step<KillSignal>(session, ctx, true); } );
+            break;
+        case state_type::Closed:
+            // Must be done before the last reference to the session - and
+            // therefore the file descriptor - goes
+            ETDCDEBUG(2, "Command connection fd=" << pClient->__m_fd << " terminated" << endl);
+            ctx.reactor.remove(pClient->__m_fd);
+            // Releasing the session's transfers waits for the ones in
+            // progress; the command pool must not be held up by that
+            if( isTransfer )
+                session->close();
+            else
+                ctx.ioPool.submit( [=](void) { session->close(); } );
+            break;
     }
+}
 
-    try {
-        // Now we can get on with our lives - atomically store the client's
-        // file descriptor as soon as accept() returns
-        if( !std::atomic_load(&shared_state.cancelled) )
-            std::atomic_store(&pClient, pServer->accept(pServer->__m_fd));
-
-        // OK we accepted a client. Now spawn a new acceptor - unless we're calling it a day
-        if( !std::atomic_load(&shared_state.cancelled) )
-            shared_state.add_thread(&data_server_thread<KillSignal>, pServer, std::ref(shared_state));
-
-        if( !pClient )
-            throw std::runtime_error("No incoming data client?!");
-        // Now we fall through handling the client
-        auto peernm = pClient->getpeername(pClient->__m_fd);
-        ETDCDEBUG(2, "Incoming DATA from " << peernm << " [local " << pClient->getsockname(pClient->__m_fd) << "]" << endl);
-
-        // This is data connection so let's set a big sokkitbuffer
-        // Do not *assert* it - e.g. on Mac OSX (and maybe other *BSDs)
-        // asking for SO_RCVBUF > maximum will /fail/ and that's not our
-        // intent. We'd *like* to have a bigr 'n bettr SO_RCVBUF if you
-        // pretty please with sugar on top. But if we can't have it then
-        // that's not an error.
-        // Note: for UDT data channels we have already set RCVBUF
-        //if( get_protocol(peernm).find("tcp")!=std::string::npos )
-        //    etdc::setsockopt(pClient->__m_fd, etdc::so_rcvbuf{32*1024*1024}, etdc::so_sndbuf{32*1024*1024});
-#if 0
-        else
-            // udt
-            etdc::setsockopt(pClient->__m_fd, etdc::udt_sndbuf{32*1024*1024}, etdc::udt_rcvbuf{32*1024*1024},
-                                              etdc::udp_sndbuf{32*1024*1024}, etdc::udp_rcvbuf{32*1024*1024});
-#endif
-        dbgMap[get_protocol(peernm)](pClient, "client");
-        etdc::ETDDataServer(pClient, std::ref(shared_state));
-    }
-    catch( std::exception const& e ) {
-        ETDCDEBUG(1, "data server thread got exception: " << e.what() << std::endl);
-    }
-    catch( ... ) {
-        ETDCDEBUG(1, "data server thread got unknown exception" << std::endl);
-    }
-    // Deregister our cancellation - only if we weren't being cancelled.
-    if( !std::atomic_load(&shared_state.cancelled) ) {
-        etdc::scoped_lock  lk(shared_state.lock);
-        shared_state.cancellations.erase( ourCancellation );
+template <int KillSignal>
+void command_client(etdc::etdc_fdptr pClient, server_context& ctx) {
+    auto peernm = pClient->getpeername(pClient->__m_fd);
+    ETDCDEBUG(2, "Incoming COMMAND from " << peernm << " [local " << pClient->getsockname(pClient->__m_fd) << "]" << endl);
+
+    // Command sockets typically do small messages so we set tcp_nodelay
+    // (if the protocol is TCP-like that is!)
+    if( get_protocol(peernm).find("tcp")!=std::string::npos )
+        etdc::setsockopt(pClient->__m_fd, etdc::tcp_nodelay{true});
+
+    dbgMap[get_protocol(peernm)](pClient, "client");
+
+    if( get_protocol(peernm).find("udt")!=std::string::npos ) {
+        // Fall into ETDServerWrapper, which serves the client until it's done
+        ctx.ioPool.submit( [=, &ctx](void) {
+            run_cancellable<KillSignal>(pClient, ctx.state, "command connection",
+                                        [&](void) { etdc::ETDServerWrapper(pClient, std::ref(ctx.state)); });
+        } );
+        return;
     }
-    ETDCDEBUG(1, "data server thread terminated" << endl);
-    return;
+    auto session = std::make_shared<etdc::ETDServerWrapper>(etdc::ETDServerWrapper::deferred_type{}, pClient, std::ref(ctx.state));
+
+    ctx.reactor.add(pClient->__m_fd, [=, &ctx](void) {
+        ctx.cmdPool.submit( [=, &ctx](void) { command_step<KillSignal>(session, ctx, false); } );
+    });
+}
+
+template <int KillSignal>
+void data_client(etdc::etdc_fdptr pClient, server_context& ctx) {
+    auto peernm = pClient->getpeername(pClient->__m_fd);
+    ETDCDEBUG(2, "Incoming DATA from " << peernm << " [local " << pClient->getsockname(pClient->__m_fd) << "]" << endl);
+
+    // Note: the send/receive buffer sizes were set on the server socket
+    dbgMap[get_protocol(peernm)](pClient, "client");
+    ctx.ioPool.submit( [=, &ctx](void) {
+        run_cancellable<KillSignal>(pClient, ctx.state, "data connection",
+                                    [&](void) { etdc::ETDDataServer(pClient, std::ref(ctx.state)); });
+    } );
 }
 
 
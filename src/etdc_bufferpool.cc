@@ -0,0 +1,344 @@
+// Shared pool of (big) transfer buffers
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+
+// MAP_HUGETLB, MADV_HUGEPAGE are not POSIX; the Makefile explicitly
+// undefines _GNU_SOURCE so we must (re)define it before including anything
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <etdc_bufferpool.h>
+#include <etdc_assert.h>
+#include <etdc_debug.h>
+#include <etdc_thread.h>
+#include <reentrant.h>
+
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+namespace etdc {
+
+    namespace detail {
+        // Smallest size class is one (small) page
+        constexpr unsigned int minSizeClass  = 12;
+        // What MAP_HUGETLB will give us on most systems
+        constexpr size_t       hugePageSize  = 2*1024*1024;
+
+        static unsigned int size_class(size_t sz) {
+            unsigned int  cls = minSizeClass;
+            while( ((size_t)1 << cls) < sz ) {
+                cls++;
+                ETDCASSERT(cls<8*sizeof(size_t)-1, "buffer_pool: absurd buffer size " << sz);
+            }
+            return cls;
+        }
+
+        // The NUMA node the calling thread is running on, 0 if we can't tell
+        static unsigned int current_node( void ) {
+#if defined(__linux__) && defined(SYS_getcpu)
+            unsigned int  cpu, node;
+            if( ::syscall(SYS_getcpu, &cpu, &node, nullptr)==0 )
+                return node;
+#endif
+            return 0;
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //                      pooled_buffer
+    //////////////////////////////////////////////////////////////////////
+    pooled_buffer::pooled_buffer(pooled_buffer&& other):
+        __m_pool( other.__m_pool ), __m_ptr( other.__m_ptr ), __m_class( other.__m_class ), __m_node( other.__m_node )
+    {
+        other.__m_pool = nullptr;
+        other.__m_ptr  = nullptr;
+    }
+
+    pooled_buffer& pooled_buffer::operator=(pooled_buffer&& other) {
+        if( this!=&other ) {
+            this->release();
+            std::swap(__m_pool, other.__m_pool);
+            std::swap(__m_ptr, other.__m_ptr);
+            __m_class = other.__m_class;
+            __m_node  = other.__m_node;
+        }
+        return *this;
+    }
+
+    pooled_buffer::~pooled_buffer() {
+        this->release();
+    }
+
+    void pooled_buffer::release( void ) {
+        if( __m_pool && __m_ptr )
+            __m_pool->put(__m_ptr, __m_class, __m_node);
+        __m_pool = nullptr;
+        __m_ptr  = nullptr;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //                      buffer_pool
+    //////////////////////////////////////////////////////////////////////
+    buffer_pool::stats_type::stats_type():
+        nHit( 0 ), nRemoteHit( 0 ), nMiss( 0 ), nHuge( 0 ), nWait( 0 ), nTrim( 0 ), nExpire( 0 ),
+        bytesTrimmed( 0 ), bytesMapped( 0 ), bytesIdle( 0 ), bytesCap( 0 )
+    {}
+
+    buffer_pool::buffer_pool(std::chrono::seconds idle):
+        __m_cap( 0 ), __m_hugePages( false ), __m_stopping( false ), __m_idleTime( idle )
+    {}
+
+    buffer_pool::~buffer_pool() {
+        {
+            std::lock_guard<std::mutex>  lk( __m_lock );
+            __m_stopping = true;
+            __m_reaperCondition.notify_all();
+        }
+        if( __m_reaper.joinable() )
+            __m_reaper.join();
+        // Buffers still on loan are not ours to unmap
+        for(auto& idle: __m_idle)
+            for(auto const& b: idle.second)
+                ::munmap(b.ptr, (size_t)1 << idle.first.second);
+    }
+
+    void buffer_pool::set_limit(size_t maxBytes) {
+        std::lock_guard<std::mutex>  lk( __m_lock );
+        __m_cap = __m_stats.bytesCap = maxBytes;
+        __m_condition.notify_all();
+    }
+
+    void buffer_pool::set_hugepages(bool hp) {
+        std::lock_guard<std::mutex>  lk( __m_lock );
+        __m_hugePages = hp;
+    }
+
+    void buffer_pool::set_idle_time(std::chrono::seconds idle) {
+        std::lock_guard<std::mutex>  lk( __m_lock );
+        __m_idleTime = idle;
+        __m_reaperCondition.notify_all();
+    }
+
+    buffer_pool::stats_type buffer_pool::stats( void ) const {
+        std::lock_guard<std::mutex>  lk( __m_lock );
+        return __m_stats;
+    }
+
+    pooled_buffers_type buffer_pool::get(size_t n, size_t sz) {
+        ETDCASSERT(n>0 && sz>0, "buffer_pool: need at least one buffer of non-zero size");
+
+        const unsigned int            cls  = detail::size_class(sz);
+        const size_t                  csz  = (size_t)1 << cls;
+        const unsigned int            node = detail::current_node();
+        std::unique_lock<std::mutex>  lk( __m_lock );
+
+        ETDCASSERT(__m_cap==0 || n*csz<=__m_cap, "buffer_pool: " << n << " x " << csz << " bytes exceeds the limit of " << __m_cap);
+
+        // How many of the requested buffers are available idle, in any node?
+        auto    nIdle = [&]( void ) {
+                    size_t  rv = 0;
+                    for(auto const& idle: __m_idle)
+                        if( idle.first.second==cls )
+                            rv += idle.second.size();
+                    return rv;
+                };
+        size_t  nNew;
+        while( true ) {
+            nNew = n - std::min(n, nIdle());
+            if( __m_cap==0 || __m_stats.bytesMapped + nNew*csz<=__m_cap )
+                break;
+            // Make room by giving back memory we're sitting on
+            if( this->trim(cls, __m_stats.bytesMapped + nNew*csz - __m_cap) )
+                continue;
+            __m_stats.nWait++;
+            ETDCDEBUG(3, "buffer_pool/waiting for " << nNew << " x " << csz << " bytes to become available" << std::endl);
+            __m_condition.wait(lk);
+        }
+
+        // Idle ones from the local node first
+        pooled_buffers_type  rv;
+
+        rv.reserve( n );
+        auto                 take = [&](key_type const& key, bool remote) {
+                                 auto  ptr = __m_idle.find( key );
+                                 while( rv.size()<n-nNew && ptr!=__m_idle.end() && !ptr->second.empty() ) {
+                                     rv.emplace_back( pooled_buffer(this, ptr->second.back().ptr, cls, key.first) );
+                                     ptr->second.pop_back();
+                                     __m_stats.bytesIdle -= csz;
+                                     __m_stats.nHit++;
+                                     __m_stats.nRemoteHit += (remote ? 1 : 0);
+                                 }
+                             };
+        take(key_type(node, cls), false);
+        for(auto const& idle: __m_idle)
+            if( idle.first.second==cls && idle.first.first!=node && rv.size()<n-nNew )
+                take(idle.first, true);
+
+        // Reserve the memory for the new ones and map + fault them in
+        // w/o holding the lock
+        const bool  tryHuge = __m_hugePages;
+        size_t      nMapped = 0, nHuge = 0;
+
+        __m_stats.bytesMapped += nNew*csz;
+        lk.unlock();
+        try {
+            for( ; nMapped<nNew; nMapped++) {
+                bool   huge;
+                char*  ptr = buffer_pool::map(csz, tryHuge, huge);
+                rv.emplace_back( pooled_buffer(this, ptr, cls, node) );
+                nHuge += (huge ? 1 : 0);
+            }
+        }
+        catch( ... ) {
+            lk.lock();
+            __m_stats.bytesMapped -= (nNew - nMapped)*csz;
+            __m_stats.nMiss       += nMapped;
+            __m_stats.nHuge       += nHuge;
+            lk.unlock();
+            throw;
+        }
+        if( nNew ) {
+            lk.lock();
+            __m_stats.nMiss += nMapped;
+            __m_stats.nHuge += nHuge;
+            ETDCDEBUG(4, "buffer_pool/mapped " << nNew << " x " << csz << " bytes on node " << node << " [" << __m_stats << "]" << std::endl);
+        }
+        return rv;
+    }
+
+    void buffer_pool::put(char* ptr, unsigned int cls, unsigned int node) {
+        std::lock_guard<std::mutex>  lk( __m_lock );
+        __m_idle[ key_type(node, cls) ].emplace_back( ptr, clock_type::now() );
+        __m_stats.bytesIdle += (size_t)1 << cls;
+        __m_condition.notify_all();
+        // Only pools that actually hand out buffers need someone to keep
+        // an eye on the idle ones
+        if( !__m_reaper.joinable() && !__m_stopping )
+            __m_reaper = etdc::thread(&buffer_pool::reaper, this);
+        else if( __m_stats.bytesIdle==((size_t)1 << cls) )
+            __m_reaperCondition.notify_all();
+    }
+
+    // Release idle buffers of other size classes until at least 'needed'
+    // bytes were freed. Must be called with the lock held. Returns true if
+    // anything was released.
+    bool buffer_pool::trim(unsigned int keepClass, size_t needed) {
+        size_t  freed = 0;
+        for(auto& idle: __m_idle) {
+            const size_t  csz = (size_t)1 << idle.first.second;
+            while( idle.first.second!=keepClass && !idle.second.empty() && freed<needed ) {
+                ::munmap(idle.second.back().ptr, csz);
+                idle.second.pop_back();
+                __m_stats.bytesMapped  -= csz;
+                __m_stats.bytesIdle    -= csz;
+                __m_stats.bytesTrimmed += csz;
+                __m_stats.nTrim++;
+                freed += csz;
+            }
+        }
+        return freed>0;
+    }
+
+    // Release the buffers that were returned longer than the idle time
+    // ago. Must be called with the lock held and a non-zero idle time.
+    // Returns when the next buffer is due.
+    buffer_pool::clock_type::time_point buffer_pool::expire(clock_type::time_point now) {
+        const auto  cutoff = now - __m_idleTime;
+        auto        next   = clock_type::time_point::max();
+        size_t      freed  = 0;
+
+        for(auto& idle: __m_idle) {
+            const size_t  csz = (size_t)1 << idle.first.second;
+            auto          old = idle.second.begin();
+
+            for( ; old!=idle.second.end() && old->since<=cutoff; old++) {
+                ::munmap(old->ptr, csz);
+                __m_stats.nExpire++;
+                freed += csz;
+            }
+            idle.second.erase(idle.second.begin(), old);
+            if( !idle.second.empty() )
+                next = std::min(next, idle.second.front().since + __m_idleTime);
+        }
+        if( freed ) {
+            __m_stats.bytesMapped  -= freed;
+            __m_stats.bytesIdle    -= freed;
+            __m_stats.bytesTrimmed += freed;
+            // Someone may be waiting for the cap
+            __m_condition.notify_all();
+            ETDCDEBUG(4, "buffer_pool/released " << freed << " idle bytes [" << __m_stats << "]" << std::endl);
+        }
+        return next;
+    }
+
+    void buffer_pool::reaper( void ) {
+        std::unique_lock<std::mutex>  lk( __m_lock );
+
+        while( !__m_stopping ) {
+            if( __m_idleTime.count()==0 || __m_stats.bytesIdle==0 ) {
+                __m_reaperCondition.wait(lk);
+                continue;
+            }
+            const auto  next = this->expire( clock_type::now() );
+            if( next==clock_type::time_point::max() )
+                __m_reaperCondition.wait(lk);
+            else
+                __m_reaperCondition.wait_until(lk, next);
+        }
+    }
+
+    char* buffer_pool::map(size_t sz, bool tryHuge, bool& huge) {
+        void*   ptr = MAP_FAILED;
+
+        huge = false;
+#ifdef MAP_HUGETLB
+        // Explicit huge pages come pre-faulted
+        if( tryHuge && (sz % detail::hugePageSize)==0 ) {
+            ptr  = ::mmap(nullptr, sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|MAP_POPULATE, -1, 0);
+            huge = (ptr!=MAP_FAILED);
+        }
+#endif
+        if( ptr==MAP_FAILED ) {
+            ptr = ::mmap(nullptr, sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+            ETDCSYSCALL(ptr!=MAP_FAILED, "buffer_pool: mmap(" << sz << " bytes) - " << etdc::strerror(errno));
+#ifdef MADV_HUGEPAGE
+            if( tryHuge )
+                (void)::madvise(ptr, sz, MADV_HUGEPAGE);
+#endif
+            // Fault the pages in now, from this thread, rather than
+            // during the transfer
+            const size_t  pgSz = (size_t)::sysconf(_SC_PAGESIZE);
+            for(size_t i=0; i<sz; i+=pgSz)
+                static_cast<volatile char*>(ptr)[i] = 0;
+        }
+        return static_cast<char*>(ptr);
+    }
+
+    std::ostream& operator<<(std::ostream& os, buffer_pool::stats_type const& s) {
+        return os << "hit=" << s.nHit << " remote-hit=" << s.nRemoteHit << " miss=" << s.nMiss << " huge=" << s.nHuge
+                  << " wait=" << s.nWait << " trim=" << s.nTrim << " expire=" << s.nExpire
+                  << " trimmed=" << s.bytesTrimmed
+                  << " mapped=" << s.bytesMapped << " idle=" << s.bytesIdle << " cap=" << s.bytesCap;
+    }
+} // namespace etdc
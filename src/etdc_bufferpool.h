@@ -0,0 +1,164 @@
+// Shared pool of (big) transfer buffers
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_BUFFERPOOL_H
+#define ETDC_BUFFERPOOL_H
+
+// C++ headers
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <ostream>
+#include <utility>
+#include <condition_variable>
+
+namespace etdc {
+
+    class buffer_pool;
+
+    // A buffer on loan from a buffer_pool. It goes back to the pool when
+    // it is destroyed. The buffer may be larger than was asked for.
+    class pooled_buffer {
+        public:
+            pooled_buffer(): __m_pool( nullptr ), __m_ptr( nullptr ), __m_class( 0 ), __m_node( 0 ) {}
+            pooled_buffer(pooled_buffer&& other);
+            pooled_buffer& operator=(pooled_buffer&& other);
+            ~pooled_buffer();
+
+            pooled_buffer(pooled_buffer const&)            = delete;
+            pooled_buffer& operator=(pooled_buffer const&) = delete;
+
+            char*   get( void ) const { return __m_ptr; }
+
+        private:
+            friend class buffer_pool;
+
+            pooled_buffer(buffer_pool* pool, char* ptr, unsigned int cls, unsigned int node):
+                __m_pool( pool ), __m_ptr( ptr ), __m_class( cls ), __m_node( node )
+            {}
+
+            void    release( void );
+
+            buffer_pool*  __m_pool;
+            char*         __m_ptr;
+            unsigned int  __m_class, __m_node;
+    };
+
+    using pooled_buffers_type = std::vector<pooled_buffer>;
+
+    // Transfers all need a handful of big buffers. Instead of allocating
+    // (and page faulting) them for each file, they're borrowed from here.
+    //
+    // Buffers come in size classes of powers of two. New memory is
+    // mmap(2)ed, pre-faulted by the thread that asked for it - so, with
+    // the kernel's default first-touch policy, it lives on that thread's
+    // NUMA node - and optionally backed by huge pages. Idle buffers are
+    // kept per node and a request is preferably served from the node the
+    // requesting thread runs on.
+    //
+    // If a cap on the total amount of memory is set, a request that does
+    // not fit first releases idle buffers of other size classes and then
+    // waits for buffers to be returned.
+    //
+    // Buffers that have not been used for a while are unmapped by a
+    // background thread, such that a burst of transfers does not keep
+    // the peak amount of memory mapped forever.
+    class buffer_pool {
+        public:
+            struct stats_type {
+                size_t  nHit;           // requests for a buffer served from the pool
+                size_t  nRemoteHit;     // ... but from another NUMA node
+                size_t  nMiss;          // newly mapped buffers
+                size_t  nHuge;          // of which backed by MAP_HUGETLB pages
+                size_t  nWait;          // number of times a request had to wait for the cap
+                size_t  nTrim;          // idle buffers released to make room
+                size_t  nExpire;        // idle buffers released because they weren't used for a while
+                size_t  bytesTrimmed;   // total released by either of the above
+                size_t  bytesMapped;    // total
+                size_t  bytesIdle;      // of which not in use
+                size_t  bytesCap;       // 0 = unlimited
+
+                stats_type();
+            };
+
+            explicit buffer_pool(std::chrono::seconds idle = std::chrono::seconds(60));
+            ~buffer_pool();
+
+            buffer_pool(buffer_pool const&)            = delete;
+            buffer_pool& operator=(buffer_pool const&) = delete;
+
+            // Cap the total amount of memory mapped (0 = no limit).
+            // Existing buffers are not taken away.
+            void                set_limit(size_t maxBytes);
+            // Try MAP_HUGETLB first for buffers that are a multiple of the
+            // huge page size; if that fails, ask for transparent huge pages
+            void                set_hugepages(bool hp);
+            // Unmap buffers that have been idle for longer than this
+            // (0 = keep them forever)
+            void                set_idle_time(std::chrono::seconds idle);
+
+            // Get n buffers of at least sz bytes each, all or nothing.
+            // May block if a cap is set. Throws if the request can never
+            // be satisfied or memory could not be mapped.
+            pooled_buffers_type get(size_t n, size_t sz);
+
+            stats_type          stats( void ) const;
+
+        private:
+            friend class pooled_buffer;
+
+            using clock_type = std::chrono::steady_clock;
+
+            struct idle_buffer {
+                char*                   ptr;
+                clock_type::time_point  since;
+
+                idle_buffer(char* p, clock_type::time_point t): ptr( p ), since( t ) {}
+            };
+
+            // node, size class. Per key the buffers are in the order they
+            // were returned, so the ones idle the longest are at the front
+            using key_type  = std::pair<unsigned int, unsigned int>;
+            using idle_type = std::map<key_type, std::vector<idle_buffer>>;
+
+            void                put(char* ptr, unsigned int cls, unsigned int node);
+            static char*        map(size_t sz, bool tryHuge, bool& huge);
+            bool                trim(unsigned int keepClass, size_t needed);
+            clock_type::time_point expire(clock_type::time_point now);
+            void                reaper( void );
+
+            mutable std::mutex       __m_lock;
+            std::condition_variable  __m_condition;
+            std::condition_variable  __m_reaperCondition;
+            idle_type                __m_idle;
+            size_t                   __m_cap;
+            bool                     __m_hugePages;
+            bool                     __m_stopping;
+            std::chrono::seconds     __m_idleTime;
+            std::thread              __m_reaper;
+            stats_type               __m_stats;
+    };
+
+    std::ostream& operator<<(std::ostream& os, buffer_pool::stats_type const& s);
+} // namespace etdc
+
+#endif
@@ -0,0 +1,120 @@
+// Selection of the congestion control of UDT data channels
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_CONGESTION_H
+#define ETDC_CONGESTION_H
+
+#include <etdc_assert.h>
+#include <etdc_stringutil.h>
+
+// C++ headers
+#include <map>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+namespace etdc {
+
+    // The congestion control algorithms a UDT data channel can use. The
+    // values go over the wire (data header, see etdc_dataheader.h).
+    //   Default: UDT's own, without rate limit; on a fresh connection nothing is changed
+    //   UDT:     the UDT library's own AIMD
+    //   Fixed:   constant rate, ignores loss - needs a rate
+    //   Delay:   keeps the queueing delay low, ignores loss w/o queue
+    //   BBR:     model based, paces at the measured bottleneck bandwidth
+    enum class cc_type : uint8_t {
+        Default = 0, UDT = 1, Fixed = 2, Delay = 3, BBR = 4
+    };
+
+    static const std::map<cc_type, std::string> cc2string{
+        {cc_type::Default, "default"}, {cc_type::UDT, "udt"}, {cc_type::Fixed, "fixed"},
+        {cc_type::Delay,   "delay"},   {cc_type::BBR, "bbr"} };
+
+    template <typename... Traits>
+    std::basic_ostream<Traits...>& operator<<(std::basic_ostream<Traits...>& os, cc_type const& cc) {
+        auto const ptr = cc2string.find( cc );
+        return os << (ptr==std::end(cc2string) ? "<invalid cc_type>" : ptr->second);
+    }
+
+    // Unrecognized names become cc_type(-1); cc2string can be used to check
+    template <typename... Traits>
+    std::basic_istream<Traits...>& operator>>(std::basic_istream<Traits...>& is, cc_type& cc) {
+        std::string  cc_s;
+        is >> cc_s;
+        auto const ptr = std::find_if(std::begin(cc2string), std::end(cc2string),
+                                      [&](std::pair<const cc_type, std::string> const& p) { return etdc::stricmp(cc_s, p.second); });
+        return (ptr==std::end(cc2string) ? cc = static_cast<cc_type>(-1) : cc = ptr->first), is;
+    }
+
+    // What the client asked for for a transfer. The MSS and buffer size
+    // apply to the data connections the transfer opens; only the congestion
+    // control and rate go in the data header.
+    struct ccspec_type {
+        cc_type       algorithm;
+        uint64_t      rate;         // bits per second, 0 = no limit
+        unsigned int  mss;          // UDT maximum segment size, 0 = the server's
+        size_t        bufSize;      // send/receive buffer size, 0 = the server's
+
+        ccspec_type(cc_type a = cc_type::Default, uint64_t r = 0):
+            algorithm( a ), rate( r ), mss( 0 ), bufSize( 0 )
+        {}
+
+        bool is_default_cc( void ) const {
+            return algorithm==cc_type::Default && rate==0;
+        }
+        bool is_default( void ) const {
+            return is_default_cc() && mss==0 && bufSize==0;
+        }
+    };
+
+    template <typename... Traits>
+    std::basic_ostream<Traits...>& operator<<(std::basic_ostream<Traits...>& os, ccspec_type const& cc) {
+        os << cc.algorithm;
+        if( cc.rate )
+            os << "@" << cc.rate << "bps";
+        if( cc.mss )
+            os << " mss=" << cc.mss;
+        if( cc.bufSize )
+            os << " buf=" << cc.bufSize;
+        return os;
+    }
+
+    // Decode a rate in bits per second: a number with an optional k, M, G
+    // or T (powers of 1000) suffix, e.g. "8G" or "2.5M". A trailing "bps"
+    // is allowed.
+    inline uint64_t str2rate(std::string const& s) {
+        static const std::string  multipliers{ "kMGT" };
+        char*                     eptr;
+        double                    rate = ::strtod(s.c_str(), &eptr);
+        std::string               unit( eptr );
+
+        ETDCASSERT(eptr!=s.c_str() && rate>=0, "Invalid rate '" << s << "'");
+        if( !unit.empty() && multipliers.find(unit[0])!=std::string::npos ) {
+            for(auto m = multipliers.find(unit[0])+1; m>0; m--)
+                rate *= 1000;
+            unit.erase(0, 1);
+        }
+        ETDCASSERT(unit.empty() || unit=="bps", "Invalid unit in rate '" << s << "'");
+        return (uint64_t)rate;
+    }
+} // namespace etdc
+
+#endif
@@ -0,0 +1,143 @@
+// Fixed size, binary, header in front of the bytes on a data connection
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <etdc_dataheader.h>
+#include <etdc_assert.h>
+
+// C++ headers
+#include <array>
+#include <limits>
+#include <cstring>
+
+namespace etdc {
+
+    // In-class constexpr statics still need a definition if odr-used
+    constexpr size_t        dataheader_type::size;
+    constexpr size_t        dataheader_type::maxUUIDLen;
+    constexpr uint32_t      dataheader_type::magic;
+    constexpr unsigned char dataheader_type::magicByte;
+    constexpr uint8_t       dataheader_type::version;
+    constexpr uint8_t       dataheader_type::flagPush;
+    constexpr uint8_t       dataheader_type::flagRanged;
+
+    namespace detail {
+        // Always big endian on the wire, whatever the host
+        static void put_u32(unsigned char* p, uint32_t v) {
+            for(int i=3; i>=0; i--, v>>=8)
+                p[i] = (unsigned char)(v & 0xff);
+        }
+        static void put_u64(unsigned char* p, uint64_t v) {
+            for(int i=7; i>=0; i--, v>>=8)
+                p[i] = (unsigned char)(v & 0xff);
+        }
+        static uint32_t get_u32(unsigned char const* p) {
+            uint32_t  v{ 0 };
+            for(int i=0; i<4; i++)
+                v = (v<<8) | p[i];
+            return v;
+        }
+        static uint64_t get_u64(unsigned char const* p) {
+            uint64_t  v{ 0 };
+            for(int i=0; i<8; i++)
+                v = (v<<8) | p[i];
+            return v;
+        }
+
+        using crctable_type = std::array<uint32_t, 256>;
+
+        static crctable_type mk_crc32c_table( void ) {
+            // Reversed Castagnoli polynomial
+            crctable_type  t;
+            for(uint32_t i=0; i<256; i++) {
+                uint32_t  c = i;
+                for(int k=0; k<8; k++)
+                    c = (c & 1) ? (c>>1) ^ 0x82F63B78 : (c>>1);
+                t[i] = c;
+            }
+            return t;
+        }
+
+        // Field offsets
+        constexpr size_t  offMagic   =  0;
+        constexpr size_t  offVersion =  4;
+        constexpr size_t  offFlags   =  5;
+        constexpr size_t  offUUIDLen =  6;
+        constexpr size_t  offCC      =  7;
+        constexpr size_t  offUUID    =  8;
+        constexpr size_t  offOffset  = 40;
+        constexpr size_t  offSize    = 48;
+        constexpr size_t  offRate    = 56;
+        constexpr size_t  offCRC     = 60;
+    }
+
+    uint32_t crc32c(unsigned char const* buf, size_t n) {
+        static const detail::crctable_type  table = detail::mk_crc32c_table();
+        uint32_t                            crc = 0xffffffff;
+
+        while( n-- )
+            crc = table[(crc ^ *buf++) & 0xff] ^ (crc>>8);
+        return crc ^ 0xffffffff;
+    }
+
+    void encode_dataheader(dataheader_type const& hdr, unsigned char* buf) {
+        ETDCASSERT(hdr.uuid.size()<=dataheader_type::maxUUIDLen, "encode_dataheader: UUID '" << hdr.uuid << "' too long");
+        ETDCASSERT(hdr.sz>=0 && hdr.offset>=0 && hdr.offset<=std::numeric_limits<off_t>::max()-hdr.sz,
+                   "encode_dataheader: invalid file range " << hdr.offset << " + " << hdr.sz);
+        // Rounded up such that a low rate doesn't become "no limit"
+        const uint64_t  kbps = (hdr.cc.rate + 999)/1000;
+        ETDCASSERT(kbps<=std::numeric_limits<uint32_t>::max(), "encode_dataheader: rate " << hdr.cc.rate << "bps too high");
+
+        ::memset(buf, 0, dataheader_type::size);
+        detail::put_u32(buf + detail::offMagic, dataheader_type::magic);
+        buf[detail::offVersion] = dataheader_type::version;
+        buf[detail::offFlags]   = (hdr.push ? dataheader_type::flagPush : 0) | (hdr.ranged ? dataheader_type::flagRanged : 0);
+        buf[detail::offUUIDLen] = (unsigned char)hdr.uuid.size();
+        buf[detail::offCC]      = (unsigned char)hdr.cc.algorithm;
+        ::memcpy(buf + detail::offUUID, hdr.uuid.data(), hdr.uuid.size());
+        detail::put_u64(buf + detail::offOffset, (uint64_t)(hdr.ranged ? hdr.offset : 0));
+        detail::put_u64(buf + detail::offSize, (uint64_t)hdr.sz);
+        detail::put_u32(buf + detail::offRate, (uint32_t)kbps);
+        detail::put_u32(buf + detail::offCRC, crc32c(buf, detail::offCRC));
+    }
+
+    dataheader_type decode_dataheader(unsigned char const* buf) {
+        ETDCASSERT(detail::get_u32(buf + detail::offMagic)==dataheader_type::magic, "decode_dataheader: not a data header");
+        ETDCASSERT(detail::get_u32(buf + detail::offCRC)==crc32c(buf, detail::offCRC), "decode_dataheader: CRC mismatch");
+        ETDCASSERT(buf[detail::offVersion]==dataheader_type::version,
+                   "decode_dataheader: unsupported version " << (unsigned int)buf[detail::offVersion]);
+
+        const uint8_t   flags   = buf[detail::offFlags];
+        const size_t    uuidLen = buf[detail::offUUIDLen];
+        const uint64_t  offset  = detail::get_u64(buf + detail::offOffset);
+        const uint64_t  sz      = detail::get_u64(buf + detail::offSize);
+        const cc_type   cc      = static_cast<cc_type>(buf[detail::offCC]);
+        const uint64_t  rate    = 1000*(uint64_t)detail::get_u32(buf + detail::offRate);
+
+        ETDCASSERT((flags & ~(dataheader_type::flagPush|dataheader_type::flagRanged))==0,
+                   "decode_dataheader: unknown flags " << (unsigned int)flags);
+        ETDCASSERT(uuidLen>0 && uuidLen<=dataheader_type::maxUUIDLen, "decode_dataheader: invalid UUID length " << uuidLen);
+        // They have to fit in an off_t, and so must the end of the range
+        ETDCASSERT(sz<=(uint64_t)std::numeric_limits<off_t>::max() && offset<=(uint64_t)std::numeric_limits<off_t>::max()-sz,
+                   "decode_dataheader: invalid file range " << offset << " + " << sz);
+        ETDCASSERT(cc2string.find(cc)!=cc2string.end(), "decode_dataheader: unknown congestion control " << (unsigned int)buf[detail::offCC]);
+        return dataheader_type(uuid_type((char const*)buf + detail::offUUID, uuidLen), (off_t)sz,
+                               (flags & dataheader_type::flagPush)!=0, (flags & dataheader_type::flagRanged)!=0, (off_t)offset,
+                               ccspec_type(cc, rate));
+    }
+} // namespace etdc
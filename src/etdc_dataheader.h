@@ -0,0 +1,94 @@
+// Fixed size, binary, header in front of the bytes on a data connection
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_DATAHEADER_H
+#define ETDC_DATAHEADER_H
+
+#include <etdc_uuid.h>
+#include <etdc_congestion.h>
+
+// C++ headers
+#include <cstdint>
+#include <cstddef>
+
+// Plain-old-C
+#include <sys/types.h>
+
+namespace etdc {
+
+    // The alternative to the text "{ uuid:..., sz:... }" header. Because
+    // it has a fixed size the receiver can read exactly the header and
+    // hand the connection, w/o any leftover bytes, to the copy routine.
+    //
+    // Layout on the wire (all integers big endian):
+    //   0  u32   magic
+    //   4  u8    version
+    //   5  u8    flags
+    //   6  u8    length of the uuid
+    //   7  u8    congestion control (cc_type, 0 = default)
+    //   8  32 x  uuid, zero padded
+    //  40  u64   offset (only meaningful if flagRanged is set)
+    //  48  u64   number of bytes following the header
+    //  56  u32   rate limit in kbit/s (0 = none)
+    //  60  u32   CRC32C of bytes 0..59
+    //
+    // The first byte of the magic can never be '{' so the receiver can
+    // tell the formats apart by looking at the first byte.
+    // The congestion control fields were reserved (zero) before, which
+    // decodes as "leave the data channel as it is".
+    struct dataheader_type {
+        constexpr static size_t        size          = 64;
+        constexpr static size_t        maxUUIDLen    = 32;
+        constexpr static uint32_t      magic         = 0xE7DCDA7A;
+        constexpr static unsigned char magicByte     = 0xE7;
+        constexpr static uint8_t       version       = 1;
+
+        // The flags
+        constexpr static uint8_t       flagPush      = 0x1;
+        constexpr static uint8_t       flagRanged    = 0x2;
+
+        uuid_type   uuid;
+        off_t       sz;
+        bool        push;
+        bool        ranged;
+        off_t       offset;
+        // The sending end of the data channel applies this
+        ccspec_type cc;
+
+        dataheader_type(uuid_type const& u, off_t s, bool p, bool r = false, off_t o = 0, ccspec_type const& c = ccspec_type()):
+            uuid( u ), sz( s ), push( p ), ranged( r ), offset( o ), cc( c )
+        {}
+    };
+
+    // Format the header into buf, which must have room for
+    // dataheader_type::size bytes. Throws if the header is not
+    // representable (e.g. uuid too long, negative values, a range that
+    // ends beyond the largest off_t, too high a rate)
+    void            encode_dataheader(dataheader_type const& hdr, unsigned char* buf);
+
+    // Decode dataheader_type::size bytes. Throws if the magic, version
+    // or CRC don't match, offset + size does not fit in an off_t or the
+    // congestion control is unknown
+    dataheader_type decode_dataheader(unsigned char const* buf);
+
+    // CRC32C (Castagnoli) over n bytes
+    uint32_t        crc32c(unsigned char const* buf, size_t n);
+} // namespace etdc
+
+#endif
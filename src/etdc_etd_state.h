@@ -26,6 +26,7 @@
 #include <etdc_thread.h>
 #include <utilities.h>
 #include <etdc_stringutil.h>
+#include <etdc_bufferpool.h>
 
 // Standard C++ headers
 #include <map>
@@ -83,39 +84,262 @@ namespace etdc {
     }
 
 
+    // A transfer can be locked exclusively - one thread does all I/O on
+    // the file - or in parts: each of a number of threads owns a disjoint
+    // byte range [begin, end) of it (parallel data streams).
+    // The exclusive part implements lock()/try_lock()/unlock() such that it
+    // can be used with std::unique_lock<>. Byte ranges are held via
+    // range_guard (see below). Waiters sleep until whoever is in the way
+    // has unlocked; they are served in order of arrival such that a
+    // thread that unlocks and immediately locks again cannot starve the
+    // others.
+    class range_lock {
+        public:
+            using range_type = std::pair<off_t, off_t>;
+
+            range_lock(): __m_exclusive( false ), __m_ticket( 0 ), __m_serving( 0 ) {}
+
+            range_lock(range_lock const&)            = delete;
+            range_lock& operator=(range_lock const&) = delete;
+
+            void lock( void ) {
+                std::unique_lock<std::mutex> lk( __m_mutex );
+                const unsigned long          ticket = __m_ticket++;
+                __m_condition.wait(lk, [&](){ return ticket==__m_serving && this->can_lock(); });
+                __m_exclusive = true;
+                this->next();
+            }
+            bool try_lock( void ) {
+                std::lock_guard<std::mutex> lk( __m_mutex );
+                return __m_ticket==__m_serving && this->can_lock() && (__m_exclusive = true);
+            }
+            void unlock( void ) {
+                std::lock_guard<std::mutex> lk( __m_mutex );
+                __m_exclusive = false;
+                __m_condition.notify_all();
+            }
+
+            // Waits until not exclusively locked and [b, e) does not
+            // overlap with any range already held
+            void lock_range(off_t b, off_t e) {
+                std::unique_lock<std::mutex> lk( __m_mutex );
+                const unsigned long          ticket = __m_ticket++;
+                __m_condition.wait(lk, [&](){ return ticket==__m_serving && this->can_lock_range(b, e); });
+                __m_ranges.emplace_back(b, e);
+                this->next();
+            }
+            void unlock_range(off_t b, off_t e) {
+                std::lock_guard<std::mutex> lk( __m_mutex );
+                auto  ptr = std::find(__m_ranges.begin(), __m_ranges.end(), range_type(b, e));
+                if( ptr!=__m_ranges.end() )
+                    __m_ranges.erase( ptr );
+                __m_condition.notify_all();
+            }
+
+        private:
+            bool                    __m_exclusive;
+            unsigned long           __m_ticket;  // next one to hand out
+            unsigned long           __m_serving; // the one that may lock
+            std::list<range_type>   __m_ranges;
+            std::mutex              __m_mutex;
+            std::condition_variable __m_condition;
+
+            // The next in line may be able to lock as well (non-overlapping range)
+            void next( void ) {
+                __m_serving++;
+                __m_condition.notify_all();
+            }
+
+            bool can_lock( void ) const {
+                return !__m_exclusive && __m_ranges.empty();
+            }
+            bool can_lock_range(off_t b, off_t e) const {
+                if( __m_exclusive )
+                    return false;
+                for(auto const& r: __m_ranges)
+                    if( b<r.second && r.first<e )
+                        return false;
+                return true;
+            }
+    };
+
+    // Locks a byte range on construction, releases it on destruction.
+    class range_guard {
+        public:
+            range_guard(): __m_lock( nullptr ), __m_range( 0, 0 ) {}
+            range_guard(range_lock& l, off_t b, off_t e):
+                __m_lock( &l ), __m_range( b, e )
+            { l.lock_range(b, e); }
+            range_guard(range_guard&& other):
+                __m_lock( other.__m_lock ), __m_range( other.__m_range )
+            { other.__m_lock = nullptr; }
+
+            range_guard(range_guard const&)            = delete;
+            range_guard& operator=(range_guard const&) = delete;
+
+            range_guard& operator=(range_guard&& other) {
+                if( this!=&other ) {
+                    this->release();
+                    std::swap(__m_lock, other.__m_lock);
+                    __m_range = other.__m_range;
+                }
+                return *this;
+            }
+
+            bool owns_range( void ) const { return __m_lock!=nullptr; }
+
+            ~range_guard() { this->release(); }
+
+        private:
+            range_lock*             __m_lock;
+            range_lock::range_type  __m_range;
+
+            void release( void ) {
+                if( __m_lock )
+                    __m_lock->unlock_range(__m_range.first, __m_range.second);
+                __m_lock = nullptr;
+            }
+    };
+
     // We keep per-transfer properties in here
     struct transferprops_type {
         std::string                 path;
         etdc::etdc_fdptr            fd;
         const openmode_type         openMode;
-        std::mutex                  lock;
+        range_lock                  lock;
+        // Set, under the lock, by whoever removes the transfer. Threads
+        // that were waiting for the lock must check it
+        bool                        removed;
 
-        // we cannot be copied or default constructed! (because of our unique_ptr)
+        // we cannot be copied or default constructed! (because of our lock)
         transferprops_type()                          = delete;
+        transferprops_type(transferprops_type const&) = delete;
 
         transferprops_type(etdc::etdc_fdptr efd, std::string const& p, openmode_type om):
-            path(p), fd(efd), openMode(om)
+            path(p), fd(efd), openMode(om), removed(false)
         {}
-    }; 
+    };
+    using transferptr_type = std::shared_ptr<transferprops_type>;
+
+    // All transfers of all clients, by UUID. Lookups only lock the shard
+    // the UUID hashes to; the transfer itself stays alive for as long as
+    // someone holds a transferptr_type to it, even after it's been erased.
+    // The map also keeps track of which paths are in use: a path can be
+    // claimed by one exclusive user (writer) or any number of shared users
+    // (readers).
+    class transfer_map {
+        public:
+            transfer_map() {}
+
+            transfer_map(transfer_map const&)            = delete;
+            transfer_map& operator=(transfer_map const&) = delete;
+
+            bool claim_path(std::string const& path, bool shared) {
+                std::lock_guard<std::mutex> lk( __m_pathMutex );
+                auto                        ptr = __m_paths.find( path );
+
+                if( ptr==__m_paths.end() ) {
+                    __m_paths.emplace(path, pathuse_type(shared, 1));
+                    return true;
+                }
+                if( !(shared && ptr->second.first) )
+                    return false;
+                ptr->second.second++;
+                return true;
+            }
+            void release_path(std::string const& path) {
+                std::lock_guard<std::mutex> lk( __m_pathMutex );
+                auto                        ptr = __m_paths.find( path );
+
+                if( ptr!=__m_paths.end() && --ptr->second.second==0 )
+                    __m_paths.erase( ptr );
+            }
+
+            bool insert(uuid_type const& uuid, transferptr_type const& xfer) {
+                shard_type&                 shard( this->shard(uuid) );
+                std::lock_guard<std::mutex> lk( shard.mutex );
+                return shard.transfers.emplace(uuid, xfer).second;
+            }
+            // Returns empty pointer if not found
+            transferptr_type find(uuid_type const& uuid) {
+                shard_type&                 shard( this->shard(uuid) );
+                std::lock_guard<std::mutex> lk( shard.mutex );
+                auto                        ptr = shard.transfers.find( uuid );
+                return ptr==shard.transfers.end() ? transferptr_type() : ptr->second;
+            }
+            // Returns what was removed (empty if nothing); the path remains
+            // claimed
+            transferptr_type erase(uuid_type const& uuid) {
+                shard_type&                 shard( this->shard(uuid) );
+                std::lock_guard<std::mutex> lk( shard.mutex );
+                auto                        ptr = shard.transfers.find( uuid );
+                transferptr_type            rv;
+
+                if( ptr!=shard.transfers.end() ) {
+                    rv = ptr->second;
+                    shard.transfers.erase( ptr );
+                }
+                return rv;
+            }
+
+        private:
+            constexpr static size_t nShards{ 16 };
+            using pathuse_type = std::pair<bool, unsigned int>; // shared?, count
+
+            struct shard_type {
+                std::mutex                                  mutex;
+                std::map<uuid_type, transferptr_type>       transfers;
+            };
+
+            shard_type                              __m_shards[nShards];
+            std::mutex                              __m_pathMutex;
+            std::map<std::string, pathuse_type>     __m_paths;
+
+            shard_type& shard(uuid_type const& uuid) {
+                return __m_shards[ std::hash<std::string>()(uuid) % nShards ];
+            }
+    };
 
     using cancel_fn         = std::function<void(void)>;
     using cancellist_type   = std::list<cancel_fn>;
     using scoped_lock       = std::lock_guard<std::mutex>;
     using threadlist_type   = std::list<std::thread>;
     using dataaddrlist_type = std::list<etdc::sockname_type>;
-    using transfermap_type  = std::map<etdc::uuid_type, std::unique_ptr<transferprops_type>>;
+
+    // Total amount of buffer memory for one transfer and the default
+    // amount of buffers that is split up into. With >1 buffers the
+    // reading and writing of the data are done in separate threads.
+    constexpr static size_t       defaultTransferBufSize{ 32*1024*1024 };
+    constexpr static unsigned int defaultNBuffers{ 4 };
+    // Upper limit on the number of parallel data streams per file
+    constexpr static unsigned int maxNStreams{ 64 };
+    // Upper limit on the number of files a single client can have open at
+    // the same time (i.e. the size of a batch of requestFileWrite/Read)
+    constexpr static unsigned int maxNOpen{ 256 };
 
     // Keep global server state
     struct etd_state {
         std::mutex              lock;
         unsigned int            n_threads;
         cancellist_type         cancellations;
-        transfermap_type        transfers;
+        // Has its own locking; does not need 'lock'
+        transfer_map            transfers;
         std::atomic<bool>       cancelled;
         dataaddrlist_type       dataaddrs;
         std::condition_variable condition;
+        // Transfer buffer settings (see above)
+        size_t                  bufSize;
+        unsigned int            nBuffers;
+        // Use io_uring(7) for file I/O if the kernel supports it
+        bool                    useUring;
+        // All transfers borrow their buffers from here
+        buffer_pool             buffers;
+        // For the UDT data connections we make
+        int                     pacingSpin;
 
-        etd_state() : n_threads{ 0 }, cancelled{ false }
+        etd_state() : n_threads{ 0 }, cancelled{ false },
+                      bufSize{ defaultTransferBufSize }, nBuffers{ defaultNBuffers }, useUring{ false },
+                      pacingSpin{ detail::defaultUDTPacing }
         {}
 
 
@@ -18,17 +18,22 @@
 //          P.O. Box 2
 //          7990 AA Dwingeloo
 #include <utilities.h>
+#include <etdc_pipeline.h>
+#include <etdc_tokenizer.h>
+#include <etdc_dataheader.h>
 #include <etdc_etdserver.h>
 
 // C++ headerts
 //#include <regex>
 #include <mutex>
+#include <limits>
 #include <memory>
 #include <thread>
 #include <functional>
 
 // Plain-old-C
 #include <glob.h>
+#include <poll.h>
 #include <string.h>
 
 namespace etdc {
@@ -120,6 +125,28 @@ namespace etdc {
         return filelist_type(&files->gl_pathv[0], &files->gl_pathv[files->gl_pathc]);
     }
 
+    // Gives back a path claimed in the transfer map unless keep() was
+    // called, e.g. when opening the file throws
+    class path_claim {
+        public:
+            path_claim(transfer_map& m, std::string const& p):
+                __m_map( &m ), __m_path( p )
+            {}
+            path_claim(path_claim const&)            = delete;
+            path_claim& operator=(path_claim const&) = delete;
+
+            void keep( void ) {
+                __m_map = nullptr;
+            }
+            ~path_claim() {
+                if( __m_map )
+                    __m_map->release_path( __m_path );
+            }
+        private:
+            transfer_map*       __m_map;
+            const std::string   __m_path;
+    };
+
     //////////////////////////////////////////////////////////////////////////////////////
     //
     // Attempt to set up resources for writing to a file
@@ -129,16 +156,12 @@ namespace etdc {
     result_type ETDServer::requestFileWrite(std::string const& path, openmode_type mode) {
         static const std::set<openmode_type> allowedModes{openmode_type::New, openmode_type::OverWrite, openmode_type::Resume, openmode_type::SkipExisting};
 
-        // We must check-and-insert-if-ok into shared state.
-        // This has to be atomic, so we'll grab the lock
-        // until we're completely done.
         auto&                       shared_state( __m_shared_state.get() );
-        std::lock_guard<std::mutex> lk( shared_state.lock );
         auto&                       transfers( shared_state.transfers );
 
         // Before we allow doing anything at all we must make sure
-        // that we're not already busy doing something else
-        ETDCASSERT(transfers.find(__m_uuid)==transfers.end(), "requestFileWrite: this server is already busy");
+        // that we're not already too busy
+        ETDCASSERT(__m_uuids.size()<maxNOpen, "requestFileWrite: this server already has " << maxNOpen << " files open");
 
         const std::string nPath( detail::normalize_path(path) );
 
@@ -146,17 +169,11 @@ namespace etdc {
         ETDCASSERT(allowedModes.find(mode)!=std::end(allowedModes),
                    "invalid open mode for requestFileWrite(" << path << ")");
 
-        // Before doing anything - see if this server already has an entry for this (normalized) path -
+        // Before doing anything - claim the (normalized) path:
         // we cannot honour multiple write attempts (not even if it was already open for reading!)
         // 9/Nov/2017 - That is, writing to /dev/null can be done any number of times
-        //              !a && !b => !(a || b)
-        //                  a: writing to dev/null?
-        //                  b: already reading/writing from/to requested file?
-        const auto  pathPresent = !((nPath=="/dev/null") ||
-                                    (std::find_if(std::begin(transfers), std::end(transfers),
-                                                [&](transfermap_type::value_type const& vt) { return vt.second->path==nPath; })
-                                    == std::end(transfers)));
-        ETDCASSERT(pathPresent==false, "requestFileWrite(" << path << ") - the path is already in use");
+        ETDCASSERT(transfers.claim_path(nPath, nPath=="/dev/null"), "requestFileWrite(" << path << ") - the path is already in use");
+        path_claim      claim( transfers, nPath );
 
         // Transform to int argument to open(2) + append some flag(s) if necessary/available
         int  omode = static_cast<int>(mode);
@@ -174,33 +191,28 @@ namespace etdc {
         //       Because it may/may not have to create, we add the file permission bits
         etdc_fdptr      fd( nPath=="/dev/null" ? mk_fd<devzeronull>(nPath, omode) : mk_fd<etdc_file>(nPath, omode, 0644) );
         const off_t     fsize{ fd->lseek(fd->__m_fd, 0, SEEK_END) };
-        //const uuid_type uuid{ uuid_type::mk() };
+        const uuid_type uuid{ uuid_type::mk() };
 
-        ETDCASSERT(transfers.emplace(__m_uuid, std::unique_ptr<transferprops_type>(new etdc::transferprops_type(fd, nPath, mode))).second,
+        ETDCASSERT(transfers.insert(uuid, std::make_shared<etdc::transferprops_type>(fd, nPath, mode)),
                    "Failed to insert new entry, request file write '" << path << "'");
+        claim.keep();
+        __m_uuids.insert( uuid );
         // and return the uuid + alreadyhave
-        return result_type(__m_uuid, fsize);
+        return result_type(uuid, fsize);
     }
 
     result_type ETDServer::requestFileRead(std::string const& path, off_t alreadyhave) {
-        // We must check-and-insert-if-ok into shared state.
-        // This has to be atomic, so we'll grab the lock
-        // until we're completely done.
         auto&                       shared_state( __m_shared_state.get() );
-        std::lock_guard<std::mutex> lk( shared_state.lock );
         auto&                       transfers( shared_state.transfers );
 
-        // Check if we're not already busy
-        ETDCASSERT(transfers.find(__m_uuid)==transfers.end(), "requestFileRead: this server is already busy");
+        // Check if we're not already too busy
+        ETDCASSERT(__m_uuids.size()<maxNOpen, "requestFileRead: this server already has " << maxNOpen << " files open");
 
-        // Before doing anything - see if this server already has an entry for this (normalized) path -
+        // Before doing anything - claim the (normalized) path -
         // we can only honour this request if it's opened for reading [multiple readers = ok]
         const std::string nPath( detail::normalize_path(path) );
-        const auto  pathPtr = std::find_if(std::begin(transfers), std::end(transfers),
-                                           std::bind([&](std::string const& p) { return p==nPath; },
-                                                     std::bind(std::mem_fn(&transferprops_type::path), std::bind(etdc::snd_type(), std::placeholders::_1))));
-        ETDCASSERT(pathPtr==std::end(transfers) || pathPtr->second->openMode==openmode_type::Read,
-                   "requestFileRead(" << path << ") - the path is already in use");
+        ETDCASSERT(transfers.claim_path(nPath, true), "requestFileRead(" << path << ") - the path is already in use");
+        path_claim      claim( transfers, nPath );
 
         // Transform to int argument to open(2) + append some flag(s) if necessary/available
         int  omode = static_cast<int>(etdc::openmode_type::Read);
@@ -215,15 +227,47 @@ namespace etdc {
         //etdc_fdptr      fd( new etdc_file(nPath, omode) );
         etdc_fdptr      fd( std::regex_match(nPath, etdc::rxDevZero) ? mk_fd<devzeronull>(nPath, omode) : mk_fd<etdc_file>(nPath, omode) );
         const off_t     sz{ fd->lseek(fd->__m_fd, 0, SEEK_END) };
-        //const uuid_type uuid{ uuid_type::mk() };
+        const uuid_type uuid{ uuid_type::mk() };
 
         // Assert that we can seek to the requested position
         ETDCASSERT(fd->lseek(fd->__m_fd, alreadyhave, SEEK_SET)!=static_cast<off_t>(-1),
                    "Cannot seek to position " << alreadyhave << " in file " << path << " - " << etdc::strerror(errno));
 
-        auto insres = transfers.emplace(__m_uuid, std::unique_ptr<transferprops_type>( new etdc::transferprops_type(fd, nPath, openmode_type::Read)));
-        ETDCASSERT(insres.second, "Failed to insert new entry, request file read '" << path << "'");
-        return result_type(__m_uuid, sz-alreadyhave);
+        ETDCASSERT(transfers.insert(uuid, std::make_shared<etdc::transferprops_type>(fd, nPath, openmode_type::Read)),
+                   "Failed to insert new entry, request file read '" << path << "'");
+        claim.keep();
+        __m_uuids.insert( uuid );
+        return result_type(uuid, sz-alreadyhave);
+    }
+
+    // Locally there's nothing to gain from batching, other than that one
+    // failure does not stop the others
+    batchresult_type ETDServer::requestFileWrites(std::vector<std::string> const& paths, openmode_type mode) {
+        batchresult_type  rv;
+
+        for(auto const& path: paths) {
+            try {
+                rv.emplace_back(std::unique_ptr<result_type>(new result_type(this->requestFileWrite(path, mode))), nullptr);
+            }
+            catch( ... ) {
+                rv.emplace_back(nullptr, std::current_exception());
+            }
+        }
+        return rv;
+    }
+
+    batchresult_type ETDServer::requestFileReads(readrequest_type const& requests) {
+        batchresult_type  rv;
+
+        for(auto const& req: requests) {
+            try {
+                rv.emplace_back(std::unique_ptr<result_type>(new result_type(this->requestFileRead(req.first, req.second))), nullptr);
+            }
+            catch( ... ) {
+                rv.emplace_back(nullptr, std::current_exception());
+            }
+        }
+        return rv;
     }
 
     dataaddrlist_type ETDServer::dataChannelAddr( void ) const {
@@ -233,116 +277,162 @@ namespace etdc {
     }
 
     bool ETDServer::removeUUID(etdc::uuid_type const& uuid) {
-        ETDCASSERT(uuid==__m_uuid, "Cannot remove someone else's UUID!");
-
-        // We need to do some thinking about locking sequence because we need
-        // a lock on the shared state *and* a lock on the transfer
-        // before we can attempt to remove it.
-        // To prevent deadlock we may have to relinquish the locks and start again.
-        // What that means is that if we fail to lock both atomically, we must start over:
-        //  lock shared state and (attempt to) find the transfer
-        // because after we've released the shared state lock, someone else may have snuck in
-        // and deleted or done something bad with the transfer i.e. we cannot do a ".find(uuid)" once 
-        // and assume the iterator will remain valid after releasing the lock on shared_state
-        etdc::etd_state&                    shared_state( __m_shared_state.get() );
-        std::unique_ptr<transferprops_type> removed;
-        while( true ) {
-            // 1. lock shared state
-            std::unique_lock<std::mutex>     lk( shared_state.lock );
-            // 2. find if there is an entry in the map for us
-            etdc::transfermap_type::iterator ptr = shared_state.transfers.find(__m_uuid);
-            
-            // No? OK then we're done
-            if( ptr==shared_state.transfers.end() )
-                return false;
+        ETDCASSERT(__m_uuids.find(uuid)!=__m_uuids.end(), "Cannot remove someone else's UUID!");
 
-            // Now we must do try_lock on the transfer - if that fails we sleep and start from the beginning
-            //std::unique_lock<std::mutex>     sh( *ptr->second.lockPtr, std::try_to_lock );
-            std::unique_lock<std::mutex>     sh( ptr->second->lock, std::try_to_lock );
-            if( !sh.owns_lock() ) {
-                // we must release the lock on shared state before sleeping
-                // for a bit or else no-one can change anything [because we
-                // hold the lock to shared state ...]
-                lk.unlock();
-                // *now* we sleep for a bit and then try again
-                std::this_thread::sleep_for( std::chrono::microseconds(42) );
-                //std::this_thread::sleep_for( std::chrono::seconds(1) );
-                continue;
-            }
-            // Right, we now hold both locks!
-            transferprops_type&  transfer( *ptr->second );
-            transfer.fd->close(transfer.fd->__m_fd);
-            // We cannot erase the transfer immediately: we hold the lock that is contained in it
-            // so what we do is transfer the lock out of the transfer and /then/ erase the entry.
-            // And when we finally return, then the lock will be unlocked and the unique pointer
-            // deleted
-            //transfer_lock = std::move(transfer.lockPtr);
-            // move the data out of the transfermap
-            //std::swap(removed, ptr->second);
-            removed.swap( ptr->second );
-            // OK lock is now moved out of the transfer, so now it's safe to erase the entry
-            // OK the uniqueptr to the transfer is now moved out of the transfermap, so now it's safe to erase the entry
-            shared_state.transfers.erase( ptr );
-            break;
+        // Once it's out of the map no-one can find it anymore but there may
+        // be threads using it or waiting to use it; we wait for our turn
+        etdc::etd_state&    shared_state( __m_shared_state.get() );
+        transferptr_type    removed = shared_state.transfers.erase( uuid );
+
+        if( !removed ) {
+            __m_uuids.erase( uuid );
+            return false;
         }
+        {
+            // Do not close(2) the fd here: others may still hold a reference to
+            // it and it closes itself when the last one goes. Closing it
+            // explicitly would close it twice - by then the number could
+            // belong to another file.
+            std::lock_guard<range_lock>  sh( removed->lock );
+            removed->removed = true;
+            removed->fd.reset();
+        }
+        shared_state.transfers.release_path( removed->path );
+        __m_uuids.erase( uuid );
         return true;
     }
 
-    bool ETDServer::sendFile(uuid_type const& srcUUID, uuid_type const& dstUUID, 
-                             off_t todo, dataaddrlist_type const& dataAddrs) {
-        // 1a. Verify that the srcUUID is our UUID
-        ETDCASSERT(srcUUID==__m_uuid, "The srcUUID '" << srcUUID << "' is not our UUID");
+    bool ETDServer::removeUUIDs(std::vector<etdc::uuid_type> const& uuids) {
+        std::exception_ptr  eptr;
 
-        // We need to protect our transfer so we need to do deadlock avoidance
-        // with re-searching our UUID until we have both locks
-        etdc::etd_state&                 shared_state( __m_shared_state.get() );
+        for(auto const& uuid: uuids) {
+            try {
+                this->removeUUID( uuid );
+            }
+            catch( ... ) {
+                if( !eptr )
+                    eptr = std::current_exception();
+            }
+        }
+        if( eptr )
+            std::rethrow_exception(eptr);
+        return true;
+    }
+
+    ////////////////////////////////////////////////////////////////////
+    //                  Reusable data connections
+    ////////////////////////////////////////////////////////////////////
+    namespace detail {
+        // An idle connection should have nothing to say; if it's readable
+        // the remote end hung up (or is confused), either way: useless.
+        static bool is_healthy(etdc_fdptr const& fd) {
+            if( dynamic_cast<etdc_udt const*>(fd.get()) )
+                return UDT::getsockstate(fd->__m_fd)==CONNECTED;
+            struct pollfd  pfd{ fd->__m_fd, POLLIN, 0 };
+            return ::poll(&pfd, 1, 0)==0;
+        }
+    }
 
-        // Make it loop until all bytes are transferred
-        while( todo>0 ) {
-            // 2a. lock shared state
-            std::unique_lock<std::mutex>     lk( shared_state.lock );
-            // 2b. assert that there is an entry for us, indicating that we ARE configured
-            etdc::transfermap_type::iterator ptr = shared_state.transfers.find(__m_uuid);
+    connection_pool::key_type connection_pool::mk_key(sockname_type const& addr) {
+        std::ostringstream  oss;
+        oss << addr;
+        return oss.str();
+    }
 
-            ETDCASSERT(ptr!=shared_state.transfers.end(), "This server was not initialized yet");
-            
-            // Now we must do try_lock on the transfer - if that fails we sleep and start from the beginning
-            //std::unique_lock<std::mutex>     sh( *ptr->second.lockPtr, std::try_to_lock );
-            std::unique_lock<std::mutex>     sh( ptr->second->lock, std::try_to_lock );
-            if( !sh ) {
-                // we must manually unlock the shared state before sleeping
-                // or else no-one will be able to change anything
-                lk.unlock();
-                // *now* sleep for a bit and then try again ...
-                std::this_thread::sleep_for( std::chrono::microseconds(19) );
+    etdc_fdptr connection_pool::get(dataaddrlist_type const& addrs, key_type& key, bool& binHdr) {
+        std::lock_guard<std::mutex>  lk( __m_lock );
+        for(auto const& addr: addrs) {
+            auto  ptr = __m_idle.find( mk_key(addr) );
+            if( ptr==__m_idle.end() )
                 continue;
+            // Discard the ones that went stale while parked
+            while( !ptr->second.empty() ) {
+                const idle_type  idle = ptr->second.front();
+                ptr->second.pop_front();
+                if( detail::is_healthy(idle.first) ) {
+                    key    = ptr->first;
+                    binHdr = idle.second;
+                    return idle.first;
+                }
+                ETDCDEBUG(3, "connection_pool/discarding stale connection to " << ptr->first << std::endl);
             }
-            // Right, we now hold both locks!
-            // At this point we don't need the shared_state lock anymore - we've found our entry and we've locked it
-            // So no-one can remove the entry from under us until we're done
-            lk.unlock();
+        }
+        return etdc_fdptr();
+    }
+
+    void connection_pool::put(key_type const& key, etdc_fdptr fd, bool binHdr) {
+        std::lock_guard<std::mutex>  lk( __m_lock );
+        auto&                        idle( __m_idle[key] );
+        // No need to keep more than can ever be used at the same time
+        if( idle.size()<maxNStreams )
+            idle.push_back( idle_type(fd, binHdr) );
+    }
 
-            // Verify that indeed we are configured for file read
-            transferprops_type&  transfer( *ptr->second );
+    void connection_pool::clear( void ) {
+        // The connections are closed when 'idle' goes, outside the lock
+        std::map<key_type, std::list<idle_type>>  idle;
+        std::lock_guard<std::mutex>               lk( __m_lock );
+        idle.swap( __m_idle );
+    }
 
-            ETDCASSERT(transfer.openMode==openmode_type::Read, "This server was initialized, but not for reading a file");
+    namespace detail {
+        // Ask a freshly connected data server if it understands the binary
+        // data header. Old servers don't know the "binhdr" key and
+        // hang up on us, new ones reply with the highest version they
+        // support and wait for the next header.
+        static bool negotiate_binary_header(etdc_fdptr const& fd) {
+            static const std::string  probe( "{ binhdr:1 }" );
+            unsigned char             version{ 0 };
+            try {
+                fd->write(fd->__m_fd, probe.data(), probe.size());
+                if( fd->read(fd->__m_fd, &version, 1)!=1 )
+                    return false;
+            }
+            catch( std::exception const& e ) {
+                ETDCDEBUG(4, "negotiate_binary_header/remote end said no: " << e.what() << std::endl);
+                return false;
+            }
+            return version>=dataheader_type::version;
+        }
 
-            // Great. Now we attempt to connect to the remote end
-            const size_t        bufSz( 32*1024*1024 );
-            etdc::etdc_fdptr    dstFD;
+        static etdc_fdptr mk_data_client(sockname_type const& addr, const size_t bufSz, const int pacingSpin, ccspec_type const& cc) {
+            // Pass all possible receive buf sizes - the mk_client
+            // will make sure only the right ones will be used.
+            // The client may have asked for its own MSS and buffer size;
+            // UDT uses the smaller MSS of the two ends anyway
+            const size_t  sockBufSz( cc.bufSize ? cc.bufSize : bufSz );
+            const int     udtBufSz( cc.bufSize ? (int)std::min(cc.bufSize, (size_t)std::numeric_limits<int>::max()) : detail::defaultUDTBufSize );
+
+            return mk_client(get_protocol(addr), get_host(addr), get_port(addr),
+                             etdc::udt_rcvbuf{udtBufSz}, etdc::udt_sndbuf{udtBufSz}, etdc::so_rcvbuf{sockBufSz}, etdc::so_sndbuf{sockBufSz},
+                             etdc::udt_mss{cc.mss ? (int)cc.mss : detail::defaultUDTMSS}, etdc::udt_pacing{pacingSpin});
+        }
+
+        // Reuse an idle connection or else try the data addresses in
+        // order; return the first one that connects.
+        // 'key' is set to the pool key of the address, 'binHdr' to whether
+        // the remote end takes binary data headers.
+        // Idle connections have the server's MSS and buffer sizes so they
+        // are only reused if the client didn't ask for its own.
+        static etdc_fdptr connect_data_channel(connection_pool& pool, dataaddrlist_type const& dataAddrs, const size_t bufSz,
+                                               const int pacingSpin, ccspec_type const& cc, char const* who,
+                                               connection_pool::key_type& key, bool& binHdr) {
+            etdc::etdc_fdptr    dstFD = (cc.mss || cc.bufSize) ? etdc::etdc_fdptr() : pool.get(dataAddrs, key, binHdr);
             std::ostringstream  tried;
 
+            if( dstFD ) {
+                ETDCDEBUG(2, who << "/reusing connection to " << key << std::endl);
+                return dstFD;
+            }
             for(auto addr: dataAddrs) {
                 try {
-                    // This is 'sendFile' so our data channel will have to
-                    // have a big send buffer
-
-                    // Pass all possible receive buf sizes - the mk_client
-                    // will make sure only the right ones will be used
-                    dstFD = mk_client(get_protocol(addr), get_host(addr), get_port(addr),
-                                      /*etdc::udt_rcvbuf{bufSz}, etdc::udt_sndbuf{bufSz},*/ etdc::so_rcvbuf{bufSz}, etdc::so_sndbuf{bufSz});
-                                      //etdc::udt_sndbuf{bufSz}, etdc::udp_sndbuf{bufSz}, etdc::so_sndbuf{bufSz});
-                    ETDCDEBUG(2, "sendFile/connected to " << addr << std::endl);
+                    dstFD  = mk_data_client(addr, bufSz, pacingSpin, cc);
+                    binHdr = negotiate_binary_header(dstFD);
+                    // An old server closed the connection on us
+                    if( !binHdr )
+                        dstFD = mk_data_client(addr, bufSz, pacingSpin, cc);
+                    key   = connection_pool::mk_key(addr);
+                    ETDCDEBUG(2, who << "/connected to " << addr << (binHdr ? " [binary headers]" : "") << std::endl);
                     break;
                 }
                 catch( std::exception const& e ) {
@@ -353,149 +443,237 @@ namespace etdc {
                 }
             }
             ETDCASSERT(dstFD, "Failed to connect to any of the data servers: " << tried.str());
+            return dstFD;
+        }
 
-            // Weehee! we're connected!
-            std::unique_ptr<unsigned char[]> buffer(new unsigned char[bufSz]);
-
-            // Create message header
+        // Tell the data server what's coming. Ranged headers are for one
+        // of a number of parallel streams. Only the binary header can
+        // carry the congestion control; servers that don't do binary
+        // headers don't know about it either.
+        static void send_data_header(etdc_fdptr const& fd, bool binHdr, uuid_type const& uuid, off_t sz,
+                                     bool push, ccspec_type const& cc, bool ranged = false, off_t offset = 0) {
+            if( binHdr ) {
+                unsigned char  hdr[ dataheader_type::size ];
+                encode_dataheader(dataheader_type(uuid, sz, push, ranged, offset, cc), hdr);
+                ETDCASSERT(fd->write(fd->__m_fd, hdr, sizeof(hdr))==(ssize_t)sizeof(hdr), "Failed to send data header");
+                return;
+            }
             std::ostringstream  msg_buf;
-            msg_buf << "{ uuid:" << dstUUID << ", sz:" << todo << "}";
+            msg_buf << "{ uuid:" << uuid << (push ? ", push:1" : "") << ", sz:" << sz;
+            if( ranged )
+                msg_buf << ", offset:" << offset;
+            msg_buf << "}";
 
             const std::string   msg( msg_buf.str() );
-            dstFD->write(dstFD->__m_fd, msg.data(), msg.size());
-            while( todo>0 ) {
-                const size_t  n = std::min((size_t)todo, bufSz);
-                ssize_t       nRead, nWritten{ 0 };
-
-                ETDCASSERT((nRead=transfer.fd->read(transfer.fd->__m_fd, &buffer[0], n))>0,
-                           ((nRead==-1) ? std::string(etdc::strerror(errno)) : std::string("read() returned 0 - hung up?!")));
-
-                // Keep on writing untill all bytes that were read are actually written
-                while( nRead>0 ) {
-                    ssize_t thisWrite;
-                    ETDCASSERT((thisWrite=dstFD->write(dstFD->__m_fd, &buffer[nWritten], nRead))>0,
-                               ((thisWrite==-1) ? std::string(etdc::strerror(errno)) : std::string("write should never have returned 0?!")) );
-                    nRead    -= thisWrite;
-                    nWritten += thisWrite;
-                }
-                todo -= (off_t)nWritten;
-            }
-            // if we make it out of the loop, todo should be <= 0 and terminate the outer loop
+            fd->write(fd->__m_fd, msg.data(), msg.size());
+        }
+
+        // Split the byte range [start, start+todo) into nStreams
+        // consecutive parts and call fn(offset, size) for each one of them,
+        // all of them concurrently. The calling thread does the first part.
+        // If any of the streams failed, the first error is rethrown after
+        // all of them have finished.
+        static void run_streams(unsigned int nStreams, off_t start, off_t todo, std::function<void(off_t, off_t)> const& fn) {
+            nStreams = (unsigned int)std::max(std::min((off_t)nStreams, todo), (off_t)1);
+
+            const off_t                     chunk = (todo + nStreams - 1)/nStreams;
+            std::vector<std::exception_ptr> errors( nStreams );
+            std::list<std::thread>          streams;
+            auto                            do_stream = [&](unsigned int i) {
+                                                const off_t  offset = start + i*chunk;
+                                                try {
+                                                    fn(offset, std::min(chunk, start + todo - offset));
+                                                }
+                                                catch( ... ) {
+                                                    errors[i] = std::current_exception();
+                                                }
+                                            };
+            ETDCDEBUG(3, "run_streams/" << todo << " bytes starting at " << start << " in " << nStreams << " streams" << std::endl);
+            for(unsigned int i=1; i<nStreams; i++)
+                streams.emplace_back( etdc::thread(do_stream, i) );
+            do_stream( 0 );
+            for(auto& t: streams)
+                t.join();
+            for(auto const& e: errors)
+                if( e )
+                    std::rethrow_exception( e );
+        }
+    }
+
+    bool ETDServer::sendFile(uuid_type const& srcUUID, uuid_type const& dstUUID, 
+                             off_t todo, dataaddrlist_type const& dataAddrs, unsigned int nStreams,
+                             ccspec_type const& cc) {
+        // 1a. Verify that the srcUUID is our UUID
+        ETDCASSERT(__m_uuids.find(srcUUID)!=__m_uuids.end(), "The srcUUID '" << srcUUID << "' is not our UUID");
+
+        etdc::etd_state&                 shared_state( __m_shared_state.get() );
+
+        // Nothing to do?
+        if( todo<=0 )
+            return true;
+
+        // 2. assert that there is an entry for us, indicating that we ARE configured
+        const transferptr_type           ptr = shared_state.transfers.find(srcUUID);
+
+        ETDCASSERT(ptr, "This server was not initialized yet");
+
+        // Wait until we have the transfer to ourselves
+        std::unique_lock<range_lock>     sh( ptr->lock );
+        ETDCASSERT(!ptr->removed, "The transfer was removed");
+
+        // Verify that indeed we are configured for file read
+        transferprops_type&  transfer( *ptr );
+
+        ETDCASSERT(transfer.openMode==openmode_type::Read, "This server was initialized, but not for reading a file");
+
+        // Great. Now we attempt to connect to the remote end
+        // This is 'sendFile' so our data channel will have to
+        // have a big send buffer
+        const size_t        bufSz( shared_state.bufSize );
+        const size_t        nBuf( std::max(shared_state.nBuffers, 1u) );
+
+        if( nStreams<=1 ) {
+            bool                       binHdr;
+            connection_pool::key_type  key;
+            etdc::etdc_fdptr           dstFD = detail::connect_data_channel(__m_dataConnections, dataAddrs, bufSz, shared_state.pacingSpin, cc, "sendFile", key, binHdr);
+
+            // Weehee! we're connected! We're the sending end so we
+            // do the congestion control
+            etdc::set_congestion(dstFD, cc);
+            detail::send_data_header(dstFD, binHdr, dstUUID, todo, false, cc);
+
+            // Keep the disk and the network busy at the same time
+            etdc::pipelined_copy((size_t)todo, transfer.fd, dstFD, shared_state.buffers, nBuf, std::max(bufSz/nBuf, (size_t)1), shared_state.useUring);
             // wait here until the recipient has acknowledged receipt of all bytes
             char    ack;
             ETDCDEBUG(4, "sendFile: waiting for remote ACK ..." << std::endl);
-            dstFD->read(dstFD->__m_fd, &ack, 1);
+            ETDCASSERT(dstFD->read(dstFD->__m_fd, &ack, 1)==1, "sendFile: failed to read ACK from remote end");
             ETDCDEBUG(4, "sendFile: ... got it" << std::endl);
+            // The connection can be used for the next file
+            __m_dataConnections.put(key, dstFD, binHdr);
+        } else {
+            // Each stream reads its own part of the file and tells the
+            // remote end where in the file it should go
+            const off_t  start = transfer.fd->lseek(transfer.fd->__m_fd, 0, SEEK_CUR);
+
+            detail::run_streams(nStreams, start, todo, [&](off_t offset, off_t sz) {
+                    bool                       binHdr;
+                    connection_pool::key_type  key;
+                    etdc::etdc_fdptr           dstFD = detail::connect_data_channel(__m_dataConnections, dataAddrs, bufSz, shared_state.pacingSpin, cc, "sendFile", key, binHdr);
+
+                    etdc::set_congestion(dstFD, cc);
+                    detail::send_data_header(dstFD, binHdr, dstUUID, sz, false, cc, true, offset);
+
+                    etdc::pipelined_copy((size_t)sz, mk_fd<etdc_file_range>(transfer.fd, offset), dstFD,
+                                         shared_state.buffers, nBuf, std::max(bufSz/nBuf, (size_t)1), shared_state.useUring);
+                    char    ack;
+                    ETDCDEBUG(4, "sendFile: waiting for remote ACK on stream @" << offset << " ..." << std::endl);
+                    ETDCASSERT(dstFD->read(dstFD->__m_fd, &ack, 1)==1, "sendFile: failed to read ACK from remote end");
+                    __m_dataConnections.put(key, dstFD, binHdr);
+                });
+            // Leave the file pointer as if we'd read it sequentially
+            transfer.fd->lseek(transfer.fd->__m_fd, start + todo, SEEK_SET);
         }
         ETDCDEBUG(4, "sendFile: done!" << std::endl);
         return true;
     }
 
     bool ETDServer::getFile(uuid_type const& srcUUID, uuid_type const& dstUUID, 
-                            off_t todo, dataaddrlist_type const& dataAddrs) {
+                            off_t todo, dataaddrlist_type const& dataAddrs, unsigned int nStreams,
+                            ccspec_type const& cc) {
         // 1a. Verify that the dstUUID is our UUID
-        ETDCASSERT(dstUUID==__m_uuid, "The dstUUID '" << dstUUID << "' is not our UUID");
+        ETDCASSERT(__m_uuids.find(dstUUID)!=__m_uuids.end(), "The dstUUID '" << dstUUID << "' is not our UUID");
 
-        // We need to protect our transfer so we need to do deadlock avoidance
-        // with re-searching our UUID until we have both locks
         etdc::etd_state&                 shared_state( __m_shared_state.get() );
 
-        // Make it loop until all bytes are transferred
-        while( todo>0 ) {
-            // 2a. lock shared state
-            std::unique_lock<std::mutex>     lk( shared_state.lock );
-            // 2b. assert that there is an entry for us, indicating that we ARE configured
-            etdc::transfermap_type::iterator ptr = shared_state.transfers.find(__m_uuid);
+        // Nothing to do?
+        if( todo<=0 )
+            return true;
 
-            ETDCASSERT(ptr!=shared_state.transfers.end(), "This server was not initialized yet");
-            
-            // Now we must do try_lock on the transfer - if that fails we sleep and start from the beginning
-            //std::unique_lock<std::mutex>     sh( *ptr->second.lockPtr, std::try_to_lock );
-            std::unique_lock<std::mutex>     sh( ptr->second->lock, std::try_to_lock );
-            if( !sh ) {
-                // Manually unlock the shared state or else nobody won't be
-                // able to change anything!
-                lk.unlock();
-
-                // *now* we sleep for a bit and then try again
-                std::this_thread::sleep_for( std::chrono::microseconds(23) );
-                continue;
-            }
-            // Right, we now hold both locks!
-            // At this point we don't need the shared_state lock anymore - we've found our entry and we've locked it
-            // So no-one can remove the entry from under us until we're done
-            lk.unlock();
-
-            // Verify that indeed we are configured for file write
-            // Note that we do NOT include 'skip existing' in here - the
-            // point is that we don't want to write to such a file!
-            transferprops_type&  transfer( *ptr->second );
-            static const std::set<etdc::openmode_type>  allowedWriteModes{ openmode_type::OverWrite, openmode_type::New, openmode_type::Resume };
-
-            ETDCASSERT(allowedWriteModes.find(transfer.openMode)!=allowedWriteModes.end(),
-                       "This server was initialized, but not for writing to file");
-
-            // Great. Now we attempt to connect to the remote end
-            const size_t        bufSz( 32*1024*1024 );
-            etdc::etdc_fdptr    dstFD;
-            std::ostringstream  tried;
+        // 2. assert that there is an entry for us, indicating that we ARE configured
+        const transferptr_type           ptr = shared_state.transfers.find(dstUUID);
 
-            for(auto addr: dataAddrs) {
-                try {
-                    // This is 'getFile' so our data channel will have to
-                    // have a big read buffer
-
-                    // Pass all possible receive buf sizes - the mk_client
-                    // will make sure only the right ones will be used
-                    dstFD = mk_client(get_protocol(addr), get_host(addr), get_port(addr),
-                                      /*etdc::udt_rcvbuf{bufSz}, etdc::udt_sndbuf{bufSz}, */etdc::so_rcvbuf{bufSz}, etdc::so_sndbuf{bufSz});
-                    ETDCDEBUG(2, "getFile/connected to " << addr << std::endl);
-                    break;
-                }
-                catch( std::exception const& e ) {
-                    tried << addr << ": " << e.what() << ", ";
-                }
-                catch( ... ) {
-                    tried << addr << ": unknown exception" << ", ";
-                }
-            }
-            ETDCASSERT(dstFD, "Failed to connect to any of the data servers: " << tried.str());
+        ETDCASSERT(ptr, "This server was not initialized yet");
 
-            // Weehee! we're connected!
-            std::unique_ptr<unsigned char[]> buffer(new unsigned char[bufSz]);
+        // Wait until we have the transfer to ourselves
+        std::unique_lock<range_lock>     sh( ptr->lock );
+        ETDCASSERT(!ptr->removed, "The transfer was removed");
 
-            // Create message header
-            ssize_t             nWritten;
-            std::ostringstream  msg_buf;
-            msg_buf << "{ uuid:" << srcUUID << ", push:1, sz:" << todo << "}";
+        // Verify that indeed we are configured for file write
+        // Note that we do NOT include 'skip existing' in here - the
+        // point is that we don't want to write to such a file!
+        transferprops_type&  transfer( *ptr );
+        static const std::set<etdc::openmode_type>  allowedWriteModes{ openmode_type::OverWrite, openmode_type::New, openmode_type::Resume };
 
-            const std::string   msg( msg_buf.str() );
-            dstFD->write(dstFD->__m_fd, msg.data(), msg.size());
-
-            while( todo>0 ) {
-                // Read at most bufSz bytes
-                // Note: we do blocking I/O so a read of size zero means
-                //       other side hung up
-                const ssize_t n = dstFD->read(dstFD->__m_fd, &buffer[0], bufSz);
-                ETDCASSERT(n>0, "getFile/problem: " << ((n==0) ? std::string("remote side hung up") : etdc::strerror(errno)));
-                ETDCASSERT((nWritten=transfer.fd->write(transfer.fd->__m_fd, &buffer[0], n))>0,
-                           ((nWritten==-1) ? std::string(etdc::strerror(errno)) : std::string("write should never have returned 0?!")) );
-                todo -= (off_t)nWritten;
-            }
-            // if we make it out of the loop, todo should be <= 0 and terminate the outer loop
+        ETDCASSERT(allowedWriteModes.find(transfer.openMode)!=allowedWriteModes.end(),
+                   "This server was initialized, but not for writing to file");
+
+        // Great. Now we attempt to connect to the remote end
+        // This is 'getFile' so our data channel will have to
+        // have a big read buffer
+        const size_t        bufSz( shared_state.bufSize );
+        const size_t        nBuf( std::max(shared_state.nBuffers, 1u) );
+
+        if( nStreams<=1 ) {
+            bool                       binHdr;
+            connection_pool::key_type  key;
+            etdc::etdc_fdptr           dstFD = detail::connect_data_channel(__m_dataConnections, dataAddrs, bufSz, shared_state.pacingSpin, cc, "getFile", key, binHdr);
+
+            // Weehee! we're connected! The remote end is the sender
+            // so it must do the congestion control
+            detail::send_data_header(dstFD, binHdr, srcUUID, todo, true, cc);
+
+            // Note: we do blocking I/O so a read of size zero means
+            //       other side hung up; pipelined_copy() will throw on that
+            etdc::pipelined_copy((size_t)todo, dstFD, transfer.fd, shared_state.buffers, nBuf, std::max(bufSz/nBuf, (size_t)1), shared_state.useUring);
             // Send ACK 
             const char ack{ 'y' };
             ETDCDEBUG(4, "ETDServer::getFile/got all bytes, sending ACK ..." << std::endl);
             dstFD->write(dstFD->__m_fd, &ack, 1);
             ETDCDEBUG(4, "ETDServer::getFile/... done." << std::endl);
+            __m_dataConnections.put(key, dstFD, binHdr);
+        } else {
+            // Ask the remote end to push each part of the file over its
+            // own stream. The remote file pointer was positioned at
+            // what we already have, which is where our file ends
+            const off_t  start = transfer.fd->lseek(transfer.fd->__m_fd, 0, SEEK_END);
+
+            detail::run_streams(nStreams, start, todo, [&](off_t offset, off_t sz) {
+                    bool                       binHdr;
+                    connection_pool::key_type  key;
+                    etdc::etdc_fdptr           dstFD = detail::connect_data_channel(__m_dataConnections, dataAddrs, bufSz, shared_state.pacingSpin, cc, "getFile", key, binHdr);
+
+                    detail::send_data_header(dstFD, binHdr, srcUUID, sz, true, cc, true, offset);
+
+                    etdc::pipelined_copy((size_t)sz, dstFD, mk_fd<etdc_file_range>(transfer.fd, offset),
+                                         shared_state.buffers, nBuf, std::max(bufSz/nBuf, (size_t)1), shared_state.useUring);
+                    const char ack{ 'y' };
+                    ETDCDEBUG(4, "ETDServer::getFile/got all bytes on stream @" << offset << ", sending ACK" << std::endl);
+                    dstFD->write(dstFD->__m_fd, &ack, 1);
+                    __m_dataConnections.put(key, dstFD, binHdr);
+                });
+            // Leave the file pointer as if we'd written it sequentially
+            transfer.fd->lseek(transfer.fd->__m_fd, start + todo, SEEK_SET);
         }
         return true;
     }
 
+    std::string ETDServer::status( void ) const {
+        std::ostringstream  oss;
+        oss << "buffers: " << __m_shared_state.get().buffers.stats();
+        return oss.str();
+    }
+
+    void ETDServer::close( void ) {
+        // we must clean up our UUIDs! (removeUUID() modifies the set)
+        const std::vector<uuid_type>  uuids( std::begin(__m_uuids), std::end(__m_uuids) );
+        __m_dataConnections.clear();
+        this->removeUUIDs( uuids );
+    }
+
     ETDServer::~ETDServer() {
-        // we must clean up our UUID!
         try {
-            this->removeUUID( __m_uuid );
+            this->close();
         }
         catch(...) {}
     }
@@ -509,25 +687,42 @@ namespace etdc {
     //     about that
     //
     /////////////////////////////////////////////////////////////////////////////////////////
-    //static std::basic_regex<unsigned char> rxLine;
-    static const std::regex::flag_type etdc_rxFlags = (std::regex::ECMAScript | std::regex::icase);
-    static const std::regex            rxLine("([^\\r\\n]+)[\\r\\n]+");
-    static const std::regex            rxReply("^(OK|ERR)(\\s+(\\S.*)?)?$", etdc_rxFlags);
-                                             //  1       2    3   submatch numbers
-
-    template <typename InputIter, typename OutputIter,
-              typename RegexIter  = std::regex_iterator<InputIter>,
-              typename RetvalType = typename std::match_results<InputIter>::size_type>
-    static RetvalType getReplies(InputIter f, InputIter l, OutputIter o) {
-        static const RegexIter  rxIterEnd{};
-
-        RetvalType endpos = 0;
-        for(RegexIter line = RegexIter(f, l, rxLine); line!=rxIterEnd; line++) {
-            // Found another line: append just the non-newline stuff to output and update endpos
-            *o++   = (*line)[1].str();
-            endpos = line->position() + line->length();
-        }
-        return endpos;
+    // All lines of reply end in either of:
+    //      OK|ERR [<info>]
+    // (case insensitive)
+    struct reply_type {
+        bool     ok;
+        strview  info;
+    };
+    static bool parse_reply(strview const& line, reply_type& reply) {
+        tok::scanner  s( line );
+
+        if( s.literal("OK") )
+            reply.ok = true;
+        else if( s.literal("ERR") )
+            reply.ok = false;
+        else
+            return false;
+        reply.info = strview();
+        if( s.at_end() )
+            return true;
+        if( !s.spaces() )
+            return false;
+        return s.at_end() || s.rest(reply.info);
+    }
+
+    // Lines of the form "<prefix><value>" where value is a single word,
+    // e.g. "UUID:<uuid>"
+    static bool parse_field(strview const& line, char const* prefix, strview& value) {
+        tok::scanner  s( line );
+        return s.literal(prefix) && s.word(value) && s.at_end();
+    }
+
+    // Requests (and thus their replies) may be tagged with a request id
+    // such that they can be pipelined: "#<id> <request>"
+    static bool parse_tagged(strview const& line, strview& id, strview& rest) {
+        tok::scanner  s( line );
+        return s.character('#') && s.digits(id) && s.spaces() && s.rest(rest);
     }
 
     filelist_type ETDProxy::listPath(std::string const& path, bool) const {
@@ -540,8 +735,8 @@ namespace etdc {
         ETDCASSERTX(__m_connection->write(__m_connection->__m_fd, msg.data(), msg.size())==(ssize_t)msg.size());
 
         // And await the reply
-        const size_t            bufSz( 16384 );
-        std::unique_ptr<char[]> buffer(new char[bufSz]);
+        const size_t            bufSz( replyBufSz );
+        char* const             buffer( __m_buffer.get() );
 
         bool          finished{ false };
         size_t        curPos{ 0 };
@@ -556,23 +751,23 @@ namespace etdc {
             curPos += n;
 
             // Parse the reply so far
-            std::list<std::string> lines;
-            std::smatch::size_type endpos = getReplies(&buffer[0], &buffer[curPos], std::back_inserter(lines));
+            std::vector<strview>   lines;
+            const size_t           endpos = tok::split_lines(&buffer[0], &buffer[curPos], std::back_inserter(lines));
             auto                   line = lines.begin();
 
             // Check what we got back
             for(; !finished && line!=lines.end(); line++) {
-                std::smatch   fields;
+                reply_type    reply;
 
                 ETDCDEBUG(4, "listPath/reply from server: '" << *line << "'" << std::endl);
-                ETDCASSERT(std::regex_match(*line, fields, rxReply), "Server replied with an invalid line");
+                ETDCASSERT(parse_reply(*line, reply), "Server replied with an invalid line");
                 // error code must be either == current state (all lines starting with OK)
                 // or state.empty && error code = ERR; we cannot have OK, OK, OK, ERR -> it's either ERR or OK, OK, OK, ... OK
-                ETDCASSERT(state.empty() || (state=="OK" && fields[1].str()==state),
+                ETDCASSERT(state.empty() || (state=="OK" && reply.ok),
                            "The server changed its mind about the success of the call in the middle of the reply");
-                state  = fields[1].str();
+                state  = (reply.ok ? "OK" : "ERR");
 
-                const std::string   info( fields[3].str() ); 
+                const std::string   info( reply.info.str() );
 
                 // Translate error into an exception
                 if( state=="ERR" )
@@ -595,10 +790,11 @@ namespace etdc {
     }
 
     result_type ETDProxy::requestFileWrite(std::string const& file, openmode_type om) {
-        static const std::regex  rxUUID( "^UUID:(\\S+)$", etdc_rxFlags);
-        static const std::regex  rxAlreadyHave( "^AlreadyHave:([0-9]+)$", etdc_rxFlags);
         std::ostringstream       msgBuf;
 
+        // From now on the daemon may hold an open file for us
+        __m_stateful = true;
+
         msgBuf << "write-file-" << om << " " << file << '\n';
         const std::string  msg( msgBuf.str() );
 
@@ -606,8 +802,8 @@ namespace etdc {
         ETDCASSERTX(__m_connection->write(__m_connection->__m_fd, msg.data(), msg.size())==(ssize_t)msg.size());
 
         // And await the reply
-        const size_t               bufSz( 2048 );
-        std::unique_ptr<char[]>    buffer(new char[bufSz]);
+        const size_t               bufSz( replyBufSz );
+        char* const                buffer( __m_buffer.get() );
 
         bool                       finished{ false };
         size_t                     curPos{ 0 };
@@ -622,27 +818,28 @@ namespace etdc {
             ETDCASSERT(n>0, "Failed to read data from remote end");
             curPos += n;
 
-            std::vector<std::string>  lines;
-            auto                      endpos = getReplies(&buffer[0], &buffer[curPos], std::back_inserter(lines));
+            std::vector<strview>      lines;
+            const size_t              endpos = tok::split_lines(&buffer[0], &buffer[curPos], std::back_inserter(lines));
             auto                      line = lines.begin();
 
             // Check what we got back
             for(; !finished && line!=lines.end(); line++) {
-                std::smatch   fields;
+                strview       value;
+                reply_type    reply;
 
-                if( std::regex_match(*line, fields, rxUUID) ) {
+                if( parse_field(*line, "UUID:", value) ) {
                     ETDCASSERT(!curUUID, "Server had already sent a UUID");
-                    curUUID = std::move( std::unique_ptr<uuid_type>(new uuid_type(fields[1].str())) );
-                } else if( std::regex_match(*line, fields, rxAlreadyHave) ) {
+                    curUUID = std::move( std::unique_ptr<uuid_type>(new uuid_type(value.str())) );
+                } else if( parse_field(*line, "AlreadyHave:", value) ) {
                     ETDCASSERT(!filePos, "Server had already sent file position");
-                    filePos = std::move( std::unique_ptr<off_t>(new off_t) );
-                    string2off_t(fields[1].str(), *filePos);
-                } else if( std::regex_match(*line, fields, rxReply) ) {
+                    filePos = std::move( std::unique_ptr<off_t>(new off_t(tok::to_int<off_t>(value))) );
+                    ETDCASSERT(*filePos>=0, "Server sent a negative file position");
+                } else if( parse_reply(*line, reply) ) {
                     // We get OK (optional stuff)
                     // or     ERR (optional error message)
                     // Either will mean end-of-parsing
-                    status_s = fields[1].str();
-                    info     = fields[3].str();
+                    status_s = (reply.ok ? "OK" : "ERR");
+                    info     = reply.info.str();
                     finished = true;
                 } else {
                     ETDCASSERT(false, "requestFileWrite: the server sent a reply that we did not recognize: " << *line);
@@ -664,10 +861,11 @@ namespace etdc {
     }
 
     result_type ETDProxy::requestFileRead(std::string const& file, off_t already_have) {
-        static const std::regex  rxUUID( "^UUID:(\\S+)$", etdc_rxFlags);
-        static const std::regex  rxRemain( "^Remain:(-?[0-9]+)$", etdc_rxFlags);
         std::ostringstream       msgBuf;
 
+        // From now on the daemon may hold an open file for us
+        __m_stateful = true;
+
         msgBuf << "read-file " << already_have << " " << file << '\n';
         const std::string  msg( msgBuf.str() );
 
@@ -675,8 +873,8 @@ namespace etdc {
         ETDCASSERTX(__m_connection->write(__m_connection->__m_fd, msg.data(), msg.size())==(ssize_t)msg.size());
 
         // And await the reply
-        const size_t               bufSz( 2048 );
-        std::unique_ptr<char[]>    buffer(new char[bufSz]);
+        const size_t               bufSz( replyBufSz );
+        char* const                buffer( __m_buffer.get() );
 
         bool                       finished{ false };
         size_t                     curPos{ 0 };
@@ -691,27 +889,27 @@ namespace etdc {
             ETDCASSERT(n>0, "Failed to read data from remote end");
             curPos += n;
 
-            std::vector<std::string>  lines;
-            auto                      endpos = getReplies(&buffer[0], &buffer[curPos], std::back_inserter(lines));
+            std::vector<strview>      lines;
+            const size_t              endpos = tok::split_lines(&buffer[0], &buffer[curPos], std::back_inserter(lines));
             auto                      line = lines.begin();
 
             // Check what we got back
             for(; !finished && line!=lines.end(); line++) {
-                std::smatch   fields;
+                strview       value;
+                reply_type    reply;
 
-                if( std::regex_match(*line, fields, rxUUID) ) {
+                if( parse_field(*line, "UUID:", value) ) {
                     ETDCASSERT(!curUUID, "Server already sent a UUID");
-                    curUUID = std::move( std::unique_ptr<uuid_type>(new uuid_type(fields[1].str())) );
-                } else if( std::regex_match(*line, fields, rxRemain) ) {
+                    curUUID = std::move( std::unique_ptr<uuid_type>(new uuid_type(value.str())) );
+                } else if( parse_field(*line, "Remain:", value) ) {
                     ETDCASSERT(!remain, "Server already sent a file position");
-                    remain = std::move( std::unique_ptr<off_t>(new off_t) );
-                    string2off_t(fields[1].str(), *remain);
-                } else if( std::regex_match(*line, fields, rxReply) ) {
+                    remain = std::move( std::unique_ptr<off_t>(new off_t(tok::to_int<off_t>(value))) );
+                } else if( parse_reply(*line, reply) ) {
                     // We get OK (optional stuff)
                     // or     ERR (optional error message)
                     // Either will mean end-of-parsing
-                    status_s = fields[1].str();
-                    info     = fields[3].str(); 
+                    status_s = (reply.ok ? "OK" : "ERR");
+                    info     = reply.info.str();
                     finished = true;
                 } else {
                     ETDCASSERT(false, "requestFileRead: the server sent a reply that we did not recognize: " << *line);
@@ -737,9 +935,9 @@ namespace etdc {
         ETDCDEBUG(4, "ETDProxy::dataChannelAddr/sending message '" << msg << "'" << std::endl);
         ETDCASSERTX(__m_connection->write(__m_connection->__m_fd, msg.data(), msg.size())==(ssize_t)msg.size());
 
-        // And await the reply. We don't expect /a lot/ of data channel addrs so don't need a really big buf
-        const size_t            bufSz( 2048 );
-        std::unique_ptr<char[]> buffer(new char[bufSz]);
+        // And await the reply. We don't expect /a lot/ of data channel addrs
+        const size_t            bufSz( replyBufSz );
+        char* const             buffer( __m_buffer.get() );
 
         bool              finished{ false };
         size_t            curPos{ 0 };
@@ -754,23 +952,23 @@ namespace etdc {
             curPos += n;
 
             // Parse the reply so far
-            std::list<std::string> lines;
-            std::smatch::size_type endpos = getReplies(&buffer[0], &buffer[curPos], std::back_inserter(lines));
+            std::vector<strview>   lines;
+            const size_t           endpos = tok::split_lines(&buffer[0], &buffer[curPos], std::back_inserter(lines));
             auto                   line = lines.begin();
 
             // Check what we got back
             for(; !finished && line!=lines.end(); line++) {
-                std::smatch   fields;
+                reply_type    reply;
 
                 ETDCDEBUG(4, "dataChannelAddr/reply from server: '" << *line << "'" << std::endl);
-                ETDCASSERT(std::regex_match(*line, fields, rxReply), "Server replied with an invalid line");
+                ETDCASSERT(parse_reply(*line, reply), "Server replied with an invalid line");
                 // error code must be either == current state (all lines starting with OK)
                 // or state.empty && error code = ERR; we cannot have OK, OK, OK, ERR -> it's either ERR or OK, OK, OK, ... OK
-                ETDCASSERT(state.empty() || (state=="OK" && fields[1].str()==state),
+                ETDCASSERT(state.empty() || (state=="OK" && reply.ok),
                            "The server changed its mind about the success of the call in the middle of the reply");
-                state  = fields[1].str();
+                state  = (reply.ok ? "OK" : "ERR");
 
-                const std::string   info( fields[3].str() ); 
+                const std::string   info( reply.info.str() );
 
                 // Translate error into an exception
                 if( state=="ERR" )
@@ -805,8 +1003,8 @@ namespace etdc {
         // And await the reply. We only allow "OK" or "ERR <msg>"
         // if we allow ~1kB for the <msg> that's quite generous I'd say
         size_t                     curPos{ 0 };
-        const size_t               bufSz( 2048 );
-        std::unique_ptr<char[]>    buffer(new char[bufSz]);
+        const size_t               bufSz( replyBufSz );
+        char* const                buffer( __m_buffer.get() );
 
         while( curPos<bufSz ) {
             const ssize_t n = __m_connection->read(__m_connection->__m_fd, &buffer[curPos], bufSz-curPos);
@@ -815,11 +1013,11 @@ namespace etdc {
             ETDCASSERT(n>0, "Failed to read data from remote end");
             curPos += n;
 
-            std::vector<std::string>  lines;
-            std::smatch               fields;
+            std::vector<strview>      lines;
+            reply_type                reply;
 
-            // Discard the return value from getReplies - we don't need to remember where we end in the buffer
-            (void)getReplies(&buffer[0], &buffer[curPos], std::back_inserter(lines));
+            // Discard the return value from split_lines - we don't need to remember where we end in the buffer
+            (void)tok::split_lines(&buffer[0], &buffer[curPos], std::back_inserter(lines));
 
             // If no line(s) yet, read more bytes
             if( lines.empty() )
@@ -828,21 +1026,74 @@ namespace etdc {
             // If we get >1 line, the client's messin' wiv de heads - we only allow 1 (one) line of reply
             ETDCASSERT(lines.size()==1, "The client sent wrong number of responses - this is likely a protocol error");
             // And that line should match our expectations
-            ETDCASSERT(std::regex_match(*lines.begin(), fields, rxReply), "The client sent a non-conforming response");
+            ETDCASSERT(parse_reply(*lines.begin(), reply), "The client sent a non-conforming response");
             // Translate "ERR <Reason>" into an exception
-            ETDCASSERT(fields[1].str()=="OK", "removeUUID failed: " << fields[2].str());
+            ETDCASSERT(reply.ok, "removeUUID failed: " << reply.info);
             // Otherwise we're done
             break;
         }
         return true;
     }
 
-    bool ETDProxy::sendFile(uuid_type const& srcUUID, uuid_type const& dstUUID, off_t todo, dataaddrlist_type const& dataaddrs) {
+    std::string ETDProxy::status( void ) const {
+        static const std::string msg{ "status\n" };
+        ETDCDEBUG(4, "ETDProxy::status/sending message '" << msg << "'" << std::endl);
+        ETDCASSERTX(__m_connection->write(__m_connection->__m_fd, msg.data(), msg.size())==(ssize_t)msg.size());
+
+        // Same form of reply as listPath: "OK <line>" for each line of
+        // status, terminated by a single "OK"
+        const size_t            bufSz( replyBufSz );
+        char* const             buffer( __m_buffer.get() );
+
+        bool                finished{ false };
+        size_t              curPos{ 0 };
+        std::ostringstream  rv;
+
+        while( !finished && curPos<bufSz ) {
+            const ssize_t n = __m_connection->read(__m_connection->__m_fd, &buffer[curPos], bufSz-curPos);
+
+            // did we read anything?
+            ETDCASSERT(n>0, "Failed to read data from remote end");
+            curPos += n;
+
+            std::vector<strview>   lines;
+            const size_t           endpos = tok::split_lines(&buffer[0], &buffer[curPos], std::back_inserter(lines));
+            auto                   line = lines.begin();
+
+            for(; !finished && line!=lines.end(); line++) {
+                reply_type    reply;
+
+                ETDCDEBUG(4, "status/reply from server: '" << *line << "'" << std::endl);
+                ETDCASSERT(parse_reply(*line, reply), "Server replied with an invalid line");
+                ETDCASSERT(reply.ok, "status() failed - " << (reply.info.empty() ? std::string("<unknown reason>") : reply.info.str()));
+                if( (finished=reply.info.empty())==true )
+                    continue;
+                rv << reply.info << '\n';
+            }
+            ETDCASSERT(line==lines.end(), "There are unprocessed lines of reply from the server. This is probably a protocol error.");
+            ::memmove(&buffer[0], &buffer[endpos], curPos - endpos);
+            curPos -= endpos;
+        }
+        ETDCASSERT(curPos==0, "status: there are " << curPos << " unconsumed bytes left in the input. This is likely a protocol error.");
+        return rv.str();
+    }
+
+    bool ETDProxy::sendFile(uuid_type const& srcUUID, uuid_type const& dstUUID, off_t todo, dataaddrlist_type const& dataaddrs,
+                            unsigned int nStreams, ccspec_type const& cc) {
         std::ostringstream       msgBuf;
 
         msgBuf << "send-file " << srcUUID << " " << dstUUID << " " << todo << " ";
         for(auto p = dataaddrs.begin(); p!=dataaddrs.end(); p++)
             msgBuf << ((p!=dataaddrs.begin()) ? "," : "") << *p;
+        // Only send the number of streams, congestion control and socket
+        // settings if they're not the default such that we can still talk
+        // to daemons that don't know about them
+        if( nStreams>1 || !cc.is_default() )
+            msgBuf << " " << nStreams;
+        if( !cc.is_default() )
+            msgBuf << " " << cc.algorithm << " " << cc.rate;
+        if( cc.mss || cc.bufSize )
+            msgBuf << " " << cc.mss << " " << cc.bufSize;
         msgBuf << '\n';
         const std::string  msg( msgBuf.str() );
 
@@ -852,8 +1103,8 @@ namespace etdc {
         // And await the reply. We only allow "OK" or "ERR <msg>"
         // if we allow ~1kB for the <msg> that's quite generous I'd say
         size_t                     curPos{ 0 };
-        const size_t               bufSz( 2048 );
-        std::unique_ptr<char[]>    buffer(new char[bufSz]);
+        const size_t               bufSz( replyBufSz );
+        char* const                buffer( __m_buffer.get() );
 
         while( curPos<bufSz ) {
             const ssize_t n = __m_connection->read(__m_connection->__m_fd, &buffer[curPos], bufSz-curPos);
@@ -862,11 +1113,11 @@ namespace etdc {
             ETDCASSERT(n>0, "Failed to read data from remote end");
             curPos += n;
 
-            std::vector<std::string>  lines;
-            std::smatch               fields;
+            std::vector<strview>      lines;
+            reply_type                reply;
 
-            // Discard the return value from getReplies - we don't need to remember where we end in the buffer
-            (void)getReplies(&buffer[0], &buffer[curPos], std::back_inserter(lines));
+            // Discard the return value from split_lines - we don't need to remember where we end in the buffer
+            (void)tok::split_lines(&buffer[0], &buffer[curPos], std::back_inserter(lines));
 
             // If no line(s) yet, read more bytes
             if( lines.empty() )
@@ -875,170 +1126,431 @@ namespace etdc {
             // If we get >1 line, the client's messin' wiv de heads - we only allow 1 (one) line of reply
             ETDCASSERT(lines.size()==1, "The client sent wrong number of responses - this is likely a protocol error");
             // And that line should match our expectations
-            ETDCASSERT(std::regex_match(*lines.begin(), fields, rxReply), "The client sent a non-conforming response");
+            ETDCASSERT(parse_reply(*lines.begin(), reply), "The client sent a non-conforming response");
             // Translate "ERR <Reason>" into an exception
-            ETDCASSERT(fields[1].str()=="OK", "sendFile failed - " << fields[2].str());
+            ETDCASSERT(reply.ok, "sendFile failed - " << reply.info);
             // Otherwise we're done
             break;
         }
         return true;
     }
 
-    //////////////////////////////////////////////////////////////////////
-    //
-    // This class does NOT implementing the ETDServerInterface but
-    // takes a connection, instantiates its own ETDServer
-    // and then loops, reading commands from the connection and sends
-    // back replies
-    //
-    //////////////////////////////////////////////////////////////////////
+    ETDProxy::replies_type ETDProxy::pipeline(std::vector<std::string> const& cmds) const {
+        const unsigned long firstTag = __m_tag;
 
-    void ETDServerWrapper::handle( void ) {
-        // here we enter our while loop, reading commands and (attempt) to
-        // interpret them.
-        // If we go 2kB w/o seeing an actual command we call it a day
-        // I mean, our commands are typically *very* small
-        const size_t            bufSz( 2*1024/**1024*/ );
-        std::unique_ptr<char[]> buffer(new char[bufSz]);
+        __m_tag += cmds.size();
 
-        bool          terminated = false;
-        size_t        curPos = 0;
+        // Collect replies until all requests are done. A request is
+        // done after its final "OK" or an "ERR"
+        const size_t        bufSz( replyBufSz );
+        char* const         buffer( __m_buffer.get() );
+        size_t              curPos{ 0 }, nSent{ 0 }, nDone{ 0 };
+        replies_type        rv( cmds.size() );
+        std::vector<bool>   done( cmds.size(), false );
+
+        while( nDone<cmds.size() ) {
+            // Top up the requests in flight
+            if( nSent<cmds.size() && nSent-nDone<maxInFlight ) {
+                std::ostringstream  msgBuf;
 
-        while( !terminated && curPos<bufSz ) {
-            ETDCDEBUG(5, "ETDServerWrapper::handle() / start loop, curPos=" << curPos << std::endl);
+                for( ; nSent<cmds.size() && nSent-nDone<maxInFlight; nSent++)
+                    msgBuf << "#" << firstTag + nSent << " " << cmds[nSent] << '\n';
+                const std::string  msg( msgBuf.str() );
+
+                ETDCDEBUG(4, "ETDProxy::pipeline/sending up to request " << nSent << " of " << cmds.size() << " in " << msg.size() << " bytes" << std::endl);
+                ETDCASSERTX(__m_connection->write(__m_connection->__m_fd, msg.data(), msg.size())==(ssize_t)msg.size());
+            }
+            ETDCASSERT(curPos<bufSz, "pipeline: the server sent a reply line that is too long");
             const ssize_t n = __m_connection->read(__m_connection->__m_fd, &buffer[curPos], bufSz-curPos);
-            ETDCDEBUG(5, "ETDServerWrapper::handle() / read n=" << n << " => nTotal=" << n + curPos << std::endl);
+
             // did we read anything?
             ETDCASSERT(n>0, "Failed to read data from remote end");
             curPos += n;
 
-            // Parse the reply so far
-            std::list<std::string> lines;
-            std::smatch::size_type endpos = getReplies(&buffer[0], &buffer[curPos], std::back_inserter(lines));
-            auto                   line = lines.begin();
+            std::vector<strview>      lines;
+            const size_t              endpos = tok::split_lines(&buffer[0], &buffer[curPos], std::back_inserter(lines));
 
-            for( ; line!=lines.end(); line++ ) {
-                // Got a line! Assert that it conforms to our expectation
-                ETDCDEBUG(4, "ETDServerWrapper::handle()/got line: '" << *line << "'" << std::endl);
-
-                // The known commands
-                static const std::regex  rxList("^list\\s+(\\S.*)$", etdc_rxFlags);
-                static const std::regex  rxReqFileWrite("^write-file-(\\S+)\\s+(\\S.*)$", etdc_rxFlags);
-                                                //                   1         2
-                                                //                   openmode  file name
-                static const std::regex  rxReqFileRead("^read-file\\s+([0-9]+)\\s+(\\S.*)$", etdc_rxFlags);
-                                                //                    1           2
-                                                //                    already have
-                                                //                                file name
-                static const std::regex  rxSendFile("^send-file\\s+(\\S+)\\s+(\\S+)\\s+([0-9]+)\\s+(\\S+)$", etdc_rxFlags);
-                                                //                 1         2         3           4
-                                                //                 srcUUID   dstUUID   todo        data-channel
-                static const std::regex  rxDataChannelAddr("^data-channel-addr$", etdc_rxFlags);
-                static const std::regex  rxRemoveUUID("^remove-uuid\\s+(\\S+)$", etdc_rxFlags);
-                                                //                     1
-                                                //                     UUID
-
-                // Match it against the known commands
-                std::smatch              fields;
-                std::vector<std::string> replies;
+            for(auto const& line: lines) {
+                strview       id, text;
+                reply_type    reply;
 
-                try {
-                    if( std::regex_match(*line, fields, rxList) ) {
-                        // we're a remote ETDServer (seen from the client)
-                        // so we do not support ~ expansion
-                        const auto entries = __m_etdserver.listPath(fields[1].str(), false);
-                        std::transform(std::begin(entries), std::end(entries), std::back_inserter(replies),
-                                       std::bind(std::plus<std::string>(), std::string("OK "), std::placeholders::_1));
-                        // and add a final OK
-                        replies.emplace_back("OK");
-                    } else if( std::regex_match(*line, fields, rxReqFileWrite) ) {
-                        openmode_type      om;
-                        std::istringstream iss( fields[1].str() );
-                        // Transform openmode string to actual openmode enum
-                        iss >> om;
-                        // Do the actual filewrite request
-                        const auto         fwresult = __m_etdserver.requestFileWrite(fields[2].str(), om);
-                        std::ostringstream oss;
-                        // Prepare replies
-                        oss << "AlreadyHave:" << get_filepos(fwresult);
-                        replies.emplace_back(oss.str());
-                        replies.emplace_back("UUID:"+get_uuid(fwresult));
-                        replies.emplace_back("OK");
-                    } else if( std::regex_match(*line, fields, rxReqFileRead) ) {
-                        // Decode the filepos from the sent command into
-                        // local, correctly typed, variable
-                        off_t               already_have;;
-                        string2off_t(fields[1].str(), already_have);
-
-                        // Do the actual fileread request
-                        const auto frresult = __m_etdserver.requestFileRead(fields[2].str(), already_have);
-
-                        // Prepare replies
-                        std::ostringstream  oss;
-                        oss << "Remain:" << get_filepos(frresult);
-                        replies.emplace_back(oss.str());
-                        replies.emplace_back("UUID:"+get_uuid(frresult));
-                        replies.emplace_back("OK");
-                    } else if( std::regex_match(*line, fields, rxSendFile) ) {
-                        // Decode the fields 
-                        off_t                 todo;
-                        const std::string     dataAddrs_s( fields[4].str() );
-                        dataaddrlist_type     dataAddrs;
-                        const etdc::uuid_type src_uuid{ fields[1].str() };
-                        const etdc::uuid_type dst_uuid{ fields[2].str() };
-
-                        string2off_t(fields[3].str(), todo);
-                        // transform data channel addresses into list-of-*
-                        static const std::regex data_sep("[^,]+");
-                        std::transform( std::sregex_iterator(std::begin(dataAddrs_s), std::end(dataAddrs_s), data_sep),
-                                        std::sregex_iterator(), std::back_inserter(dataAddrs), 
-                                        [](std::smatch const& sm) { return decode_data_addr(sm.str()); });
-
-                        const bool rv = __m_etdserver.sendFile(src_uuid, dst_uuid, todo, dataAddrs);
-                        replies.emplace_back( rv ? "OK" : "ERR Failed to send file" );
-                    } else if( std::regex_match(*line, fields, rxDataChannelAddr) ) {
-                        const auto entries = __m_etdserver.dataChannelAddr();
-                        std::transform(std::begin(entries), std::end(entries), std::back_inserter(replies),
-                                       [](sockname_type const& sn) { std::ostringstream oss; oss << "OK " << sn; return oss.str(); });
-                        // and add a final OK
-                        replies.emplace_back("OK");
-                    } else if( std::regex_match(*line, fields, rxRemoveUUID) ) {
-                        const bool removeResult = __m_etdserver.removeUUID(uuid_type(fields[1].str()));
-                        ETDCDEBUG(4, "ETDServerWrapper: removeUUID(" << fields[1].str() << " yields " << removeResult << std::endl);
-                        replies.emplace_back( removeResult ? "OK" : "ERR Failed to remove UUID" );
+                ETDCDEBUG(4, "pipeline/reply from server: '" << line << "'" << std::endl);
+                ETDCASSERT(parse_tagged(line, id, text), "pipeline: the server sent an untagged reply: " << line);
+
+                const unsigned long idx = tok::to_int<unsigned long>(id) - firstTag;
+                ETDCASSERT(idx<nSent && !done[idx], "pipeline: the server sent a reply to a request that we're not waiting for: " << line);
+
+                rv[idx].push_back( text.str() );
+                if( parse_reply(text, reply) && (!reply.ok || reply.info.empty()) ) {
+                    done[idx] = true;
+                    nDone++;
+                }
+            }
+            // Processed all lines in the reply so far.
+            // So we move all processed bytes to begin of buffer
+            ::memmove(&buffer[0], &buffer[endpos], curPos - endpos);
+            curPos -= endpos;
+        }
+        ETDCASSERT(curPos==0, "pipeline: there are " << curPos << " unconsumed bytes left in the input. This is likely a protocol error.");
+        return rv;
+    }
+
+    bool ETDProxy::pipelining( void ) {
+        // Only while the daemon has nothing of ours we can afford to
+        // have it hang up on us
+        if( __m_pipelining==support_type::Unknown && (__m_stateful || !__m_reconnect) )
+            __m_pipelining = support_type::No;
+        if( __m_pipelining!=support_type::Unknown )
+            return __m_pipelining==support_type::Yes;
+
+        // Any request will do as long as it has no side effects
+        try {
+            (void)this->pipeline( std::vector<std::string>{ "data-channel-addr" } );
+            __m_pipelining = support_type::Yes;
+        }
+        catch( std::exception const& e ) {
+            ETDCDEBUG(2, "ETDProxy: daemon does not do tagged requests (" << e.what() << "), sending them one by one" << std::endl);
+            __m_connection  = __m_reconnect();
+            __m_pipelining  = support_type::No;
+        }
+        return __m_pipelining==support_type::Yes;
+    }
+
+    namespace detail {
+        // Turn the reply to a write-file or read-file request into a result.
+        // 'posField' is the name of the file position field the server must send.
+        static batchentry_type decode_open_reply(std::vector<std::string> const& lines, char const* posField, std::string const& what) {
+            try {
+                strview                    value;
+                reply_type                 reply;
+                std::string                info, status_s;
+                std::unique_ptr<off_t>     filePos{};
+                std::unique_ptr<uuid_type> curUUID{};
+
+                for(auto const& line: lines) {
+                    if( parse_field(line, "UUID:", value) ) {
+                        ETDCASSERT(!curUUID, "Server had already sent a UUID");
+                        curUUID = std::unique_ptr<uuid_type>(new uuid_type(value.str()));
+                    } else if( parse_field(line, posField, value) ) {
+                        ETDCASSERT(!filePos, "Server had already sent file position");
+                        filePos = std::unique_ptr<off_t>(new off_t(tok::to_int<off_t>(value)));
+                    } else if( parse_reply(line, reply) ) {
+                        status_s = (reply.ok ? "OK" : "ERR");
+                        info     = reply.info.str();
                     } else {
-                        ETDCDEBUG(4, "line '" << *line << "' did not match any regex" << std::endl);
-                        __m_connection->close( __m_connection->__m_fd );
-                        throw std::string("client sent unknown command");
+                        ETDCASSERT(false, what << ": the server sent a reply that we did not recognize: " << line);
                     }
                 }
-                catch( std::string const& e ) {
-                    ETDCDEBUG(-1, "ETDServerWrapper: terminating because of condition " << e << std::endl);
-                    terminated = true;
+                ETDCASSERT(status_s=="OK", what << " failed - " << (info.empty() ? "<unknown reason>" : info));
+                ETDCASSERT(filePos && curUUID, what << ": the server did NOT send all required fields");
+                return batchentry_type(std::unique_ptr<result_type>(new result_type(*curUUID, *filePos)), nullptr);
+            }
+            catch( ... ) {
+                return batchentry_type(nullptr, std::current_exception());
+            }
+        }
+    }
+
+    batchresult_type ETDProxy::requestFileWrites(std::vector<std::string> const& files, openmode_type om) {
+        batchresult_type         rv;
+
+        // A batch of one, or a daemon that doesn't know about tagged
+        // requests, we do the old-fashioned way
+        if( files.size()==1 || !this->pipelining() ) {
+            for(auto const& file: files) {
+                try {
+                    rv.emplace_back(std::unique_ptr<result_type>(new result_type(this->requestFileWrite(file, om))), nullptr);
+                }
+                catch( ... ) {
+                    rv.emplace_back(nullptr, std::current_exception());
                 }
-                catch( std::exception const& e ) {
-                    replies.emplace_back( std::string("ERR ")+e.what() );
+            }
+            return rv;
+        }
+        __m_stateful = true;
+
+        std::vector<std::string>  cmds;
+        for(auto const& file: files) {
+            std::ostringstream  msgBuf;
+            msgBuf << "write-file-" << om << " " << file;
+            cmds.push_back( msgBuf.str() );
+        }
+
+        const auto    replies = this->pipeline(cmds);
+        for(size_t i=0; i<files.size(); i++)
+            rv.push_back( detail::decode_open_reply(replies[i], "AlreadyHave:", "requestFileWrite("+files[i]+")") );
+        return rv;
+    }
+
+    batchresult_type ETDProxy::requestFileReads(readrequest_type const& requests) {
+        batchresult_type         rv;
+
+        if( requests.size()==1 || !this->pipelining() ) {
+            for(auto const& req: requests) {
+                try {
+                    rv.emplace_back(std::unique_ptr<result_type>(new result_type(this->requestFileRead(req.first, req.second))), nullptr);
                 }
                 catch( ... ) {
-                    replies.emplace_back( "ERR Unknown exception" );
+                    rv.emplace_back(nullptr, std::current_exception());
                 }
+            }
+            return rv;
+        }
+        __m_stateful = true;
 
-                // Now send back the replies
-                for(auto const& r: replies) {
-                    ETDCDEBUG(4, "ETDServerWrapper: sending reply '" << r << "'" << std::endl);
-                    __m_connection->write(__m_connection->__m_fd, r.data(), r.size());
-                    __m_connection->write(__m_connection->__m_fd, "\n", 1);
+        std::vector<std::string>  cmds;
+        for(auto const& req: requests) {
+            std::ostringstream  msgBuf;
+            msgBuf << "read-file " << req.second << " " << req.first;
+            cmds.push_back( msgBuf.str() );
+        }
+
+        const auto    replies = this->pipeline(cmds);
+        for(size_t i=0; i<requests.size(); i++)
+            rv.push_back( detail::decode_open_reply(replies[i], "Remain:", "requestFileRead("+requests[i].first+")") );
+        return rv;
+    }
+
+    bool ETDProxy::removeUUIDs(std::vector<uuid_type> const& uuids) {
+        if( uuids.size()==1 )
+            return this->removeUUID( uuids[0] );
+
+        if( !this->pipelining() ) {
+            // Attempt all of them, report the first failure
+            std::exception_ptr  eptr;
+            for(auto const& uuid: uuids) {
+                try {
+                    (void)this->removeUUID( uuid );
                 }
-            } 
-            ETDCASSERT(line==lines.end(), "There were unprocessed lines of input from the client. This is likely a logical error in this server");
-            // Processed all lines in the reply so far.
-            // So we move all processed bytes to begin of buffer
-            ::memmove(&buffer[0], &buffer[endpos], curPos - endpos);
-            curPos -= endpos;
+                catch( ... ) {
+                    if( !eptr )
+                        eptr = std::current_exception();
+                }
+            }
+            if( eptr )
+                std::rethrow_exception(eptr);
+            return true;
         }
+
+        std::vector<std::string>  cmds;
+        for(auto const& uuid: uuids)
+            cmds.push_back( "remove-uuid "+uuid );
+
+        // Report the first failure, if any
+        for(auto const& reply: this->pipeline(cmds)) {
+            reply_type    r;
+            ETDCASSERT(reply.size()==1 && parse_reply(reply[0], r), "The server sent a non-conforming response");
+            ETDCASSERT(r.ok, "removeUUID failed: " << r.info);
+        }
+        return true;
+    }
+
+    //////////////////////////////////////////////////////////////////////
+    //
+    // This class does NOT implementing the ETDServerInterface but
+    // takes a connection, instantiates its own ETDServer
+    // and then loops, reading commands from the connection and sends
+    // back replies
+    //
+    //////////////////////////////////////////////////////////////////////
+
+    // Commands that may take as long as a file transfer; remove-uuid waits
+    // for the transfer(s) using the UUID to finish
+    static bool is_transfer(strview const& line) {
+        strview       id, cmd( line );
+        parse_tagged(line, id, cmd);
+        return tok::scanner(cmd).literal("send-file") || tok::scanner(cmd).literal("remove-uuid");
+    }
+
+    // Serve the connection until the client hangs up
+    void ETDServerWrapper::handle( void ) {
+        while( this->read(true)!=state_type::Closed )
+            ;
         ETDCDEBUG(3, "ETDServerWrapper: terminated." << std::endl);
     }
 
+    ETDServerWrapper::state_type ETDServerWrapper::read(bool mayTransfer) {
+        // If we go 2kB w/o seeing an actual command we call it a day
+        // I mean, our commands are typically *very* small
+        ETDCDEBUG(5, "ETDServerWrapper::read() / curPos=" << __m_curPos << std::endl);
+        const ssize_t n = __m_connection->read(__m_connection->__m_fd, &__m_buffer[__m_curPos], bufSz-__m_curPos);
+        ETDCDEBUG(5, "ETDServerWrapper::read() / read n=" << n << " => nTotal=" << n + __m_curPos << std::endl);
+        // did we read anything?
+        ETDCASSERT(n>0, "Failed to read data from remote end");
+        __m_curPos += n;
+        return this->process(mayTransfer);
+    }
+
+    ETDServerWrapper::state_type ETDServerWrapper::process(bool mayTransfer) {
+        // Parse the commands so far
+        std::vector<strview>   lines;
+        const size_t           endpos = tok::split_lines(&__m_buffer[0], &__m_buffer[__m_curPos], std::back_inserter(lines));
+        size_t                 donepos = endpos;
+        state_type             state = state_type::Idle;
+
+        for(auto const& line: lines) {
+            // Leave the transfer and everything after it for the caller
+            // to run somewhere where blocking for a long time is fine
+            if( !mayTransfer && is_transfer(line) ) {
+                donepos = (size_t)(line.begin() - &__m_buffer[0]);
+                state   = state_type::Transfer;
+                break;
+            }
+            if( !this->execute(line) ) {
+                state = state_type::Closed;
+                break;
+            }
+        }
+        // So we move all processed bytes to begin of buffer
+        ::memmove(&__m_buffer[0], &__m_buffer[donepos], __m_curPos - donepos);
+        __m_curPos -= donepos;
+        return (__m_curPos<bufSz) ? state : state_type::Closed;
+    }
+
+    bool ETDServerWrapper::execute(strview const& line) {
+        bool                     terminated = false;
+
+        // Got a line! Assert that it conforms to our expectation
+        ETDCDEBUG(4, "ETDServerWrapper::execute()/got line: '" << line << "'" << std::endl);
+
+        // The known commands:
+        //      list <path>
+        //      write-file-<openmode> <file name>
+        //      read-file <already have> <file name>
+        //      send-file <srcUUID> <dstUUID> <todo> <data-channel>[,<data-channel>...] [<nStreams> [<cc> <rate> [<mss> <bufsize>]]]
+        //      data-channel-addr
+        //      remove-uuid <UUID>
+        //      status
+        // (keywords are case insensitive) and the command may be
+        // preceded by a request id "#<id> "
+        std::vector<std::string> replies;
+        std::string              tag;
+        strview                  id, cmd( line ), arg1, arg2, arg3, arg4, arg5, arg6, arg7, arg8, arg9;
+        tok::scanner             s( cmd );
+
+        // Strip the request id, if any; it must be echoed in the replies
+        if( parse_tagged(line, id, cmd) )
+            tag = "#"+id.str()+" ";
+
+        try {
+            if( (s=tok::scanner(cmd)).literal("list") && s.spaces() && s.rest(arg1) ) {
+                // we're a remote ETDServer (seen from the client)
+                // so we do not support ~ expansion
+                const auto entries = __m_etdserver.listPath(arg1.str(), false);
+                std::transform(std::begin(entries), std::end(entries), std::back_inserter(replies),
+                               std::bind(std::plus<std::string>(), std::string("OK "), std::placeholders::_1));
+                // and add a final OK
+                replies.emplace_back("OK");
+            } else if( (s=tok::scanner(cmd)).literal("write-file-") && s.word(arg1) && s.spaces() && s.rest(arg2) ) {
+                openmode_type      om;
+                std::istringstream iss( arg1.str() );
+                // Transform openmode string to actual openmode enum
+                iss >> om;
+                // Do the actual filewrite request
+                const auto         fwresult = __m_etdserver.requestFileWrite(arg2.str(), om);
+                std::ostringstream oss;
+                // Prepare replies
+                oss << "AlreadyHave:" << get_filepos(fwresult);
+                replies.emplace_back(oss.str());
+                replies.emplace_back("UUID:"+get_uuid(fwresult));
+                replies.emplace_back("OK");
+            } else if( (s=tok::scanner(cmd)).literal("read-file") && s.spaces() && s.digits(arg1) && s.spaces() && s.rest(arg2) ) {
+                // Decode the filepos from the sent command into
+                // local, correctly typed, variable
+                const off_t         already_have = tok::to_int<off_t>(arg1);
+
+                // Do the actual fileread request
+                const auto frresult = __m_etdserver.requestFileRead(arg2.str(), already_have);
+
+                // Prepare replies
+                std::ostringstream  oss;
+                oss << "Remain:" << get_filepos(frresult);
+                replies.emplace_back(oss.str());
+                replies.emplace_back("UUID:"+get_uuid(frresult));
+                replies.emplace_back("OK");
+            } else if( (s=tok::scanner(cmd)).literal("send-file") && s.spaces() && s.word(arg1) && s.spaces() && s.word(arg2) &&
+                       s.spaces() && s.digits(arg3) && s.spaces() && s.word(arg4) &&
+                       (s.at_end() || (s.spaces() && s.digits(arg5) &&
+                                       (s.at_end() || (s.spaces() && s.word(arg6) && s.spaces() && s.digits(arg7) &&
+                                                       (s.at_end() || (s.spaces() && s.digits(arg8) && s.spaces() && s.digits(arg9) && s.at_end())))))) ) {
+                // Decode the fields 
+                const off_t           todo = tok::to_int<off_t>(arg3);
+                dataaddrlist_type     dataAddrs;
+                const etdc::uuid_type src_uuid{ arg1.str() };
+                const etdc::uuid_type dst_uuid{ arg2.str() };
+
+                // transform comma separated data channel addresses into list-of-*
+                tok::scanner          addrs( arg4 );
+                strview               addr;
+                do {
+                    if( addrs.span(addr, [](char c) { return c!=','; }) )
+                        dataAddrs.push_back( decode_data_addr(addr.str()) );
+                } while( addrs.character(',') );
+
+                const unsigned long   nStreams = (arg5.empty() ? 1ul : tok::to_int<unsigned long>(arg5));
+
+                ETDCASSERT(nStreams>=1 && nStreams<=maxNStreams, "The number of streams must be 1.." << maxNStreams);
+
+                ccspec_type           cc;
+                if( !arg6.empty() ) {
+                    std::istringstream  iss( arg6.str() );
+                    iss >> cc.algorithm;
+                    ETDCASSERT(cc2string.find(cc.algorithm)!=cc2string.end(), "Unknown congestion control '" << arg6 << "'");
+                    cc.rate = tok::to_int<uint64_t>(arg7);
+                }
+                if( !arg8.empty() ) {
+                    cc.mss     = tok::to_int<unsigned int>(arg8);
+                    cc.bufSize = tok::to_int<size_t>(arg9);
+                    ETDCASSERT(cc.mss==0 || (cc.mss>=64 && cc.mss<=65536), "The MSS must be 64..65536");
+                }
+
+                const bool rv = __m_etdserver.sendFile(src_uuid, dst_uuid, todo, dataAddrs, (unsigned int)nStreams, cc);
+                replies.emplace_back( rv ? "OK" : "ERR Failed to send file" );
+            } else if( (s=tok::scanner(cmd)).literal("data-channel-addr") && s.at_end() ) {
+                const auto entries = __m_etdserver.dataChannelAddr();
+                std::transform(std::begin(entries), std::end(entries), std::back_inserter(replies),
+                               [](sockname_type const& sn) { std::ostringstream oss; oss << "OK " << sn; return oss.str(); });
+                // and add a final OK
+                replies.emplace_back("OK");
+            } else if( (s=tok::scanner(cmd)).literal("remove-uuid") && s.spaces() && s.word(arg1) && s.at_end() ) {
+                const bool removeResult = __m_etdserver.removeUUID(uuid_type(arg1.str()));
+                ETDCDEBUG(4, "ETDServerWrapper: removeUUID(" << arg1 << " yields " << removeResult << std::endl);
+                replies.emplace_back( removeResult ? "OK" : "ERR Failed to remove UUID" );
+            } else if( (s=tok::scanner(cmd)).literal("status") && s.at_end() ) {
+                std::istringstream  iss( __m_etdserver.status() );
+                std::string         l;
+                // an empty line would look like the end of the reply
+                while( std::getline(iss, l) )
+                    if( !l.empty() )
+                        replies.emplace_back( "OK "+l );
+                // and add a final OK
+                replies.emplace_back("OK");
+            } else {
+                // whoever owns the connection closes it
+                ETDCDEBUG(4, "line '" << line << "' is not a known command" << std::endl);
+                throw std::string("client sent unknown command");
+            }
+        }
+        catch( std::string const& e ) {
+            ETDCDEBUG(-1, "ETDServerWrapper: terminating because of condition " << e << std::endl);
+            terminated = true;
+        }
+        catch( std::exception const& e ) {
+            replies.emplace_back( std::string("ERR ")+e.what() );
+        }
+        catch( ... ) {
+            replies.emplace_back( "ERR Unknown exception" );
+        }
+
+        // Now send back the replies
+        for(auto const& r: replies) {
+            const std::string  reply( tag + r + "\n" );
+            ETDCDEBUG(4, "ETDServerWrapper: sending reply '" << tag << r << "'" << std::endl);
+            __m_connection->write(__m_connection->__m_fd, reply.data(), reply.size());
+        }
+        return !terminated;
+    }
+
 
     //////////////////////////////////////////////////////////////////////
     //
@@ -1046,42 +1558,6 @@ namespace etdc {
     //  this is the ETDDataServer - it only deals with data connections
     //
     //////////////////////////////////////////////////////////////////////
-    static const std::regex rxCommand("^(\\{([^\\}]*)\\})");
-    //               subgroup indices:  1   2
-    //                                      just the fields
-    //                                  whole command
-
-    // we support key:value pairs
-    using  kvmap_type = std::map<std::string, std::string, etdc::case_insensitive_lt>;
-    static const std::regex rxKeyValue("\\b([a-zA-Z][a-zA-Z0-9_-]+)\\s*:\\s*(\"(.*(?!\\\\))\"|[^, \\t\\v]+)", etdc_rxFlags);
-    //             subgroup indices:       1                          2   3 quoted string literal
-    //                                     key                        complete value 
-    // NOTE: in the rxKeyValue we write out [a-zA-Z][a-zA-Z...] despite
-    //       etdc_rxFlags contains std::regex::icase. Turns out GCC libstdc++ 
-    //       has a bugz - 'case insensitive match' on character range(s)
-    //       don't work!
-    //          https://gcc.gnu.org/bugzilla/show_bug.cgi?id=71500
-    //       At the time of writing this (29 Jun 2017) this was not yet
-    //       fixed in the gcc version(s) that I had access to.
-    static const std::regex rxSlash("\\\\");
-    static const auto       unSlash = [](std::string const& s) { return std::regex_replace(s, rxSlash, ""); };
-
-    template <typename InputIter, typename OutputIter,
-              typename RegexIter  = std::regex_iterator<InputIter>,
-              typename RetvalType = typename std::match_results<InputIter>::size_type>
-    static RetvalType getKeyValuePairs(InputIter f, InputIter l, OutputIter o) {
-        static const RegexIter  rxIterEnd{};
-
-        RetvalType endpos = 0;
-        for(RegexIter kv = RegexIter(f, l, rxKeyValue); kv!=rxIterEnd; kv++) {
-            // Found another key-value pair: append to output and update endpos
-            const auto this_kv = *kv;
-            *o++   = kvmap_type::value_type{ this_kv[1].str(), unSlash((this_kv[3].length() ? this_kv[3].str() : this_kv[2].str())) };
-            endpos = this_kv.position() + this_kv.length();
-        }
-        return endpos;
-    }
-
     void ETDDataServer::handle( void ) {
         // When writing to a file these are the allowed modes
         static const std::set<openmode_type> allowedWriteModes{openmode_type::New, openmode_type::OverWrite, openmode_type::Resume};
@@ -1091,9 +1567,11 @@ namespace etdc {
         // interpret them.
         // If we go 2kB w/o seeing an actual command we call it a day
         // I mean, our commands are typically *very* small
+        // The actual data transfer is done through pipelined_copy() which
+        // allocates its own buffers so we only need room for the command
+        // and whatever bytes may have followed it.
         const size_t            maxNoCmdSz( 4*1024 );
-        const size_t            bufSz( 10*1024*1024 );
-        std::unique_ptr<char[]> buffer(new char[bufSz]);
+        std::unique_ptr<char[]> buffer(new char[maxNoCmdSz]);
 
         bool          terminated = false;
         size_t        curPos = 0;
@@ -1103,100 +1581,120 @@ namespace etdc {
         // to break us so we just terminate
         while( !terminated && curPos<maxNoCmdSz ) {
             ETDCDEBUG(5, "ETDDataServer::handle() / start loop, curPos=" << curPos << std::endl);
-            const ssize_t n = __m_connection->read(__m_connection->__m_fd, &buffer[curPos], maxNoCmdSz-curPos);
+            // Until we know which kind of header it is, never read past
+            // the size of a binary one: that header is followed by nothing
+            // but data, which we'd rather not copy.
+            const bool    binary = (curPos>0 && (unsigned char)buffer[0]==dataheader_type::magicByte);
+            const size_t  rdMax  = (curPos==0 || binary) ? dataheader_type::size : maxNoCmdSz;
+            const ssize_t n = __m_connection->read(__m_connection->__m_fd, &buffer[curPos], rdMax-curPos);
             ETDCDEBUG(5, "ETDDataServer::handle() / read n=" << n << " => nTotal=" << n + curPos << std::endl);
             // did we read anything?
             ETDCASSERT(n>0, "Failed to read data from remote end");
             curPos += n;
 
             // We know that we have a non-zero amount of bytes read from the client.
-            // If the first byte is not '{' then we're screwed
-            ETDCASSERT(buffer[0]=='{', "Client is messing with us - doesn't look like it is going to send a command");
-
-            // If we end up here we're looking for commands:
-            // '{ uuid:.... , sz: ..., [push: 1, data_addr: ....] }' + binary data
-            kvmap_type             kvpairs;
-            std::cmatch            command;
+            // If the first byte is not '{' or the start of a binary header then we're screwed
+            ETDCASSERT(buffer[0]=='{' || (unsigned char)buffer[0]==dataheader_type::magicByte,
+                       "Client is messing with us - doesn't look like it is going to send a command");
+
+            // What we need to know from either kind of header
+            std::string  uuid;
+            off_t        sz, offset{ 0 };
+            bool         push, ranged;
+            size_t       cmdLen;
+            ccspec_type  cc;
+
+            if( (unsigned char)buffer[0]==dataheader_type::magicByte ) {
+                if( curPos<dataheader_type::size )
+                    continue;
+                const dataheader_type  hdr = decode_dataheader((unsigned char const*)&buffer[0]);
+
+                uuid   = hdr.uuid;
+                sz     = hdr.sz;
+                push   = hdr.push;
+                ranged = hdr.ranged;
+                offset = hdr.offset;
+                cc     = hdr.cc;
+                cmdLen = dataheader_type::size;
+                ETDCDEBUG(4, "ETDDataServer: found binary header uuid:" << uuid << " sz:" << sz << (push ? " push" : "")
+                             << (ranged ? " offset:" : "") << (ranged ? std::to_string(offset) : "") << " cc:" << cc << std::endl);
+            } else {
+                // If we end up here we're looking for commands:
+                // '{ uuid:.... , sz: ..., [push: 1, data_addr: ....] }' + binary data
+                kvheader_type          kvpairs;
+
+                cmdLen = kvpairs.parse(&buffer[0], &buffer[curPos]);
+                if( cmdLen==0 ) {
+                    ETDCDEBUG(4, "ETDDataServer: so far no command in bytes 0.." << curPos << std::endl);
+                    continue;
+                }
+                // OK we found "{ ... }" in the current buffer
+                ETDCDEBUG(4, "ETDDataServer: found command @0 + " << cmdLen << std::endl);
+
+                ETDCDEBUG(4, "ETDDataServer: found " << kvpairs.size() << " key-value pairs inside:" << std::endl);
+                for(size_t i=0; i<kvpairs.size(); i++)
+                    ETDCDEBUG(4, "   " << kvpairs[i].first << ":" << kvpairs[i].second << std::endl);
+
+                // The client asking whether we do binary headers:
+                // '{ binhdr:<version> }'. Tell it the highest version
+                // we support and wait for the next header
+                if( kvpairs.has("binhdr") && !kvpairs.has("uuid") ) {
+                    const unsigned char  version{ dataheader_type::version };
+                    ETDCASSERT(__m_connection->write(__m_connection->__m_fd, &version, 1)==1, "Failed to reply to binary header probe");
+                    ::memmove(&buffer[0], &buffer[cmdLen], curPos - cmdLen);
+                    curPos -= cmdLen;
+                    continue;
+                }
 
-            if( !std::regex_search((const char*)&buffer[0], (const char*)&buffer[curPos], command, rxCommand) ) {
-                ETDCDEBUG(4, "ETDDataServer: so far no command in bytes 0.." << curPos << std::endl);
-                continue;
+                // By the time we get here, we know for sure:
+                //  1.) there was a command '{ ... }' in our buffer
+                //  2.From: ) it may have had a number of key-value pairs in there
+                //
+                // Now it's time to verify:
+                //  - we need 'uuid:'  and 'sz:' key-value pairs
+                //  - there may be 'push:1' 
+                //  - there may be 'offset:' - this is one of a number of
+                //    parallel streams, transferring sz bytes starting at
+                //    absolute file position offset
+                push   = kvpairs.has("push");
+                ranged = kvpairs.has("offset");
+
+                ETDCASSERT(kvpairs.has("uuid"), "No UUID was sent");
+                ETDCASSERT(kvpairs.has("sz"), "No amount was sent");
+                ETDCASSERT(!push || kvpairs.find("push")=="1", "push keyword may only take one specific value");
+                // The size (and offset) must be off_t values
+                uuid = kvpairs.find("uuid").str();
+                sz   = tok::to_int<off_t>(kvpairs.find("sz"));
+                if( ranged ) {
+                    offset = tok::to_int<off_t>(kvpairs.find("offset"));
+                    ETDCASSERT(offset>=0 && sz>=0, "Invalid file range " << offset << " + " << sz);
+                }
             }
-            // OK we found "{ ... }" in the current buffer
-            ETDCDEBUG(4, "ETDDataServer: found command @" << command.position() << " + " << command.length() << std::endl);
-
-            // Ignore the return value of getKeyValuePairs - we already
-            // have the command match doing that for us
-            (void)getKeyValuePairs(&buffer[command.position() + 1], &buffer[command.position() + command.length() - 1],
-                                   etdc::no_duplicates_inserter(kvpairs, kvpairs.end()));
-
-            ETDCDEBUG(4, "ETDDataServer: found " << kvpairs.size() << " key-value pairs inside:" << std::endl);
-            for(const auto& kv: kvpairs)
-                ETDCDEBUG(4, "   " << kv.first << ":" << kv.second << std::endl);
-
-            // By the time we get here, we know for sure:
-            //  1.) there was a command '{ ... }' in our buffer
-            //  2.From: ) it may have had a number of key-value pairs in there
-            //
-            // Now it's time to verify:
-            //  - we need 'uuid:'  and 'sz:' key-value pairs
-            //  - there may be 'push:1' 
-            off_t      sz;
-            const auto uuidptr = kvpairs.find("uuid");
-            const auto szptr   = kvpairs.find("sz");
-            const auto pushptr = kvpairs.find("push");
-
-            ETDCASSERT(uuidptr!=kvpairs.end(), "No UUID was sent");
-            ETDCASSERT(szptr!=kvpairs.end(), "No amount was sent");
-            ETDCASSERT(pushptr==kvpairs.end() || pushptr->second=="1", "push keyword may only take one specific value");
-            // The size must be an off_t value
-            string2off_t(szptr->second, sz);
 
             // Verification = complete.
             // Now we must grab a lock on the transfer (if there is one)
-            // and do our thang
-            const bool                       push = (pushptr!=kvpairs.end());
+            // and do our thang. Parallel streams only lock their own part
+            // of the transfer such that they can all proceed at the same
+            // time
             etdc::etd_state&                 shared_state( __m_shared_state.get() );
-            std::unique_lock<std::mutex>     xfer_lock;
-            etdc::transfermap_type::iterator xfer_ptr;
-
-            // Loop until we've got the lock acquired
-            while( !xfer_lock.owns_lock() /*true*/ ) {
-                // 2a. lock shared state
-                std::unique_lock<std::mutex>     lk( shared_state.lock );
-                // 2b. assert that there is an entry for the indicated uuid
-                xfer_ptr = shared_state.transfers.find(uuid_type(uuidptr->second));
-
-                ETDCASSERT(xfer_ptr!=shared_state.transfers.end(), "No transfer associated with the UUID");
-
-                // Now we must do try_lock on the transfer - if that fails we sleep and start from the beginning
-                std::unique_lock<std::mutex>     sh( xfer_ptr->second->lock, std::try_to_lock );
-                if( !sh.owns_lock() ) {
-                    // Manually unlock the shared state or else nobody won't be
-                    // able to change anything!
-                    lk.unlock();
-
-                    // *now* we sleep for a bit and then try again
-                    std::this_thread::sleep_for( std::chrono::microseconds(9) );
-                    //std::this_thread::sleep_for( std::chrono::seconds(5) );
-                    continue;
-                }
-                // Technically we could've tested the following /before/ getting a
-                // lock on the transfer; we're only checking the transfer's
-                // properties to make sure it is compatible with the current
-                // request.
-                // But putting the test in before attempting to lock the
-                // transfer would mean that we would be doing this test over
-                // and over again until we actually managed to lock the
-                // transfer, which sounds a bit wasteful.
-                // So now we test it once, after we've acquired the lock
-                ETDCASSERT( (push ? allowedReadModes.find(xfer_ptr->second->openMode)!=allowedReadModes.end() :
-                                    allowedWriteModes.find(xfer_ptr->second->openMode)!=allowedWriteModes.end()),
-                            "The referred-to transfer's open mode (" << xfer_ptr->second->openMode << ") is not compatible with the current data request");
-                // move the transfer lock out of this loop;
-                // breaking out of the loop will unlock the shared state
-                xfer_lock = std::move( sh );
-            }
+            const transferptr_type           xfer_ptr = shared_state.transfers.find(uuid_type(uuid));
+
+            ETDCASSERT(xfer_ptr, "No transfer associated with the UUID");
+
+            // Checking the transfer's properties does not need the lock;
+            // they're constant
+            ETDCASSERT( (push ? allowedReadModes.find(xfer_ptr->openMode)!=allowedReadModes.end() :
+                                allowedWriteModes.find(xfer_ptr->openMode)!=allowedWriteModes.end()),
+                        "The referred-to transfer's open mode (" << xfer_ptr->openMode << ") is not compatible with the current data request");
+
+            std::unique_lock<range_lock>     xfer_lock( xfer_ptr->lock, std::defer_lock );
+            range_guard                      range_lk;
+
+            if( ranged )
+                range_lk = range_guard(xfer_ptr->lock, offset, offset+sz);
+            else
+                xfer_lock.lock();
+            ETDCASSERT(!xfer_ptr->removed, "The transfer was removed");
             ETDCDEBUG(5, "ETDDataServer/owning transfer lock, now sucking data!" << std::endl);
 
             // If we end up here we know that the transfer is locked and
@@ -1205,87 +1703,43 @@ namespace etdc {
             
             // We found a valid command in the buffer, there may be raw bytes left following that command.
             // Therefore we initialize our read position to the end of the command we found.
-            const size_t  rdPos( command.position() + command.length() ); 
-            if( push )
-                ETDDataServer::push_n(sz, xfer_ptr->second->fd, __m_connection, rdPos, curPos, bufSz, buffer);
-            else
-                ETDDataServer::pull_n(sz, __m_connection, xfer_ptr->second->fd, rdPos, curPos, bufSz, buffer);
+            const size_t        rdPos( cmdLen );
+            const size_t        nBuf( std::max(shared_state.nBuffers, 1u) );
+            const size_t        bufSz( std::max(shared_state.bufSize/nBuf, (size_t)1) );
+            const etdc_fdptr    xferFD( ranged ? mk_fd<etdc_file_range>(xfer_ptr->fd, offset) : xfer_ptr->fd );
+            if( push ) {
+                // We're the sending end so we do the congestion control
+                etdc::set_congestion(__m_connection, cc);
+                ETDDataServer::push_n(sz, xferFD, __m_connection, shared_state.buffers, nBuf, bufSz, shared_state.useUring);
+            } else
+                ETDDataServer::pull_n(sz, __m_connection, xferFD, &buffer[rdPos], curPos-rdPos, shared_state.buffers, nBuf, bufSz, shared_state.useUring);
             // This command has been served, ready to accept next
             curPos = 0;
         }
         ETDCDEBUG(4, "ETDDataServer::handle() / terminated" << std::endl);
     }
 
-    // PUSH n bytes src to dst, using buffer of size bufSz.
-    // the bytes between endPos and rdPos is are what was read from the
-    // client, following the command. But since we're pushing we're going to 
-    // ignore any extra bytes sent by the client and overwrite everything in
-    // the buffer
+    // PUSH n bytes src to dst, using nBuf buffers of size bufSz.
+    // Any extra bytes sent by the client following the command are ignored;
+    // we're pushing, not receiving.
     void ETDDataServer::push_n(size_t n, etdc::etdc_fdptr src, etdc::etdc_fdptr dst,
-                               size_t /*rdPos*/, const size_t /*endPos*/, const size_t bufSz, std::unique_ptr<char[]>& buf) {
-        while( n>0 ) {
-            // Amount of bytes to process in this iteration
-            const ssize_t nRead = std::min(n, bufSz);
-            ssize_t       aRead, nWritten{ 0 };
-
-            ETDCASSERT((aRead=src->read(src->__m_fd, &buf[0], nRead))>0,
-                       ((aRead==-1) ? std::string(etdc::strerror(errno)) : std::string("read() returned 0 - hung up?!")));
-
-            // Keep on writing untill all bytes that were read are actually written
-            while( aRead>0 ) {
-                ssize_t thisWrite;
-                ETDCASSERT((thisWrite=dst->write(dst->__m_fd, &buf[nWritten], aRead))>0,
-                           ((thisWrite==-1) ? std::string(etdc::strerror(errno)) : std::string("write should never have returned 0?!")) );
-                aRead    -= thisWrite;
-                nWritten += thisWrite;
-            }
-            n -= (size_t)nWritten;
-        }
+                               etdc::buffer_pool& pool, const size_t nBuf, const size_t bufSz, const bool useUring) {
+        etdc::pipelined_copy(n, src, dst, pool, nBuf, bufSz, useUring);
+
         // Do a read from the destination such that we know it is finished
         char ack;
         ETDCDEBUG(5, "ETDDataServer::push_n/waiting for ACK " << std::endl);
         dst->read(dst->__m_fd, &ack, 1);
         ETDCDEBUG(5, "ETDDataServer::push_n/done." << std::endl);
     }
-    // PULL n bytes from rc to dst, using buffer of size bufSz
-    // the bytes between endPos and rdPos are what was read from the client,
-    // raw bytes immediately following the command. We flush those to the
-    // file first and then we can use the whole buffer for reading bytes.
-    void ETDDataServer::pull_n(size_t n, etdc::etdc_fdptr src, etdc::etdc_fdptr dst,
-                               size_t rdPos, const size_t endPos, const size_t bufSz, std::unique_ptr<char[]>& buf) {
-        // rdPos:  current start of read area in buf
-        // endPos: passed in from above; this is where the initial command
-        //         reader left off
-        // wrPos:  current end of read aread in buf
-        // bufSz:  size of buf
-        size_t  wrEnd( endPos );
-
-        while( n>0 ) {
-            // Attempt read as many bytes into our buffer as we can; there
-            // should be room for bufSz - wrEnd bytes. Amount of bytes still/already in buf = wrEnd - rdPos
-            // (thus: "n - (wrEnd - rdPos)" amount still to be read, if any; and "n - (wrEnd - rdPos)" == "n + rdPos - wrEnd"
-            ssize_t       aRead;
-            const ssize_t nRead = std::min(n + rdPos - wrEnd, bufSz - wrEnd);
-        
-            // Attempt to read bytes. <0 is an error
-            ETDCASSERT((aRead = src->read(src->__m_fd, &buf[wrEnd], nRead))>=0, "Failed to read bytes from client - " << etdc::strerror(errno));
-
-            // Now we can bump wrEnd by that amount [at this point aRead might still be zero]
-            wrEnd += aRead;
+    // PULL n bytes from src to dst, using nBuf buffers of size bufSz.
+    // The nPre bytes at pre are what was read from the client, raw bytes
+    // immediately following the command. Those are flushed to the file
+    // first.
+    void ETDDataServer::pull_n(size_t n, etdc::etdc_fdptr src, etdc::etdc_fdptr dst, char const* pre, const size_t nPre,
+                               etdc::buffer_pool& pool, const size_t nBuf, const size_t bufSz, const bool useUring) {
+        etdc::pipelined_copy(n, src, dst, pool, nBuf, bufSz, useUring, pre, nPre);
 
-            // If there are no bytes to write to file that means that 0
-            // bytes were read and no bytes still left in buffer == error
-            ETDCASSERT((wrEnd - rdPos)>0, "No bytes read from client and no more bytes still left in buffer");
-
-            // Now flush the amount of available bytes to the destination
-            ETDCASSERTX(dst->write(dst->__m_fd, &buf[rdPos], wrEnd-rdPos)==ssize_t(wrEnd-rdPos));
-
-            n -= (wrEnd - rdPos);
-
-            // Now we are sure we can use the whole buffer for reading bytes
-            // from the client
-            wrEnd = rdPos = 0;
-        }
         const char ack{ 'y' };
         ETDCDEBUG(5, "ETDDataServer::pull_n/got all bytes, sending ACK " << std::endl);
         src->write(src->__m_fd, &ack, 1);
@@ -25,17 +25,29 @@
 #include <etdc_uuid.h>
 #include <etdc_assert.h>
 #include <etdc_etd_state.h>
+#include <etdc_tokenizer.h>
 
 // C++ headers
+#include <map>
+#include <set>
 #include <list>
+#include <mutex>
 #include <regex>
 #include <string>
 #include <memory>
+#include <vector>
+#include <exception>
+#include <functional>
 #include <type_traits>
 
 namespace etdc {
     using filelist_type     = std::list<std::string>;
     using result_type       = std::tuple<etdc::uuid_type, off_t>;
+    // Batched requests yield, per entry, either a result or why there isn't one
+    using batchentry_type   = std::pair<std::unique_ptr<result_type>, std::exception_ptr>;
+    using batchresult_type  = std::vector<batchentry_type>;
+    // (file name, alreadyhave) for batched requestFileRead
+    using readrequest_type  = std::vector<std::pair<std::string, off_t>>;
 
     // On some systems off_t is an 'alias' for long long int, on others for
     // long int. So when converting between string and off_t we must choose
@@ -77,20 +89,36 @@ namespace etdc {
             virtual result_type       requestFileRead(std::string const& /*file name*/, off_t /*alreadyhave*/)       = 0;
             virtual dataaddrlist_type dataChannelAddr( void ) const = 0;
 
+            // The batched versions: open all files in one go. Failure to
+            // open one of the files does not affect the others.
+            virtual batchresult_type  requestFileWrites(std::vector<std::string> const& /*file names*/, openmode_type) = 0;
+            virtual batchresult_type  requestFileReads(readrequest_type const&) = 0;
+            // How many files can be open at the same time, i.e. the
+            // largest useful batch
+            virtual unsigned int      maxOpen( void ) = 0;
+
             // In the sendFile canned sequence:
             //      srcUUID == own UUID [assume: requestFileRead() was issued to this instance]
             //      dstUUID == UUID of the requestFileWrite on the the destination
             //  Then we attempt to connect from here to 'remote' and push 
+            //  If nStreams>1 the bytes are split over that many data
+            //  connections, each carrying its own part of the file.
+            //  The sending end of the data connection(s) uses the
+            //  congestion control and rate limit in cc
             virtual bool          sendFile(uuid_type const& /*srcUUID*/, uuid_type const& /*dstUUID*/,
-                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/) = 0;
+                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/, unsigned int /*nStreams*/,
+                                           ccspec_type const& /*cc*/) = 0;
             // In the getFile canned sequence, we are the remote end, thus:
             //      srcUUID == remote UUID [assume: requestFileRead() was issued to that instance]
             //      dstUUID == own UUID of the requestFileWrite
             //  Then we attempt to connect from here to 'remote' and ask them to push
             virtual bool          getFile (uuid_type const& /*srcUUID*/, uuid_type const& /*dstUUID*/,
-                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/) = 0;
+                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/, unsigned int /*nStreams*/,
+                                           ccspec_type const& /*cc*/) = 0;
 
             virtual bool          removeUUID(etdc::uuid_type const&) = 0;
+            // Attempts to remove all, throws the first error afterwards
+            virtual bool          removeUUIDs(std::vector<etdc::uuid_type> const&) = 0;
             virtual std::string   status( void ) const = 0;
 
             virtual ~ETDServerInterface() {}
@@ -100,6 +128,47 @@ namespace etdc {
     using etd_server_ptr = std::shared_ptr<ETDServerInterface>;
 
 
+    //////////////////////////////////////////////////////////////////////
+    //
+    //  Data connections are not closed after a transfer but parked in
+    //  here, per data address, such that the next file(s) can be sent over
+    //  them: no connection setup and for UDT no handshake and no starting
+    //  from scratch of the congestion control.
+    //  The ETDDataServer at the other end already loops, expecting the
+    //  next "{ ... }" header after each transfer.
+    //  With each connection we remember whether the remote end understands
+    //  the binary data header (see etdc_dataheader.h); that was
+    //  negotiated when the connection was made.
+    //
+    //////////////////////////////////////////////////////////////////////
+    class connection_pool {
+        public:
+            using key_type = std::string;
+
+            connection_pool() {}
+
+            connection_pool(connection_pool const&)            = delete;
+            connection_pool& operator=(connection_pool const&) = delete;
+
+            // Returns an idle connection to the first of the addresses that
+            // has one which still looks healthy, or an empty pointer.
+            // 'key' is set to identify the address it connects to
+            etdc_fdptr      get(dataaddrlist_type const& addrs, key_type& key, bool& binHdr);
+            // Park a connection that is idle, i.e. the transfer has
+            // completed (including the ACK)
+            void            put(key_type const& key, etdc_fdptr fd, bool binHdr);
+            // Close all parked connections
+            void            clear( void );
+
+            static key_type mk_key(sockname_type const& addr);
+
+        private:
+            using idle_type = std::pair<etdc_fdptr, bool>;
+
+            std::mutex                                   __m_lock;
+            std::map<key_type, std::list<idle_type>>     __m_idle;
+    };
+
     //////////////////////////////////////////////////////////////////////
     //
     //  The concrete ETDServer
@@ -108,8 +177,8 @@ namespace etdc {
     class ETDServer: public ETDServerInterface {
         public:
             explicit ETDServer(etdc::etd_state& shared_state):
-                __m_uuid( etdc::uuid_type::mk() ), __m_shared_state( shared_state )
-            { ETDCDEBUG(2, "ETDServer starting, my uuid=" << __m_uuid << std::endl); }
+                __m_shared_state( shared_state )
+            { ETDCDEBUG(2, "ETDServer starting" << std::endl); }
 
             virtual filelist_type     listPath(std::string const& /*path*/, bool /*allow tilde expansion*/) const;
 
@@ -117,21 +186,37 @@ namespace etdc {
             virtual result_type       requestFileRead(std::string const&,  off_t);
             virtual dataaddrlist_type dataChannelAddr( void ) const;
 
+            virtual batchresult_type  requestFileWrites(std::vector<std::string> const&, openmode_type);
+            virtual batchresult_type  requestFileReads(readrequest_type const&);
+            virtual unsigned int      maxOpen( void ) { return maxNOpen; }
+
             // Canned sequence?
             virtual bool          sendFile(uuid_type const& /*srcUUID*/, uuid_type const& /*dstUUID*/,
-                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/);
+                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/, unsigned int /*nStreams*/,
+                                           ccspec_type const& /*cc*/);
             virtual bool          getFile (uuid_type const& /*srcUUID*/, uuid_type const& /*dstUUID*/,
-                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/);
+                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/, unsigned int /*nStreams*/,
+                                           ccspec_type const& /*cc*/);
 
             virtual bool          removeUUID(etdc::uuid_type const&);
-            virtual std::string   status( void ) const NOTIMPLEMENTED;
+            virtual bool          removeUUIDs(std::vector<etdc::uuid_type> const&);
+            virtual std::string   status( void ) const;
+
+            // Remove our transfers - waiting for the ones in progress - and
+            // close our data connections. The destructor does this too but
+            // this allows the caller to choose the thread that may block.
+            void                  close( void );
 
             virtual ~ETDServer();
 
         private:
+            // Each requestFile{Read,Write} gets their own UUID; these are
+            // the transfers that belong to us
+            std::set<etdc::uuid_type>               __m_uuids;
             // We operate on shared state
-            const etdc::uuid_type                   __m_uuid;
             std::reference_wrapper<etdc::etd_state> __m_shared_state;
+            // Our outgoing data connections, reused across transfers
+            connection_pool                         __m_dataConnections;
     };
 
     //////////////////////////////////////////////////////////////////////
@@ -142,8 +227,15 @@ namespace etdc {
     //////////////////////////////////////////////////////////////////////
     class ETDProxy: public ETDServerInterface {
         public:
-            explicit ETDProxy(etdc::etdc_fdptr conn):
-                __m_connection( conn )
+            // Makes a new connection to the same daemon
+            using connect_type = std::function<etdc::etdc_fdptr(void)>;
+
+            // Without a way to reconnect we cannot find out if the daemon
+            // understands tagged requests, so batches are then sent one
+            // request at a time
+            explicit ETDProxy(etdc::etdc_fdptr conn, connect_type reconnect = connect_type()):
+                __m_tag( 0 ), __m_pipelining( support_type::Unknown ), __m_stateful( false ),
+                __m_buffer( new char[replyBufSz] ), __m_connection( conn ), __m_reconnect( reconnect )
             { ETDCASSERT(__m_connection, "The proxy must have a valid connection"); }
 
             virtual filelist_type     listPath(std::string const& /*path*/, bool /*allow tilde expansion*/) const;
@@ -152,20 +244,58 @@ namespace etdc {
             virtual result_type       requestFileRead(std::string const&,  off_t);
             virtual dataaddrlist_type dataChannelAddr( void ) const;
 
+            // These send the requests tagged with a request id, without
+            // waiting for each reply, if the daemon understands that;
+            // otherwise they send them one at a time.
+            virtual batchresult_type  requestFileWrites(std::vector<std::string> const&, openmode_type);
+            virtual batchresult_type  requestFileReads(readrequest_type const&);
+            // Daemons that don't understand tagged requests predate
+            // having more than one file open per connection
+            virtual unsigned int      maxOpen( void ) { return this->pipelining() ? maxNOpen : 1; }
+
             // Canned sequence?
             virtual bool          sendFile(uuid_type const& /*srcUUID*/, uuid_type const& /*dstUUID*/,
-                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/);
+                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/, unsigned int /*nStreams*/,
+                                           ccspec_type const& /*cc*/);
             virtual bool          getFile (uuid_type const& /*srcUUID*/, uuid_type const& /*dstUUID*/,
-                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/) NOTIMPLEMENTED;
+                                           off_t /*todo*/, dataaddrlist_type const& /*remote*/, unsigned int /*nStreams*/,
+                                           ccspec_type const& /*cc*/) NOTIMPLEMENTED;
 
             virtual bool          removeUUID(etdc::uuid_type const&);
-            virtual std::string   status( void ) const NOTIMPLEMENTED;
+            virtual bool          removeUUIDs(std::vector<etdc::uuid_type> const&);
+            virtual std::string   status( void ) const;
 
             virtual ~ETDProxy() {}
 
         private:
+            using replies_type = std::vector<std::vector<std::string>>;
+            enum class support_type { Unknown, Yes, No };
+
+            // Replies are read into this one, reused, buffer
+            constexpr static size_t         replyBufSz{ 16384 };
+            // The daemon answers a request before reading the next one;
+            // with too many outstanding both ends could block writing
+            constexpr static size_t         maxInFlight{ 16 };
+            mutable unsigned long           __m_tag;
+            support_type                    __m_pipelining;
+            // Set once the daemon holds something for us (open files):
+            // from then on the connection cannot be replaced
+            bool                            __m_stateful;
+            std::unique_ptr<char[]>         __m_buffer;
             // Because we are a proxy we only have a connection to the other end
-            etdc::etdc_fdptr    __m_connection;
+            etdc::etdc_fdptr                __m_connection;
+            connect_type                    __m_reconnect;
+
+            // Send the commands as tagged requests, at most maxInFlight
+            // at a time, and wait for all of them to complete; the replies
+            // are returned in the order of the commands, whatever order
+            // they arrived in
+            replies_type pipeline(std::vector<std::string> const& cmds) const;
+
+            // Whether the daemon understands tagged requests. The first
+            // time, if nothing is open yet, it sends one: older daemons
+            // hang up on that, after which we reconnect.
+            bool         pipelining( void );
     };
 
     //////////////////////////////////////////////////////////////////////
@@ -178,25 +308,71 @@ namespace etdc {
     //////////////////////////////////////////////////////////////////////
     class ETDServerWrapper {
         public:
+            // Tag for the event driven constructor
+            struct deferred_type {};
+
+            // What the connection needs next:
+            //   Idle:     more input from the client - call read()
+            //   Transfer: a command that blocks for as long as a file
+            //             transfer takes is up - call process(true) on a
+            //             thread that can afford that
+            //   Closed:   nothing, the client is done or misbehaved
+            enum class state_type { Idle, Transfer, Closed };
+
             ETDServerWrapper(ETDServerWrapper&&)                       = delete;
             ETDServerWrapper(ETDServerWrapper const&)                  = delete;
             ETDServerWrapper const& operator=(ETDServerWrapper const&) = delete;
 
+            // Serves the connection on the calling thread until the client
+            // hangs up
             template <typename... Args>
             explicit ETDServerWrapper(etdc::etdc_fdptr conn, Args&&... args):
-                __m_etdserver( std::forward<Args>(args)... ), __m_connection(conn)
+                __m_etdserver( std::forward<Args>(args)... ), __m_connection(conn),
+                __m_buffer( new char[bufSz] ), __m_curPos( 0 )
             {
                 ETDCASSERT(__m_connection, "The server wrapper must have a valid connection");
                 this->handle();
             }
 
+            // Leaves it to the caller to read() when there is input
+            template <typename... Args>
+            ETDServerWrapper(deferred_type, etdc::etdc_fdptr conn, Args&&... args):
+                __m_etdserver( std::forward<Args>(args)... ), __m_connection(conn),
+                __m_buffer( new char[bufSz] ), __m_curPos( 0 )
+            {
+                ETDCASSERT(__m_connection, "The server wrapper must have a valid connection");
+            }
+
+            // Read once from the connection and execute the complete
+            // commands; throws if the client hung up
+            state_type read(bool mayTransfer);
+            // Execute the complete commands that have been read
+            state_type process(bool mayTransfer);
+
+            etdc::etdc_fdptr connection( void ) const {
+                return __m_connection;
+            }
+
+            // Release the server's transfers; may block for as long as a
+            // file transfer takes
+            void close( void ) {
+                __m_etdserver.close();
+            }
+
         private:
+            // Our commands are typically *very* small
+            constexpr static size_t bufSz{ 2*1024 };
+
             // We operate on shared state
-            ETDServer           __m_etdserver;
-            etdc::etdc_fdptr    __m_connection;
+            ETDServer               __m_etdserver;
+            etdc::etdc_fdptr        __m_connection;
+            std::unique_ptr<char[]> __m_buffer;
+            size_t                  __m_curPos;
 
             // Sucks the connection empty for commands
             void handle( void );
+            // Returns false if the connection should be terminated
+            bool execute(strview const& line);
     };
 
     //////////////////////////////////////////////////////////////////////
@@ -218,10 +394,10 @@ namespace etdc {
 
             void handle( void );
 
-            static void pull_n(size_t n, etdc::etdc_fdptr src, etdc::etdc_fdptr dst,
-                               size_t rdPos, const size_t endPos, const size_t bufSz, std::unique_ptr<char[]>& buf);
+            static void pull_n(size_t n, etdc::etdc_fdptr src, etdc::etdc_fdptr dst, char const* pre, const size_t nPre,
+                               etdc::buffer_pool& pool, const size_t nBuf, const size_t bufSz, const bool useUring);
             static void push_n(size_t n, etdc::etdc_fdptr src, etdc::etdc_fdptr dst,
-                               size_t rdPos, const size_t endPos, const size_t bufSz, std::unique_ptr<char[]>& buf);
+                               etdc::buffer_pool& pool, const size_t nBuf, const size_t bufSz, const bool useUring);
 
     };
 } // namespace etdc
@@ -233,6 +409,6 @@ etdc::etd_server_ptr mk_etdserver(Args&&... args) {
 
 template <typename... Args>
 etdc::etd_server_ptr mk_etdproxy(Args&&... args) {
-    return std::make_shared<etdc::ETDProxy>( mk_client(std::forward<Args>(args)...) );
+    return std::make_shared<etdc::ETDProxy>( mk_client(args...), [=]( void ) { return mk_client(args...); } );
 }
 #endif
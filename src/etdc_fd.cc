@@ -108,6 +108,8 @@ namespace etdc {
         write( nullfn(decltype(write)) ),
         close( nullfn(decltype(close)) ),
         lseek( nullfn(decltype(lseek)) ), 
+        pread( nullfn(decltype(pread)) ),
+        pwrite( nullfn(decltype(pwrite)) ),
         accept( nullfn(decltype(accept)) ),
         getsockname( nullfn(typename decltype(getsockname)::type) ),
         getpeername( nullfn(typename decltype(getpeername)::type) )
@@ -247,6 +249,30 @@ namespace etdc {
             }
             return (ssize_t)r;
         }
+
+        // Before closing, report how well the sender kept its pace. The
+        // numbers are per UDP port, since the port was opened.
+        // Also what the buffer auto-tuning ended up with.
+        int udtclose(int s) {
+            UDT::TRACEINFO  perf;
+
+            if( UDT::perfmon((UDTSOCKET)s, &perf, false)==UDT::ERROR )
+                return UDT::close((UDTSOCKET)s);
+
+            ETDCDEBUG(3, "udtclose(" << s << ")/buffers: snd=" << perf.pktSndBuf << " rcv=" << perf.pktRcvBuf
+                         << " max snd=" << perf.pktMaxSndBuf << " rcv=" << perf.pktMaxBuf << " packets, bdp snd=" << perf.pktSndBDP << " rcv=" << perf.pktRcvBDP
+                         << " unit queue=" << perf.pktUnitQueue << std::endl);
+            if( perf.pktPacedTotal>0 ) {
+                ETDCDEBUG(3, "udtclose(" << s << ")/pacing: n=" << perf.pktPacedTotal
+                             << " late avg=" << perf.usPacingErrAvg << "us max=" << perf.usPacingErrMax << "us"
+                             << " <1us:" << perf.pktPacingErrHist[0] << " <2us:" << perf.pktPacingErrHist[1]
+                             << " <5us:" << perf.pktPacingErrHist[2] << " <10us:" << perf.pktPacingErrHist[3]
+                             << " <20us:" << perf.pktPacingErrHist[4] << " <50us:" << perf.pktPacingErrHist[5]
+                             << " <100us:" << perf.pktPacingErrHist[6] << " >=100us:" << perf.pktPacingErrHist[7] << std::endl);
+            }
+            return UDT::close((UDTSOCKET)s);
+        }
+
         // Again, UDT does not provide their API with socklen_t
         // so we wrap and make sure that sizeof socklen_t is compatible with
         // what UDT expects.
@@ -306,7 +332,7 @@ namespace etdc {
         // Update basic read/write/close functions
         etdc::update_fd(*this, read_fn(std::bind(&detail::udtrecv, _1, _2, _3, 0)), 
                                write_fn(std::bind(&detail::udtsend, _1, _2, _3, 0)),
-                               close_fn( &UDT::close ),
+                               close_fn( &detail::udtclose ),
                                getsockname_fn( [](int fd) {
                                     return detail::ipv4_sockname<detail::udt_sockname>(fd, "udt", "getsockname"); } ),
                                getpeername_fn( [](int fd) {
@@ -353,6 +379,52 @@ namespace etdc {
 
     etdc_udt6::~etdc_udt6() {}
 
+    namespace detail {
+        // UDT clones the factory so it only needs to live for the call
+        template <typename T>
+        static void set_udt_cc(int fd) {
+            CCCFactory<T>  factory;
+            etdc::setsockopt(fd, udt_set_cc<T>{ &factory });
+        }
+    }
+
+    void set_congestion(etdc_fdptr const& fd, ccspec_type const& cc) {
+        etdc_udt*  udt = dynamic_cast<etdc_udt*>(fd.get());
+
+        // Data connections are pooled, so what the previous transfer set is
+        // still in effect; only if it left the defaults there's nothing to do
+        if( !udt || (cc.is_default_cc() && udt->__m_cc.is_default_cc()) )
+            return;
+        ETDCASSERT(cc.algorithm!=cc_type::Fixed || cc.rate>0, "set_congestion: fixed rate congestion control needs a rate");
+
+        // The rate first: the fixed rate algorithm starts out at full speed,
+        // only UDT_MAXBW holds it back. UDT wants bytes per second
+        etdc::setsockopt(fd->__m_fd, udt_maxbw{ cc.rate ? (int64_t)(cc.rate/8) : (int64_t)-1 });
+
+        // The default algorithm is UDT's own, which the socket may no longer have
+        const cc_type  algorithm = (cc.algorithm==cc_type::Default && udt->__m_cc.algorithm!=cc_type::Default) ?
+                                   cc_type::UDT : cc.algorithm;
+        switch( algorithm ) {
+            case cc_type::UDT:
+                detail::set_udt_cc<CUDTCC>(fd->__m_fd);
+                break;
+            case cc_type::Fixed:
+                detail::set_udt_cc<CFixedRateCC>(fd->__m_fd);
+                break;
+            case cc_type::Delay:
+                detail::set_udt_cc<CDelayCC>(fd->__m_fd);
+                break;
+            case cc_type::BBR:
+                detail::set_udt_cc<CBBRCC>(fd->__m_fd);
+                break;
+            default:
+                // Only the rate then
+                break;
+        }
+        udt->__m_cc = cc;
+        ETDCDEBUG(3, "set_congestion/fd#" << fd->__m_fd << " now uses " << cc << std::endl);
+    }
+
 
     ////////////////////////////////////////////////////////////////
     //   I/O to a regular file
@@ -361,6 +433,7 @@ namespace etdc {
         // Update basic read/write/close functions
         // and on files seek() makes sense!
         etdc::update_fd(*this, read_fn(&::read), write_fn(&::write), close_fn(&::close),
+                               pread_fn(&::pread), pwrite_fn(&::pwrite),
                                setblocking_fn(&setfdblockingmode),
                                // we wrap the ::lseek() inna error check'n lambda dat does error check'n
                                lseek_fn([](int fd, off_t offset, int whence) { 
@@ -371,6 +444,51 @@ namespace etdc {
         );
     }
 
+    ////////////////////////////////////////////////////////////////////////
+    //                   A view on part of a file
+    ////////////////////////////////////////////////////////////////////////
+    etdc_file_range::etdc_file_range(etdc_fdptr file, off_t offset):
+        __m_file( file ), __m_offset( offset )
+    {
+        ETDCASSERT(__m_file, "constructing a file range on a null file");
+        ETDCASSERT(__m_offset>=0, "constructing a file range with negative offset " << __m_offset);
+
+        // pwrite(2) on an O_APPEND file appends irrespective of the offset
+        const int   fmode = ::fcntl(__m_file->__m_fd, F_GETFL);
+        if( fmode!=-1 && (fmode & O_APPEND)==O_APPEND ) {
+            ETDCSYSCALL(::fcntl(__m_file->__m_fd, F_SETFL, fmode & ~O_APPEND)!=-1,
+                        "failed to clear O_APPEND - " << etdc::strerror(errno));
+            (void)__m_file->lseek(__m_file->__m_fd, 0, SEEK_END);
+        }
+        __m_fd = __m_file->__m_fd;
+
+        // Map read/write onto the file's positioned I/O at our offset
+        etdc::update_fd(*this,
+                        read_fn([this](int fd, void* buf, size_t n) {
+                                const ssize_t  rv = __m_file->pread(fd, buf, n, __m_offset);
+                                if( rv>0 )
+                                    __m_offset += rv;
+                                return rv;
+                            }),
+                        write_fn([this](int fd, const void* buf, size_t n) {
+                                const ssize_t  rv = __m_file->pwrite(fd, buf, n, __m_offset);
+                                if( rv>0 )
+                                    __m_offset += rv;
+                                return rv;
+                            }),
+                        lseek_fn([this](int, off_t off, int whence) {
+                                ETDCASSERT(whence==SEEK_SET || whence==SEEK_CUR, "a file range can only seek absolute or relative");
+                                return (__m_offset = (whence==SEEK_SET ? off : __m_offset + off));
+                            }),
+                        pread_fn(__m_file->pread), pwrite_fn(__m_file->pwrite),
+                        // the file is not ours to close
+                        close_fn([](int) { return 0; }),
+                        setblocking_fn([](int, bool) { return; })
+        );
+    }
+
+    etdc_file_range::~etdc_file_range() {}
+
     namespace detail {
         // normalize path according to http://en.cppreference.com/w/cpp/filesystem/path
         // but we limit ourselves to '/' as preferred path separator.
@@ -579,6 +697,26 @@ namespace etdc {
                                 }
                                 return (off_t)(__m_fPointer = new_fPointer);
                             }),
+                        // positioned I/O only tests against the file size.
+                        // Note that, unlike write(), pwrite() does not
+                        // grow /dev/null; multiple streams may be writing
+                        // to it concurrently
+                        pread_fn([this](int, void*, size_t n, off_t offset) {
+                                if( __m_closed || ((__m_mode&O_RDWR)!=O_RDWR && (__m_mode&O_RDONLY)!=O_RDONLY) ) {
+                                    errno = EBADF;
+                                    return (ssize_t)-1;
+                                }
+                                if( offset<0 || (std::size_t)offset>=__m_fSize )
+                                    return (ssize_t)0;
+                                return (ssize_t)std::min(n, __m_fSize - (std::size_t)offset);
+                            }),
+                        pwrite_fn([this](int, const void*, size_t n, off_t) {
+                                if( __m_closed || ((__m_mode&O_RDWR)==0 && (__m_mode&O_WRONLY)==0) ) {
+                                    errno = EBADF;
+                                    return (ssize_t)-1;
+                                }
+                                return (ssize_t)n;
+                            }),
                         // mark the file as closed
                         close_fn([this](int) { __m_closed = true; return 0; }),
                         // setting blocking flag doesn't do /anything/
@@ -24,6 +24,7 @@
 #include <notimplemented.h>
 #include <utilities.h>
 #include <etdc_setsockopt.h>
+#include <etdc_congestion.h>
 #include <etdc_resolve.h>
 #include <etdc_assert.h>
 #include <etdc_debug.h>
@@ -151,6 +152,9 @@ namespace etdc {
     using write_fn       = std::function<ssize_t(int, const void*, size_t)>;
     using close_fn       = std::function<int(int)>;
     using lseek_fn       = std::function<off_t(int, off_t, int)>;
+    // positioned I/O, only makes sense on files
+    using pread_fn       = std::function<ssize_t(int, void*, size_t, off_t)>;
+    using pwrite_fn      = std::function<ssize_t(int, const void*, size_t, off_t)>;
     // connect and bind have same signature but we must be able to tell'm
     // apart so we use tagging!
     //using connect_fn     = etdc::tagged<std::function<int(int, ipport_type const&)>, detail::connect_tag>;
@@ -180,6 +184,8 @@ namespace etdc {
         write_fn       write;
         close_fn       close;
         lseek_fn       lseek;
+        pread_fn       pread;
+        pwrite_fn      pwrite;
         //connect_fn     connect;
         //bind_fn        bind;
         //listen_fn      listen;
@@ -191,7 +197,7 @@ namespace etdc {
 
     static const etdc::construct<etdc_fd> update_fd( &etdc_fd::read, &etdc_fd::write, &etdc_fd::close, &etdc_fd::accept,
                                                      &etdc_fd::getsockname, &etdc_fd::getpeername, &etdc_fd::setblocking,
-                                                     &etdc_fd::lseek );
+                                                     &etdc_fd::lseek, &etdc_fd::pread, &etdc_fd::pwrite );
 
     //////////////////////////////////////////////////////////////////
     //
@@ -232,6 +238,9 @@ namespace etdc {
 
         virtual ~etdc_udt();
 
+        // What set_congestion() last did to this socket
+        ccspec_type __m_cc {};
+
         protected:
             void setup_basic_fns( void );
     };
@@ -247,6 +256,12 @@ namespace etdc {
             void setup_basic_fns( void );
     };
 
+    // Switch a connected UDT socket to the requested congestion control
+    // and rate limit. Anything that is not UDT is left alone, as is a
+    // default congestion control - unless an earlier call changed it, then
+    // it goes back to UDT's own, unlimited.
+    void set_congestion(etdc_fdptr const& fd, ccspec_type const& cc);
+
     namespace detail {
         std::string normalize_path(std::string const&);
         std::string dirname(std::string const&);
@@ -273,6 +288,28 @@ namespace etdc {
             void setup_basic_fns( void );
     };
 
+    // A view on an opened file, starting at byte 'offset'.
+    // Reading/writing is done through the file's pread()/pwrite() so
+    // multiple views on the same file can be used concurrently (e.g. each
+    // by its own data stream transferring a disjoint part of the file) and
+    // the file's own file pointer is left alone.
+    // lseek() only moves the view's offset. Closing the view does not close
+    // the underlying file; the view keeps the file alive for as long as it
+    // exists.
+    // Note: if the file was opened with O_APPEND, that flag is removed and
+    // the file pointer moved to the end - pwrite(2) would ignore the
+    // offset otherwise.
+    struct etdc_file_range:
+        public etdc_fd
+    {
+        etdc_file_range() = delete;
+        etdc_file_range(etdc_fdptr file, off_t offset);
+        virtual ~etdc_file_range();
+
+        const etdc_fdptr  __m_file;
+        off_t             __m_offset;
+    };
+
     namespace detail {
         constexpr int64_t ipow(int64_t base, int exp, int64_t result = 1) {
               return exp < 1 ? result : ipow(base*base, exp/2, (exp % 2) ? result*base : result);
@@ -419,6 +456,20 @@ namespace etdc {
 
     namespace detail {
         constexpr static int defaultUDTBufSize{ 320*1024*1024 };
+        // UDT paces its packets by sleeping until this many microseconds
+        // before the next one is due and busy-waiting for the rest
+        // (-1 = the library's compiled-in timer)
+        constexpr static int defaultUDTPacing{ 100 };
+        // Number of UDT send/receive thread pairs serving a server's port
+        constexpr static int defaultUDTShards{ 1 };
+        // UDT grows the buffers (and with them the flight window) to twice
+        // the measured bandwidth-delay product, but never beyond this many
+        // bytes. It applies to every data connection, of which a daemon
+        // may have many, so it's modest: 2 x BDP of 1Gbps at 250ms RTT
+        constexpr static int64_t defaultUDTBufLimit{ 64*1024*1024 };
+        // UDT starts the connection handshake with jumbo frames and
+        // settles for the largest MSS the path carries (udt_pmtud)
+        constexpr static int defaultUDTMSS{ 9000 };
 
         // For creating sokkits
         using protocol_map_type = std::map<std::string, std::function<etdc_fdptr(void)>>;
@@ -445,6 +496,10 @@ namespace etdc {
             etdc::udp_sndbuf udpSndBufSize {};
             etdc::ipv6_only  ipv6_only  {};
             etdc::udt_linger udtLinger  {};
+            etdc::udt_pacing udtPacing  {};
+            etdc::udt_shards udtShards  {};
+            etdc::udt_buflimit udtBufLimit {};
+            etdc::udt_pmtud  udtPMTUD   {};
         };
         const etdc::construct<server_settings>  update_srv( &server_settings::blocking,
                                                             &server_settings::backLog,
@@ -458,7 +513,11 @@ namespace etdc {
                                                             &server_settings::udpSndBufSize,
                                                             &server_settings::udtMSS,
                                                             &server_settings::ipv6_only,
-                                                            &server_settings::udtLinger );
+                                                            &server_settings::udtLinger,
+                                                            &server_settings::udtPacing,
+                                                            &server_settings::udtShards,
+                                                            &server_settings::udtBufLimit,
+                                                            &server_settings::udtPMTUD );
 
         using server_defaults_map = std::map<std::string, std::function<server_settings(void)>>;
 
@@ -479,7 +538,11 @@ namespace etdc {
                                                 etdc::udp_sndbuf{32*1024*1024},
                                                 etdc::udp_rcvbuf{32*1024*1024},
                                                 any_port, etdc::udt_linger{{0,0}},
-                                                etdc::udt_mss{1500});
+                                                etdc::udt_pacing{defaultUDTPacing},
+                                                etdc::udt_shards{defaultUDTShards},
+                                                etdc::udt_buflimit{defaultUDTBufLimit},
+                                                etdc::udt_pmtud{true},
+                                                etdc::udt_mss{defaultUDTMSS});
                          }},
             {"udt6", []() { return update_srv.mk(backlog_type{4},
                                                 blocking_type{true},
@@ -488,7 +551,11 @@ namespace etdc {
                                                 etdc::udp_sndbuf{32*1024*1024},
                                                 etdc::udp_rcvbuf{32*1024*1024},
                                                 any_port, etdc::udt_linger{{0,0}},
-                                                etdc::udt_mss{1500});
+                                                etdc::udt_pacing{defaultUDTPacing},
+                                                etdc::udt_shards{defaultUDTShards},
+                                                etdc::udt_buflimit{defaultUDTBufLimit},
+                                                etdc::udt_pmtud{true},
+                                                etdc::udt_mss{defaultUDTMSS});
                          }}
         };
 
@@ -608,9 +675,11 @@ namespace etdc {
                         //       to a larger value (25600 in libudt), it is
                         //       measured in MSS packets so we set this
                         //       option from the server's configured values
+                        // The MSS goes first: UDT converts the buffer sizes into packets of the current MSS
                         const auto fc = (etdc::untag(srv.udtBufSize)/(etdc::untag(srv.udtMSS)-28))+256;
-                        etdc::setsockopt(pSok->__m_fd, etdc::udt_reuseaddr{true}, etdc::udt_fc{fc}, 
-                                         srv.udtBufSize, srv.udtSndBufSize, srv.udtMSS, srv.udtLinger);
+                        etdc::setsockopt(pSok->__m_fd, etdc::udt_reuseaddr{true}, etdc::udt_fc{fc}, srv.udtMSS,
+                                         srv.udtBufSize, srv.udtSndBufSize, srv.udtLinger, srv.udtPacing,
+                                         srv.udtShards, srv.udtBufLimit, srv.udtPMTUD);
 
                         if( srv.udpBufSize )
                             etdc::setsockopt(pSok->__m_fd, srv.udpBufSize);
@@ -663,9 +732,11 @@ namespace etdc {
                         //       to a larger value (25600 in libudt), it is
                         //       measured in MSS packets so we set this
                         //       option from the server's configured values
+                        // The MSS goes first: UDT converts the buffer sizes into packets of the current MSS
                         const auto fc = (etdc::untag(srv.udtBufSize)/(etdc::untag(srv.udtMSS)-28))+256;
-                        etdc::setsockopt(pSok->__m_fd, etdc::udt_reuseaddr{true}, etdc::udt_fc{fc}, 
-                                         srv.udtBufSize, srv.udtSndBufSize, srv.udtMSS, srv.udtLinger);
+                        etdc::setsockopt(pSok->__m_fd, etdc::udt_reuseaddr{true}, etdc::udt_fc{fc}, srv.udtMSS,
+                                         srv.udtBufSize, srv.udtSndBufSize, srv.udtLinger, srv.udtPacing,
+                                         srv.udtShards, srv.udtBufLimit, srv.udtPMTUD);
                         //etdc::setsockopt(pSok->__m_fd, etdc::udt_reuseaddr{true}, srv.udtBufSize, srv.udtSndBufSize, srv.udtMSS, srv.udtLinger);
 
                         if( srv.udpBufSize )
@@ -736,6 +807,9 @@ namespace etdc {
             etdc::udp_rcvbuf udpRcvBufSize {};
             etdc::ipv6_only  ipv6_only  {};
             etdc::udt_linger udtLinger  {};
+            etdc::udt_pacing udtPacing  {};
+            etdc::udt_buflimit udtBufLimit {};
+            etdc::udt_pmtud  udtPMTUD   {};
         };
         const etdc::construct<client_settings>  update_clnt( &client_settings::blocking,
                                                              &client_settings::clntPort,
@@ -748,7 +822,10 @@ namespace etdc {
                                                              &client_settings::udpBufSize,
                                                              &client_settings::udpRcvBufSize,
                                                              &client_settings::ipv6_only,
-                                                             &client_settings::udtLinger );
+                                                             &client_settings::udtLinger,
+                                                             &client_settings::udtPacing,
+                                                             &client_settings::udtBufLimit,
+                                                             &client_settings::udtPMTUD );
 
         using client_defaults_map = std::map<std::string, std::function<client_settings(void)>>;
 
@@ -761,15 +838,17 @@ namespace etdc {
             {"tcp6", []() { return update_clnt.mk(blocking_type{true}, etdc::ipv6_only{true},
                                                  any_port );
                          }},
-            {"udt", []() { return update_clnt.mk(etdc::udt_mss{1500},
+            {"udt", []() { return update_clnt.mk(etdc::udt_mss{defaultUDTMSS}, etdc::udt_pmtud{true},
                                                  any_port, etdc::udt_linger{{0, 0}},
                                                  etdc::udt_sndbuf{defaultUDTBufSize},
                                                  etdc::udt_rcvbuf{defaultUDTBufSize},
                                                  etdc::udp_sndbuf{32*1024*1024},
                                                  etdc::udp_rcvbuf{32*1024*1024},
+                                                 etdc::udt_pacing{defaultUDTPacing},
+                                                 etdc::udt_buflimit{defaultUDTBufLimit},
                                                  blocking_type{true});
                          }},
-            {"udt6", []() { return update_clnt.mk(etdc::udt_mss{1500},
+            {"udt6", []() { return update_clnt.mk(etdc::udt_mss{defaultUDTMSS}, etdc::udt_pmtud{true},
                                                  // UDT does not allow direct access to the real socket so we can't really
                                                  // set an option at the IPPROTO_IPV6 level.
                                                  any_port, etdc::udt_linger{{0,0}},
@@ -777,6 +856,8 @@ namespace etdc {
                                                  etdc::udt_rcvbuf{defaultUDTBufSize},
                                                  etdc::udp_sndbuf{32*1024*1024},
                                                  etdc::udp_rcvbuf{32*1024*1024},
+                                                 etdc::udt_pacing{defaultUDTPacing},
+                                                 etdc::udt_buflimit{defaultUDTBufLimit},
                                                  blocking_type{true});
                          }}
         };
@@ -866,9 +947,11 @@ namespace etdc {
                         //       to a larger value (25600 in libudt), it is
                         //       measured in MSS packets so we set this
                         //       option from the server's configured values
+                        // The MSS goes first: UDT converts the buffer sizes into packets of the current MSS
                         const auto fc = (etdc::untag(clnt.udtRcvBufSize)/(etdc::untag(clnt.udtMSS)-28))+256;
-                        etdc::setsockopt(pSok->__m_fd, etdc::udt_reuseaddr{true}, etdc::udt_fc{fc}, 
-                                         clnt.udtBufSize, clnt.udtRcvBufSize, clnt.udtMSS, clnt.udtLinger);
+                        etdc::setsockopt(pSok->__m_fd, etdc::udt_reuseaddr{true}, etdc::udt_fc{fc}, clnt.udtMSS,
+                                         clnt.udtBufSize, clnt.udtRcvBufSize, clnt.udtLinger, clnt.udtPacing,
+                                         clnt.udtBufLimit, clnt.udtPMTUD);
                         //etdc::setsockopt(pSok->__m_fd, clnt.udtBufSize, clnt.udtRcvBufSize, clnt.udtMSS, clnt.udtLinger);
 
                         if( clnt.udpBufSize )
@@ -909,9 +992,11 @@ namespace etdc {
                         //       to a larger value (25600 in libudt), it is
                         //       measured in MSS packets so we set this
                         //       option from the server's configured values
+                        // The MSS goes first: UDT converts the buffer sizes into packets of the current MSS
                         const auto fc = (etdc::untag(clnt.udtRcvBufSize)/(etdc::untag(clnt.udtMSS)-28))+256;
-                        etdc::setsockopt(pSok->__m_fd, etdc::udt_reuseaddr{true}, etdc::udt_fc{fc}, 
-                                         clnt.udtBufSize, clnt.udtRcvBufSize, clnt.udtMSS, clnt.udtLinger);
+                        etdc::setsockopt(pSok->__m_fd, etdc::udt_reuseaddr{true}, etdc::udt_fc{fc}, clnt.udtMSS,
+                                         clnt.udtBufSize, clnt.udtRcvBufSize, clnt.udtLinger, clnt.udtPacing,
+                                         clnt.udtBufLimit, clnt.udtPMTUD);
                         //etdc::setsockopt(pSok->__m_fd, clnt.udtBufSize, clnt.udtRcvBufSize, clnt.udtMSS, clnt.udtLinger);
 
                         if( clnt.udpBufSize )
@@ -0,0 +1,542 @@
+// Implementation of the N-buffered copying between two etdc_fd's
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+// splice(2) is a GNU extension; the Makefile explicitly undefines
+// _GNU_SOURCE so we must (re)define it before including anything
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <etdc_pipeline.h>
+#include <etdc_uring.h>
+#include <etdc_thread.h>
+#include <etdc_assert.h>
+#include <etdc_debug.h>
+#include <reentrant.h>
+
+#include <thread>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+namespace etdc {
+
+    buffer_ring::buffer_ring(pooled_buffers_type&& buffers, size_t bufSz):
+        __m_buffers( std::move(buffers) ), __m_nBuf( __m_buffers.size() ), __m_bufSz( bufSz ), __m_fill( __m_nBuf, 0 ),
+        __m_rdIdx( 0 ), __m_wrIdx( 0 ), __m_nFull( 0 ), __m_nBusy( 0 ), __m_cancelled( false )
+    {
+        ETDCASSERT(__m_nBuf>0 && __m_bufSz>0, "buffer_ring needs at least one buffer of non-zero size");
+    }
+
+    char* buffer_ring::get_empty( void ) {
+        std::unique_lock<std::mutex> lk( __m_lock );
+        __m_condition.wait(lk, [this]() { return __m_cancelled || __m_nFull<__m_nBuf; });
+        return __m_cancelled ? nullptr : __m_buffers[__m_wrIdx].get();
+    }
+
+    void buffer_ring::put_full(size_t n) {
+        std::lock_guard<std::mutex> lk( __m_lock );
+        __m_fill[__m_wrIdx] = n;
+        __m_wrIdx           = (__m_wrIdx + 1) % __m_nBuf;
+        __m_nFull++;
+        __m_condition.notify_all();
+    }
+
+    char* buffer_ring::get_full(size_t& n) {
+        std::unique_lock<std::mutex> lk( __m_lock );
+        __m_condition.wait(lk, [this]() { return __m_cancelled || __m_nFull>__m_nBusy; });
+        if( __m_cancelled )
+            return nullptr;
+        const size_t  idx = (__m_rdIdx + __m_nBusy++) % __m_nBuf;
+        n = __m_fill[idx];
+        return __m_buffers[idx].get();
+    }
+
+    void buffer_ring::put_empty( void ) {
+        std::lock_guard<std::mutex> lk( __m_lock );
+        __m_rdIdx = (__m_rdIdx + 1) % __m_nBuf;
+        __m_nFull--;
+        __m_nBusy--;
+        __m_condition.notify_all();
+    }
+
+    void buffer_ring::cancel( void ) {
+        std::lock_guard<std::mutex> lk( __m_lock );
+        __m_cancelled = true;
+        __m_condition.notify_all();
+    }
+
+
+    namespace detail {
+        // Keep on writing until all n bytes from buf are actually written
+        static void write_all(etdc_fdptr const& dst, char const* buf, size_t n) {
+            while( n>0 ) {
+                ssize_t thisWrite;
+                ETDCASSERT((thisWrite=dst->write(dst->__m_fd, buf, n))>0,
+                           ((thisWrite==-1) ? std::string(etdc::strerror(errno)) : std::string("write should never have returned 0?!")) );
+                buf += thisWrite;
+                n   -= (size_t)thisWrite;
+            }
+        }
+
+        // One read from src into buf, at most n bytes. Anything <=0 is an error
+        // because we know exactly how many bytes we should be getting
+        static size_t read_some(etdc_fdptr const& src, char* buf, size_t n) {
+            ssize_t nRead;
+            ETDCASSERT((nRead=src->read(src->__m_fd, buf, n))>0,
+                       ((nRead==-1) ? std::string(etdc::strerror(errno)) : std::string("read() returned 0 - hung up?!")));
+            return (size_t)nRead;
+        }
+    }
+
+    namespace detail {
+        // The zero-copy paths only apply to real files and TCP sockets;
+        // etdc_tcp6 derives from etdc_tcp so it is included
+        template <typename T>
+        static bool is_a(etdc_fdptr const& fd) {
+            return dynamic_cast<T const*>(fd.get())!=nullptr;
+        }
+
+        // Real files and ranges of real files can be handed to the kernel.
+        // For a range 'offset' is pointed at the range's offset, which the
+        // kernel can update, for a file it is nullptr: use the file pointer
+        static bool is_file(etdc_fdptr const& fd, off_t*& offset) {
+            etdc_file_range* const  range = dynamic_cast<etdc_file_range*>(fd.get());
+
+            offset = nullptr;
+            if( range && is_a<etdc_file>(range->__m_file) ) {
+                offset = &range->__m_offset;
+                return true;
+            }
+            return is_a<etdc_file>(fd);
+        }
+
+#ifdef __linux__
+        // Not every file system, socket or kernel supports the zero-copy
+        // calls; if the first one says so, the bytes can still be copied
+        // the ordinary way
+        static bool unsupported(ssize_t rv) {
+            return rv==-1 && (errno==EINVAL || errno==ENOSYS);
+        }
+
+        // file -> socket: sendfile(2) from the file's current position.
+        // 'n' is decremented by the number of bytes moved
+        static bool zerocopy_send(size_t& n, etdc_fdptr const& src, etdc_fdptr const& dst) {
+            off_t*  offset;
+            if( !(is_file(src, offset) && is_a<etdc_tcp>(dst)) )
+                return false;
+            ETDCDEBUG(4, "zerocopy_send/using sendfile(2) for " << n << " bytes" << std::endl);
+            for(bool first = true; n>0; first = false) {
+                // Linux transfers at most 0x7ffff000 bytes per call anyway
+                const ssize_t  nSent = ::sendfile(dst->__m_fd, src->__m_fd, offset, std::min(n, (size_t)0x7ffff000));
+                if( first && unsupported(nSent) ) {
+                    ETDCDEBUG(4, "zerocopy_send/sendfile(2) not supported - " << etdc::strerror(errno) << std::endl);
+                    return false;
+                }
+                ETDCASSERT(nSent>0, "sendfile/" << ((nSent==-1) ? etdc::strerror(errno) : std::string("source file hit EOF")));
+                n -= (size_t)nSent;
+            }
+            return true;
+        }
+#else
+        static bool zerocopy_send(size_t&, etdc_fdptr const&, etdc_fdptr const&) {
+            return false;
+        }
+#endif
+
+#if defined(__linux__) && defined(SPLICE_F_MOVE)
+        // socket -> file: splice(2) via a pipe.
+        // 'n' is decremented by the number of bytes moved
+        static bool zerocopy_recv(size_t& n, etdc_fdptr const& src, etdc_fdptr const& dst) {
+            off_t*  offset;
+            if( !(is_a<etdc_tcp>(src) && is_file(dst, offset)) )
+                return false;
+            // splice(2) refuses to write to files opened with O_APPEND
+            // (Resume mode) - find out before any bytes are sucked into the pipe
+            const int fmode = ::fcntl(dst->__m_fd, F_GETFL);
+            if( fmode==-1 || (fmode&O_APPEND)==O_APPEND )
+                return false;
+
+            int  fds[2];
+            if( ::pipe(fds)!=0 )
+                return false;
+            std::unique_ptr<int, void(*)(int*)>  pipeCloser(&fds[0], [](int* p) { ::close(p[0]); ::close(p[1]); });
+
+#ifdef F_SETPIPE_SZ
+            // Try for a bigger pipe; if we don't get it, it's not an error
+            (void)::fcntl(fds[1], F_SETPIPE_SZ, 1024*1024);
+#endif
+            const size_t  chunk( 1024*1024 );
+
+            ETDCDEBUG(4, "zerocopy_recv/using splice(2) for " << n << " bytes" << std::endl);
+            for(bool first = true; n>0; first = false) {
+                ssize_t  nIn = ::splice(src->__m_fd, nullptr, fds[1], nullptr, std::min(n, chunk), SPLICE_F_MOVE|SPLICE_F_MORE);
+                if( first && unsupported(nIn) ) {
+                    ETDCDEBUG(4, "zerocopy_recv/splice(2) from socket not supported - " << etdc::strerror(errno) << std::endl);
+                    return false;
+                }
+                ETDCASSERT(nIn>0, "splice/" << ((nIn==-1) ? etdc::strerror(errno) : std::string("remote side hung up")));
+                n -= (size_t)nIn;
+                // Drain the pipe completely into the file
+                while( nIn>0 ) {
+                    const ssize_t  nOut = ::splice(fds[0], nullptr, dst->__m_fd, offset, (size_t)nIn, SPLICE_F_MOVE);
+                    if( first && unsupported(nOut) ) {
+                        // The bytes already in the pipe are written the
+                        // ordinary way, the caller copies the rest
+                        ETDCDEBUG(4, "zerocopy_recv/splice(2) to file not supported - " << etdc::strerror(errno) << std::endl);
+                        char  buf[64*1024];
+                        while( nIn>0 ) {
+                            const ssize_t  nRead = ::read(fds[0], buf, std::min((size_t)nIn, sizeof(buf)));
+                            ETDCASSERT(nRead>0, "read from pipe/" << ((nRead==-1) ? etdc::strerror(errno) : std::string("pipe is empty?!")));
+                            write_all(dst, buf, (size_t)nRead);
+                            nIn -= nRead;
+                        }
+                        return false;
+                    }
+                    ETDCASSERT(nOut>0, "splice/" << ((nOut==-1) ? etdc::strerror(errno) : std::string("write should never have returned 0?!")));
+                    nIn -= nOut;
+                }
+            }
+            return true;
+        }
+#else
+        static bool zerocopy_recv(size_t&, etdc_fdptr const&, etdc_fdptr const&) {
+            return false;
+        }
+#endif
+    }
+
+    namespace detail {
+        // Where a file, or range of one, is at: the range's offset or the
+        // file pointer
+        static off_t file_position(etdc_fdptr const& fd, off_t const* offset) {
+            return offset ? *offset : fd->lseek(fd->__m_fd, 0, SEEK_CUR);
+        }
+
+        // file -> UDT socket: UDT reads the file straight into its send buffer
+        static bool udt_send(size_t n, etdc_fdptr const& src, etdc_fdptr const& dst) {
+            off_t*  offset;
+            if( !(is_file(src, offset) && is_a<etdc_udt>(dst)) )
+                return false;
+
+            int64_t        pos = (int64_t)file_position(src, offset);
+            const int64_t  nSent = UDT::sendfile((UDTSOCKET)dst->__m_fd, src->__m_fd, pos, (int64_t)n);
+
+            ETDCDEBUG(4, "udt_send/UDT::sendfile " << n << " bytes" << std::endl);
+            ETDCASSERT(nSent==(int64_t)n, "udt_send/" << ((nSent==UDT::ERROR) ? std::string(UDT::getlasterror().getErrorMessage()) :
+                                                                             std::string("source file hit EOF")));
+            // Leave the file position where read(2) would have left it
+            if( offset )
+                *offset = (off_t)pos;
+            else
+                src->lseek(src->__m_fd, (off_t)pos, SEEK_SET);
+            return true;
+        }
+
+        // UDT socket -> file: UDT writes the packets straight from its
+        // receive buffer
+        static bool udt_recv(size_t n, etdc_fdptr const& src, etdc_fdptr const& dst) {
+            off_t*  offset;
+            if( !(is_a<etdc_udt>(src) && is_file(dst, offset)) )
+                return false;
+
+            int64_t        pos = (int64_t)file_position(dst, offset);
+            const int64_t  nRecv = UDT::recvfile((UDTSOCKET)src->__m_fd, dst->__m_fd, pos, (int64_t)n);
+
+            ETDCDEBUG(4, "udt_recv/UDT::recvfile " << n << " bytes" << std::endl);
+            ETDCASSERT(nRecv==(int64_t)n, "udt_recv/" << ((nRecv==UDT::ERROR) ? std::string(UDT::getlasterror().getErrorMessage()) :
+                                                                             std::string("got only ") + std::to_string(nRecv) + " bytes"));
+            // Leave the file position where write(2) would have left it
+            if( offset )
+                *offset = (off_t)pos;
+            else
+                dst->lseek(dst->__m_fd, (off_t)pos, SEEK_SET);
+            return true;
+        }
+
+        // Called by UDT when the remote end has acknowledged a buffer
+        // (or the socket is gone): it may be filled again
+        using ring_ptr = std::shared_ptr<buffer_ring>;
+
+        static void udt_release(void* ctx, const char*, int, bool) {
+            ring_ptr*  ring = static_cast<ring_ptr*>(ctx);
+            (*ring)->put_empty();
+            delete ring;
+        }
+
+        // Hand a full buffer over to UDT without copying it. The ring -
+        // and thus the buffer - is kept alive until UDT is done with it,
+        // even if we're not around anymore by then
+        static void udt_send_ref(etdc_fdptr const& dst, char const* buf, size_t n, ring_ptr const& ring) {
+            const int  nSent = UDT::sendref((UDTSOCKET)dst->__m_fd, buf, (int)n, &udt_release, new ring_ptr(ring));
+            ETDCASSERT(nSent==(int)n, "udt_send_ref/" << ((nSent==UDT::ERROR) ? std::string(UDT::getlasterror().getErrorMessage()) :
+                                                                                 std::string("only ") + std::to_string(nSent) + " out of " + std::to_string(n) + " bytes were queued"));
+        }
+    }
+
+    namespace detail {
+        // Per buffer bookkeeping for the io_uring path: which part of the
+        // file it maps to and how much of that has been done already
+        struct uring_slot {
+            char*   buf;
+            size_t  len, done;
+            off_t   off;
+            bool    busy;
+        };
+
+        // Reap one completion. Partial reads/writes are requeued for the
+        // remainder, otherwise the slot is marked not busy anymore
+        static void uring_reap(uring& ring, std::vector<uring_slot>& slots, int fd, bool isRead) {
+            int             res;
+            const uint64_t  idx  = ring.wait(res);
+            uring_slot&     slot = slots[idx];
+
+            ETDCASSERT(res>0, (isRead ? "read" : "write") << " - " <<
+                              ((res<0) ? etdc::strerror(-res) : std::string(isRead ? "file hit EOF" : "write should never have returned 0?!")));
+            slot.done += (size_t)res;
+            if( slot.done<slot.len ) {
+                if( isRead )
+                    ring.prep_read(fd, slot.buf+slot.done, slot.len-slot.done, slot.off+(off_t)slot.done, idx);
+                else
+                    ring.prep_write(fd, slot.buf+slot.done, slot.len-slot.done, slot.off+(off_t)slot.done, idx);
+                ring.submit();
+                return;
+            }
+            slot.busy = false;
+        }
+
+        // Wait for all operations the kernel has accepted. Closing the ring
+        // does not stop them, so until this returns the kernel may still
+        // read into or write from our buffers
+        static void uring_drain(uring& ring) {
+            int  res;
+            while( ring.inflight() )
+                (void)ring.wait(res);
+        }
+
+        // file -> anything or anything -> file with up to nBuf file I/Os
+        // in flight. Returns false without having touched a byte if it
+        // does not apply or the kernel can't do it.
+        static bool uring_copy(size_t n, etdc_fdptr const& src, etdc_fdptr const& dst, buffer_pool& pool, size_t nBuf, size_t bufSz) {
+            off_t*      offset;
+            const bool  fromFile = is_file(src, offset);
+            const bool  toFile   = is_file(dst, offset);
+
+            if( fromFile==toFile || nBuf<=1 || !uring::available() )
+                return false;
+
+            etdc_fdptr const&  file   = (fromFile ? src : dst);
+            const int          fileFd = file->__m_fd;
+            const int          fmode  = ::fcntl(fileFd, F_GETFL);
+
+            // With O_APPEND (Resume mode) the kernel ignores our offsets and
+            // writes would land in completion order, not file order
+            if( fmode==-1 || (fmode&O_APPEND)==O_APPEND )
+                return false;
+            const off_t        start  = file->lseek(fileFd, 0, SEEK_CUR);
+
+            // Memory first such that the ring is destroyed before the
+            // buffers are. That alone is not enough: the ring must be
+            // drained before we leave, see uring_drain()
+            pooled_buffers_type                   buffers( pool.get(nBuf, bufSz) );
+            std::vector<struct iovec>             iov;
+            std::vector<uring_slot>               slots;
+
+            for(auto const& b: buffers) {
+                iov.push_back( iovec{b.get(), bufSz} );
+                slots.push_back( uring_slot{b.get(), 0, 0, 0, false} );
+            }
+
+            std::unique_ptr<uring>  ringptr;
+            try {
+                ringptr.reset( new uring((unsigned int)nBuf) );
+            }
+            catch( std::exception const& e ) {
+                ETDCDEBUG(2, "uring_copy/falling back to normal I/O - " << e.what() << std::endl);
+                return false;
+            }
+            uring&      ring( *ringptr );
+            const bool  fixedBuf  = ring.register_buffers(iov);
+            const bool  fixedFile = ring.register_file(fileFd);
+
+            ETDCDEBUG(4, "uring_copy/" << n << " bytes " << (fromFile ? "from" : "to") << " file, " << nBuf << " x " << bufSz <<
+                         " bytes in flight [fixed buffers:" << fixedBuf << " fixed file:" << fixedFile << "]" << std::endl);
+
+            off_t   nextOff = start;
+            size_t  cur     = 0;
+
+            try {
+                if( fromFile ) {
+                    // Keep nBuf reads in flight; hand the buffers over to the
+                    // destination strictly in file order
+                    size_t  toQueue = n;
+                    auto    queue   = [&](size_t i) {
+                        const size_t  len = std::min(toQueue, bufSz);
+                        slots[i].len  = len;
+                        slots[i].done = 0;
+                        slots[i].off  = nextOff;
+                        slots[i].busy = true;
+                        ring.prep_read(fileFd, slots[i].buf, len, nextOff, i);
+                        nextOff += (off_t)len;
+                        toQueue -= len;
+                    };
+                    for(size_t i=0; i<nBuf && toQueue>0; i++)
+                        queue(i);
+                    ring.submit();
+
+                    while( n>0 ) {
+                        while( slots[cur].busy )
+                            uring_reap(ring, slots, fileFd, true);
+                        write_all(dst, slots[cur].buf, slots[cur].len);
+                        n -= slots[cur].len;
+                        if( toQueue>0 ) {
+                            queue(cur);
+                            ring.submit();
+                        }
+                        cur = (cur + 1) % nBuf;
+                    }
+                } else {
+                    // Read from the source into the next free buffer and queue
+                    // the write; only wait for the disk if we've run out of buffers
+                    while( n>0 ) {
+                        while( slots[cur].busy )
+                            uring_reap(ring, slots, fileFd, false);
+                        const size_t nRead = read_some(src, slots[cur].buf, std::min(n, bufSz));
+                        slots[cur].len  = nRead;
+                        slots[cur].done = 0;
+                        slots[cur].off  = nextOff;
+                        slots[cur].busy = true;
+                        ring.prep_write(fileFd, slots[cur].buf, nRead, nextOff, cur);
+                        ring.submit();
+                        nextOff += (off_t)nRead;
+                        n       -= nRead;
+                        cur      = (cur + 1) % nBuf;
+                    }
+                    while( ring.inflight() )
+                        uring_reap(ring, slots, fileFd, false);
+                }
+            }
+            catch( ... ) {
+                // Failed reads/writes or the network end gave up; the
+                // buffers go back to the pool only after the kernel is done
+                // with them
+                uring_drain(ring);
+                throw;
+            }
+            uring_drain(ring);
+            // Leave the file position where read(2)/write(2) would have left it
+            file->lseek(fileFd, nextOff, SEEK_SET);
+            return true;
+        }
+    }
+
+    void pipelined_copy(size_t n, etdc_fdptr src, etdc_fdptr dst, buffer_pool& pool, size_t nBuf, size_t bufSz,
+                        bool useUring, char const* pre, size_t nPre) {
+        ETDCASSERT(nPre<=n, "pipelined_copy: there are more prefix bytes (" << nPre << ") than should be copied (" << n << ")");
+
+        // Whatever happens, the prefix bytes go first
+        if( nPre )
+            detail::write_all(dst, pre, nPre);
+        n -= nPre;
+
+        // If the kernel (or UDT) can move the bytes for us, let it. Should
+        // the kernel turn out not to support it, the rest is copied below
+        if( n==0 || detail::zerocopy_send(n, src, dst) || detail::zerocopy_recv(n, src, dst) ||
+            detail::udt_send(n, src, dst) || detail::udt_recv(n, src, dst) )
+            return;
+
+        // With more than one buffer UDT can send straight from them
+        const bool  byRef = (nBuf>1 && detail::is_a<etdc_udt>(dst));
+
+        // Let the kernel keep multiple file I/Os in flight, if asked to
+        if( useUring && !byRef && detail::uring_copy(n, src, dst, pool, nBuf, bufSz) )
+            return;
+
+        // Plain old read-write-read-write if no pipelining requested
+        if( nBuf<=1 ) {
+            const pooled_buffers_type  buffer( pool.get(1, bufSz) );
+            while( n>0 ) {
+                const size_t nRead = detail::read_some(src, buffer[0].get(), std::min(n, bufSz));
+                detail::write_all(dst, buffer[0].get(), nRead);
+                n -= nRead;
+            }
+            return;
+        }
+
+        // Start the reader ("disk") thread. It fills buffers until it has
+        // read all bytes or something went wrong. In the latter case it
+        // captures the exception such that we can rethrow it in here
+        // The ring is shared with UDT, which may still refer to its
+        // buffers after we're done
+        detail::ring_ptr    ringPtr = std::make_shared<buffer_ring>(pool.get(nBuf, bufSz), bufSz);
+        buffer_ring&        ring( *ringPtr );
+        std::exception_ptr  rdError;
+        std::thread         reader = etdc::thread([&]() {
+                                        try {
+                                            size_t  todo( n );
+                                            while( todo>0 ) {
+                                                char*  buf = ring.get_empty();
+                                                if( buf==nullptr )
+                                                    break;
+                                                const size_t nRead = detail::read_some(src, buf, std::min(todo, ring.bufSize()));
+                                                ring.put_full( nRead );
+                                                todo -= nRead;
+                                            }
+                                        }
+                                        catch( ... ) {
+                                            rdError = std::current_exception();
+                                            ring.cancel();
+                                        }
+                                    });
+        // The current thread becomes the writer ("network") thread
+        std::exception_ptr  wrError;
+        try {
+            while( n>0 ) {
+                size_t       nFull;
+                char const*  buf = ring.get_full( nFull );
+
+                // If the ring was cancelled, the reader has failed
+                if( buf==nullptr )
+                    break;
+                if( byRef ) {
+                    detail::udt_send_ref(dst, buf, nFull, ringPtr);
+                } else {
+                    detail::write_all(dst, buf, nFull);
+                    ring.put_empty();
+                }
+                n -= nFull;
+            }
+        }
+        catch( ... ) {
+            wrError = std::current_exception();
+            ring.cancel();
+        }
+        reader.join();
+        ETDCDEBUG(5, "pipelined_copy/reader and writer finished, " << n << " bytes left" << std::endl);
+
+        // Report the reader's error first - it's usually the cause
+        if( rdError )
+            std::rethrow_exception( rdError );
+        if( wrError )
+            std::rethrow_exception( wrError );
+    }
+} // namespace etdc
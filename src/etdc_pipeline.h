@@ -0,0 +1,101 @@
+// Double (or N-)buffered copying between two etdc_fd's
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_PIPELINE_H
+#define ETDC_PIPELINE_H
+
+#include <etdc_fd.h>
+#include <etdc_bufferpool.h>
+
+// C++ headers
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <exception>
+#include <condition_variable>
+
+namespace etdc {
+
+    // A ring of preallocated buffers, each of (at least) size bufSz.
+    // The reader (producer) fills empty slots, the writer (consumer)
+    // drains full ones. Both ends may block waiting for the other.
+    // If one side fails it calls 'cancel()' so the other side will not wait
+    // forever.
+    class buffer_ring {
+        public:
+            buffer_ring(pooled_buffers_type&& buffers, size_t bufSz);
+
+            buffer_ring()                              = delete;
+            buffer_ring(buffer_ring const&)            = delete;
+            buffer_ring& operator=(buffer_ring const&) = delete;
+
+            size_t  bufSize( void ) const { return __m_bufSz; }
+
+            // Producer side: wait for an empty slot. Returns nullptr if cancelled
+            char*   get_empty( void );
+            // Producer side: hand over the slot obtained via get_empty()
+            // with 'n' valid bytes in it
+            void    put_full(size_t n);
+
+            // Consumer side: wait for a filled slot. Returns nullptr if
+            // cancelled. 'n' is set to the number of valid bytes.
+            // The consumer may hold on to more than one slot at a time.
+            char*   get_full(size_t& n);
+            // Consumer side: give back the oldest slot obtained via get_full()
+            void    put_empty( void );
+
+            // Either side may call this to wake up the other one
+            void    cancel( void );
+
+        private:
+            pooled_buffers_type      __m_buffers;
+            const size_t             __m_nBuf;
+            const size_t             __m_bufSz;
+            std::vector<size_t>      __m_fill;
+            size_t                   __m_rdIdx, __m_wrIdx, __m_nFull, __m_nBusy;
+            bool                     __m_cancelled;
+            std::mutex               __m_lock;
+            std::condition_variable  __m_condition;
+    };
+
+    // Copy exactly n bytes from src to dst.
+    // If src is an etdc_file (or a range of one) and dst a TCP socket (or vice versa) the
+    // kernel is asked to move the bytes without copying them through user
+    // space (sendfile(2) resp. splice(2)), where available.
+    // Likewise, UDT reads an etdc_file straight into its send buffer and
+    // writes to one straight from its receive buffer.
+    // Otherwise, if useUring is set and one of the sides is an etdc_file,
+    // io_uring(7) is used to keep up to nBuf file reads/writes in flight
+    // from the calling thread. If the kernel can't do that, or
+    // if nBuf<=1 the copy is done the old-fashioned way: read a buffer,
+    // write it, rinse, repeat. Otherwise a dedicated reader thread is started
+    // which keeps the source busy whilst the calling thread writes to the
+    // destination. An UDT destination sends straight from those buffers;
+    // a buffer is reused once the remote end has acknowledged its contents.
+    // The buffers, if needed, are borrowed from 'pool' for the duration of
+    // the copy.
+    // The optional prefix (pre, nPre) are bytes that were already read from
+    // src (e.g. trailing the data channel header) and must be written to
+    // dst before anything else; they count towards n.
+    void pipelined_copy(size_t n, etdc_fdptr src, etdc_fdptr dst, buffer_pool& pool, size_t nBuf, size_t bufSz,
+                        bool useUring = false, char const* pre = nullptr, size_t nPre = 0);
+} // namespace etdc
+
+#endif
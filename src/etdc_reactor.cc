@@ -0,0 +1,228 @@
+// Wait for readability on many file descriptors in one thread
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <etdc_reactor.h>
+#include <etdc_assert.h>
+#include <etdc_debug.h>
+#include <reentrant.h>
+
+#include <vector>
+#include <utility>
+
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#define ETDC_REACTOR_EPOLL 1
+#endif
+
+namespace etdc {
+
+    // Pack fd + generation into one epoll event / unpack them
+    static uint64_t mk_token(int fd, uint32_t generation) {
+        return (static_cast<uint64_t>(generation)<<32) | static_cast<uint32_t>(fd);
+    }
+
+    reactor::reactor():
+        __m_fd( -1 ), __m_wakeup{ -1, -1 }, __m_generation( 0 ), __m_stop( false )
+    {
+#ifdef ETDC_REACTOR_EPOLL
+        ETDCSYSCALL( (__m_fd=::epoll_create1(EPOLL_CLOEXEC))!=-1,
+                     "reactor: failed to create epoll fd - " << etdc::strerror(errno) );
+        ETDCSYSCALL( (__m_wakeup[0]=__m_wakeup[1]=::eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC))!=-1,
+                     "reactor: failed to create eventfd - " << etdc::strerror(errno) );
+        // Generation 0 is never handed out to a registered fd
+        struct epoll_event  ev;
+        ev.events   = EPOLLIN;
+        ev.data.u64 = mk_token(__m_wakeup[0], 0);
+        ETDCSYSCALL( ::epoll_ctl(__m_fd, EPOLL_CTL_ADD, __m_wakeup[0], &ev)==0,
+                     "reactor: failed to add eventfd to epoll - " << etdc::strerror(errno) );
+#else
+        ETDCSYSCALL( ::pipe(__m_wakeup)==0, "reactor: failed to create pipe - " << etdc::strerror(errno) );
+        for(auto fd: __m_wakeup)
+            ETDCSYSCALL( ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL)|O_NONBLOCK)==0 &&
+                         ::fcntl(fd, F_SETFD, FD_CLOEXEC)==0,
+                         "reactor: failed to set pipe flags - " << etdc::strerror(errno) );
+#endif
+    }
+
+    void reactor::add(int fd, callback_type cb) {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        auto        ptr   = __m_entries.find( fd );
+        const bool  isNew = (ptr==__m_entries.end());
+
+        if( isNew )
+            ptr = __m_entries.emplace(fd, entry_type()).first;
+        if( ++__m_generation==0 )
+            ++__m_generation;
+        ptr->second.generation = __m_generation;
+        ptr->second.armed      = true;
+        ptr->second.callback   = std::make_shared<callback_type>( std::move(cb) );
+        this->arm(fd, ptr->second, isNew);
+    }
+
+    void reactor::rearm(int fd) {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        auto        ptr = __m_entries.find( fd );
+
+        if( ptr==__m_entries.end() || ptr->second.armed )
+            return;
+        ptr->second.armed = true;
+        this->arm(fd, ptr->second, false);
+    }
+
+    void reactor::remove(int fd) {
+        std::lock_guard<std::mutex> lk( __m_mutex );
+        if( __m_entries.erase(fd)==0 )
+            return;
+#ifdef ETDC_REACTOR_EPOLL
+        // Failure is not interesting; the fd may already have been closed
+        struct epoll_event  ev;
+        ::epoll_ctl(__m_fd, EPOLL_CTL_DEL, fd, &ev);
+#endif
+    }
+
+    void reactor::run( void ) {
+#ifdef ETDC_REACTOR_EPOLL
+        struct epoll_event  events[64];
+
+        while( !__m_stop.load() ) {
+            const int n = ::epoll_wait(__m_fd, events, sizeof(events)/sizeof(events[0]), -1);
+
+            if( n==-1 && errno==EINTR )
+                continue;
+            ETDCSYSCALL( n>=0, "reactor: epoll_wait fails - " << etdc::strerror(errno) );
+
+            for(int i = 0; i<n; i++) {
+                const int       fd  = static_cast<int>(events[i].data.u64 & 0xffffffff);
+                const uint32_t  gen = static_cast<uint32_t>(events[i].data.u64 >> 32);
+
+                if( gen==0 )
+                    this->drain();
+                else
+                    this->dispatch(fd, gen);
+            }
+        }
+#else
+        std::vector<struct pollfd>  pfds;
+        std::vector<uint32_t>       gens;
+
+        while( !__m_stop.load() ) {
+            pfds.clear();
+            gens.clear();
+            pfds.push_back( pollfd{__m_wakeup[0], POLLIN, 0} );
+            gens.push_back( 0 );
+            {
+                std::lock_guard<std::mutex> lk( __m_mutex );
+                for(auto const& e: __m_entries) {
+                    if( !e.second.armed )
+                        continue;
+                    pfds.push_back( pollfd{e.first, POLLIN, 0} );
+                    gens.push_back( e.second.generation );
+                }
+            }
+            const int n = ::poll(&pfds[0], pfds.size(), -1);
+
+            if( n==-1 && errno==EINTR )
+                continue;
+            ETDCSYSCALL( n>=0, "reactor: poll fails - " << etdc::strerror(errno) );
+
+            for(size_t i = 0; i<pfds.size(); i++) {
+                if( pfds[i].revents==0 )
+                    continue;
+                if( gens[i]==0 )
+                    this->drain();
+                else
+                    this->dispatch(pfds[i].fd, gens[i]);
+            }
+        }
+#endif
+        ETDCDEBUG(4, "reactor::run/stopped" << std::endl);
+    }
+
+    void reactor::stop( void ) {
+        __m_stop.store( true );
+        this->wakeup();
+    }
+
+    reactor::~reactor() {
+        if( __m_fd!=-1 )
+            ::close( __m_fd );
+        ::close( __m_wakeup[0] );
+        if( __m_wakeup[1]!=__m_wakeup[0] )
+            ::close( __m_wakeup[1] );
+    }
+
+    // Must be called with the mutex held
+    void reactor::arm(int fd, entry_type const& e, bool isNew) {
+#ifdef ETDC_REACTOR_EPOLL
+        struct epoll_event  ev;
+        ev.events   = EPOLLIN | EPOLLONESHOT;
+        ev.data.u64 = mk_token(fd, e.generation);
+        ETDCSYSCALL( ::epoll_ctl(__m_fd, isNew ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev)==0,
+                     "reactor: failed to watch fd#" << fd << " - " << etdc::strerror(errno) );
+#else
+        // The poll set is rebuilt every time around
+        (void)e; (void)isNew; (void)fd;
+        this->wakeup();
+#endif
+    }
+
+    void reactor::wakeup( void ) {
+#ifdef ETDC_REACTOR_EPOLL
+        const uint64_t  one = 1;
+#else
+        const char      one = 1;
+#endif
+        // If this fails the reactor has been woken up already
+        if( ::write(__m_wakeup[1], &one, sizeof(one))!=sizeof(one) )
+            return;
+    }
+
+    void reactor::drain( void ) {
+        char  buf[64];
+        while( ::read(__m_wakeup[0], buf, sizeof(buf))>0 )
+            ;
+    }
+
+    void reactor::dispatch(int fd, uint32_t generation) {
+        std::shared_ptr<callback_type>  cb;
+        {
+            std::lock_guard<std::mutex> lk( __m_mutex );
+            auto    ptr = __m_entries.find( fd );
+
+            if( ptr==__m_entries.end() || ptr->second.generation!=generation || !ptr->second.armed )
+                return;
+            ptr->second.armed = false;
+            cb = ptr->second.callback;
+        }
+        try {
+            (*cb)();
+        }
+        catch( std::exception const& e ) {
+            ETDCDEBUG(1, "reactor: callback for fd#" << fd << " threw - " << e.what() << std::endl);
+        }
+        catch( ... ) {
+            ETDCDEBUG(1, "reactor: callback for fd#" << fd << " threw unknown exception" << std::endl);
+        }
+    }
+}
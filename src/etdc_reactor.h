@@ -0,0 +1,93 @@
+// Wait for readability on many file descriptors in one thread
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_REACTOR_H
+#define ETDC_REACTOR_H
+
+// C++ headers
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <functional>
+
+namespace etdc {
+
+    // One thread calls run() and waits for any of the registered (system)
+    // file descriptors to become readable; it then calls the callback that
+    // was registered with the fd.
+    // Registrations are one-shot: after the callback has been called the fd
+    // is not watched until rearm(fd) is called. This allows the callback to
+    // hand the fd off to another thread for doing the actual reading
+    // without the reactor reporting it again in the mean time.
+    // Callbacks are executed in the thread calling run() so they should
+    // not block.
+    // On Linux epoll(7) is used, elsewhere poll(2).
+    // All methods except run() can be called from any thread.
+    class reactor {
+        public:
+            using callback_type = std::function<void(void)>;
+
+            reactor();
+            reactor(reactor const&)            = delete;
+            reactor& operator=(reactor const&) = delete;
+
+            // Register fd; it is armed immediately. Replaces a previous
+            // registration of the same fd
+            void add(int fd, callback_type cb);
+            // Watch fd again
+            void rearm(int fd);
+            // Forget about fd. The fd must be removed before it is closed:
+            // it may be reused by the system
+            void remove(int fd);
+
+            // Returns after stop() has been called
+            void run( void );
+            void stop( void );
+
+            ~reactor();
+
+        private:
+            struct entry_type {
+                // The generation number allows us to ignore events for an
+                // fd that was removed + re-added while the event was
+                // underway
+                uint32_t                        generation;
+                bool                            armed;
+                std::shared_ptr<callback_type>  callback;
+            };
+            using entrymap_type = std::map<int, entry_type>;
+
+            int                 __m_fd;        // epoll fd (if used)
+            int                 __m_wakeup[2]; // read, write end. Equal for eventfd
+            uint32_t            __m_generation;
+            std::atomic<bool>   __m_stop;
+            std::mutex          __m_mutex;
+            entrymap_type       __m_entries;
+
+            void arm(int fd, entry_type const& e, bool isNew);
+            void wakeup( void );
+            void drain( void );
+            // Call the callback for fd if it's still the same registration
+            void dispatch(int fd, uint32_t generation);
+    };
+}
+
+#endif
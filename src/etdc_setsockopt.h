@@ -159,6 +159,14 @@ namespace etdc {
     using udt_reuseaddr = detail::BooleanUDTOption<UDT_REUSEADDR>;
     using udt_sndsyn    = detail::BooleanUDTOption<UDT_SNDSYN>;
     using udt_rcvsyn    = detail::BooleanUDTOption<UDT_RCVSYN>;
+    using udt_pacing    = detail::SimpleUDTOption<UDT_PACING>;
+    using udt_shards    = detail::SimpleUDTOption<UDT_SHARDS>;
+    // don't fragment and lower udt_mss to what the path to the peer carries
+    using udt_pmtud     = detail::BooleanUDTOption<UDT_PMTUD>;
+    // bytes per second, <=0 means no limit
+    using udt_maxbw     = detail::SocketOption<int64_t, detail::UDTName<UDT_MAXBW>, detail::Level<-1>, tags::udt_option, tags::gettable, tags::settable>;
+    // bytes, 0 means the UDT buffers keep the size set by udt_sndbuf/udt_rcvbuf
+    using udt_buflimit  = detail::SocketOption<int64_t, detail::UDTName<UDT_BUFLIMIT>, detail::Level<-1>, tags::udt_option, tags::gettable, tags::settable>;
     using udt_linger    = detail::SocketOption<struct linger, detail::UDTName<UDT_LINGER>, tags::udt_option, detail::Level<-1>, tags::settable, tags::gettable>;
 
     // UDT Congestion Control
@@ -216,6 +224,17 @@ namespace etdc {
             }
         };
 
+        // What to pass as optval to UDT::setsockopt(): normally the address
+        // of the value but pointer options (UDT_CC) are passed as the
+        // pointer itself
+        template <typename T>
+        char const* udt_optval(T const& t) {
+            return (char const*)&t;
+        }
+        inline char const* udt_optval(void* const& p) {
+            return (char const*)p;
+        }
+
         // "system", Berkely, sockets (TCP, UDP, ssl?) also mostly follow the native 
         // types, only they don't know about "bool"
         template <typename T>
@@ -274,7 +293,8 @@ namespace etdc {
         // And type safe for UDT
         using i2n_udt_map_type = std::map<UDTOpt, std::string>;
         static const i2n_udt_map_type i2n_udt_map{ OPTION(UDT_MSS), OPTION(UDT_CC), OPTION(UDT_REUSEADDR), OPTION(UDT_SNDBUF),
-                                                   OPTION(UDT_RCVBUF), OPTION(UDT_MAXBW) };
+                                                   OPTION(UDT_RCVBUF), OPTION(UDT_MAXBW), OPTION(UDT_PACING),
+                                                   OPTION(UDT_SHARDS), OPTION(UDT_BUFLIMIT), OPTION(UDT_PMTUD) };
 
         inline std::string udt_option_str(UDTOpt o) {
             i2n_udt_map_type::const_iterator p = i2n_udt_map.find(o);
@@ -309,7 +329,7 @@ namespace etdc {
         const UDTOpt               opt_name = etdc::get_tag_p<has_name_tag,  Option>::type::type::value;
         typename native_type::type opt_val  = native_type::to_native( untag(ov) );
 
-        if( UDT::setsockopt(s, level, opt_name, (char const*)&opt_val, int(sizeof(typename native_type::type)))==UDT::ERROR ) {
+        if( UDT::setsockopt(s, level, opt_name, detail::udt_optval(opt_val), int(sizeof(typename native_type::type)))==UDT::ERROR ) {
             UDT::ERRORINFO & udterr( UDT::getlasterror() );
             throw std::runtime_error("Failed to set UDT option "+detail::udt_option_str(opt_name)+": "+
                                       udterr.getErrorMessage()+" ("+etdc::repr(udterr.getErrorCode())+"/fd="+repr(s));
@@ -21,11 +21,18 @@
 #define ETDC_THREAD_H
 
 // own includes
+#include <etdc_debug.h>
 #include <etdc_signal.h>
 
 // std c++
-#include <thread>
 #include <map>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <exception>
+#include <functional>
+#include <condition_variable>
 
 namespace etdc {
     // Wrapper for std::thread(...) that guarantees the thread is being run
@@ -35,6 +42,89 @@ namespace etdc {
         etdc::BlockAll     block_all{};
         return std::thread(std::forward<Args>(args)...);
     }
+
+    // Runs submitted jobs on a set of threads. A job goes to an idle
+    // thread if there is one; otherwise a new thread is started, up to
+    // maxThreads (0 = no limit), after that it waits for a thread to
+    // become available. Threads that have been idle for a while exit.
+    // The threads have all signals blocked (see etdc::thread above).
+    class thread_pool {
+        public:
+            using job_type = std::function<void(void)>;
+
+            explicit thread_pool(unsigned int maxThreads = 0,
+                                 std::chrono::seconds idle = std::chrono::seconds(60)):
+                __m_max( maxThreads ), __m_idleTime( idle ), __m_nThreads( 0 ), __m_nIdle( 0 ), __m_stopping( false )
+            {}
+
+            thread_pool(thread_pool const&)            = delete;
+            thread_pool& operator=(thread_pool const&) = delete;
+
+            // Never blocks
+            void submit(job_type job) {
+                std::lock_guard<std::mutex> lk( __m_mutex );
+                if( __m_stopping )
+                    return;
+                __m_jobs.emplace_back( std::move(job) );
+                // Every idle thread will pick up one job
+                if( __m_jobs.size()>__m_nIdle && (__m_max==0 || __m_nThreads<__m_max) ) {
+                    etdc::thread(&thread_pool::worker, this).detach();
+                    __m_nThreads++;
+                }
+                else
+                    __m_condition.notify_one();
+            }
+
+            // Jobs that haven't started yet are dropped; waits for the
+            // running ones to finish
+            ~thread_pool() {
+                std::unique_lock<std::mutex> lk( __m_mutex );
+                __m_stopping = true;
+                __m_jobs.clear();
+                __m_condition.notify_all();
+                __m_condition.wait(lk, [this](){ return __m_nThreads==0; });
+            }
+
+        private:
+            const unsigned int      __m_max;
+            const std::chrono::seconds __m_idleTime;
+            unsigned int            __m_nThreads;
+            unsigned int            __m_nIdle;
+            bool                    __m_stopping;
+            std::deque<job_type>    __m_jobs;
+            std::mutex              __m_mutex;
+            std::condition_variable __m_condition;
+
+            void worker( void ) {
+                std::unique_lock<std::mutex> lk( __m_mutex );
+
+                while( true ) {
+                    __m_nIdle++;
+                    const bool haveJob = __m_condition.wait_for(lk, __m_idleTime,
+                                                                [this](){ return __m_stopping || !__m_jobs.empty(); });
+                    __m_nIdle--;
+                    if( __m_stopping || !haveJob )
+                        break;
+
+                    job_type job( std::move(__m_jobs.front()) );
+                    __m_jobs.pop_front();
+                    lk.unlock();
+                    try {
+                        job();
+                    }
+                    catch( std::exception const& e ) {
+                        ETDCDEBUG(1, "thread_pool/job threw: " << e.what() << std::endl);
+                    }
+                    catch( ... ) {
+                        ETDCDEBUG(1, "thread_pool/job threw unknown exception" << std::endl);
+                    }
+                    lk.lock();
+                }
+                // The destructor may be waiting for us
+                __m_nThreads--;
+                __m_condition.notify_all();
+            }
+    };
 }
 
 #endif  // ETDC_THREAD_H
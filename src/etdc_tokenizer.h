@@ -0,0 +1,292 @@
+// Allocation free scanning of the (text) protocol messages
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_TOKENIZER_H
+#define ETDC_TOKENIZER_H
+
+#include <etdc_assert.h>
+
+// C++ headers
+#include <array>
+#include <string>
+#include <limits>
+#include <ostream>
+#include <cstddef>
+#include <type_traits>
+
+// Plain-old-C
+#include <ctype.h>
+#include <string.h>
+
+namespace etdc {
+
+    // A non-owning view of a range of characters - we're C++11 so no
+    // std::string_view. The viewed characters must outlive the view.
+    class strview {
+        public:
+            strview(): __m_first( nullptr ), __m_last( nullptr ) {}
+            strview(char const* f, char const* l): __m_first( f ), __m_last( l ) {}
+            strview(char const* s): __m_first( s ), __m_last( s+::strlen(s) ) {}
+            strview(std::string const& s): __m_first( s.data() ), __m_last( s.data()+s.size() ) {}
+
+            char const* begin( void ) const { return __m_first; }
+            char const* end( void ) const   { return __m_last; }
+            size_t      size( void ) const  { return static_cast<size_t>(__m_last - __m_first); }
+            bool        empty( void ) const { return __m_first==__m_last; }
+            char        operator[](size_t i) const { return __m_first[i]; }
+
+            // Only here we allocate
+            std::string str( void ) const { return std::string(__m_first, __m_last); }
+
+            bool        operator==(strview const& o) const {
+                return o.size()==this->size() && ::memcmp(__m_first, o.__m_first, this->size())==0;
+            }
+            bool        iequals(strview const& o) const {
+                if( o.size()!=this->size() )
+                    return false;
+                for(size_t i=0; i<this->size(); i++)
+                    if( ::tolower((unsigned char)__m_first[i])!=::tolower((unsigned char)o.__m_first[i]) )
+                        return false;
+                return true;
+            }
+
+        private:
+            char const*  __m_first;
+            char const*  __m_last;
+    };
+
+    template <class CharT, class Traits>
+    std::basic_ostream<CharT, Traits>& operator<<(std::basic_ostream<CharT, Traits>& os, strview const& sv) {
+        return os.write(sv.begin(), static_cast<std::streamsize>(sv.size()));
+    }
+
+    namespace tok {
+        // What ECMAScript regex calls \s and \d
+        inline bool is_space(char c) { return c==' ' || c=='\t' || c=='\n' || c=='\v' || c=='\f' || c=='\r'; }
+        inline bool is_digit(char c) { return c>='0' && c<='9'; }
+        inline bool is_eol(char c)   { return c=='\r' || c=='\n'; }
+
+        // Find the next complete line in [cur, end): a non-empty sequence
+        // of non-newline characters followed by at least one newline
+        // character. On success, cur is moved past the newline(s).
+        inline bool next_line(char const*& cur, char const* end, strview& line) {
+            char const* p = cur;
+            // Skip leading empty lines
+            while( p!=end && is_eol(*p) )
+                p++;
+            char const* b = p;
+            while( p!=end && !is_eol(*p) )
+                p++;
+            // Incomplete (or no) line?
+            if( p==end || p==b )
+                return false;
+            line = strview(b, p);
+            while( p!=end && is_eol(*p) )
+                p++;
+            cur = p;
+            return true;
+        }
+
+        // Split all complete lines out of [f, l) into o, returns the number
+        // of bytes consumed
+        template <typename OutputIter>
+        size_t split_lines(char const* f, char const* l, OutputIter o) {
+            strview     line;
+            char const* cur = f;
+            while( next_line(cur, l, line) )
+                *o++ = line;
+            return static_cast<size_t>(cur - f);
+        }
+
+        // Convert a string of (possibly signed) decimal digits to an
+        // integer type. Throws on empty, non-digits or overflow.
+        template <typename T>
+        T to_int(strview const& sv) {
+            static_assert( std::is_integral<T>::value, "to_int only converts to integer types" );
+            using U = typename std::make_unsigned<T>::type;
+            const U     maxU = static_cast<U>( std::numeric_limits<T>::max() );
+            char const* p = sv.begin();
+            const bool  neg = (p!=sv.end() && *p=='-' && std::is_signed<T>::value);
+            U           v{ 0 };
+
+            if( neg )
+                p++;
+            ETDCASSERT(p!=sv.end(), "to_int: no digits in '" << sv << "'");
+            for( ; p!=sv.end(); p++) {
+                ETDCASSERT(is_digit(*p), "to_int: '" << sv << "' is not a number");
+                const U d = static_cast<U>(*p - '0');
+                ETDCASSERT(v<=(maxU-d)/10, "to_int: '" << sv << "' does not fit");
+                v = v*10 + d;
+            }
+            return neg ? static_cast<T>(-static_cast<T>(v)) : static_cast<T>(v);
+        }
+
+        // Recursive descent over a single line - each method consumes what
+        // it matches and returns false, without consuming anything, if it
+        // doesn't. So, like this:
+        //   scanner  s(line);
+        //   if( s.literal("read-file") && s.spaces() && s.digits(n) && ...
+        class scanner {
+            public:
+                explicit scanner(strview const& sv): __m_cur( sv.begin() ), __m_end( sv.end() ) {}
+
+                bool at_end( void ) const { return __m_cur==__m_end; }
+                char peek( void ) const   { return __m_cur==__m_end ? '\0' : *__m_cur; }
+
+                // Case insensitive literal text
+                bool literal(char const* lit) {
+                    const strview l( lit );
+                    if( static_cast<size_t>(__m_end-__m_cur)<l.size() || !strview(__m_cur, __m_cur+l.size()).iequals(l) )
+                        return false;
+                    __m_cur += l.size();
+                    return true;
+                }
+                bool character(char c) {
+                    if( __m_cur==__m_end || *__m_cur!=c )
+                        return false;
+                    __m_cur++;
+                    return true;
+                }
+                // \s*
+                void skip_spaces( void ) {
+                    while( __m_cur!=__m_end && is_space(*__m_cur) )
+                        __m_cur++;
+                }
+                // \s+
+                bool spaces( void ) {
+                    char const* b = __m_cur;
+                    skip_spaces();
+                    return __m_cur!=b;
+                }
+                // \S+
+                bool word(strview& w) {
+                    return span(w, [](char c) { return !is_space(c); });
+                }
+                // [0-9]+
+                bool digits(strview& d) {
+                    return span(d, is_digit);
+                }
+                // \S.* - i.e. all remaining characters but must start with non-whitespace
+                bool rest(strview& r) {
+                    if( __m_cur==__m_end || is_space(*__m_cur) )
+                        return false;
+                    r = strview(__m_cur, __m_end);
+                    __m_cur = __m_end;
+                    return true;
+                }
+                // The longest non-empty run of characters satisfying pred
+                template <typename Pred>
+                bool span(strview& s, Pred pred) {
+                    char const* b = __m_cur;
+                    while( __m_cur!=__m_end && pred(*__m_cur) )
+                        __m_cur++;
+                    s = strview(b, __m_cur);
+                    return __m_cur!=b;
+                }
+
+            private:
+                char const*  __m_cur;
+                char const*  __m_end;
+        };
+    } // namespace tok
+
+    // The "{ key:value, ... }" header in front of data on a data
+    // connection. Up to maxN key-value pairs are kept, as views into
+    // the original text; keys are matched case-insensitively.
+    // Quoted values are returned without the quotes but escapes are
+    // left in.
+    class kvheader_type {
+        public:
+            constexpr static size_t maxN = 8;
+
+            kvheader_type(): __m_n( 0 ) {}
+
+            // Look for a complete "{ ... }" at the start of [f, l).
+            // Returns the number of bytes making up the header, 0 if
+            // it's not complete yet. Throws if it is malformed.
+            size_t parse(char const* f, char const* l);
+
+            // Empty view if key not present
+            strview find(strview const& key) const {
+                for(size_t i=0; i<__m_n; i++)
+                    if( __m_kv[i].first.iequals(key) )
+                        return __m_kv[i].second;
+                return strview();
+            }
+            bool    has(strview const& key) const {
+                for(size_t i=0; i<__m_n; i++)
+                    if( __m_kv[i].first.iequals(key) )
+                        return true;
+                return false;
+            }
+
+            size_t  size( void ) const { return __m_n; }
+            std::pair<strview, strview> const& operator[](size_t i) const { return __m_kv[i]; }
+
+        private:
+            size_t                                          __m_n;
+            std::array<std::pair<strview, strview>, maxN>   __m_kv;
+    };
+
+    inline size_t kvheader_type::parse(char const* f, char const* l) {
+        using tok::is_space;
+        // The whole header is what's between '{' and the first '}'
+        ETDCASSERT(f!=l && *f=='{', "data header does not start with '{'");
+        char const* close = static_cast<char const*>( ::memchr(f, '}', static_cast<size_t>(l-f)) );
+        if( close==nullptr )
+            return 0;
+
+        // key   = [a-zA-Z][a-zA-Z0-9_-]+
+        // value = "..." | [^, \t\v]+
+        // separated by whitespace and/or commas
+        tok::scanner  s( strview(f+1, close) );
+        __m_n = 0;
+        while( true ) {
+            while( s.spaces() || s.character(',') )
+                ;
+            if( s.at_end() )
+                break;
+
+            strview  key, value;
+            ETDCASSERT(::isalpha((unsigned char)s.peek()) &&
+                       s.span(key, [](char c) { return ::isalnum((unsigned char)c) || c=='_' || c=='-'; }) && key.size()>1,
+                       "data header: invalid key");
+            s.skip_spaces();
+            ETDCASSERT(s.character(':'), "data header: expected ':' after key '" << key << "'");
+            s.skip_spaces();
+            if( s.character('"') ) {
+                // Quoted: up to the next '"' that is not escaped
+                bool esc = false;
+                ETDCASSERT(s.span(value, [&esc](char c) { const bool r = esc || c!='"'; esc = (!esc && c=='\\'); return r; }) || s.peek()=='"',
+                           "data header: unterminated string value for '" << key << "'");
+                ETDCASSERT(s.character('"'), "data header: unterminated string value for '" << key << "'");
+            } else {
+                ETDCASSERT(s.span(value, [](char c) { return c!=',' && c!=' ' && c!='\t' && c!='\v'; }),
+                           "data header: no value for '" << key << "'");
+            }
+            ETDCASSERT(!this->has(key), "data header: duplicate key '" << key << "'");
+            ETDCASSERT(__m_n<maxN, "data header: too many key:value pairs");
+            __m_kv[__m_n++] = std::make_pair(key, value);
+        }
+        return static_cast<size_t>(close - f) + 1;
+    }
+
+} // namespace etdc
+
+#endif
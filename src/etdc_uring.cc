@@ -0,0 +1,288 @@
+// Minimal io_uring(7) wrapper for keeping multiple file I/Os in flight
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#include <etdc_uring.h>
+#include <etdc_assert.h>
+#include <etdc_debug.h>
+#include <reentrant.h>
+
+#include <mutex>
+#include <memory>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #define ETDC_HAVE_URING 1
+    #endif
+#endif
+
+#ifdef ETDC_HAVE_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace etdc {
+
+#ifdef ETDC_HAVE_URING
+    namespace detail {
+        static int io_uring_setup(unsigned int entries, struct io_uring_params* p) {
+            return (int)::syscall(__NR_io_uring_setup, entries, p);
+        }
+        static int io_uring_enter(int fd, unsigned int toSubmit, unsigned int minComplete, unsigned int flags) {
+            return (int)::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+        }
+        static int io_uring_register(int fd, unsigned int opcode, void const* arg, unsigned int nArg) {
+            return (int)::syscall(__NR_io_uring_register, fd, opcode, arg, nArg);
+        }
+
+        // The ring indices are shared with the kernel
+        static unsigned int load_acquire(unsigned int const* p) {
+            return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+        }
+        static void store_release(unsigned int* p, unsigned int v) {
+            __atomic_store_n(p, v, __ATOMIC_RELEASE);
+        }
+
+        template <typename T>
+        static T* at_offset(void* base, unsigned int off) {
+            return reinterpret_cast<T*>(reinterpret_cast<char*>(base) + off);
+        }
+    }
+
+    uring::uring(unsigned int entries):
+        __m_ringFd( -1 ), __m_inflight( 0 ), __m_queued( 0 ),
+        __m_sqPtr( MAP_FAILED ), __m_cqPtr( MAP_FAILED ), __m_sqes( MAP_FAILED ),
+        __m_sqSz( 0 ), __m_cqSz( 0 ), __m_sqesSz( 0 ), __m_fixedFd( -1 )
+    {
+        struct io_uring_params  p;
+
+        ::memset(&p, 0, sizeof(p));
+        ETDCSYSCALL((__m_ringFd = detail::io_uring_setup(entries, &p))>=0,
+                    "io_uring_setup(" << entries << ") - " << etdc::strerror(errno));
+
+        // From here on we must clean up if something fails
+        try {
+            __m_sqSz   = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+            __m_cqSz   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+            __m_sqesSz = p.sq_entries * sizeof(struct io_uring_sqe);
+            if( p.features & IORING_FEAT_SINGLE_MMAP )
+                __m_sqSz = __m_cqSz = std::max(__m_sqSz, __m_cqSz);
+
+            __m_sqPtr = ::mmap(nullptr, __m_sqSz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, __m_ringFd, IORING_OFF_SQ_RING);
+            ETDCSYSCALL(__m_sqPtr!=MAP_FAILED, "mmap(IORING_OFF_SQ_RING) - " << etdc::strerror(errno));
+            if( p.features & IORING_FEAT_SINGLE_MMAP ) {
+                __m_cqPtr = __m_sqPtr;
+            } else {
+                __m_cqPtr = ::mmap(nullptr, __m_cqSz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, __m_ringFd, IORING_OFF_CQ_RING);
+                ETDCSYSCALL(__m_cqPtr!=MAP_FAILED, "mmap(IORING_OFF_CQ_RING) - " << etdc::strerror(errno));
+            }
+            __m_sqes = ::mmap(nullptr, __m_sqesSz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, __m_ringFd, IORING_OFF_SQES);
+            ETDCSYSCALL(__m_sqes!=MAP_FAILED, "mmap(IORING_OFF_SQES) - " << etdc::strerror(errno));
+        }
+        catch( ... ) {
+            this->close_ring();
+            throw;
+        }
+        __m_sqHead  = detail::at_offset<unsigned int>(__m_sqPtr, p.sq_off.head);
+        __m_sqTail  = detail::at_offset<unsigned int>(__m_sqPtr, p.sq_off.tail);
+        __m_sqMask  = detail::at_offset<unsigned int>(__m_sqPtr, p.sq_off.ring_mask);
+        __m_sqArray = detail::at_offset<unsigned int>(__m_sqPtr, p.sq_off.array);
+        __m_cqHead  = detail::at_offset<unsigned int>(__m_cqPtr, p.cq_off.head);
+        __m_cqTail  = detail::at_offset<unsigned int>(__m_cqPtr, p.cq_off.tail);
+        __m_cqMask  = detail::at_offset<unsigned int>(__m_cqPtr, p.cq_off.ring_mask);
+        __m_cqes    = detail::at_offset<void>(__m_cqPtr, p.cq_off.cqes);
+        ETDCDEBUG(4, "uring/created ring with " << p.sq_entries << " entries" << std::endl);
+    }
+
+    uring::~uring() {
+        // Operations still in flight may reference memory that is about to
+        // be released so wait for them to finish
+        try {
+            if( __m_queued )
+                this->submit();
+            while( __m_inflight ) {
+                int  res;
+                (void)this->wait(res);
+            }
+        }
+        catch( ... ) { }
+        this->close_ring();
+    }
+
+    void uring::close_ring( void ) {
+        if( __m_sqes!=MAP_FAILED )
+            ::munmap(__m_sqes, __m_sqesSz);
+        if( __m_cqPtr!=MAP_FAILED && __m_cqPtr!=__m_sqPtr )
+            ::munmap(__m_cqPtr, __m_cqSz);
+        if( __m_sqPtr!=MAP_FAILED )
+            ::munmap(__m_sqPtr, __m_sqSz);
+        if( __m_ringFd>=0 )
+            ::close(__m_ringFd);
+        __m_sqes = __m_cqPtr = __m_sqPtr = MAP_FAILED;
+        __m_ringFd = -1;
+    }
+
+    bool uring::available( void ) {
+        static bool            haveIt = false;
+        static std::once_flag  probed;
+
+        std::call_once(probed, []() {
+            try {
+                uring  ring( 2 );
+                // Ask for the opcodes we need. Kernels without
+                // IORING_REGISTER_PROBE (<5.6) also lack IORING_OP_READ/WRITE
+                const size_t                                     nOps( IORING_OP_LAST );
+                std::unique_ptr<char[]>                          mem( new char[sizeof(struct io_uring_probe) + nOps*sizeof(struct io_uring_probe_op)]() );
+                struct io_uring_probe*                           probe = reinterpret_cast<struct io_uring_probe*>(mem.get());
+
+                if( detail::io_uring_register(ring.__m_ringFd, IORING_REGISTER_PROBE, probe, (unsigned int)nOps)<0 ) {
+                    const int  eno = errno;
+                    ETDCDEBUG(2, "uring::available/IORING_REGISTER_PROBE failed - " << etdc::strerror(eno) << std::endl);
+                    return;
+                }
+                auto supported = [&](unsigned int op) {
+                    return op<=probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+                };
+                haveIt = supported(IORING_OP_READ) && supported(IORING_OP_WRITE) &&
+                         supported(IORING_OP_READ_FIXED) && supported(IORING_OP_WRITE_FIXED);
+            }
+            catch( std::exception const& e ) {
+                ETDCDEBUG(2, "uring::available/" << e.what() << std::endl);
+            }
+        });
+        return haveIt;
+    }
+
+    bool uring::register_buffers(std::vector<struct iovec> const& iov) {
+        if( detail::io_uring_register(__m_ringFd, IORING_REGISTER_BUFFERS, iov.data(), (unsigned int)iov.size())<0 ) {
+            const int  eno = errno;
+            ETDCDEBUG(3, "uring::register_buffers/failed - " << etdc::strerror(eno) << std::endl);
+            return false;
+        }
+        __m_buffers = iov;
+        return true;
+    }
+
+    bool uring::register_file(int fd) {
+        if( detail::io_uring_register(__m_ringFd, IORING_REGISTER_FILES, &fd, 1)<0 ) {
+            const int  eno = errno;
+            ETDCDEBUG(3, "uring::register_file/failed - " << etdc::strerror(eno) << std::endl);
+            return false;
+        }
+        __m_fixedFd = fd;
+        return true;
+    }
+
+    void uring::prep(unsigned char opcode, int fd, void const* buf, size_t n, off_t off, uint64_t user) {
+        const unsigned int      tail = *__m_sqTail;
+        ETDCASSERT(tail - detail::load_acquire(__m_sqHead) <= *__m_sqMask, "uring::prep/submission queue full");
+
+        const unsigned int      idx = tail & *__m_sqMask;
+        struct io_uring_sqe*    sqe = reinterpret_cast<struct io_uring_sqe*>(__m_sqes) + idx;
+
+        ::memset(sqe, 0, sizeof(*sqe));
+        sqe->fd        = fd;
+        sqe->addr      = (uint64_t)(uintptr_t)buf;
+        sqe->len       = (uint32_t)n;
+        sqe->off       = (uint64_t)off;
+        sqe->user_data = user;
+
+        // Registered file?
+        if( fd==__m_fixedFd ) {
+            sqe->fd     = 0;
+            sqe->flags |= IOSQE_FIXED_FILE;
+        }
+        // In one of the registered buffers? Then we can use the _FIXED variant
+        char const* const  p = reinterpret_cast<char const*>(buf);
+        for(size_t i=0; i<__m_buffers.size(); i++) {
+            char const* const  b = reinterpret_cast<char const*>(__m_buffers[i].iov_base);
+            if( p>=b && p+n<=b+__m_buffers[i].iov_len ) {
+                opcode         = (opcode==IORING_OP_READ) ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+                sqe->buf_index = (uint16_t)i;
+                break;
+            }
+        }
+        sqe->opcode       = opcode;
+        __m_sqArray[idx]  = idx;
+        detail::store_release(__m_sqTail, tail+1);
+        __m_queued++;
+    }
+
+    void uring::prep_read(int fd, void* buf, size_t n, off_t off, uint64_t user) {
+        this->prep(IORING_OP_READ, fd, buf, n, off, user);
+    }
+
+    void uring::prep_write(int fd, void const* buf, size_t n, off_t off, uint64_t user) {
+        this->prep(IORING_OP_WRITE, fd, buf, n, off, user);
+    }
+
+    void uring::submit( void ) {
+        while( __m_queued ) {
+            int  n;
+            if( (n = detail::io_uring_enter(__m_ringFd, __m_queued, 0, 0))<0 ) {
+                ETDCSYSCALL(errno==EINTR || errno==EAGAIN || errno==EBUSY, "io_uring_enter/submit - " << etdc::strerror(errno));
+                continue;
+            }
+            __m_queued   -= (unsigned int)n;
+            __m_inflight += (unsigned int)n;
+        }
+    }
+
+    uint64_t uring::wait(int& res) {
+        ETDCASSERT(__m_inflight>0, "uring::wait/no operations in flight, would wait forever");
+        unsigned int  head = *__m_cqHead;
+        while( head==detail::load_acquire(__m_cqTail) ) {
+            if( detail::io_uring_enter(__m_ringFd, 0, 1, IORING_ENTER_GETEVENTS)<0 )
+                ETDCSYSCALL(errno==EINTR || errno==EAGAIN, "io_uring_enter/wait - " << etdc::strerror(errno));
+        }
+        struct io_uring_cqe const*  cqe = reinterpret_cast<struct io_uring_cqe const*>(__m_cqes) + (head & *__m_cqMask);
+        const uint64_t              user = cqe->user_data;
+
+        res = cqe->res;
+        detail::store_release(__m_cqHead, head+1);
+        __m_inflight--;
+        return user;
+    }
+
+
+#else  // no io_uring available at compile time
+
+    uring::uring(unsigned int) {
+        throw std::runtime_error("uring: this system does not support io_uring");
+    }
+    uring::~uring() { }
+    bool uring::available( void )                                            { return false; }
+    bool uring::register_buffers(std::vector<struct iovec> const&)           { return false; }
+    bool uring::register_file(int)                                           { return false; }
+    void uring::prep(unsigned char, int, void const*, size_t, off_t, uint64_t) { }
+    void uring::close_ring( void )                                           { }
+    void uring::prep_read(int, void*, size_t, off_t, uint64_t)               { }
+    void uring::prep_write(int, void const*, size_t, off_t, uint64_t)        { }
+    void uring::submit( void )                                               { }
+    uint64_t uring::wait(int&)                                               { return 0; }
+
+#endif
+
+} // namespace etdc
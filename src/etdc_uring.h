@@ -0,0 +1,96 @@
+// Minimal io_uring(7) wrapper for keeping multiple file I/Os in flight
+// Copyright (C) 2007-2016 Harro Verkouter
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+// PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Author:  Harro Verkouter - verkouter@jive.eu
+//          Joint Institute for VLBI in Europe
+//          P.O. Box 2
+//          7990 AA Dwingeloo
+#ifndef ETDC_URING_H
+#define ETDC_URING_H
+
+// C++ headers
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Plain-old-C
+#include <sys/uio.h>
+#include <sys/types.h>
+
+namespace etdc {
+
+    // We talk to the kernel directly - no liburing dependency.
+    // The ring is used strictly single threaded: queue a number of
+    // reads/writes, submit() them in one system call and reap the
+    // completions one by one with wait().
+    //
+    // If buffers and/or a file were registered with the ring, operations on
+    // them automatically use the READ_FIXED/WRITE_FIXED opcodes and/or the
+    // fixed-file index, saving the kernel from mapping the pages/looking up
+    // the file on each I/O.
+    class uring {
+        public:
+            // Throws if the ring could not be created
+            explicit uring(unsigned int entries);
+            ~uring();
+
+            uring()                        = delete;
+            uring(uring const&)            = delete;
+            uring& operator=(uring const&) = delete;
+
+            // Does the running kernel support what we need? Only probed once.
+            static bool available( void );
+
+            // Failure to register is not an error - I/O will just take the
+            // slower path. The registered memory must outlive the ring.
+            bool    register_buffers(std::vector<struct iovec> const& iov);
+            bool    register_file(int fd);
+
+            // Queue a read or write of n bytes at absolute file offset 'off'.
+            // 'user' is handed back on completion.
+            void    prep_read(int fd, void* buf, size_t n, off_t off, uint64_t user);
+            void    prep_write(int fd, void const* buf, size_t n, off_t off, uint64_t user);
+
+            // Hand all queued operations to the kernel
+            void    submit( void );
+
+            // Block until one operation has completed. Returns the 'user'
+            // value and sets 'res' to the read(2)/write(2) style result
+            // (negative values are -errno)
+            uint64_t wait(int& res);
+
+            // Number of operations submitted but not reaped yet
+            unsigned int inflight( void ) const { return __m_inflight; }
+
+        private:
+            int                      __m_ringFd;
+            unsigned int             __m_inflight, __m_queued;
+            void*                    __m_sqPtr;
+            void*                    __m_cqPtr;
+            void*                    __m_sqes;
+            size_t                   __m_sqSz, __m_cqSz, __m_sqesSz;
+            unsigned int            *__m_sqHead, *__m_sqTail, *__m_sqMask, *__m_sqArray;
+            unsigned int            *__m_cqHead, *__m_cqTail, *__m_cqMask;
+            void*                    __m_cqes;
+            int                      __m_fixedFd;
+            std::vector<struct iovec> __m_buffers;
+
+            void  prep(unsigned char opcode, int fd, void const* buf, size_t n, off_t off, uint64_t user);
+            void  close_ring( void );
+    };
+
+} // namespace etdc
+
+#endif